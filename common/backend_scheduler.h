@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Cost-model scheduler that routes each image to the hybrid (CPU Huffman)
+// or the GPU hybrid backend.
+//
+// The decode time of an image on a backend is modelled as
+//   seconds = overhead + seconds_per_sample * samples
+// where samples = width * height * (chroma scale factor), with separate
+// models for baseline and progressive streams. The models start from a
+// prior that reproduces the old fixed rule (GPU above 512x512 4:4:4) and are
+// refit online, by exponentially weighted least squares, from the decode
+// times reported through complete().
+//
+// pick() sends an image to the backend where it is expected to finish first:
+// the predicted work already in flight on that backend divided by its number
+// of lanes (decodes that run concurrently), plus the image's own predicted
+// time. Greedily minimizing completion time keeps the batch makespan low when
+// one backend is saturated.
+//
+// Shared by the nvJPEG MultipleInstances and Backend-ROI samples. Only host
+// code is used, so the policy can be exercised with synthetic timings (see
+// nvJPEG/nvJPEG-Decoder-MultipleInstances/backend_scheduler_simulation.cpp).
+// All methods are thread safe.
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+enum class DecodeBackend { Hybrid = 0, GpuHybrid = 1 };
+
+struct JpegFeatures {
+  double samples = 0;  // width * height * chroma scale factor
+  bool progressive = false;
+};
+
+// returned by pick()/assign(), handed back to complete()
+struct BackendTicket {
+  DecodeBackend backend = DecodeBackend::Hybrid;
+  JpegFeatures features;
+  double predicted_seconds = 0;
+};
+
+struct BackendSchedulerConfig {
+  int lanes[2] = {1, 1};  // concurrent decodes per backend
+  double decay = 0.98;    // weight kept by older observations per update
+  int explore_interval = 64;  // every n-th pick goes to the less observed backend, 0: never
+  // prior models, in seconds and seconds per sample
+  double prior_overhead[2] = {50e-6, 1.23e-3};
+  double prior_seconds_per_sample[2] = {2.0e-9, 0.5e-9};
+};
+
+class BackendScheduler {
+ public:
+  explicit BackendScheduler(const BackendSchedulerConfig &config = BackendSchedulerConfig())
+      : config_(config) {
+    for (int b = 0; b < 2; b++) {
+      config_.lanes[b] = std::max(1, config_.lanes[b]);
+      for (int p = 0; p < 2; p++) {
+        // two pseudo observations around the old crossover point, so the fit
+        // is well defined before any decode was timed
+        const double reference = 512.0 * 512.0 * 3.0;
+        for (double samples : {reference / 4, reference * 4}) {
+          models_[b][p].add(samples, config_.prior_overhead[b] +
+                                         config_.prior_seconds_per_sample[b] * samples, 1.0);
+        }
+      }
+    }
+  }
+
+  // routes an image and accounts it as in flight on the chosen backend
+  BackendTicket pick(const JpegFeatures &features) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const int p = features.progressive ? 1 : 0;
+    int best = 0;
+    double best_finish = 0;
+    for (int b = 0; b < 2; b++) {
+      const double finish = pending_[b] / config_.lanes[b] + models_[b][p].predict(features.samples);
+      if (b == 0 || finish < best_finish) {
+        best = b;
+        best_finish = finish;
+      }
+    }
+    // occasionally try the backend we know less about, otherwise a backend
+    // that looked slow early is never measured again
+    if (config_.explore_interval > 0 && ++picks_ % config_.explore_interval == 0) {
+      best = observations_[0][p] <= observations_[1][p] ? 0 : 1;
+    }
+    return assign_locked(features, static_cast<DecodeBackend>(best));
+  }
+
+  // accounts an image whose backend was chosen by the caller
+  BackendTicket assign(const JpegFeatures &features, DecodeBackend backend) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return assign_locked(features, backend);
+  }
+
+  // reports the measured decode time of a ticket; observed_seconds <= 0
+  // only releases the in-flight accounting
+  void complete(const BackendTicket &ticket, double observed_seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const int b = static_cast<int>(ticket.backend);
+    const int p = ticket.features.progressive ? 1 : 0;
+    pending_[b] = std::max(0.0, pending_[b] - ticket.predicted_seconds);
+    if (observed_seconds > 0) {
+      models_[b][p].add(ticket.features.samples, observed_seconds, 1.0, config_.decay);
+      observations_[b][p]++;
+    }
+  }
+
+  double predict(DecodeBackend backend, const JpegFeatures &features) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return models_[static_cast<int>(backend)][features.progressive ? 1 : 0].predict(features.samples);
+  }
+
+  // images routed to each backend so far
+  uint64_t decisions(DecodeBackend backend) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return decisions_[static_cast<int>(backend)];
+  }
+
+  void print(std::ostream &os) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    static const char *names[2] = {"hybrid", "gpu hybrid"};
+    for (int b = 0; b < 2; b++) {
+      const LinearModel &m = models_[b][0];
+      os << "Backend " << names[b] << ": " << decisions_[b] << " images, baseline model "
+         << m.intercept() * 1e6 << " us + " << m.slope() * 1e9 << " ns/sample ("
+         << observations_[b][0] << " baseline, " << observations_[b][1]
+         << " progressive observations)" << std::endl;
+    }
+  }
+
+ private:
+  // weighted least squares fit of y = intercept + slope * x, older samples
+  // decay geometrically
+  struct LinearModel {
+    double w = 0, wx = 0, wy = 0, wxx = 0, wxy = 0;
+
+    void add(double x, double y, double weight, double decay = 1.0) {
+      w = w * decay + weight;
+      wx = wx * decay + weight * x;
+      wy = wy * decay + weight * y;
+      wxx = wxx * decay + weight * x * x;
+      wxy = wxy * decay + weight * x * y;
+    }
+
+    double slope() const {
+      const double det = w * wxx - wx * wx;
+      // all samples of (almost) the same size: fall back to a proportional model
+      if (det <= 1e-9 * w * wxx) return wx > 0 ? wy / wx : 0;
+      return std::max(0.0, (w * wxy - wx * wy) / det);
+    }
+
+    double intercept() const {
+      return w > 0 ? std::max(0.0, (wy - slope() * wx) / w) : 0;
+    }
+
+    double predict(double x) const { return intercept() + slope() * x; }
+  };
+
+  BackendTicket assign_locked(const JpegFeatures &features, DecodeBackend backend) {
+    const int b = static_cast<int>(backend);
+    BackendTicket ticket;
+    ticket.backend = backend;
+    ticket.features = features;
+    ticket.predicted_seconds = models_[b][features.progressive ? 1 : 0].predict(features.samples);
+    pending_[b] += ticket.predicted_seconds;
+    decisions_[b]++;
+    return ticket;
+  }
+
+  BackendSchedulerConfig config_;
+  mutable std::mutex mutex_;
+  LinearModel models_[2][2];  // [backend][progressive]
+  double pending_[2] = {0, 0};  // predicted seconds in flight
+  uint64_t observations_[2][2] = {{0, 0}, {0, 0}};
+  uint64_t decisions_[2] = {0, 0};
+  uint64_t picks_ = 0;
+};
+
+// holds a ticket from pick()/assign() until it is handed on with release();
+// a ticket still held on scope exit (an error return) is completed without a
+// timing, so it does not stay in flight
+class BackendTicketGuard {
+ public:
+  BackendTicketGuard(BackendScheduler &scheduler, const BackendTicket &ticket)
+      : scheduler_(scheduler), ticket_(ticket) {}
+  ~BackendTicketGuard() {
+    if (held_) scheduler_.complete(ticket_, 0);
+  }
+  BackendTicketGuard(const BackendTicketGuard &) = delete;
+  BackendTicketGuard &operator=(const BackendTicketGuard &) = delete;
+
+  const BackendTicket &get() const { return ticket_; }
+
+  // the caller is now responsible for calling complete()
+  BackendTicket release() {
+    held_ = false;
+    return ticket_;
+  }
+
+ private:
+  BackendScheduler &scheduler_;
+  BackendTicket ticket_;
+  bool held_ = true;
+};
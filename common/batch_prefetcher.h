@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Background reader stage for the batch decode loops.
+//
+// A producer thread reads the next `depth` batches ahead of the decoder, with
+// the files of one batch read by `io_threads` threads in parallel: the
+// producer and a pool of io_threads-1 readers that live as long as the
+// prefetcher, so no thread is started per batch. Batches
+// are handed to the consumer through a bounded queue; next_batch() swaps the
+// consumer's vectors with the prefetched ones, so the file buffers of the
+// batch the consumer is done with go back to the producer and are reused
+// (they only grow), without copying file contents.
+//
+// next_batch() has the same contract as read_next_batch(): it always returns
+// a full batch, wraps around the image list, and drops files that cannot be
+// read. Only host code is used; the header builds without CUDA.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct PrefetchStats
+{
+    size_t batches = 0;
+    size_t files = 0;
+    size_t bytes = 0;
+    double read_seconds = 0;  // time the producer spent reading
+    double stall_seconds = 0; // time next_batch() waited for the producer
+};
+
+class BatchPrefetcher
+{
+  public:
+    typedef std::vector<std::string> Names;
+    typedef std::vector<std::vector<char>> Data;
+
+    /**
+     * \param image_names list of files (copied; the prefetcher owns its list)
+     * \param batch_size  number of files per batch
+     * \param depth       number of batches read ahead (>= 1)
+     * \param io_threads  files of one batch are read by this many threads
+     */
+    BatchPrefetcher(const Names &image_names, int batch_size, int depth = 2,
+                    int io_threads = 4, bool verbose = true)
+        : names_(image_names), batch_size_(batch_size), io_threads_(io_threads < 1 ? 1 : io_threads),
+          verbose_(verbose), cur_(0), stop_(false)
+    {
+        if (depth < 1)
+            depth = 1;
+        // depth slots in flight plus the one the consumer hands back
+        for (int i = 0; i <= depth; i++)
+        {
+            free_.emplace_back(new Batch(batch_size));
+        }
+        for (int t = 1; t < io_threads_; t++)
+        {
+            readers_.emplace_back([this] { run_reader(); });
+        }
+        producer_ = std::thread([this] { produce(); });
+    }
+
+    ~BatchPrefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        producer_.join();
+        {
+            std::lock_guard<std::mutex> lock(read_mutex_);
+            read_stop_ = true;
+        }
+        read_cv_.notify_all();
+        for (auto &t : readers_)
+            t.join();
+        for (auto b : free_)
+            delete b;
+        for (auto b : ready_)
+            delete b;
+    }
+
+    BatchPrefetcher(const BatchPrefetcher &) = delete;
+    BatchPrefetcher &operator=(const BatchPrefetcher &) = delete;
+
+    /**
+     * Hands out the next batch; raw_data, raw_len and current_names are
+     * resized to batch_size. Returns EXIT_FAILURE once no readable image is
+     * left.
+     */
+    int next_batch(Data &raw_data, std::vector<size_t> &raw_len, Names &current_names)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return !ready_.empty(); });
+        stats_.stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        Batch *batch = ready_.front();
+        if (batch->status != EXIT_SUCCESS)
+        {
+            // stays queued, so subsequent calls keep reporting the failure
+            return batch->status;
+        }
+        ready_.pop_front();
+        raw_data.resize(batch_size_);
+        raw_len.resize(batch_size_);
+        current_names.resize(batch_size_);
+        raw_data.swap(batch->data);
+        raw_len.swap(batch->len);
+        current_names.swap(batch->names);
+        stats_.batches++;
+        free_.push_back(batch);
+        lock.unlock();
+        cv_.notify_all();
+        return EXIT_SUCCESS;
+    }
+
+    PrefetchStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+  private:
+    struct Batch
+    {
+        explicit Batch(int size) : data(size), len(size), names(size) {}
+        Data data;
+        std::vector<size_t> len;
+        Names names;
+        int status = EXIT_SUCCESS;
+    };
+
+    void produce()
+    {
+        for (;;)
+        {
+            Batch *batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !free_.empty(); });
+                if (stop_)
+                    return;
+                batch = free_.front();
+                free_.pop_front();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            size_t bytes = 0;
+            batch->status = fill(*batch, bytes);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stats_.read_seconds += seconds;
+                if (batch->status == EXIT_SUCCESS)
+                {
+                    stats_.files += batch_size_;
+                    stats_.bytes += bytes;
+                }
+                ready_.push_back(batch);
+            }
+            cv_.notify_all();
+            if (batch->status != EXIT_SUCCESS)
+                return;
+        }
+    }
+
+    // picks the next batch_size names (wrapping around) and reads them in
+    // parallel; unreadable files are dropped from the list and replaced
+    int fill(Batch &batch, size_t &bytes)
+    {
+        int counter = 0;
+        while (counter < batch_size_)
+        {
+            if (names_.empty())
+            {
+                std::cerr << "No valid images left in the input list, exit" << std::endl;
+                return EXIT_FAILURE;
+            }
+            std::vector<size_t> slots;
+            for (; counter < batch_size_; counter++)
+            {
+                if (cur_ >= names_.size())
+                {
+                    if (verbose_)
+                    {
+                        std::cerr << "Image list is too short to fill the batch, adding files "
+                                     "from the beginning of the image list"
+                                  << std::endl;
+                    }
+                    cur_ = 0;
+                }
+                batch.names[counter] = names_[cur_++];
+                slots.push_back(counter);
+            }
+
+            std::vector<char> ok(slots.size(), 0);
+            read_files(batch, slots, ok);
+
+            // compact: move failed files out of the batch and the list
+            counter = slots.front();
+            for (size_t i = 0; i < slots.size(); i++)
+            {
+                const int s = static_cast<int>(slots[i]);
+                if (!ok[i])
+                {
+                    std::cerr << "Cannot read image: " << batch.names[s]
+                              << ", removing it from image list" << std::endl;
+                    remove_name(batch.names[s]);
+                    continue;
+                }
+                if (s != counter)
+                {
+                    batch.data[counter].swap(batch.data[s]);
+                    batch.len[counter] = batch.len[s];
+                    batch.names[counter] = batch.names[s];
+                }
+                bytes += batch.len[counter];
+                counter++;
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // a set of files to read; readers that wake up late hold on to a finished
+    // job, whose counter is past the end, and so never touch the next one
+    struct ReadJob
+    {
+        Batch *batch = nullptr;
+        const size_t *slots = nullptr;
+        char *ok = nullptr;
+        size_t count = 0;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> remaining{0};
+    };
+
+    // reads the files of the slots on the producer and the reader pool
+    void read_files(Batch &batch, const std::vector<size_t> &slots, std::vector<char> &ok)
+    {
+        if (readers_.empty() || slots.size() < 2)
+        {
+            for (size_t i = 0; i < slots.size(); i++)
+                ok[i] = read_file(batch, slots[i]);
+            return;
+        }
+        std::shared_ptr<ReadJob> job = std::make_shared<ReadJob>();
+        job->batch = &batch;
+        job->slots = slots.data();
+        job->ok = ok.data();
+        job->count = slots.size();
+        job->remaining = slots.size();
+        {
+            std::lock_guard<std::mutex> lock(read_mutex_);
+            read_job_ = job;
+            read_generation_++;
+        }
+        read_cv_.notify_all();
+        work(*job);
+        std::unique_lock<std::mutex> lock(read_mutex_);
+        read_done_cv_.wait(lock, [&job] { return job->remaining == 0; });
+        read_job_.reset();
+    }
+
+    void work(ReadJob &job)
+    {
+        for (size_t i = job.next++; i < job.count; i = job.next++)
+        {
+            job.ok[i] = read_file(*job.batch, job.slots[i]);
+            if (job.remaining.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> lock(read_mutex_);
+                read_done_cv_.notify_all();
+            }
+        }
+    }
+
+    void run_reader()
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            std::shared_ptr<ReadJob> job;
+            {
+                std::unique_lock<std::mutex> lock(read_mutex_);
+                read_cv_.wait(lock, [&] { return read_stop_ || read_generation_ != seen; });
+                if (read_stop_)
+                    return;
+                seen = read_generation_;
+                job = read_job_;
+            }
+            if (job)
+                work(*job);
+        }
+    }
+
+    static bool read_file(Batch &batch, size_t slot)
+    {
+        std::ifstream input(batch.names[slot].c_str(),
+                            std::ios::in | std::ios::binary | std::ios::ate);
+        if (!(input.is_open()))
+            return false;
+        std::streamsize file_size = input.tellg();
+        input.seekg(0, std::ios::beg);
+        // resize if buffer is too small
+        if (batch.data[slot].size() < static_cast<size_t>(file_size))
+            batch.data[slot].resize(file_size);
+        if (!input.read(batch.data[slot].data(), file_size))
+            return false;
+        batch.len[slot] = file_size;
+        return true;
+    }
+
+    void remove_name(const std::string &name)
+    {
+        for (size_t i = 0; i < names_.size(); i++)
+        {
+            if (names_[i] == name)
+            {
+                names_.erase(names_.begin() + i);
+                if (i < cur_)
+                    cur_--;
+                return;
+            }
+        }
+    }
+
+    Names names_;
+    const int batch_size_;
+    const int io_threads_;
+    const bool verbose_;
+    size_t cur_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Batch *> free_;  // buffers the producer may fill
+    std::deque<Batch *> ready_; // bounded by the number of slots
+    bool stop_;
+    PrefetchStats stats_;
+    std::thread producer_;
+
+    // reader pool, fed by the producer
+    std::vector<std::thread> readers_;
+    std::mutex read_mutex_;
+    std::condition_variable read_cv_;
+    std::condition_variable read_done_cv_;
+    std::shared_ptr<ReadJob> read_job_;
+    uint64_t read_generation_ = 0;
+    bool read_stop_ = false;
+};
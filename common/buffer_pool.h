@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Size-class pool for device and pinned host buffers, shared by the nvJPEG
+// samples.
+//
+// A request is rounded up to a size class (four classes per power of two,
+// so at most 25% of a buffer is unused) and a released buffer is kept on the
+// free list of its class. Once a workload's image sizes have been seen,
+// acquire() and release() only move pointers between lists and the CUDA
+// allocator is not called again. The allocator is passed in as callbacks
+// with the nvJPEG allocator signature, so the pool is host code only.
+//
+// A buffer may be released only when the work using it has completed, or is
+// ordered on the stream of the next user; the pool does not track streams.
+// All methods are thread safe.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct BufferPoolStats {
+  uint64_t hits = 0;         // served from a free list
+  uint64_t misses = 0;       // needed a new buffer from the allocator
+  uint64_t failures = 0;     // the allocator failed, even after trimming
+  uint64_t allocations = 0;  // allocator calls
+  uint64_t frees = 0;        // deallocator calls
+  size_t bytes_in_use = 0;   // held by callers
+  size_t bytes_cached = 0;   // on the free lists
+  size_t high_water_in_use = 0;
+  size_t high_water_allocated = 0;  // peak of bytes_in_use + bytes_cached
+};
+
+class BufferPool;
+
+// Returns its buffer to the pool when destroyed, so an early return cannot
+// leak it.
+class PooledBuffer {
+ public:
+  PooledBuffer() = default;
+  PooledBuffer(BufferPool *pool, void *ptr, size_t size) : pool_(pool), ptr_(ptr), size_(size) {}
+  ~PooledBuffer() { reset(); }
+
+  PooledBuffer(PooledBuffer &&other) noexcept { swap(other); }
+  PooledBuffer &operator=(PooledBuffer &&other) noexcept {
+    if (this != &other) {
+      reset();
+      swap(other);
+    }
+    return *this;
+  }
+  PooledBuffer(const PooledBuffer &) = delete;
+  PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+  template <typename T = unsigned char>
+  T *get() const {
+    return static_cast<T *>(ptr_);
+  }
+  size_t size() const { return size_; }  // of the size class, >= the request
+  explicit operator bool() const { return ptr_ != nullptr; }
+
+  inline void reset();
+
+ private:
+  void swap(PooledBuffer &other) {
+    std::swap(pool_, other.pool_);
+    std::swap(ptr_, other.ptr_);
+    std::swap(size_, other.size_);
+  }
+
+  BufferPool *pool_ = nullptr;
+  void *ptr_ = nullptr;
+  size_t size_ = 0;
+};
+
+class BufferPool {
+ public:
+  typedef int (*Allocate)(void **, size_t);
+  typedef int (*Deallocate)(void *);
+
+  // max_cached_bytes bounds the memory kept on the free lists, 0: unbounded.
+  // A request may be served from a larger class of up to max_oversize times
+  // its own class, which keeps the hit rate up when sizes vary slightly.
+  BufferPool(Allocate allocate, Deallocate deallocate, size_t max_cached_bytes = 0,
+             double max_oversize = 2.0)
+      : allocate_(allocate),
+        deallocate_(deallocate),
+        max_cached_bytes_(max_cached_bytes),
+        max_oversize_(max_oversize < 1.0 ? 1.0 : max_oversize) {}
+
+  // frees the cached buffers; buffers still acquired must not outlive the pool
+  ~BufferPool() { trim(); }
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  // an empty PooledBuffer if the allocator fails
+  PooledBuffer acquire(size_t bytes) {
+    size_t size = 0;
+    void *ptr = acquire_raw(bytes, &size);
+    return PooledBuffer(ptr ? this : nullptr, ptr, size);
+  }
+
+  // bucketed by pitch * height, pitch in bytes
+  PooledBuffer acquire_image(size_t pitch, size_t height) { return acquire(pitch * height); }
+
+  void *acquire_raw(size_t bytes, size_t *size = nullptr) {
+    const size_t cls = size_class(bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = free_.lower_bound(cls);
+    if (it != free_.end() && it->first <= cls * max_oversize_) {
+      void *ptr = it->second.back();
+      it->second.pop_back();
+      const size_t found = it->first;
+      if (it->second.empty()) free_.erase(it);
+      stats_.hits++;
+      stats_.bytes_cached -= found;
+      return hand_out(ptr, found, size);
+    }
+    stats_.misses++;
+    void *ptr = nullptr;
+    stats_.allocations++;
+    if (allocate_(&ptr, cls) != 0 || !ptr) {
+      // out of memory: give the cached buffers back and try once more
+      trim_locked();
+      ptr = nullptr;
+      stats_.allocations++;
+      if (allocate_(&ptr, cls) != 0 || !ptr) {
+        stats_.failures++;
+        return nullptr;
+      }
+    }
+    return hand_out(ptr, cls, size);
+  }
+
+  void release(void *ptr) {
+    if (!ptr) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = in_use_.find(ptr);
+    if (it == in_use_.end()) return;  // not from this pool
+    const size_t cls = it->second;
+    in_use_.erase(it);
+    stats_.bytes_in_use -= cls;
+    if (max_cached_bytes_ && stats_.bytes_cached + cls > max_cached_bytes_) {
+      stats_.frees++;
+      deallocate_(ptr);
+      return;
+    }
+    free_[cls].push_back(ptr);
+    stats_.bytes_cached += cls;
+  }
+
+  // frees all cached buffers
+  void trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trim_locked();
+  }
+
+  BufferPoolStats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  void print(std::ostream &os, const char *name) const {
+    const BufferPoolStats s = stats();
+    const uint64_t requests = s.hits + s.misses;
+    os << name << " pool: " << requests << " requests, " << s.hits << " hits, " << s.misses
+       << " misses (" << (requests ? 100.0 * s.hits / requests : 0.0) << "% hit rate), "
+       << s.allocations << " allocations, " << s.frees << " frees, high water "
+       << s.high_water_in_use / 1024 << " KiB in use, " << s.high_water_allocated / 1024
+       << " KiB allocated" << std::endl;
+  }
+
+  static size_t size_class(size_t bytes) {
+    const size_t min_class = 256;
+    if (bytes <= min_class) return min_class;
+    // bytes - 1 is in [2^shift, 2^(shift + 1)); four classes in that range
+    int shift = 0;
+    while ((bytes - 1) >> (shift + 1)) shift++;
+    const size_t step = (size_t(1) << shift) / 4;
+    return (bytes + step - 1) / step * step;
+  }
+
+ private:
+  void *hand_out(void *ptr, size_t cls, size_t *size) {
+    in_use_[ptr] = cls;
+    stats_.bytes_in_use += cls;
+    stats_.high_water_in_use = std::max(stats_.high_water_in_use, stats_.bytes_in_use);
+    stats_.high_water_allocated =
+        std::max(stats_.high_water_allocated, stats_.bytes_in_use + stats_.bytes_cached);
+    if (size) *size = cls;
+    return ptr;
+  }
+
+  void trim_locked() {
+    for (auto &entry : free_) {
+      for (void *ptr : entry.second) {
+        stats_.frees++;
+        deallocate_(ptr);
+      }
+    }
+    free_.clear();
+    stats_.bytes_cached = 0;
+  }
+
+  Allocate allocate_;
+  Deallocate deallocate_;
+  const size_t max_cached_bytes_;
+  const double max_oversize_;
+  mutable std::mutex mutex_;
+  std::map<size_t, std::vector<void *>> free_;  // by size class
+  std::unordered_map<void *, size_t> in_use_;   // pointer -> size class
+  BufferPoolStats stats_;
+};
+
+void PooledBuffer::reset() {
+  if (pool_) pool_->release(ptr_);
+  pool_ = nullptr;
+  ptr_ = nullptr;
+  size_ = 0;
+}
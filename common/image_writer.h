@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Host-side BMP/PNM writers shared by the nvJPEG, nvJPEG2000 and nvTIFF
+// samples.
+//
+// The whole file (header and rows) is assembled in a buffer that is reused
+// across images and written with a single fwrite(). AsyncImageWriter moves
+// that work to a background thread, so a decode loop only pays for the
+// device-to-host copy.
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// An image in host memory: sample c of pixel (x, y) is at
+// channel[c][y * row_stride[c] + x * pixel_stride]. Strides are in elements.
+template <typename T>
+struct HostImage {
+  const T *channel[4] = {nullptr, nullptr, nullptr, nullptr};
+  size_t row_stride[4] = {0, 0, 0, 0};
+  size_t pixel_stride = 1;
+  int num_channels = 0;
+  int width = 0;
+  int height = 0;
+  int precision = 8 * sizeof(T);  // significant bits per sample
+
+  // separate planes, pitches in bytes
+  static HostImage planar(const T *const *planes, const size_t *pitch_in_bytes, int num_channels,
+                          int width, int height, int precision = 8 * sizeof(T)) {
+    HostImage img;
+    for (int c = 0; c < num_channels; c++) {
+      img.channel[c] = planes[c];
+      img.row_stride[c] = pitch_in_bytes[c] / sizeof(T);
+    }
+    img.num_channels = num_channels;
+    img.width = width;
+    img.height = height;
+    img.precision = precision;
+    return img;
+  }
+
+  // interleaved samples, e.g. RGBRGB..., pitch in bytes
+  static HostImage interleaved(const T *data, size_t pitch_in_bytes, int samples_per_pixel,
+                               int num_channels, int width, int height,
+                               int precision = 8 * sizeof(T)) {
+    HostImage img;
+    for (int c = 0; c < num_channels; c++) {
+      img.channel[c] = data + c;
+      img.row_stride[c] = pitch_in_bytes / sizeof(T);
+    }
+    img.pixel_stride = samples_per_pixel;
+    img.num_channels = num_channels;
+    img.width = width;
+    img.height = height;
+    img.precision = precision;
+    return img;
+  }
+
+  const T *row(int c, int y) const { return channel[c] + y * row_stride[c]; }
+};
+
+class ImageWriter {
+ public:
+  // 24 bit BMP; 1 channel is written as gray, a 4th channel is dropped.
+  // Samples with more than 8 significant bits are rounded to 8 bits.
+  template <typename T>
+  int write_bmp(const char *filename, const HostImage<T> &img) {
+    const int row_bytes = (img.width * 3 + 3) & ~3;  // rows are padded to 4 bytes
+    const uint32_t image_size = static_cast<uint32_t>(row_bytes) * img.height;
+    buffer_.assign(54 + static_cast<size_t>(image_size), 0);
+
+    unsigned char *h = buffer_.data();
+    h[0] = 'B';
+    h[1] = 'M';
+    put_le32(h + 2, 54 + image_size);  // bfSize (whole file size)
+    put_le32(h + 10, 54);              // bfOffBits
+    put_le32(h + 14, 40);              // biSize
+    put_le32(h + 18, img.width);
+    put_le32(h + 22, img.height);
+    h[26] = 1;   // biPlanes
+    h[28] = 24;  // biBitCount
+    put_le32(h + 34, image_size);
+
+    const int r = 0;
+    const int g = img.num_channels >= 3 ? 1 : 0;
+    const int b = img.num_channels >= 3 ? 2 : 0;
+    const int shift = img.precision - 8;
+    for (int y = 0; y < img.height; y++) {
+      // BMP image format is written from bottom to top, in (b,g,r) order
+      unsigned char *out = h + 54 + static_cast<size_t>(img.height - 1 - y) * row_bytes;
+      const T *pr = img.row(r, y);
+      const T *pg = img.row(g, y);
+      const T *pb = img.row(b, y);
+      for (int x = 0; x < img.width; x++, pr += img.pixel_stride, pg += img.pixel_stride,
+               pb += img.pixel_stride) {
+        *out++ = to_8bit(*pb, shift);
+        *out++ = to_8bit(*pg, shift);
+        *out++ = to_8bit(*pr, shift);
+      }
+    }
+    return write_file(filename);
+  }
+
+  // binary PGM (1 channel), PPM (3 channels) or PAM (4 channels); samples
+  // with more than 8 significant bits are written as 16 bit big endian
+  template <typename T>
+  int write_pnm(const char *filename, const HostImage<T> &img, const char *comment = nullptr) {
+    const int maxval = (1 << img.precision) - 1;
+    std::string header;
+    if (img.num_channels == 4) {
+      header = "P7\n";
+      if (comment) header += std::string("#") + comment + "\n";
+      header += "WIDTH " + std::to_string(img.width) + "\nHEIGHT " + std::to_string(img.height) +
+                "\nDEPTH 4\nMAXVAL " + std::to_string(maxval) + "\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+    } else {
+      header = img.num_channels == 1 ? "P5\n" : "P6\n";
+      if (comment) header += std::string("#") + comment + "\n";
+      header += std::to_string(img.width) + " " + std::to_string(img.height) + "\n" +
+                std::to_string(maxval) + "\n";
+    }
+    const size_t bytes_per_sample = img.precision > 8 ? 2 : 1;
+    const size_t row_bytes = bytes_per_sample * img.num_channels * img.width;
+    buffer_.resize(header.size() + row_bytes * img.height);
+    memcpy(buffer_.data(), header.data(), header.size());
+
+    unsigned char *out = buffer_.data() + header.size();
+    for (int y = 0; y < img.height; y++) {
+      const T *rows[4];
+      for (int c = 0; c < img.num_channels; c++) rows[c] = img.row(c, y);
+      for (int x = 0; x < img.width; x++) {
+        for (int c = 0; c < img.num_channels; c++) {
+          const unsigned int v = static_cast<unsigned int>(rows[c][x * img.pixel_stride]);
+          if (bytes_per_sample == 2) *out++ = static_cast<unsigned char>(v >> 8);
+          *out++ = static_cast<unsigned char>(v & 0xff);
+        }
+      }
+    }
+    return write_file(filename);
+  }
+
+ private:
+  static void put_le32(unsigned char *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+  }
+
+  // rounds to nearest when dropping bits; clamped, since rounding up the
+  // maximum overflows
+  template <typename T>
+  static unsigned char to_8bit(T v, int shift) {
+    unsigned int x = static_cast<unsigned int>(v);
+    if (shift > 0) x = (x >> shift) + ((x >> (shift - 1)) & 1);
+    return x > 255 ? 255 : static_cast<unsigned char>(x);
+  }
+
+  int write_file(const char *filename) {
+    FILE *outfile = fopen(filename, "wb");
+    if (!outfile) {
+      std::cerr << "Cannot open file: " << filename << std::endl;
+      return 1;
+    }
+    const size_t written = fwrite(buffer_.data(), 1, buffer_.size(), outfile);
+    const int closed = fclose(outfile);
+    return (written == buffer_.size() && closed == 0) ? 0 : 1;
+  }
+
+  std::vector<unsigned char> buffer_;
+};
+
+// per-thread writer for synchronous use, keeps its buffer between calls
+inline ImageWriter &thread_image_writer() {
+  static thread_local ImageWriter writer;
+  return writer;
+}
+
+// Runs write jobs on a background thread. A job owns its (host) pixel data
+// and writes it with the thread's ImageWriter; submit() blocks while
+// max_pending jobs are queued, bounding the memory held by the queue.
+class AsyncImageWriter {
+ public:
+  typedef std::function<int(ImageWriter &)> Job;
+
+  explicit AsyncImageWriter(size_t max_pending = 8)
+      : max_pending_(max_pending < 1 ? 1 : max_pending), busy_(false), stop_(false), failures_(0) {
+    worker_ = std::thread([this] { run(); });
+  }
+
+  ~AsyncImageWriter() {
+    flush();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+  }
+
+  AsyncImageWriter(const AsyncImageWriter &) = delete;
+  AsyncImageWriter &operator=(const AsyncImageWriter &) = delete;
+
+  void submit(Job job) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return jobs_.size() < max_pending_; });
+    jobs_.push_back(std::move(job));
+    lock.unlock();
+    cv_.notify_all();
+  }
+
+  // waits for all submitted jobs; returns the number of failed jobs since
+  // the previous flush()
+  int flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return jobs_.empty() && !busy_; });
+    const int failures = failures_;
+    failures_ = 0;
+    return failures;
+  }
+
+ private:
+  void run() {
+    ImageWriter writer;
+    for (;;) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+        if (jobs_.empty()) return;
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+        busy_ = true;
+      }
+      cv_.notify_all();
+      const int err = job(writer);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        busy_ = false;
+        if (err) failures_++;
+      }
+      cv_.notify_all();
+    }
+  }
+
+  const size_t max_pending_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Job> jobs_;
+  bool busy_;
+  bool stop_;
+  int failures_;
+  std::thread worker_;
+};
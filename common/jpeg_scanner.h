@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Header-only JPEG marker scanner that plans decodes without nvJPEG.
+//
+// scan_jpeg() walks the marker segments of a JPEG stream up to the first
+// SOS (or, with full_scan, through all scans to EOI) and fills a compact
+// JpegDescriptor: frame size and type, per-component sampling, chroma
+// subsampling, restart interval, EXIF orientation and the offsets of the
+// SOF, first DHT and first SOS markers. Only the bytes of the headers are
+// read unless full_scan is set, so a scan costs well under a microsecond
+// per image.
+//
+// JpegBatchScanner runs scan_jpeg() over a batch on a set of persistent CPU
+// threads; the calling thread takes part. Only host code is used (see
+// jpeg_scanner_check.cpp).
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class JpegScanStatus : uint8_t {
+  Ok = 0,
+  NotJpeg,      // no SOI marker
+  Truncated,    // a segment runs past the end of the data
+  BadSegment,   // malformed segment contents
+  NoFrame,      // no SOF before the first scan
+  NoScan,       // data ends before the first SOS
+  Unsupported,  // e.g. height defined by DNL, more than 4 components
+};
+
+// same order as nvjpegChromaSubsampling_t
+enum class JpegSubsampling : uint8_t {
+  CSS_444 = 0,
+  CSS_422,
+  CSS_420,
+  CSS_440,
+  CSS_411,
+  CSS_410,
+  CSS_GRAY,
+  CSS_410V,
+  CSS_UNKNOWN,
+};
+
+struct JpegDescriptor {
+  enum Flags : uint8_t {
+    kProgressive = 1,
+    kArithmetic = 2,
+    kLossless = 4,
+    kJfif = 8,
+    kAdobe = 16,  // APP14 Adobe segment, see adobe_transform
+    kExif = 32,
+  };
+
+  // byte offsets of the markers in the stream, 0 if absent
+  uint32_t sof_offset = 0;
+  uint32_t dht_offset = 0;        // first DHT
+  uint32_t sos_offset = 0;        // first SOS
+  uint32_t scan_data_offset = 0;  // entropy coded data of the first scan
+  uint16_t width = 0;
+  uint16_t height = 0;
+  uint16_t restart_interval = 0;  // MCUs, 0: no restart markers
+  JpegScanStatus status = JpegScanStatus::NotJpeg;
+  uint8_t sof_marker = 0;  // 0xC0 baseline, 0xC1 extended, 0xC2 progressive, ...
+  uint8_t precision = 0;   // bits per sample
+  uint8_t components = 0;
+  JpegSubsampling subsampling = JpegSubsampling::CSS_UNKNOWN;
+  uint8_t orientation = 1;      // EXIF orientation 1..8, 1 if absent
+  uint8_t adobe_transform = 0;  // 0: none/CMYK, 1: YCbCr, 2: YCCK
+  uint8_t flags = 0;
+  uint8_t scans = 0;      // SOS segments seen
+  uint8_t dht_count = 0;  // DHT segments seen
+  uint8_t dqt_count = 0;  // DQT segments seen
+  uint8_t sampling[4] = {0, 0, 0, 0};  // (h << 4) | v per component
+
+  bool ok() const { return status == JpegScanStatus::Ok; }
+  bool progressive() const { return flags & kProgressive; }
+  bool arithmetic() const { return flags & kArithmetic; }
+  bool lossless() const { return flags & kLossless; }
+  // baseline (or extended sequential) 8 bit Huffman, what the GPU and
+  // hardware decoders handle
+  bool baseline() const {
+    return ok() && (sof_marker == 0xC0 || sof_marker == 0xC1) && precision == 8;
+  }
+
+  int h(int c) const { return sampling[c] >> 4; }
+  int v(int c) const { return sampling[c] & 15; }
+
+  // size of component c, as nvjpegGetImageInfo reports it
+  int component_width(int c) const {
+    int hmax = 1;
+    for (int i = 0; i < components; i++) hmax = std::max(hmax, h(i));
+    return (width * h(c) + hmax - 1) / hmax;
+  }
+  int component_height(int c) const {
+    int vmax = 1;
+    for (int i = 0; i < components; i++) vmax = std::max(vmax, v(i));
+    return (height * v(c) + vmax - 1) / vmax;
+  }
+
+  // decoded samples over all components
+  uint64_t samples() const {
+    uint64_t n = 0;
+    for (int c = 0; c < components; c++)
+      n += static_cast<uint64_t>(component_width(c)) * component_height(c);
+    return n;
+  }
+};
+
+namespace jpeg_scanner_detail {
+
+inline uint16_t be16(const unsigned char *p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+
+inline uint16_t tiff16(const unsigned char *p, bool le) {
+  return le ? static_cast<uint16_t>(p[0] | (p[1] << 8)) : be16(p);
+}
+
+inline uint32_t tiff32(const unsigned char *p, bool le) {
+  return le ? (p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24))
+            : ((static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+// orientation tag (0x0112) of IFD0 in an APP1 Exif payload, 1 if absent
+inline uint8_t exif_orientation(const unsigned char *p, size_t n) {
+  if (n < 14 || memcmp(p, "Exif\0\0", 6) != 0) return 1;
+  const unsigned char *tiff = p + 6;
+  const size_t size = n - 6;
+  bool le;
+  if (tiff[0] == 'I' && tiff[1] == 'I')
+    le = true;
+  else if (tiff[0] == 'M' && tiff[1] == 'M')
+    le = false;
+  else
+    return 1;
+  const uint32_t ifd = tiff32(tiff + 4, le);
+  if (ifd > size || size - ifd < 2) return 1;
+  const unsigned entries = tiff16(tiff + ifd, le);
+  for (unsigned e = 0; e < entries; e++) {
+    const size_t entry = ifd + 2 + 12 * static_cast<size_t>(e);
+    if (entry + 12 > size) break;
+    if (tiff16(tiff + entry, le) == 0x0112) {
+      const uint16_t value = tiff16(tiff + entry + 8, le);
+      return value >= 1 && value <= 8 ? static_cast<uint8_t>(value) : 1;
+    }
+  }
+  return 1;
+}
+
+inline JpegSubsampling classify(const JpegDescriptor &d) {
+  if (d.components == 1) return JpegSubsampling::CSS_GRAY;
+  // chroma (and K) components must share one sampling factor that divides luma's
+  for (int c = 2; c < d.components; c++)
+    if (d.sampling[c] != d.sampling[1]) return JpegSubsampling::CSS_UNKNOWN;
+  if (d.h(1) == 0 || d.v(1) == 0 || d.h(0) % d.h(1) || d.v(0) % d.v(1))
+    return JpegSubsampling::CSS_UNKNOWN;
+  const int h = d.h(0) / d.h(1), v = d.v(0) / d.v(1);
+  if (h == 1 && v == 1) return JpegSubsampling::CSS_444;
+  if (h == 2 && v == 1) return JpegSubsampling::CSS_422;
+  if (h == 2 && v == 2) return JpegSubsampling::CSS_420;
+  if (h == 1 && v == 2) return JpegSubsampling::CSS_440;
+  if (h == 4 && v == 1) return JpegSubsampling::CSS_411;
+  if (h == 4 && v == 2) return JpegSubsampling::CSS_410;
+  return JpegSubsampling::CSS_UNKNOWN;
+}
+
+}  // namespace jpeg_scanner_detail
+
+// full_scan: also walk the entropy coded data of all scans up to EOI, to
+// count the scans of progressive streams and find DHTs between them
+inline JpegDescriptor scan_jpeg(const unsigned char *data, size_t size, bool full_scan = false) {
+  using namespace jpeg_scanner_detail;
+  JpegDescriptor d;
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return d;  // NotJpeg
+  size_t pos = 2;
+  bool seen_sof = false;
+  for (;;) {
+    // markers may be preceded by any number of 0xFF fill bytes
+    if (pos >= size || data[pos] != 0xFF) {
+      d.status = d.scans ? JpegScanStatus::Ok : (pos >= size ? JpegScanStatus::NoScan : JpegScanStatus::BadSegment);
+      break;
+    }
+    while (pos < size && data[pos] == 0xFF) pos++;
+    if (pos >= size) {
+      d.status = d.scans ? JpegScanStatus::Ok : JpegScanStatus::NoScan;
+      break;
+    }
+    const size_t marker_offset = pos - 1;
+    const uint8_t marker = data[pos++];
+    if (marker == 0xD9) {  // EOI
+      d.status = d.scans ? JpegScanStatus::Ok : JpegScanStatus::NoScan;
+      break;
+    }
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;  // no length
+    if (pos + 2 > size) {
+      d.status = d.scans ? JpegScanStatus::Ok : JpegScanStatus::Truncated;
+      break;
+    }
+    const size_t length = be16(data + pos);
+    if (length < 2) {
+      d.status = JpegScanStatus::BadSegment;
+      break;
+    }
+    if (pos + length > size) {
+      d.status = d.scans ? JpegScanStatus::Ok : JpegScanStatus::Truncated;
+      break;
+    }
+    const unsigned char *p = data + pos + 2;  // segment payload
+    const size_t n = length - 2;
+    const size_t segment_end = pos + length;
+
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+      // SOFn
+      if (seen_sof || n < 6) {
+        d.status = JpegScanStatus::BadSegment;
+        break;
+      }
+      seen_sof = true;
+      d.sof_offset = static_cast<uint32_t>(marker_offset);
+      d.sof_marker = marker;
+      d.precision = p[0];
+      d.height = be16(p + 1);
+      d.width = be16(p + 3);
+      const int components = p[5];
+      if (components < 1 || components > 4 || d.height == 0 || d.width == 0) {
+        d.status = JpegScanStatus::Unsupported;
+        break;
+      }
+      if (n < 6 + 3 * static_cast<size_t>(components)) {
+        d.status = JpegScanStatus::BadSegment;
+        break;
+      }
+      d.components = static_cast<uint8_t>(components);
+      bool bad_factor = false;
+      for (int c = 0; c < components; c++) {
+        d.sampling[c] = p[6 + 3 * c + 1];
+        if (d.h(c) < 1 || d.h(c) > 4 || d.v(c) < 1 || d.v(c) > 4) bad_factor = true;
+      }
+      if (bad_factor) {
+        d.status = JpegScanStatus::BadSegment;
+        break;
+      }
+      if (marker == 0xC2 || marker == 0xC6 || marker == 0xCA || marker == 0xCE)
+        d.flags |= JpegDescriptor::kProgressive;
+      if (marker >= 0xC9) d.flags |= JpegDescriptor::kArithmetic;
+      if (marker == 0xC3 || marker == 0xC7 || marker == 0xCB || marker == 0xCF)
+        d.flags |= JpegDescriptor::kLossless;
+      d.subsampling = classify(d);
+    } else if (marker == 0xC4) {
+      if (!d.dht_count) d.dht_offset = static_cast<uint32_t>(marker_offset);
+      if (d.dht_count < 255) d.dht_count++;
+    } else if (marker == 0xDB) {
+      if (d.dqt_count < 255) d.dqt_count++;
+    } else if (marker == 0xDD) {
+      if (n < 2) {
+        d.status = JpegScanStatus::BadSegment;
+        break;
+      }
+      d.restart_interval = be16(p);
+    } else if (marker == 0xE0) {
+      if (n >= 5 && memcmp(p, "JFIF\0", 5) == 0) d.flags |= JpegDescriptor::kJfif;
+    } else if (marker == 0xE1) {
+      if (n >= 6 && memcmp(p, "Exif\0\0", 6) == 0) {
+        d.flags |= JpegDescriptor::kExif;
+        d.orientation = exif_orientation(p, n);
+      }
+    } else if (marker == 0xEE) {
+      if (n >= 12 && memcmp(p, "Adobe", 5) == 0) {
+        d.flags |= JpegDescriptor::kAdobe;
+        d.adobe_transform = p[11];
+      }
+    } else if (marker == 0xDA) {
+      if (!seen_sof) {
+        d.status = JpegScanStatus::NoFrame;
+        break;
+      }
+      if (!d.scans) {
+        d.sos_offset = static_cast<uint32_t>(marker_offset);
+        d.scan_data_offset = static_cast<uint32_t>(segment_end);
+      }
+      if (d.scans < 255) d.scans++;
+      if (!full_scan) {
+        d.status = JpegScanStatus::Ok;
+        break;
+      }
+      // skip the entropy coded data: the next marker is an 0xFF that is
+      // neither stuffed (0xFF00) nor a restart marker
+      size_t q = segment_end;
+      for (;;) {
+        const void *ff = memchr(data + q, 0xFF, size - q);
+        if (!ff) {
+          q = size;
+          break;
+        }
+        q = static_cast<const unsigned char *>(ff) - data;
+        if (q + 1 >= size) {
+          q = size;
+          break;
+        }
+        const uint8_t next = data[q + 1];
+        if (next == 0x00 || next == 0xFF || (next >= 0xD0 && next <= 0xD7)) {
+          q += next == 0xFF ? 1 : 2;
+          continue;
+        }
+        break;
+      }
+      pos = q;
+      continue;
+    }
+    pos = segment_end;
+  }
+  if (d.status == JpegScanStatus::Ok && !seen_sof) d.status = JpegScanStatus::NoFrame;
+  return d;
+}
+
+// Scans the images of a batch in parallel on persistent threads.
+class JpegBatchScanner {
+ public:
+  // threads: total, including the calling thread; 0: one per hardware thread
+  explicit JpegBatchScanner(int threads = 0, bool full_scan = false) : full_scan_(full_scan) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int t = 1; t < threads; t++) workers_.emplace_back([this] { run(); });
+  }
+
+  ~JpegBatchScanner() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto &w : workers_) w.join();
+  }
+
+  JpegBatchScanner(const JpegBatchScanner &) = delete;
+  JpegBatchScanner &operator=(const JpegBatchScanner &) = delete;
+
+  // out[i] = scan_jpeg(data[i], lengths[i]); returns the number of images
+  // that could not be scanned
+  int scan(const unsigned char *const *data, const size_t *lengths, size_t count, JpegDescriptor *out) {
+    // a header scan takes a fraction of a microsecond; small batches are
+    // not worth waking the workers for
+    if (workers_.empty() || count < kMinParallel) {
+      for (size_t i = 0; i < count; i++) out[i] = scan_jpeg(data[i], lengths[i], full_scan_);
+    } else {
+      std::shared_ptr<Job> job = std::make_shared<Job>();
+      job->data = data;
+      job->lengths = lengths;
+      job->out = out;
+      job->count = count;
+      job->remaining = count;
+      job->chunk = std::max<size_t>(kMinChunk, count / (4 * (workers_.size() + 1)));
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = job;
+        generation_++;
+      }
+      cv_.notify_all();
+      work(*job);
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_cv_.wait(lock, [&job] { return job->remaining == 0; });
+      job_.reset();
+    }
+    int failures = 0;
+    for (size_t i = 0; i < count; i++) failures += out[i].ok() ? 0 : 1;
+    return failures;
+  }
+
+  // several vectors, as the decode loops keep them
+  int scan(const std::vector<const unsigned char *> &data, const std::vector<size_t> &lengths,
+           std::vector<JpegDescriptor> &out) {
+    out.resize(data.size());
+    return scan(data.data(), lengths.data(), data.size(), out.data());
+  }
+
+ private:
+  // a batch; workers that wake up late hold on to a finished job, whose
+  // counter is past the end, and so never touch the next batch
+  struct Job {
+    const unsigned char *const *data = nullptr;
+    const size_t *lengths = nullptr;
+    JpegDescriptor *out = nullptr;
+    size_t count = 0;
+    size_t chunk = 1;  // images claimed at a time
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> remaining{0};
+  };
+
+  void work(Job &job) {
+    for (;;) {
+      const size_t begin = job.next.fetch_add(job.chunk);
+      if (begin >= job.count) return;
+      const size_t end = std::min(job.count, begin + job.chunk);
+      for (size_t i = begin; i < end; i++) job.out[i] = scan_jpeg(job.data[i], job.lengths[i], full_scan_);
+      if (job.remaining.fetch_sub(end - begin) == end - begin) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_cv_.notify_all();
+      }
+    }
+  }
+
+  void run() {
+    uint64_t seen = 0;
+    for (;;) {
+      std::shared_ptr<Job> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) return;
+        seen = generation_;
+        job = job_;
+      }
+      if (job) work(*job);
+    }
+  }
+
+  static constexpr size_t kMinParallel = 256;
+  static constexpr size_t kMinChunk = 32;
+
+  const bool full_scan_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable done_cv_;
+  std::shared_ptr<Job> job_;
+  uint64_t generation_ = 0;
+  bool stop_ = false;
+};
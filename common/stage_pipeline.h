@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Multi-stage pipeline with a bound on the items in flight and per-stage
+// latency histograms, used by the resize samples' pipeline mode.
+//
+// Items pass through the stages in the order the stages were added. Every
+// stage has its own input queue and worker threads. A worker takes the items
+// that are waiting, up to the stage's batch size, without waiting for a full
+// batch, and calls the stage function once for all of them; a GPU stage can
+// issue a whole batch on the worker's stream and synchronize once. An item
+// whose `int status` member is set to non-zero by a stage skips the remaining
+// stages. submit() blocks while max_in_flight items are in the pipeline, which
+// bounds the memory held by the queues.
+//
+// For every stage, the time items wait in its queue and the time of the
+// stage function (the whole batch, counted for each item in it) are recorded,
+// as well as the end to end latency. Only host code is used, so the pipeline
+// can be run with CPU stub stages (see pipeline_simulation.cpp).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Latencies in buckets of a quarter octave from 1 us to about an hour.
+class LatencyHistogram {
+ public:
+  static const int kBuckets = 4 * 32 + 1;  // bucket 0: below 1 us
+
+  void add(double seconds) {
+    const double us = seconds * 1e6;
+    int b = 0;
+    if (us >= 1.0) b = std::min(kBuckets - 1, 1 + static_cast<int>(4.0 * std::log2(us)));
+    counts_[b]++;
+    count_++;
+    sum_ += seconds;
+    max_ = std::max(max_, seconds);
+  }
+
+  void merge(const LatencyHistogram &other) {
+    for (int b = 0; b < kBuckets; b++) counts_[b] += other.counts_[b];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  uint64_t count() const { return count_; }
+  double mean() const { return count_ ? sum_ / count_ : 0; }
+  double max() const { return max_; }
+
+  // in seconds, interpolated within the bucket
+  double percentile(double p) const {
+    if (!count_) return 0;
+    const double rank = p / 100.0 * count_;
+    uint64_t seen = 0;
+    for (int b = 0; b < kBuckets; b++) {
+      if (!counts_[b] || seen + counts_[b] < rank) {
+        seen += counts_[b];
+        continue;
+      }
+      const double lower = b == 0 ? 0 : bucket_lower_us(b);
+      const double upper = bucket_lower_us(b + 1);
+      const double f = (rank - seen) / counts_[b];
+      return std::min(max_, (lower + f * (upper - lower)) * 1e-6);
+    }
+    return max_;
+  }
+
+  // one summary line, then one bar per octave that has entries
+  void print(std::ostream &os, const std::string &name, bool bars = true) const {
+    char line[256];
+    snprintf(line, sizeof(line), "%-16s %8llu  mean %9.3f  p50 %9.3f  p90 %9.3f  p99 %9.3f  max %9.3f ms",
+             name.c_str(), static_cast<unsigned long long>(count_), mean() * 1e3,
+             percentile(50) * 1e3, percentile(90) * 1e3, percentile(99) * 1e3, max_ * 1e3);
+    os << line << std::endl;
+    if (!bars || !count_) return;
+    uint64_t octaves[kBuckets / 4 + 2] = {0};
+    for (int b = 0; b < kBuckets; b++) octaves[b == 0 ? 0 : 1 + (b - 1) / 4] += counts_[b];
+    const uint64_t most = *std::max_element(std::begin(octaves), std::end(octaves));
+    for (int o = 0; o < kBuckets / 4 + 2; o++) {
+      if (!octaves[o]) continue;
+      const double lower = o == 0 ? 0 : std::ldexp(1.0, o - 1) * 1e-3;
+      const int width = static_cast<int>(40 * octaves[o] / most);
+      snprintf(line, sizeof(line), "%16s %10.3f - %-10.3f ms |%-40s %llu", "", lower,
+               std::ldexp(1.0, o) * 1e-3, std::string(std::max(1, width), '#').c_str(),
+               static_cast<unsigned long long>(octaves[o]));
+      os << line << std::endl;
+    }
+  }
+
+ private:
+  static double bucket_lower_us(int b) { return std::exp2((b - 1) / 4.0); }
+
+  uint64_t counts_[kBuckets] = {0};
+  uint64_t count_ = 0;
+  double sum_ = 0;
+  double max_ = 0;
+};
+
+template <typename T>
+class StagePipeline {
+ public:
+  // called with the items of a batch and the index of the calling worker
+  // within the stage, e.g. to pick the worker's stream
+  typedef std::function<void(const std::vector<T *> &batch, int worker)> StageFn;
+  // called for every item leaving the pipeline, done or failed, one at a time
+  typedef std::function<void(T &item)> SinkFn;
+
+  explicit StagePipeline(size_t max_in_flight) : max_in_flight_(std::max<size_t>(1, max_in_flight)) {}
+
+  ~StagePipeline() { finish(); }
+
+  StagePipeline(const StagePipeline &) = delete;
+  StagePipeline &operator=(const StagePipeline &) = delete;
+
+  // stages are added before start()
+  void add_stage(const std::string &name, StageFn fn, int workers = 1, size_t max_batch = 1) {
+    std::unique_ptr<Stage> stage(new Stage);
+    stage->name = name;
+    stage->fn = std::move(fn);
+    stage->workers = std::max(1, workers);
+    stage->max_batch = std::max<size_t>(1, max_batch);
+    stage->active = stage->workers;
+    stages_.push_back(std::move(stage));
+  }
+
+  void start(SinkFn sink) {
+    sink_ = std::move(sink);
+    for (size_t s = 0; s < stages_.size(); s++) {
+      for (int w = 0; w < stages_[s]->workers; w++) threads_.emplace_back([this, s, w] { run(s, w); });
+    }
+    started_ = true;
+  }
+
+  // blocks while max_in_flight items are in the pipeline
+  void submit(T item) {
+    {
+      std::unique_lock<std::mutex> lock(flight_mutex_);
+      flight_cv_.wait(lock, [this] { return in_flight_ < max_in_flight_; });
+      in_flight_++;
+      max_observed_in_flight_ = std::max(max_observed_in_flight_, in_flight_);
+    }
+    Slot *slot = new Slot{std::move(item), Clock::now(), Clock::now()};
+    if (stages_.empty()) {
+      retire(slot);
+      return;
+    }
+    push(*stages_[0], slot);
+  }
+
+  // waits until all submitted items left the pipeline and stops the workers
+  void finish() {
+    if (!started_) return;
+    started_ = false;
+    if (!stages_.empty()) close(*stages_[0]);
+    for (auto &t : threads_) t.join();
+    threads_.clear();
+  }
+
+  uint64_t completed() const {
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    return completed_;
+  }
+  uint64_t failed() const {
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    return failed_;
+  }
+  size_t max_observed_in_flight() const {
+    std::lock_guard<std::mutex> lock(flight_mutex_);
+    return max_observed_in_flight_;
+  }
+
+  // per stage: queue wait and stage time; bars: print the histograms too
+  void print_stats(std::ostream &os, bool bars = false) const {
+    for (const auto &stage : stages_) {
+      std::lock_guard<std::mutex> lock(stage->mutex);
+      os << stage->name << ": " << stage->batches << " batches, "
+         << (stage->batches ? static_cast<double>(stage->processed) / stage->batches : 0.0)
+         << " items per batch" << std::endl;
+      stage->wait.print(os, "  queue wait", bars);
+      stage->service.print(os, "  stage", bars);
+    }
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    os << "end to end: " << completed_ << " done, " << failed_ << " failed" << std::endl;
+    end_to_end_.print(os, "  latency", bars);
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Slot {
+    T item;
+    Clock::time_point submitted;
+    Clock::time_point enqueued;
+  };
+
+  struct Stage {
+    std::string name;
+    StageFn fn;
+    int workers = 1;
+    size_t max_batch = 1;
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Slot *> queue;
+    bool closed = false;
+    int active = 0;  // workers still running
+    uint64_t batches = 0;
+    uint64_t processed = 0;
+    LatencyHistogram wait;
+    LatencyHistogram service;
+  };
+
+  static double seconds(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double>(to - from).count();
+  }
+
+  void push(Stage &stage, Slot *slot) {
+    slot->enqueued = Clock::now();
+    {
+      std::lock_guard<std::mutex> lock(stage.mutex);
+      stage.queue.push_back(slot);
+    }
+    stage.cv.notify_one();
+  }
+
+  void close(Stage &stage) {
+    {
+      std::lock_guard<std::mutex> lock(stage.mutex);
+      stage.closed = true;
+    }
+    stage.cv.notify_all();
+  }
+
+  void run(size_t s, int worker) {
+    Stage &stage = *stages_[s];
+    std::vector<Slot *> slots;
+    std::vector<T *> batch;
+    for (;;) {
+      slots.clear();
+      {
+        std::unique_lock<std::mutex> lock(stage.mutex);
+        stage.cv.wait(lock, [&stage] { return stage.closed || !stage.queue.empty(); });
+        if (stage.queue.empty()) break;
+        while (!stage.queue.empty() && slots.size() < stage.max_batch) {
+          slots.push_back(stage.queue.front());
+          stage.queue.pop_front();
+        }
+      }
+      const Clock::time_point start = Clock::now();
+      batch.clear();
+      for (Slot *slot : slots) {
+        if (slot->item.status == 0) batch.push_back(&slot->item);
+      }
+      if (!batch.empty()) stage.fn(batch, worker);
+      const Clock::time_point end = Clock::now();
+      {
+        std::lock_guard<std::mutex> lock(stage.mutex);
+        for (Slot *slot : slots) stage.wait.add(seconds(slot->enqueued, start));
+        for (size_t i = 0; i < batch.size(); i++) stage.service.add(seconds(start, end));
+        if (!batch.empty()) stage.batches++;
+        stage.processed += batch.size();
+      }
+      for (Slot *slot : slots) {
+        if (s + 1 < stages_.size())
+          push(*stages_[s + 1], slot);
+        else
+          retire(slot);
+      }
+    }
+    // the last worker of a stage closes the next one
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(stage.mutex);
+      last = --stage.active == 0;
+    }
+    if (last && s + 1 < stages_.size()) close(*stages_[s + 1]);
+  }
+
+  void retire(Slot *slot) {
+    {
+      std::lock_guard<std::mutex> lock(sink_mutex_);
+      end_to_end_.add(seconds(slot->submitted, Clock::now()));
+      if (slot->item.status == 0)
+        completed_++;
+      else
+        failed_++;
+      if (sink_) sink_(slot->item);
+    }
+    delete slot;
+    {
+      std::lock_guard<std::mutex> lock(flight_mutex_);
+      in_flight_--;
+    }
+    flight_cv_.notify_all();
+  }
+
+  const size_t max_in_flight_;
+  std::vector<std::unique_ptr<Stage>> stages_;
+  std::vector<std::thread> threads_;
+  bool started_ = false;
+  SinkFn sink_;
+
+  mutable std::mutex flight_mutex_;
+  std::condition_variable flight_cv_;
+  size_t in_flight_ = 0;
+  size_t max_observed_in_flight_ = 0;
+
+  mutable std::mutex sink_mutex_;
+  uint64_t completed_ = 0;
+  uint64_t failed_ = 0;
+  LatencyHistogram end_to_end_;
+};
@@ -0,0 +1,637 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Pipeline mode of the nvJPEG Image-Resize and Image-Resize-WaterMark samples
+// (-pipeline).
+//
+// The images of a directory stream through
+//   read -> batched decode -> resize -> [watermark] -> encode -> write
+// stages connected by queues (common/stage_pipeline.h), with up to
+// in_flight images between the first and the last stage. Decode, resize and
+// encode run on several workers, each with its own CUDA stream and nvJPEG
+// state; a worker issues its whole batch on its stream and synchronizes once
+// before handing the batch to the next stage. Device buffers come from a
+// BufferPool.
+//
+// Every source image is decoded once and resized to each rendition of a
+// ladder (e.g. -ladder 1920,1280:80,640:75,320:70 for responsive images,
+// width[:quality]). The renditions are produced largest first, each one
+// from the nearest larger rendition rather than from the full image, and
+// the renditions of a batch are encoded concurrently, one encoder state and
+// stream per rendition.
+//
+// Images are decoded to interleaved BGR, so every resize and blend is a
+// single C3R NPP call. Include after the CHECK_CUDA and CHECK_NVJPEG macros.
+
+#include "buffer_pool.h"
+#include "stage_pipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cuda_runtime_api.h>
+#include <nvjpeg.h>
+#include <nppcore.h>
+#include <nppi_arithmetic_and_logical_operations.h>
+#include <nppi_geometry_transforms.h>
+
+struct LadderStep {
+    int width;
+    int quality;  // 0: the -q quality
+};
+
+struct thumbnail_pipeline_params_t {
+    std::string output_dir;
+    int quality = 85;
+    // renditions, heights keep the aspect ratio; empty: one output of width x
+    // height, half the source size if 0
+    std::vector<LadderStep> ladder;
+    int width = 0;
+    int height = 0;
+    int in_flight = 32;
+    int batch_size = 8;
+    int streams = 2;            // workers of the decode, resize and encode stages
+    std::string watermark;      // JPEG blended into every output, empty: none
+    int watermark_alpha = 50;   // of 255
+};
+
+struct ThumbnailOutput {
+    int width = 0;
+    int height = 0;
+    int quality = 0;
+    PooledBuffer image;  // BGRI on the device, pitch 3 * width
+    std::vector<unsigned char> bitstream;
+};
+
+struct ThumbnailJob {
+    int status = 0;
+    std::string path;
+    std::vector<unsigned char> data;  // the JPEG file
+    int width = 0;
+    int height = 0;
+    nvjpegChromaSubsampling_t subsampling = NVJPEG_CSS_UNKNOWN;
+    PooledBuffer decoded;  // BGRI on the device, pitch 3 * width
+    std::vector<ThumbnailOutput> outputs;
+};
+
+// Parses "1920,1280:80,640:75" (width[:quality]); returns 1 on a malformed
+// list. The steps are sorted by decreasing width, duplicates removed.
+inline int parseLadder(const char *arg, std::vector<LadderStep> &ladder)
+{
+    ladder.clear();
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        LadderStep step = {std::atoi(item.c_str()), 0};
+        const size_t colon = item.find(':');
+        if (colon != std::string::npos)
+        {
+            step.quality = std::atoi(item.c_str() + colon + 1);
+            if (step.quality < 1 || step.quality > 100)
+            {
+                return 1;
+            }
+        }
+        if (step.width <= 0)
+        {
+            return 1;
+        }
+        ladder.push_back(step);
+    }
+    std::stable_sort(ladder.begin(), ladder.end(), [](const LadderStep &a, const LadderStep &b) { return a.width > b.width; });
+    ladder.erase(std::unique(ladder.begin(), ladder.end(),
+                             [](const LadderStep &a, const LadderStep &b) { return a.width == b.width; }),
+                 ladder.end());
+    return ladder.empty() ? 1 : 0;
+}
+
+class ThumbnailPipeline
+{
+public:
+    ThumbnailPipeline(nvjpegHandle_t handle, const thumbnail_pipeline_params_t &params)
+        : handle_(handle), params_(params), device_pool_(&devMalloc, &devFree)
+    {
+        params_.streams = std::max(1, params_.streams);
+        params_.batch_size = std::max(1, params_.batch_size);
+    }
+
+    ~ThumbnailPipeline()
+    {
+        watermark_cache_.clear();
+        watermark_image_.reset();
+        for (auto &w : workers_)
+        {
+            if (w.decode_state) nvjpegJpegStateDestroy(w.decode_state);
+            if (w.single_state) nvjpegJpegStateDestroy(w.single_state);
+            for (auto &e : w.encoders)
+            {
+                if (e.params) nvjpegEncoderParamsDestroy(e.params);
+                if (e.state) nvjpegEncoderStateDestroy(e.state);
+                if (e.stream) cudaStreamDestroy(e.stream);
+            }
+            for (cudaStream_t stream : {w.decode_stream, w.resize_stream})
+            {
+                if (stream) cudaStreamDestroy(stream);
+            }
+        }
+        if (watermark_stream_) cudaStreamDestroy(watermark_stream_);
+    }
+
+    // processes the files, returns the number of images that failed
+    int run(const std::vector<std::string> &files)
+    {
+        if (init())
+        {
+            return static_cast<int>(files.size());
+        }
+
+        StagePipeline<ThumbnailJob> pipeline(params_.in_flight);
+        pipeline.add_stage("read", [this](const std::vector<ThumbnailJob *> &batch, int) { read(batch); }, 2);
+        pipeline.add_stage("decode", [this](const std::vector<ThumbnailJob *> &batch, int w) { decode(batch, workers_[w]); },
+                           params_.streams, params_.batch_size);
+        pipeline.add_stage("resize", [this](const std::vector<ThumbnailJob *> &batch, int w) { resize(batch, workers_[w]); },
+                           params_.streams, params_.batch_size);
+        if (watermark_image_)
+        {
+            pipeline.add_stage("watermark", [this](const std::vector<ThumbnailJob *> &batch, int) { watermark(batch); },
+                               1, params_.batch_size);
+        }
+        pipeline.add_stage("encode", [this](const std::vector<ThumbnailJob *> &batch, int w) { encode(batch, workers_[w]); },
+                           params_.streams, params_.batch_size);
+        pipeline.add_stage("write", [this](const std::vector<ThumbnailJob *> &batch, int) { write(batch); }, 2);
+
+        size_t outputs = 0;
+        pipeline.start([&outputs](ThumbnailJob &job)
+        {
+            if (job.status)
+            {
+                std::cerr << "Error processing file: " << job.path << std::endl;
+            }
+            else
+            {
+                outputs += job.outputs.size();
+            }
+        });
+
+        const auto start = std::chrono::steady_clock::now();
+        for (const std::string &file : files)
+        {
+            ThumbnailJob job;
+            job.path = file;
+            pipeline.submit(std::move(job));
+        }
+        pipeline.finish();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "------------------------------------------------------------- " << std::endl;
+        std::cout << "Pipeline: " << params_.in_flight << " images in flight, batch size " << params_.batch_size
+                  << ", " << params_.streams << " streams" << std::endl;
+        pipeline.print_stats(std::cout, true);
+        std::cout << "Total images resized: " << pipeline.completed() << " (" << outputs << " outputs, "
+                  << pipeline.failed() << " failed)" << std::endl;
+        std::cout << "Total time: " << seconds * 1e3 << " (ms), " << pipeline.completed() / seconds
+                  << " images/s" << std::endl;
+        if (!params_.ladder.empty())
+        {
+            std::cout << "Resize input: " << resize_input_pixels_ / 1e6 << " Mpixel ("
+                      << full_resize_input_pixels_ / 1e6 << " Mpixel when every rendition is resized from the full image)"
+                      << std::endl;
+        }
+        device_pool_.print(std::cout, "Device buffer");
+        std::cout << "------------------------------------------------------------- " << std::endl;
+        return static_cast<int>(pipeline.failed());
+    }
+
+private:
+    struct Encoder {
+        cudaStream_t stream = NULL;
+        nvjpegEncoderState_t state = NULL;
+        nvjpegEncoderParams_t params = NULL;
+    };
+
+    // one per worker index; stage s uses the members of its own stage
+    struct Worker {
+        cudaStream_t decode_stream = NULL;
+        cudaStream_t resize_stream = NULL;
+        nvjpegJpegState_t decode_state = NULL;  // batched decode
+        nvjpegJpegState_t single_state = NULL;  // fallback, one image at a time
+        std::vector<Encoder> encoders;          // one per rendition
+    };
+
+    static int devMalloc(void **p, size_t s) { return (int)cudaMalloc(p, s); }
+    static int devFree(void *p) { return (int)cudaFree(p); }
+
+    static NppStreamContext streamContext(cudaStream_t stream)
+    {
+        NppStreamContext ctx;
+        nppGetStreamContext(&ctx);
+        ctx.hStream = stream;
+        return ctx;
+    }
+
+    int init()
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(params_.output_dir, ec);
+        if (ec)
+        {
+            std::cerr << "Cannot create output directory: " << params_.output_dir << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        workers_.resize(params_.streams);
+        for (auto &w : workers_)
+        {
+            CHECK_CUDA(cudaStreamCreateWithFlags(&w.decode_stream, cudaStreamNonBlocking));
+            CHECK_CUDA(cudaStreamCreateWithFlags(&w.resize_stream, cudaStreamNonBlocking));
+            CHECK_NVJPEG(nvjpegJpegStateCreate(handle_, &w.decode_state));
+            CHECK_NVJPEG(nvjpegJpegStateCreate(handle_, &w.single_state));
+            w.encoders.resize(std::max<size_t>(1, params_.ladder.size()));
+            for (auto &e : w.encoders)
+            {
+                CHECK_CUDA(cudaStreamCreateWithFlags(&e.stream, cudaStreamNonBlocking));
+                CHECK_NVJPEG(nvjpegEncoderStateCreate(handle_, &e.state, e.stream));
+                CHECK_NVJPEG(nvjpegEncoderParamsCreate(handle_, &e.params, e.stream));
+            }
+        }
+
+        if (!params_.watermark.empty())
+        {
+            // decoded once, resized to every output size on first use
+            CHECK_CUDA(cudaStreamCreateWithFlags(&watermark_stream_, cudaStreamNonBlocking));
+            ThumbnailJob logo;
+            logo.path = params_.watermark;
+            std::vector<ThumbnailJob *> batch(1, &logo);
+            read(batch);
+            if (!logo.status)
+            {
+                decode(batch, workers_[0]);
+            }
+            if (logo.status)
+            {
+                std::cerr << "Cannot decode watermark image: " << params_.watermark << std::endl;
+                return EXIT_FAILURE;
+            }
+            watermark_width_ = logo.width;
+            watermark_height_ = logo.height;
+            watermark_image_ = std::move(logo.decoded);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    void read(const std::vector<ThumbnailJob *> &batch)
+    {
+        for (ThumbnailJob *job : batch)
+        {
+            std::ifstream input(job->path.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+            if (!input.is_open())
+            {
+                std::cerr << "Cannot open image: " << job->path << std::endl;
+                job->status = EXIT_FAILURE;
+                continue;
+            }
+            const std::streamsize size = input.tellg();
+            input.seekg(0, std::ios::beg);
+            job->data.resize(size);
+            if (!input.read(reinterpret_cast<char *>(job->data.data()), size))
+            {
+                std::cerr << "Cannot read image: " << job->path << std::endl;
+                job->status = EXIT_FAILURE;
+                continue;
+            }
+
+            int nComponent = 0;
+            int widths[NVJPEG_MAX_COMPONENT];
+            int heights[NVJPEG_MAX_COMPONENT];
+            if (NVJPEG_STATUS_SUCCESS != nvjpegGetImageInfo(handle_, job->data.data(), job->data.size(),
+                                                            &nComponent, &job->subsampling, widths, heights))
+            {
+                std::cerr << "Error decoding JPEG header: " << job->path << std::endl;
+                job->status = EXIT_FAILURE;
+                continue;
+            }
+            job->width = widths[0];
+            job->height = heights[0];
+        }
+    }
+
+    void decode(const std::vector<ThumbnailJob *> &batch, Worker &w)
+    {
+        std::vector<const unsigned char *> data;
+        std::vector<size_t> lengths;
+        std::vector<nvjpegImage_t> destinations;
+        std::vector<ThumbnailJob *> jobs;
+        for (ThumbnailJob *job : batch)
+        {
+            job->decoded = device_pool_.acquire_image(3 * job->width, job->height);
+            if (!job->decoded)
+            {
+                std::cerr << "Cannot allocate the decode buffer: " << job->path << std::endl;
+                job->status = EXIT_FAILURE;
+                continue;
+            }
+            nvjpegImage_t dst = {};
+            dst.channel[0] = job->decoded.get();
+            dst.pitch[0] = 3 * job->width;
+            data.push_back(job->data.data());
+            lengths.push_back(job->data.size());
+            destinations.push_back(dst);
+            jobs.push_back(job);
+        }
+        if (jobs.empty())
+        {
+            return;
+        }
+
+        nvjpegStatus_t status = nvjpegDecodeBatchedInitialize(handle_, w.decode_state, (int)jobs.size(), 1, NVJPEG_OUTPUT_BGRI);
+        if (status == NVJPEG_STATUS_SUCCESS)
+        {
+            status = nvjpegDecodeBatched(handle_, w.decode_state, data.data(), lengths.data(), destinations.data(),
+                                         w.decode_stream);
+        }
+        if (status != NVJPEG_STATUS_SUCCESS)
+        {
+            // one bad stream fails the whole batch: decode one by one to
+            // find it
+            for (size_t i = 0; i < jobs.size(); i++)
+            {
+                if (NVJPEG_STATUS_SUCCESS != nvjpegDecode(handle_, w.single_state, data[i], lengths[i], NVJPEG_OUTPUT_BGRI,
+                                                          &destinations[i], w.decode_stream))
+                {
+                    std::cerr << "Error in nvjpegDecode: " << jobs[i]->path << std::endl;
+                    jobs[i]->status = EXIT_FAILURE;
+                }
+            }
+        }
+        CHECK_CUDA(cudaStreamSynchronize(w.decode_stream));
+        for (ThumbnailJob *job : jobs)
+        {
+            std::vector<unsigned char>().swap(job->data);
+            if (job->status)
+            {
+                job->decoded.reset();
+            }
+        }
+    }
+
+    // the renditions of an image, largest first
+    void outputSizes(ThumbnailJob &job) const
+    {
+        job.outputs.clear();
+        if (params_.ladder.empty())
+        {
+            const bool half = params_.width == 0 || params_.height == 0;
+            job.outputs.resize(1);
+            job.outputs[0].width = std::max(1, half ? job.width / 2 : params_.width);
+            job.outputs[0].height = std::max(1, half ? job.height / 2 : params_.height);
+            job.outputs[0].quality = params_.quality;
+            return;
+        }
+        for (const LadderStep &step : params_.ladder)
+        {
+            // no upscaling; steps above the source size collapse into one
+            const int width = std::max(1, std::min(step.width, job.width));
+            if (!job.outputs.empty() && job.outputs.back().width == width)
+            {
+                continue;
+            }
+            ThumbnailOutput out;
+            out.width = width;
+            out.height = std::max(1, (int)(((long long)job.height * width + job.width / 2) / job.width));
+            out.quality = step.quality ? step.quality : params_.quality;
+            job.outputs.push_back(std::move(out));
+        }
+    }
+
+    void resize(const std::vector<ThumbnailJob *> &batch, Worker &w)
+    {
+        const NppStreamContext ctx = streamContext(w.resize_stream);
+        for (ThumbnailJob *job : batch)
+        {
+            outputSizes(*job);
+            // pyramid: every rendition is resized from the previous, larger
+            // one, which is ordered before it on the stream
+            const unsigned char *src = job->decoded.get();
+            NppiSize srcSize = {job->width, job->height};
+            for (size_t i = 0; i < job->outputs.size() && !job->status; i++)
+            {
+                ThumbnailOutput &out = job->outputs[i];
+                out.image = device_pool_.acquire_image(3 * out.width, out.height);
+                const NppiRect srcRoi = {0, 0, srcSize.width, srcSize.height};
+                const NppiSize dstSize = {out.width, out.height};
+                const NppiRect dstRoi = {0, 0, out.width, out.height};
+                if (!out.image ||
+                    NPP_SUCCESS != nppiResize_8u_C3R_Ctx(src, 3 * srcSize.width, srcSize, srcRoi,
+                                                         out.image.get(), 3 * out.width, dstSize, dstRoi,
+                                                         NPPI_INTER_LANCZOS, ctx))
+                {
+                    std::cerr << "NPP resize failed: " << job->path << std::endl;
+                    job->status = EXIT_FAILURE;
+                    break;
+                }
+                resize_input_pixels_ += (uint64_t)srcSize.width * srcSize.height;
+                full_resize_input_pixels_ += (uint64_t)job->width * job->height;
+                src = out.image.get();
+                srcSize = dstSize;
+            }
+        }
+        CHECK_CUDA(cudaStreamSynchronize(w.resize_stream));
+        for (ThumbnailJob *job : batch)
+        {
+            job->decoded.reset();
+        }
+    }
+
+    // the logo resized to an output size, cached per size
+    unsigned char *watermarkFor(int width, int height, const NppStreamContext &ctx)
+    {
+        const std::pair<int, int> key(width, height);
+        auto it = watermark_cache_.find(key);
+        if (it != watermark_cache_.end())
+        {
+            return it->second.get();
+        }
+        if (watermark_cache_.size() >= 64)
+        {
+            // many distinct sizes: start over rather than grow without bound
+            CHECK_CUDA(cudaStreamSynchronize(ctx.hStream));
+            watermark_cache_.clear();
+        }
+        PooledBuffer logo = device_pool_.acquire_image(3 * width, height);
+        const NppiSize srcSize = {watermark_width_, watermark_height_};
+        const NppiRect srcRoi = {0, 0, watermark_width_, watermark_height_};
+        const NppiSize dstSize = {width, height};
+        const NppiRect dstRoi = {0, 0, width, height};
+        if (!logo ||
+            NPP_SUCCESS != nppiResize_8u_C3R_Ctx(watermark_image_.get(), 3 * watermark_width_, srcSize, srcRoi,
+                                                 logo.get(), 3 * width, dstSize, dstRoi, NPPI_INTER_LANCZOS, ctx))
+        {
+            return NULL;
+        }
+        unsigned char *ptr = logo.get();
+        watermark_cache_[key] = std::move(logo);
+        return ptr;
+    }
+
+    void watermark(const std::vector<ThumbnailJob *> &batch)
+    {
+        const NppStreamContext ctx = streamContext(watermark_stream_);
+        for (ThumbnailJob *job : batch)
+        {
+            for (ThumbnailOutput &out : job->outputs)
+            {
+                const NppiSize size = {out.width, out.height};
+                unsigned char *logo = watermarkFor(out.width, out.height, ctx);
+                if (!logo ||
+                    NPP_SUCCESS != nppiAlphaCompC_8u_C3R_Ctx(out.image.get(), 3 * out.width, 255, logo, 3 * out.width,
+                                                             params_.watermark_alpha, out.image.get(), 3 * out.width,
+                                                             size, NPPI_OP_ALPHA_PLUS, ctx))
+                {
+                    std::cerr << "NPP alpha blending failed: " << job->path << std::endl;
+                    job->status = EXIT_FAILURE;
+                    break;
+                }
+            }
+        }
+        CHECK_CUDA(cudaStreamSynchronize(watermark_stream_));
+    }
+
+    void encode(const std::vector<ThumbnailJob *> &batch, Worker &w)
+    {
+        // all renditions of the batch, issued in rounds of one per encoder
+        std::vector<std::pair<ThumbnailJob *, ThumbnailOutput *>> outputs;
+        for (ThumbnailJob *job : batch)
+        {
+            for (ThumbnailOutput &out : job->outputs)
+            {
+                outputs.push_back(std::make_pair(job, &out));
+            }
+        }
+        for (size_t first = 0; first < outputs.size(); first += w.encoders.size())
+        {
+            const size_t count = std::min(w.encoders.size(), outputs.size() - first);
+            for (size_t i = 0; i < count; i++)
+            {
+                ThumbnailJob *job = outputs[first + i].first;
+                ThumbnailOutput &out = *outputs[first + i].second;
+                Encoder &e = w.encoders[i];
+                if (job->status)
+                {
+                    continue;
+                }
+                nvjpegChromaSubsampling_t subsampling = job->subsampling;
+                if (subsampling == NVJPEG_CSS_UNKNOWN)
+                {
+                    subsampling = NVJPEG_CSS_420;
+                }
+                nvjpegImage_t img = {};
+                img.channel[0] = out.image.get();
+                img.pitch[0] = 3 * out.width;
+                if (NVJPEG_STATUS_SUCCESS != nvjpegEncoderParamsSetSamplingFactors(e.params, subsampling, e.stream) ||
+                    NVJPEG_STATUS_SUCCESS != nvjpegEncoderParamsSetQuality(e.params, out.quality, e.stream) ||
+                    NVJPEG_STATUS_SUCCESS != nvjpegEncodeImage(handle_, e.state, e.params, &img, NVJPEG_INPUT_BGRI,
+                                                               out.width, out.height, e.stream))
+                {
+                    std::cerr << "Error in nvjpegEncodeImage: " << job->path << std::endl;
+                    job->status = EXIT_FAILURE;
+                }
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                ThumbnailJob *job = outputs[first + i].first;
+                ThumbnailOutput &out = *outputs[first + i].second;
+                Encoder &e = w.encoders[i];
+                size_t length = 0;
+                if (!job->status &&
+                    NVJPEG_STATUS_SUCCESS == nvjpegEncodeRetrieveBitstream(handle_, e.state, NULL, &length, e.stream))
+                {
+                    out.bitstream.resize(length);
+                    CHECK_NVJPEG(nvjpegEncodeRetrieveBitstream(handle_, e.state, out.bitstream.data(), &length, e.stream));
+                }
+                else if (!job->status)
+                {
+                    std::cerr << "Error in nvjpegEncodeRetrieveBitstream: " << job->path << std::endl;
+                    job->status = EXIT_FAILURE;
+                }
+                CHECK_CUDA(cudaStreamSynchronize(e.stream));
+                out.image.reset();
+            }
+        }
+    }
+
+    void write(const std::vector<ThumbnailJob *> &batch)
+    {
+        for (ThumbnailJob *job : batch)
+        {
+            // the file name without directories and extension
+            std::string name = std::filesystem::path(job->path).stem().string();
+            for (const ThumbnailOutput &out : job->outputs)
+            {
+                std::string filename = params_.output_dir + "/" + name;
+                if (!params_.ladder.empty())
+                {
+                    filename += "_" + std::to_string(out.width) + "x" + std::to_string(out.height);
+                }
+                filename += ".jpg";
+                FILE *file = fopen(filename.c_str(), "wb");
+                const bool ok = file && fwrite(out.bitstream.data(), 1, out.bitstream.size(), file) == out.bitstream.size();
+                if (!file || fclose(file) != 0 || !ok)
+                {
+                    std::cerr << "Cannot write file: " << filename << std::endl;
+                    job->status = EXIT_FAILURE;
+                }
+            }
+        }
+    }
+
+    nvjpegHandle_t handle_;
+    thumbnail_pipeline_params_t params_;
+    BufferPool device_pool_;
+    std::vector<Worker> workers_;
+    cudaStream_t watermark_stream_ = NULL;
+    PooledBuffer watermark_image_;
+    int watermark_width_ = 0;
+    int watermark_height_ = 0;
+    std::map<std::pair<int, int>, PooledBuffer> watermark_cache_;  // (width, height) -> logo
+    std::atomic<uint64_t> resize_input_pixels_{0};
+    std::atomic<uint64_t> full_resize_input_pixels_{0};
+};
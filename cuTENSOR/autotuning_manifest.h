@@ -0,0 +1,455 @@
+/*
+ * Copyright (c) 2019, NVIDIA CORPORATION.  All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  - Neither the name(s) of the copyright holder(s) nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/**
+ * Host-only part of the autotuning sweep (contraction_autotuning_sweep.cu):
+ * workload manifest parsing, scheduling and report generation.
+ *
+ * A manifest lists contractions, either as CSV
+ *
+ *     # equation; extents; dtype
+ *     mhkn,ukvh->munv; m=96 n=96 u=96 v=64 h=64 k=64; float
+ *
+ * (fields separated by ';' since equations contain commas) or as JSON
+ *
+ *     [ {"equation": "mhkn,ukvh->munv",
+ *        "extents": {"m": 96, "n": 96, "u": 96, "v": 64, "h": 64, "k": 64},
+ *        "dtype": "float"} ]
+ *
+ * Supported dtypes: half, float, tf32 (float data, TF32 compute), double,
+ * complex (single precision) and complex_double.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct ManifestEntry
+{
+    int id = 0;                        // position in the manifest (1-based)
+    std::string equation;              // "A,B->C", explicit output required
+    std::string modeA, modeB, modeC;
+    std::map<char, int64_t> extent;
+    std::string dtype;
+
+    double flops() const
+    {
+        double flops = 2.0;
+        for (const auto &it : extent) flops *= it.second;
+        return flops;
+    }
+
+    int64_t elements(const std::string &modes) const
+    {
+        int64_t elements = 1;
+        for (auto mode : modes) elements *= extent.at(mode);
+        return elements;
+    }
+};
+
+/**
+ * Splits "A,B->C" into its operands and validates it against the extents
+ * (every mode needs one, and there must be none for other modes).
+ */
+inline bool parseManifestEquation(ManifestEntry &entry, std::string &error)
+{
+    std::string eq;
+    for (auto c : entry.equation) if (c != ' ') eq += c;
+    const auto arrow = eq.find("->");
+    const auto comma = eq.find(',');
+    if (arrow == std::string::npos || comma == std::string::npos || comma > arrow)
+    {
+        error = "expected a binary contraction of the form 'A,B->C': '" + entry.equation + "'";
+        return false;
+    }
+    entry.modeA = eq.substr(0, comma);
+    entry.modeB = eq.substr(comma + 1, arrow - comma - 1);
+    entry.modeC = eq.substr(arrow + 2);
+    for (const auto &modes : {entry.modeA, entry.modeB, entry.modeC})
+    {
+        for (auto mode : modes)
+        {
+            if (entry.extent.find(mode) == entry.extent.end())
+            {
+                error = std::string("missing extent for mode '") + mode + "'";
+                return false;
+            }
+        }
+    }
+    // extents of other modes would inflate flops() and the reported GFLOPs/s
+    for (const auto &it : entry.extent)
+    {
+        if (eq.find(it.first) == std::string::npos)
+        {
+            error = std::string("extent for mode '") + it.first + "' which is not in the equation";
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool isSupportedDtype(const std::string &dtype)
+{
+    return dtype == "half" || dtype == "float" || dtype == "tf32" || dtype == "double" ||
+           dtype == "complex" || dtype == "complex_double";
+}
+
+inline std::string trim(const std::string &str)
+{
+    const auto first = str.find_first_not_of(" \t\r\n\"");
+    if (first == std::string::npos) return "";
+    const auto last = str.find_last_not_of(" \t\r\n\"");
+    return str.substr(first, last - first + 1);
+}
+
+/**
+ * Parses one CSV line ("equation; m=96 n=96 ...; dtype").
+ */
+inline bool parseManifestCsvLine(const std::string &line, ManifestEntry &entry, std::string &error)
+{
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, ';')) fields.push_back(trim(field));
+    if (fields.size() < 2 || fields.size() > 3)
+    {
+        error = "expected 'equation; extents; dtype'";
+        return false;
+    }
+    entry.equation = fields[0];
+    entry.dtype = (fields.size() == 3 && ! fields[2].empty()) ? fields[2] : "float";
+
+    std::stringstream extents(fields[1]);
+    std::string item;
+    while (extents >> item)
+    {
+        const auto eq = item.find('=');
+        if (eq != 1)
+        {
+            error = "malformed extent '" + item + "' (expected e.g. 'm=96')";
+            return false;
+        }
+        entry.extent[item[0]] = atoll(item.c_str() + 2);
+    }
+    return true;
+}
+
+/**
+ * Minimal JSON reader for the manifest schema (array of flat objects whose
+ * "extents" member is an object of integers).
+ */
+class ManifestJsonReader
+{
+    public:
+    explicit ManifestJsonReader(const std::string &text) : text_(text) {}
+
+    bool parse(std::vector<ManifestEntry> &entries, std::string &error)
+    {
+        if (! expect('['))
+        {
+            error = "expected a JSON array";
+            return false;
+        }
+        if (peek() == ']') return true;
+        do
+        {
+            ManifestEntry entry;
+            if (! parseEntry(entry))
+            {
+                error = "malformed JSON near offset " + std::to_string(pos_);
+                return false;
+            }
+            entries.push_back(entry);
+        } while (accept(','));
+        if (! expect(']'))
+        {
+            error = "expected ']' near offset " + std::to_string(pos_);
+            return false;
+        }
+        return true;
+    }
+
+    private:
+    void skipSpace()
+    {
+        while (pos_ < text_.size() && isspace(static_cast<unsigned char>(text_[pos_]))) ++pos_;
+    }
+    char peek() { skipSpace(); return pos_ < text_.size() ? text_[pos_] : '\0'; }
+    bool accept(char c) { if (peek() != c) return false; ++pos_; return true; }
+    bool expect(char c) { return accept(c); }
+
+    bool parseString(std::string &str)
+    {
+        if (! expect('"')) return false;
+        str.clear();
+        while (pos_ < text_.size() && text_[pos_] != '"')
+        {
+            if (text_[pos_] == '\\' && pos_ + 1 < text_.size()) ++pos_;
+            str += text_[pos_++];
+        }
+        return expect('"');
+    }
+
+    bool parseInteger(int64_t &value)
+    {
+        skipSpace();
+        const size_t start = pos_;
+        while (pos_ < text_.size() && (isdigit(static_cast<unsigned char>(text_[pos_])) || text_[pos_] == '-')) ++pos_;
+        if (pos_ == start) return false;
+        value = atoll(text_.substr(start, pos_ - start).c_str());
+        return true;
+    }
+
+    bool parseEntry(ManifestEntry &entry)
+    {
+        if (! expect('{')) return false;
+        entry.dtype = "float";
+        if (accept('}')) return true;
+        do
+        {
+            std::string key;
+            if (! parseString(key) || ! expect(':')) return false;
+            if (key == "equation")
+            {
+                if (! parseString(entry.equation)) return false;
+            }
+            else if (key == "dtype")
+            {
+                if (! parseString(entry.dtype)) return false;
+            }
+            else if (key == "extents")
+            {
+                if (! expect('{')) return false;
+                if (accept('}')) continue;
+                do
+                {
+                    std::string mode;
+                    int64_t extent;
+                    if (! parseString(mode) || mode.size() != 1 || ! expect(':') || ! parseInteger(extent)) return false;
+                    entry.extent[mode[0]] = extent;
+                } while (accept(','));
+                if (! expect('}')) return false;
+            }
+            else
+            {
+                return false;
+            }
+        } while (accept(','));
+        return expect('}');
+    }
+
+    std::string text_;
+    size_t pos_ = 0;
+};
+
+/**
+ * Loads a manifest; files ending in ".json" are parsed as JSON, all others
+ * as CSV (empty lines and lines starting with '#' are ignored).
+ */
+inline bool loadManifest(const std::string &filename, std::vector<ManifestEntry> &entries, std::string &error)
+{
+    std::ifstream input(filename);
+    if (! input)
+    {
+        error = "cannot open '" + filename + "'";
+        return false;
+    }
+
+    entries.clear();
+    const bool isJson = filename.size() >= 5 && filename.substr(filename.size() - 5) == ".json";
+    if (isJson)
+    {
+        std::stringstream buffer;
+        buffer << input.rdbuf();
+        if (! ManifestJsonReader(buffer.str()).parse(entries, error)) return false;
+    }
+    else
+    {
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(input, line))
+        {
+            ++lineNumber;
+            line = trim(line);
+            if (line.empty() || line[0] == '#') continue;
+            ManifestEntry entry;
+            if (! parseManifestCsvLine(line, entry, error))
+            {
+                error = filename + ":" + std::to_string(lineNumber) + ": " + error;
+                return false;
+            }
+            entries.push_back(entry);
+        }
+    }
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        entries[i].id = static_cast<int>(i) + 1;
+        if (! parseManifestEquation(entries[i], error) )
+        {
+            error = "entry " + std::to_string(i + 1) + ": " + error;
+            return false;
+        }
+        if (! isSupportedDtype(entries[i].dtype))
+        {
+            error = "entry " + std::to_string(i + 1) + ": unsupported dtype '" + entries[i].dtype + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Orders the manifest for tuning: duplicates (same equation, extents and
+ * dtype) are tuned once, entries are grouped by dtype, and within a group the
+ * most expensive contractions come first so that the device buffers reach
+ * their final size up front.
+ */
+inline std::vector<ManifestEntry> scheduleManifest(const std::vector<ManifestEntry> &entries)
+{
+    std::vector<ManifestEntry> scheduled;
+    for (const auto &entry : entries)
+    {
+        bool duplicate = false;
+        for (const auto &other : scheduled)
+        {
+            if (other.modeA == entry.modeA && other.modeB == entry.modeB && other.modeC == entry.modeC &&
+                other.extent == entry.extent && other.dtype == entry.dtype)
+            {
+                duplicate = true;
+                break;
+            }
+        }
+        if (! duplicate) scheduled.push_back(entry);
+    }
+    std::stable_sort(scheduled.begin(), scheduled.end(), [](const ManifestEntry &a, const ManifestEntry &b)
+    {
+        if (a.dtype != b.dtype) return a.dtype < b.dtype;
+        return a.flops() > b.flops();
+    });
+    return scheduled;
+}
+
+struct AutotuneResult
+{
+    int entry = 0;
+    std::string equation;
+    std::string dtype;
+    int algo = 0;
+    bool supported = false;
+    double seconds = 0;
+    double gflops = 0;
+    bool best = false;
+};
+
+/**
+ * Collects per-algorithm timings and writes them as CSV or JSON.
+ */
+class AutotuneReport
+{
+    public:
+    void add(const ManifestEntry &entry, int algo, bool supported, double seconds)
+    {
+        AutotuneResult result;
+        result.entry = entry.id;
+        result.equation = entry.equation;
+        result.dtype = entry.dtype;
+        result.algo = algo;
+        result.supported = supported;
+        result.seconds = supported ? seconds : 0;
+        result.gflops = (supported && seconds > 0) ? entry.flops() / seconds / 1e9 : 0;
+        results_.push_back(result);
+    }
+
+    /**
+     * Marks the fastest supported algorithm of each entry; returns its index
+     * into results() (or -1).
+     */
+    int markBest(int entry)
+    {
+        int best = -1;
+        for (size_t i = 0; i < results_.size(); ++i)
+        {
+            if (results_[i].entry != entry || ! results_[i].supported) continue;
+            results_[i].best = false;
+            if (best < 0 || results_[i].seconds < results_[best].seconds) best = static_cast<int>(i);
+        }
+        if (best >= 0) results_[best].best = true;
+        return best;
+    }
+
+    const std::vector<AutotuneResult>& results() const { return results_; }
+
+    bool write(const std::string &filename) const
+    {
+        FILE* file = fopen(filename.c_str(), "w");
+        if (file == NULL) return false;
+        const bool isJson = filename.size() >= 5 && filename.substr(filename.size() - 5) == ".json";
+        if (isJson) writeJson(file); else writeCsv(file);
+        fclose(file);
+        return true;
+    }
+
+    void writeCsv(FILE* file) const
+    {
+        fprintf(file, "entry,equation,dtype,algo,supported,seconds,gflops,best\n");
+        for (const auto &r : results_)
+        {
+            fprintf(file, "%d,\"%s\",%s,%d,%d,%.9f,%.3f,%d\n", r.entry, r.equation.c_str(), r.dtype.c_str(),
+                    r.algo, r.supported ? 1 : 0, r.seconds, r.gflops, r.best ? 1 : 0);
+        }
+    }
+
+    void writeJson(FILE* file) const
+    {
+        fprintf(file, "[\n");
+        for (size_t i = 0; i < results_.size(); ++i)
+        {
+            const auto &r = results_[i];
+            fprintf(file, "  {\"entry\": %d, \"equation\": \"%s\", \"dtype\": \"%s\", \"algo\": %d, "
+                          "\"supported\": %s, \"seconds\": %.9f, \"gflops\": %.3f, \"best\": %s}%s\n",
+                    r.entry, r.equation.c_str(), r.dtype.c_str(), r.algo, r.supported ? "true" : "false",
+                    r.seconds, r.gflops, r.best ? "true" : "false", (i + 1 < results_.size()) ? "," : "");
+        }
+        fprintf(file, "]\n");
+    }
+
+    private:
+    std::vector<AutotuneResult> results_;
+};
@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2019, NVIDIA CORPORATION.  All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  - Neither the name(s) of the copyright holder(s) nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// CPU-only check of the host side of the autotuning sweep
+// (autotuning_manifest.h).
+//
+// Parses the sample manifest as CSV and, converted, as JSON, rejects
+// malformed manifests, checks the tuning schedule (duplicates dropped,
+// grouped by dtype, most expensive first), then runs the sweep's
+// per-algorithm loop with a fake timer and checks the best algorithm of
+// each entry and the CSV and JSON reports.
+//
+// Build: g++ -O2 -std=c++11 autotuning_manifest_check.cpp -o autotuning_manifest_check
+// Usage: ./autotuning_manifest_check [-m manifest.csv] [-o report_prefix]
+
+#include "autotuning_manifest.h"
+
+#include <math.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define EXPECT(cond, what)                                          \
+    do                                                              \
+    {                                                               \
+        if (!(cond))                                                \
+        {                                                           \
+            printf("FAILED: %s: %s (line %d)\n", what, #cond, __LINE__); \
+            failures++;                                             \
+        }                                                           \
+    } while (0)
+
+static void writeFile(const std::string &filename, const std::string &text)
+{
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == NULL)
+    {
+        printf("FAILED: cannot write %s\n", filename.c_str());
+        failures++;
+        return;
+    }
+    fputs(text.c_str(), file);
+    fclose(file);
+}
+
+static std::string readFile(const std::string &filename)
+{
+    std::ifstream input(filename);
+    std::stringstream buffer;
+    buffer << input.rdbuf();
+    return buffer.str();
+}
+
+static std::string toJson(const std::vector<ManifestEntry> &entries)
+{
+    std::string json = "[\n";
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        json += "  {\"equation\": \"" + entries[i].equation + "\", \"extents\": {";
+        bool first = true;
+        for (const auto &it : entries[i].extent)
+        {
+            json += std::string(first ? "" : ", ") + "\"" + it.first + "\": " + std::to_string(it.second);
+            first = false;
+        }
+        json += "}, \"dtype\": \"" + entries[i].dtype + "\"}" + (i + 1 < entries.size() ? ",\n" : "\n");
+    }
+    return json + "]\n";
+}
+
+static bool sameEntries(const std::vector<ManifestEntry> &a, const std::vector<ManifestEntry> &b)
+{
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        if (a[i].id != b[i].id || a[i].modeA != b[i].modeA || a[i].modeB != b[i].modeB ||
+            a[i].modeC != b[i].modeC || a[i].extent != b[i].extent || a[i].dtype != b[i].dtype)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void checkManifest(const std::string &manifest, const std::string &prefix,
+                          std::vector<ManifestEntry> &entries)
+{
+    std::string error;
+    EXPECT(loadManifest(manifest, entries, error), error.c_str());
+    EXPECT(entries.size() == 4, "sample manifest entries");
+    if (entries.size() == 4)
+    {
+        EXPECT(entries[0].modeA == "mhkn" && entries[0].modeB == "ukvh" && entries[0].modeC == "munv",
+               "modes of entry 1");
+        EXPECT(entries[0].extent.at('m') == 96 && entries[0].extent.at('k') == 64, "extents of entry 1");
+        EXPECT(entries[1].dtype == "tf32" && entries[2].dtype == "half" && entries[3].dtype == "double", "dtypes");
+        EXPECT(entries[1].flops() == 2.0 * 4096 * 4096 * 4096, "flops");
+        EXPECT(entries[2].elements(entries[2].modeC) == 64 * 256 * 256, "elements");
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            EXPECT(entries[i].id == static_cast<int>(i) + 1, "ids follow the manifest");
+        }
+    }
+
+    // the same manifest as JSON
+    const std::string json = prefix + "manifest.json";
+    writeFile(json, toJson(entries));
+    std::vector<ManifestEntry> fromJson;
+    EXPECT(loadManifest(json, fromJson, error), error.c_str());
+    EXPECT(sameEntries(entries, fromJson), "JSON manifest matches the CSV one");
+    remove(json.c_str());
+
+    // malformed manifests are rejected with a message
+    const char* bad[][2] = {
+        {"ij,jk; i=4 j=4 k=4; float\n",          "no output"},
+        {"ij->ik; i=4 j=4 k=4; float\n",         "no second operand"},
+        {"ij,jk->ik; i=4 j=4; float\n",          "missing extent"},
+        {"ij,jk->ik; i=4 j=4 k=4 l=9; float\n",  "extent of a mode not in the equation"},
+        {"ij,jk->ik; i=4 jj=4 k=4; float\n",     "malformed extent"},
+        {"ij,jk->ik; i=4 j=4 k=4; int8\n",       "unsupported dtype"},
+        {"ij,jk->ik\n",                          "missing extents"},
+        {"ij,jk->ik; i=4 j=4 k=4; float; x\n",   "too many fields"},
+    };
+    for (const auto &b : bad)
+    {
+        const std::string csv = prefix + "bad.csv";
+        writeFile(csv, std::string("# comment\n\n") + b[0]);
+        std::vector<ManifestEntry> rejected;
+        error.clear();
+        EXPECT(! loadManifest(csv, rejected, error) && ! error.empty(), b[1]);
+        remove(csv.c_str());
+    }
+    const std::string badJson = prefix + "bad.json";
+    writeFile(badJson, "[ {\"equation\": \"ij,jk->ik\", \"extents\": {\"i\": 4, \"j\": }} ]");
+    std::vector<ManifestEntry> rejected;
+    EXPECT(! loadManifest(badJson, rejected, error), "truncated JSON");
+    writeFile(badJson, "[ {\"equation\": \"ij,jk->ik\", \"extents\": {\"i\": 4, \"j\": 4, \"k\": 4, \"z\": 2}} ]");
+    EXPECT(! loadManifest(badJson, rejected, error), "JSON extent of a mode not in the equation");
+    remove(badJson.c_str());
+    EXPECT(! loadManifest(prefix + "does_not_exist.csv", rejected, error), "missing file");
+}
+
+static void checkSchedule(const std::vector<ManifestEntry> &entries)
+{
+    std::vector<ManifestEntry> manifest = entries;
+    manifest.push_back(entries[0]);    // a duplicate, tuned once
+    manifest.back().id = 5;
+    ManifestEntry small = entries[0];  // same dtype, cheaper
+    small.extent['m'] = 8;
+    small.id = 6;
+    manifest.push_back(small);
+
+    const std::vector<ManifestEntry> schedule = scheduleManifest(manifest);
+    EXPECT(schedule.size() == 5, "duplicate dropped");
+    for (size_t i = 0; i < schedule.size(); ++i)
+    {
+        EXPECT(schedule[i].id != 5, "the first of the duplicates is kept");
+        if (i == 0) continue;
+        EXPECT(schedule[i - 1].dtype <= schedule[i].dtype, "grouped by dtype");
+        if (schedule[i - 1].dtype == schedule[i].dtype)
+        {
+            EXPECT(schedule[i - 1].flops() >= schedule[i].flops(), "most expensive first");
+        }
+    }
+}
+
+/**
+ * Stands in for GPUTimer: the time of an algorithm is the entry's flops at a
+ * rate that depends on the algorithm, plus some noise on each run.
+ */
+struct FakeTimer
+{
+    double seconds(const ManifestEntry &entry, int algo, int run) const
+    {
+        static const double kGflops[] = {800, 1200, 950, 1500, 600};
+        return entry.flops() / (kGflops[algo] * 1e9) * (1.0 + 0.01 * ((run * 7 + algo) % 5));
+    }
+};
+
+static void checkReport(const std::vector<ManifestEntry> &entries, const std::string &prefix)
+{
+    const std::vector<ManifestEntry> schedule = scheduleManifest(entries);
+    const int kAlgos = 5;
+    const int kRuns = 3;
+    FakeTimer timer;
+    AutotuneReport report;
+    for (const auto &entry : schedule)
+    {
+        // as in tuneEntry(): minimum over the runs, algorithm 3 is not
+        // supported for half precision
+        for (int algo = 0; algo < kAlgos; ++algo)
+        {
+            const bool supported = ! (algo == 3 && entry.dtype == "half");
+            double minTime = 1e100;
+            for (int run = 0; run < kRuns && supported; ++run)
+            {
+                minTime = std::min(minTime, timer.seconds(entry, algo, run));
+            }
+            report.add(entry, algo, supported, minTime);
+        }
+        const int best = report.markBest(entry.id);
+        EXPECT(best >= 0, "best algorithm found");
+        if (best >= 0)
+        {
+            const AutotuneResult &r = report.results()[best];
+            EXPECT(r.algo == (entry.dtype == "half" ? 1 : 3), "fastest supported algorithm is best");
+            EXPECT(fabs(r.gflops - entry.flops() / r.seconds / 1e9) < 1e-6 * r.gflops, "gflops");
+        }
+    }
+    // marking again does not add a second best
+    report.markBest(schedule[0].id);
+    int numBest = 0;
+    for (const auto &r : report.results())
+    {
+        numBest += r.best ? 1 : 0;
+        EXPECT(r.supported || (r.seconds == 0 && r.gflops == 0), "unsupported algorithms have no timing");
+    }
+    EXPECT(report.results().size() == schedule.size() * kAlgos, "one result per algorithm");
+    EXPECT(numBest == static_cast<int>(schedule.size()), "one best per entry");
+
+    // CSV: a header and one line per result, in order
+    const std::string csv = prefix + "report.csv";
+    EXPECT(report.write(csv), "write CSV report");
+    std::stringstream lines(readFile(csv));
+    std::string line;
+    std::getline(lines, line);
+    EXPECT(line == "entry,equation,dtype,algo,supported,seconds,gflops,best", "CSV header");
+    size_t n = 0;
+    while (std::getline(lines, line))
+    {
+        if (n >= report.results().size()) break;
+        const AutotuneResult &r = report.results()[n++];
+        char expected[256];
+        snprintf(expected, sizeof(expected), "%d,\"%s\",%s,%d,%d,", r.entry, r.equation.c_str(),
+                 r.dtype.c_str(), r.algo, r.supported ? 1 : 0);
+        EXPECT(line.compare(0, strlen(expected), expected) == 0, "CSV line");
+        EXPECT(line.substr(line.size() - 2) == (r.best ? ",1" : ",0"), "CSV best column");
+    }
+    EXPECT(n == report.results().size(), "CSV lines");
+    remove(csv.c_str());
+
+    // JSON: an array of one object per result, without a trailing comma
+    const std::string json = prefix + "report.json";
+    EXPECT(report.write(json), "write JSON report");
+    const std::string text = readFile(json);
+    size_t objects = 0;
+    for (size_t pos = text.find("{\"entry\""); pos != std::string::npos; pos = text.find("{\"entry\"", pos + 1))
+    {
+        ++objects;
+    }
+    EXPECT(objects == report.results().size(), "JSON objects");
+    EXPECT(text.compare(0, 2, "[\n") == 0 && text.size() >= 4 && text.substr(text.size() - 4) == "}\n]\n" &&
+           text.find("},\n]") == std::string::npos, "JSON array");
+    size_t bestFlags = 0;
+    for (size_t pos = text.find("\"best\": true"); pos != std::string::npos; pos = text.find("\"best\": true", pos + 1))
+    {
+        ++bestFlags;
+    }
+    EXPECT(bestFlags == schedule.size(), "JSON best flags");
+    remove(json.c_str());
+
+    EXPECT(! report.write(prefix + "no_such_dir/report.csv"), "unwritable report");
+}
+
+int main(int argc, char** argv)
+{
+    std::string manifest = "contraction_autotuning_manifest.csv";
+    std::string prefix = "autotuning_manifest_check_";
+    for (int i = 1; i < argc; ++i)
+    {
+        if (! strcmp(argv[i], "-h"))
+        {
+            printf("Usage: %s [-m manifest.csv] [-o report_prefix]\n", argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (! strcmp(argv[i], "-m") && i + 1 < argc) manifest = argv[++i];
+        if (! strcmp(argv[i], "-o") && i + 1 < argc) prefix = argv[++i];
+    }
+
+    std::vector<ManifestEntry> entries;
+    checkManifest(manifest, prefix, entries);
+    if (entries.size() == 4)
+    {
+        checkSchedule(entries);
+        checkReport(entries, prefix);
+    }
+    printf("autotuning manifest check: %s\n", failures ? "FAILED" : "ok");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
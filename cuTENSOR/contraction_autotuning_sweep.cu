@@ -0,0 +1,328 @@
+/*  
+ * Copyright (c) 2019, NVIDIA CORPORATION.  All rights reserved.
+ * 
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  - Neither the name(s) of the copyright holder(s) nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR 
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */  
+
+/*
+ * Offline autotuning sweep: tunes every contraction of a workload manifest
+ * (see autotuning_manifest.h) across all algorithms, persists the winners
+ * into the plan cache file (see plan_cache_store.h) and writes a report with
+ * the GFLOPs/s of each algorithm.
+ *
+ * Usage: contraction_autotuning_sweep <manifest.csv|manifest.json> [report.csv|report.json]
+ *
+ * Production jobs then start with a fully tuned cache by loading the same
+ * cache file (CUTENSOR_CACHE_DIR) via PlanCacheStore::load().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include <cuda_runtime.h>
+#include <cutensor.h>
+
+#include "autotuning_manifest.h"
+#include "plan_cache_store.h"
+
+#define HANDLE_ERROR(x)                                               \
+{ const auto err = x;                                                 \
+  if( err != CUTENSOR_STATUS_SUCCESS )                                \
+  { printf("Error: %s\n", cutensorGetErrorString(err)); return err; } \
+};
+
+#define HANDLE_CUDA_ERROR_STATUS(x)                               \
+{ const auto err = x;                                             \
+  if( err != cudaSuccess )                                        \
+  { printf("Error: %s\n", cudaGetErrorString(err));               \
+    return CUTENSOR_STATUS_ALLOC_FAILED; }                        \
+};
+
+struct GPUTimer
+{
+    GPUTimer() 
+    {
+        cudaEventCreate(&start_);
+        cudaEventCreate(&stop_);
+        cudaEventRecord(start_, 0);
+    }
+
+    ~GPUTimer() 
+    {
+        cudaEventDestroy(start_);
+        cudaEventDestroy(stop_);
+    }
+
+    void start() 
+    {
+        cudaEventRecord(start_, 0);
+    }
+
+    float seconds() 
+    {
+        cudaEventRecord(stop_, 0);
+        cudaEventSynchronize(stop_);
+        float time;
+        cudaEventElapsedTime(&time, start_, stop_);
+        return time * 1e-3;
+    }
+    private:
+    cudaEvent_t start_, stop_;
+};
+
+struct DtypeInfo
+{
+    cudaDataType_t dataType;
+    cutensorComputeType_t computeType;
+    size_t elementSize;
+};
+
+DtypeInfo getDtypeInfo(const std::string &dtype)
+{
+    if (dtype == "half")           return {CUDA_R_16F, CUTENSOR_COMPUTE_32F, 2};
+    if (dtype == "tf32")           return {CUDA_R_32F, CUTENSOR_COMPUTE_TF32, 4};
+    if (dtype == "double")         return {CUDA_R_64F, CUTENSOR_COMPUTE_64F, 8};
+    if (dtype == "complex")        return {CUDA_C_32F, CUTENSOR_COMPUTE_32F, 8};
+    if (dtype == "complex_double") return {CUDA_C_64F, CUTENSOR_COMPUTE_64F, 16};
+    return {CUDA_R_32F, CUTENSOR_COMPUTE_32F, 4};
+}
+
+/**
+ * Device buffers that are reused across manifest entries (grown on demand).
+ */
+struct DeviceBuffer
+{
+    ~DeviceBuffer() { if (ptr) cudaFree(ptr); }
+
+    cudaError_t reserve(size_t bytes)
+    {
+        if (bytes <= size) return cudaSuccess;
+        if (ptr) cudaFree(ptr);
+        ptr = nullptr;
+        size = 0;
+        cudaError_t err = cudaMalloc(&ptr, bytes);
+        if (err != cudaSuccess) return err;
+        size = bytes;
+        // contents don't matter for timing; avoid uninitialized NaNs/denormals
+        return cudaMemset(ptr, 0, bytes);
+    }
+
+    void* ptr = nullptr;
+    size_t size = 0;
+};
+
+/**
+ * Tunes one manifest entry: times every algorithm (for the report) and then
+ * plans the fastest one with the cache enabled, so that the algorithm the
+ * report marks as best is the one that lands in the plan cache.
+ */
+cutensorStatus_t tuneEntry(const cutensorHandle_t* handle, const ManifestEntry &entry,
+                           DeviceBuffer &bufA, DeviceBuffer &bufB, DeviceBuffer &bufC, DeviceBuffer &bufWork,
+                           int numRuns, AutotuneReport &report, double &autotuneSeconds)
+{
+    const DtypeInfo info = getDtypeInfo(entry.dtype);
+
+    std::vector<int> modeA(entry.modeA.begin(), entry.modeA.end());
+    std::vector<int> modeB(entry.modeB.begin(), entry.modeB.end());
+    std::vector<int> modeC(entry.modeC.begin(), entry.modeC.end());
+    std::vector<int64_t> extentA, extentB, extentC;
+    for (auto mode : modeA) extentA.push_back(entry.extent.at(mode));
+    for (auto mode : modeB) extentB.push_back(entry.extent.at(mode));
+    for (auto mode : modeC) extentC.push_back(entry.extent.at(mode));
+
+    HANDLE_CUDA_ERROR_STATUS(bufA.reserve(entry.elements(entry.modeA) * info.elementSize));
+    HANDLE_CUDA_ERROR_STATUS(bufB.reserve(entry.elements(entry.modeB) * info.elementSize));
+    HANDLE_CUDA_ERROR_STATUS(bufC.reserve(entry.elements(entry.modeC) * info.elementSize));
+
+    cutensorTensorDescriptor_t descA, descB, descC;
+    HANDLE_ERROR(cutensorInitTensorDescriptor(handle, &descA, modeA.size(), extentA.data(),
+                 NULL /* stride */, info.dataType, CUTENSOR_OP_IDENTITY));
+    HANDLE_ERROR(cutensorInitTensorDescriptor(handle, &descB, modeB.size(), extentB.data(),
+                 NULL /* stride */, info.dataType, CUTENSOR_OP_IDENTITY));
+    HANDLE_ERROR(cutensorInitTensorDescriptor(handle, &descC, modeC.size(), extentC.data(),
+                 NULL /* stride */, info.dataType, CUTENSOR_OP_IDENTITY));
+
+    uint32_t alignmentRequirementA, alignmentRequirementB, alignmentRequirementC;
+    HANDLE_ERROR(cutensorGetAlignmentRequirement(handle, bufA.ptr, &descA, &alignmentRequirementA));
+    HANDLE_ERROR(cutensorGetAlignmentRequirement(handle, bufB.ptr, &descB, &alignmentRequirementB));
+    HANDLE_ERROR(cutensorGetAlignmentRequirement(handle, bufC.ptr, &descC, &alignmentRequirementC));
+
+    cutensorContractionDescriptor_t desc;
+    HANDLE_ERROR(cutensorInitContractionDescriptor(handle, &desc,
+                 &descA, modeA.data(), alignmentRequirementA,
+                 &descB, modeB.data(), alignmentRequirementB,
+                 &descC, modeC.data(), alignmentRequirementC,
+                 &descC, modeC.data(), alignmentRequirementC,
+                 info.computeType));
+
+    cutensorContractionFind_t find;
+    HANDLE_ERROR(cutensorInitContractionFind(handle, &find, CUTENSOR_ALGO_DEFAULT));
+
+    uint64_t worksize = 0;
+    HANDLE_ERROR(cutensorContractionGetWorkspaceSize(handle, &desc, &find, CUTENSOR_WORKSPACE_MAX, &worksize));
+    if (bufWork.reserve(worksize) != cudaSuccess)
+    {
+        worksize = bufWork.size;
+    }
+
+    // alpha = 1, beta = 0 in any of the supported scalar types
+    const double alpha[2] = {1.0, 0.0};
+    const double beta[2] = {0.0, 0.0};
+    const float alphaF[2] = {1.f, 0.f};
+    const float betaF[2] = {0.f, 0.f};
+    const bool doubleScalars = (info.computeType == CUTENSOR_COMPUTE_64F);
+    const void* alphaPtr = doubleScalars ? (const void*) alpha : (const void*) alphaF;
+    const void* betaPtr = doubleScalars ? (const void*) beta : (const void*) betaF;
+
+    /**********************
+     * Sweep all algorithms
+     **********************/
+
+    int32_t maxAlgosTC = 0;
+    cutensorContractionMaxAlgos(&maxAlgosTC);
+
+    for (int algo = (int) CUTENSOR_ALGO_GETT; algo < maxAlgosTC; algo++)
+    {
+        double minTime = 1e100;
+        bool supported = false;
+        cutensorContractionFind_t algoFind;
+        cutensorContractionPlan_t plan;
+        // only the winner may land in the cache
+        const cutensorCacheMode_t sweepCacheMode = CUTENSOR_CACHE_MODE_NONE;
+        if (cutensorInitContractionFind(handle, &algoFind, (cutensorAlgo_t) algo) == CUTENSOR_STATUS_SUCCESS &&
+            cutensorContractionFindSetAttribute(handle, &algoFind, CUTENSOR_CONTRACTION_FIND_CACHE_MODE,
+                &sweepCacheMode, sizeof(cutensorCacheMode_t)) == CUTENSOR_STATUS_SUCCESS &&
+            cutensorInitContractionPlan(handle, &plan, &desc, &algoFind, worksize) == CUTENSOR_STATUS_SUCCESS)
+        {
+            supported = true;
+            for (int i = 0; i < numRuns && supported; i++)
+            {
+                GPUTimer timer;
+                timer.start();
+                cutensorStatus_t err = cutensorContraction(handle, &plan,
+                                                           alphaPtr, bufA.ptr, bufB.ptr,
+                                                           betaPtr, bufC.ptr, bufC.ptr,
+                                                           bufWork.ptr, worksize, 0 /* stream */);
+                auto time = timer.seconds();
+                autotuneSeconds += time;
+                if (err != CUTENSOR_STATUS_SUCCESS)
+                {
+                    if (err != CUTENSOR_STATUS_NOT_SUPPORTED)
+                    {
+                        printf("ERROR: %s in line %d\n", cutensorGetErrorString(err), __LINE__);
+                    }
+                    supported = false;
+                }
+                minTime = (minTime < time) ? minTime : time;
+            }
+        }
+        report.add(entry, algo, supported, minTime);
+    }
+    const int best = report.markBest(entry.id);
+    if (best < 0)
+    {
+        printf("[%d] %s (%s): not supported\n", entry.id, entry.equation.c_str(), entry.dtype.c_str());
+        return CUTENSOR_STATUS_SUCCESS;
+    }
+    const auto &result = report.results()[best];
+    printf("[%d] %s (%s): best algo %d %.2f GFLOPs/s\n", entry.id, entry.equation.c_str(),
+           entry.dtype.c_str(), result.algo, result.gflops);
+
+    /**********************
+     * Persist the winner in the plan cache
+     **********************/
+
+    cutensorContractionFind_t bestFind;
+    HANDLE_ERROR(cutensorInitContractionFind(handle, &bestFind, (cutensorAlgo_t) result.algo));
+
+    const cutensorCacheMode_t cacheMode = CUTENSOR_CACHE_MODE_PEDANTIC;
+    HANDLE_ERROR(cutensorContractionFindSetAttribute(handle, &bestFind, CUTENSOR_CONTRACTION_FIND_CACHE_MODE,
+                 &cacheMode, sizeof(cutensorCacheMode_t)));
+
+    GPUTimer timer;
+    timer.start();
+    cutensorContractionPlan_t plan;
+    HANDLE_ERROR(cutensorInitContractionPlan(handle, &plan, &desc, &bestFind, worksize));
+    HANDLE_ERROR(cutensorContraction(handle, &plan,
+                                     alphaPtr, bufA.ptr, bufB.ptr,
+                                     betaPtr, bufC.ptr, bufC.ptr,
+                                     bufWork.ptr, worksize, 0 /* stream */));
+    autotuneSeconds += timer.seconds();
+    return CUTENSOR_STATUS_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <manifest.csv|manifest.json> [report.csv|report.json]\n", argv[0]);
+        return -1;
+    }
+    const std::string reportFilename = (argc > 2) ? argv[2] : "autotuning_report.csv";
+    const int numRuns = getenv("CUTENSOR_SWEEP_RUNS") ? atoi(getenv("CUTENSOR_SWEEP_RUNS")) : 3;
+
+    std::vector<ManifestEntry> manifest;
+    std::string error;
+    if (! loadManifest(argv[1], manifest, error))
+    {
+        printf("Error: %s\n", error.c_str());
+        return -1;
+    }
+    const std::vector<ManifestEntry> schedule = scheduleManifest(manifest);
+    printf("Tuning %zu contractions (%zu manifest entries).\n", schedule.size(), manifest.size());
+
+    cutensorHandle_t handle;
+    HANDLE_ERROR(cutensorInit(&handle));
+
+    const char* cacheDir = getenv("CUTENSOR_CACHE_DIR") ? getenv("CUTENSOR_CACHE_DIR") : ".";
+    PlanCacheStore cacheStore(cacheDir, std::max<uint32_t>(1024, 2 * schedule.size()));
+    HANDLE_ERROR(cacheStore.load(&handle));
+
+    DeviceBuffer bufA, bufB, bufC, bufWork;
+    AutotuneReport report;
+    double autotuneSeconds = 0;
+    for (const auto &entry : schedule)
+    {
+        HANDLE_ERROR(tuneEntry(&handle, entry, bufA, bufB, bufC, bufWork, numRuns, report, autotuneSeconds));
+    }
+
+    cacheStore.addAutotuneTime(autotuneSeconds);
+    HANDLE_ERROR(cacheStore.store());
+    printf("Plan cache written to %s.\n", cacheStore.cachePath().c_str());
+    cacheStore.printStats();
+
+    if (! report.write(reportFilename))
+    {
+        printf("Error: cannot write report (%s).\n", reportFilename.c_str());
+        return -1;
+    }
+    printf("Report written to %s.\n", reportFilename.c_str());
+
+    return 0;
+}
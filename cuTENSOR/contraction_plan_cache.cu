@@ -36,6 +36,8 @@
 #include <cuda_runtime.h>
 #include <cutensor.h>
 
+#include "plan_cache_store.h"
+
 #define HANDLE_ERROR(x)                                               \
 { const auto err = x;                                                 \
   if( err != CUTENSOR_STATUS_SUCCESS )                                \
@@ -185,26 +187,24 @@ int main()
     /**********************
      * Setup planCache
      **********************/
-    constexpr int32_t numCachelines = 1024;
-    size_t sizeCache = numCachelines * sizeof(cutensorPlanCacheline_t);
-    printf("Allocating: %.2f kB for the cache\n", sizeCache / 1000.);
-    cutensorPlanCacheline_t* cachelines = (cutensorPlanCacheline_t*) malloc(sizeCache);
-    HANDLE_ERROR( cutensorHandleAttachPlanCachelines(&handle, cachelines, numCachelines) );
-
-    const char cacheFilename[] = "./cache.bin";
-    uint32_t numCachelinesRead = 0;
-    cutensorStatus_t status = cutensorHandleReadCacheFromFile(&handle, cacheFilename, &numCachelinesRead);
-    if (status == CUTENSOR_STATUS_SUCCESS)
-    {
-        printf("%d cachelines have been successfully read from file (%s).\n", numCachelinesRead, cacheFilename);
-    }
-    else if (status == CUTENSOR_STATUS_IO_ERROR)
+
+    // The cache file is namespaced by GPU architecture and library versions, and it can
+    // safely be shared by concurrent processes (see plan_cache_store.h).
+    // CUTENSOR_CACHE_DIR selects the directory, CUTENSOR_CACHE_LINES the initial number of cachelines.
+    const char* cacheDir = getenv("CUTENSOR_CACHE_DIR") ? getenv("CUTENSOR_CACHE_DIR") : ".";
+    const uint32_t numCachelines = getenv("CUTENSOR_CACHE_LINES") ? atoi(getenv("CUTENSOR_CACHE_LINES")) : 1024;
+    printf("Allocating: %.2f kB for the cache\n", numCachelines * sizeof(cutensorPlanCacheline_t) / 1000.);
+
+    PlanCacheStore cacheStore(cacheDir, numCachelines);
+    HANDLE_ERROR( cacheStore.load(&handle) );
+    if (cacheStore.stats().warmStart)
     {
-        printf("File (%s) doesn't seem to exist.\n", cacheFilename);
+        printf("%d cachelines have been successfully read from file (%s).\n",
+               cacheStore.stats().cachelinesLoaded, cacheStore.cachePath().c_str());
     }
-    else if (status == CUTENSOR_STATUS_INSUFFICIENT_WORKSPACE)
+    else
     {
-        printf("Cannot read cache: Please attach at least %d cachelines to the handle.\n", numCachelinesRead);
+        printf("File (%s) doesn't seem to exist.\n", cacheStore.cachePath().c_str());
     }
 
     /**********************
@@ -334,6 +334,7 @@ int main()
      **********************/
 
     double minTimeCUTENSOR = 1e100;
+    double autotuneTime = 0;
     // warm-up GPU (without caching) (optional, but recommended for more accurate measurements later on)
     for (int i=0; i < 4; ++i)
     {
@@ -396,6 +397,14 @@ int main()
             break;
         }
         minTimeCUTENSOR = (minTimeCUTENSOR < time) ? minTimeCUTENSOR : time;
+        if (i < incCount)
+        {
+            autotuneTime += time; // these iterations explore candidate kernels
+        }
+    }
+    if (! cacheStore.stats().warmStart)
+    {
+        cacheStore.addAutotuneTime(autotuneTime);
     }
 
     /*************************/
@@ -407,18 +416,16 @@ int main()
 
 
     /*
-     * Optional: Write cache to disk
+     * Optional: Write cache to disk (atomically; if another process published a
+     * cache since ours was loaded, the one with more cachelines is kept)
      */
-    HANDLE_ERROR( cutensorHandleWriteCacheToFile(&handle, cacheFilename) );
-    printf("Cache has been successfully written to file (%s).\n", cacheFilename);
-
-    // Detach cache and free-up resources
-    HANDLE_ERROR( cutensorHandleDetachPlanCachelines(&handle) );
+    HANDLE_ERROR( cacheStore.store() );
+    printf("Cache has been successfully written to file (%s).\n", cacheStore.cachePath().c_str());
+    cacheStore.printStats();
 
     if (A) free(A);
     if (B) free(B);
     if (C) free(C);
-    if (cachelines) free(cachelines);
     if (A_d) cudaFree(A_d);
     if (B_d) cudaFree(B_d);
     if (C_d) cudaFree(C_d);
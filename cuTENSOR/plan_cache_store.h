@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2019, NVIDIA CORPORATION.  All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  - Neither the name(s) of the copyright holder(s) nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/**
+ * On-disk store for cuTENSOR plan caches that can be shared by many
+ * processes on one node.
+ *
+ *  - Namespacing: one file per GPU architecture, cuTENSOR version and CUDA
+ *    runtime version, e.g. <dir>/cutensor_cache_sm80_v10700_cuda11040.bin,
+ *    so that incompatible caches are never mixed.
+ *  - Crash safety: the cache is written to a process-private temporary file,
+ *    flushed to disk and then atomically renamed over the previous version,
+ *    and the rename itself is flushed with the directory; readers never
+ *    observe partially written files, and a crash leaves either the old or
+ *    the new cache behind the file name.
+ *  - Concurrency: writers serialize on an advisory lock file. Each published
+ *    cache carries a generation number (in a small ".meta" sidecar). If
+ *    another process published a newer generation since this process
+ *    loaded the cache, the file holding more cachelines wins. The cacheline
+ *    format is opaque, so individual lines cannot be merged.
+ *  - Warm start: load() attaches enough cachelines for the stored cache and
+ *    reports how much autotuning time was spent to produce it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include <cuda_runtime.h>
+#include <cutensor.h>
+
+struct PlanCacheStoreStats
+{
+    bool warmStart = false;           // a cache was found and loaded
+    uint32_t cachelinesLoaded = 0;
+    uint64_t generationLoaded = 0;
+    double autotuneSecondsSaved = 0;  // tuning time recorded by the writers of the loaded cache
+    double autotuneSecondsSpent = 0;  // tuning time spent by this process (see addAutotuneTime())
+    uint64_t generationWritten = 0;
+    bool conflict = false;            // another process published a cache after we loaded ours
+    bool keptOther = false;           // ... and its cache was kept instead of ours
+};
+
+class PlanCacheStore
+{
+    public:
+    /**
+     * \param[in] directory where the cache files live (must exist)
+     * \param[in] numCachelines number of cachelines to attach initially;
+     *            grown automatically if a stored cache requires more
+     */
+    PlanCacheStore(const std::string &directory, uint32_t numCachelines = 1024) :
+        directory_(directory), numCachelines_(numCachelines) {}
+
+    ~PlanCacheStore()
+    {
+        if (handle_ != nullptr)
+        {
+            cutensorHandleDetachPlanCachelines(handle_);
+        }
+    }
+
+    /**
+     * Path of the cache file for the current device and library versions.
+     */
+    std::string cachePath() const
+    {
+        int device = 0;
+        cudaGetDevice(&device);
+        cudaDeviceProp prop;
+        int major = 0, minor = 0;
+        if (cudaGetDeviceProperties(&prop, device) == cudaSuccess)
+        {
+            major = prop.major;
+            minor = prop.minor;
+        }
+        int cudartVersion = 0;
+        cudaRuntimeGetVersion(&cudartVersion);
+
+        char name[128];
+        snprintf(name, sizeof(name), "cutensor_cache_sm%d%d_v%zu_cuda%d.bin",
+                 major, minor, (size_t) cutensorGetVersion(), cudartVersion);
+        return directory_ + "/" + name;
+    }
+
+    /**
+     * Attaches cachelines to handle and preloads the stored cache (if any).
+     *
+     * \returns CUTENSOR_STATUS_SUCCESS also if no cache exists yet (cold start)
+     */
+    cutensorStatus_t load(cutensorHandle_t* handle)
+    {
+        handle_ = handle;
+        cutensorStatus_t status = attach(handle_, cachelines_, numCachelines_);
+        if (status != CUTENSOR_STATUS_SUCCESS)
+        {
+            return status;
+        }
+
+        const std::string path = cachePath();
+        Lock lock(path + ".lock");
+        readMeta(path, stats_.generationLoaded, stats_.autotuneSecondsSaved);
+
+        uint32_t numCachelinesRead = 0;
+        status = cutensorHandleReadCacheFromFile(handle_, path.c_str(), &numCachelinesRead);
+        if (status == CUTENSOR_STATUS_INSUFFICIENT_WORKSPACE)
+        {
+            // numCachelinesRead holds the required number of cachelines
+            numCachelines_ = numCachelinesRead;
+            status = attach(handle_, cachelines_, numCachelines_);
+            if (status != CUTENSOR_STATUS_SUCCESS)
+            {
+                return status;
+            }
+            status = cutensorHandleReadCacheFromFile(handle_, path.c_str(), &numCachelinesRead);
+        }
+
+        if (status == CUTENSOR_STATUS_IO_ERROR)
+        {
+            // no cache yet
+            stats_.generationLoaded = 0;
+            stats_.autotuneSecondsSaved = 0;
+            return CUTENSOR_STATUS_SUCCESS;
+        }
+        if (status != CUTENSOR_STATUS_SUCCESS)
+        {
+            return status;
+        }
+        stats_.warmStart = true;
+        stats_.cachelinesLoaded = numCachelinesRead;
+        return CUTENSOR_STATUS_SUCCESS;
+    }
+
+    /**
+     * Accounts time spent autotuning; it is recorded alongside the cache so
+     * that later processes can report the time their warm start saved.
+     */
+    void addAutotuneTime(double seconds) { stats_.autotuneSecondsSpent += seconds; }
+
+    /**
+     * Publishes the handle's cache (atomic write-rename under the lock).
+     */
+    cutensorStatus_t store()
+    {
+        if (handle_ == nullptr)
+        {
+            return CUTENSOR_STATUS_INVALID_VALUE;
+        }
+        const std::string path = cachePath();
+        Lock lock(path + ".lock");
+
+        uint64_t generationOnDisk = 0;
+        double secondsOnDisk = 0;
+        readMeta(path, generationOnDisk, secondsOnDisk);
+
+        char suffix[64];
+        snprintf(suffix, sizeof(suffix), ".tmp.%d", (int) getProcessId());
+        const std::string tmpPath = path + suffix;
+        cutensorStatus_t status = cutensorHandleWriteCacheToFile(handle_, tmpPath.c_str());
+        if (status != CUTENSOR_STATUS_SUCCESS)
+        {
+            remove(tmpPath.c_str());
+            return status;
+        }
+
+        stats_.conflict = (generationOnDisk != stats_.generationLoaded);
+        if (stats_.conflict && countCachelines(path) > countCachelines(tmpPath))
+        {
+            // the other writer's cache covers more problems; keep it
+            stats_.keptOther = true;
+            remove(tmpPath.c_str());
+            return CUTENSOR_STATUS_SUCCESS;
+        }
+
+        if (! replaceFile(tmpPath, path))
+        {
+            remove(tmpPath.c_str());
+            return CUTENSOR_STATUS_IO_ERROR;
+        }
+        stats_.generationWritten = generationOnDisk + 1;
+        const double baseSeconds = stats_.conflict ? std::max(secondsOnDisk, stats_.autotuneSecondsSaved)
+                                                   : stats_.autotuneSecondsSaved;
+        writeMeta(path, stats_.generationWritten, baseSeconds + stats_.autotuneSecondsSpent);
+        return CUTENSOR_STATUS_SUCCESS;
+    }
+
+    const PlanCacheStoreStats& stats() const { return stats_; }
+
+    void printStats() const
+    {
+        if (stats_.warmStart)
+        {
+            printf("Plan cache: warm start with %u cachelines (generation %llu), ~%.2f s of autotuning saved.\n",
+                   stats_.cachelinesLoaded, (unsigned long long) stats_.generationLoaded, stats_.autotuneSecondsSaved);
+        }
+        else
+        {
+            printf("Plan cache: cold start.\n");
+        }
+        printf("Plan cache: %.2f s spent autotuning in this process.\n", stats_.autotuneSecondsSpent);
+        if (stats_.keptOther)
+        {
+            printf("Plan cache: a concurrent writer published a larger cache; it was kept.\n");
+        }
+        else if (stats_.generationWritten > 0)
+        {
+            printf("Plan cache: published generation %llu%s.\n", (unsigned long long) stats_.generationWritten,
+                   stats_.conflict ? " (after a concurrent writer)" : "");
+        }
+    }
+
+    private:
+    /**
+     * Advisory, process-wide exclusive lock on a file (released on destruction).
+     */
+    struct Lock
+    {
+        explicit Lock(const std::string &path)
+        {
+#ifdef _WIN32
+            file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (file_ != INVALID_HANDLE_VALUE)
+            {
+                OVERLAPPED overlapped = {};
+                LockFileEx(file_, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped);
+            }
+#else
+            fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+            if (fd_ >= 0)
+            {
+                flock(fd_, LOCK_EX);
+            }
+#endif
+        }
+
+        ~Lock()
+        {
+#ifdef _WIN32
+            if (file_ != INVALID_HANDLE_VALUE)
+            {
+                OVERLAPPED overlapped = {};
+                UnlockFileEx(file_, 0, MAXDWORD, MAXDWORD, &overlapped);
+                CloseHandle(file_);
+            }
+#else
+            if (fd_ >= 0)
+            {
+                flock(fd_, LOCK_UN);
+                close(fd_);
+            }
+#endif
+        }
+
+#ifdef _WIN32
+        HANDLE file_;
+#else
+        int fd_;
+#endif
+    };
+
+    static int getProcessId()
+    {
+#ifdef _WIN32
+        return _getpid();
+#else
+        return getpid();
+#endif
+    }
+
+    /**
+     * Flushes a file, or a directory, to disk.
+     */
+    static bool syncPath(const std::string &path)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                  NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        const bool ok = FlushFileBuffers(file) != 0;
+        CloseHandle(file);
+        return ok;
+#else
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        const bool ok = fsync(fd) == 0;
+        close(fd);
+        return ok;
+#endif
+    }
+
+    /**
+     * Replaces `to` with `from`: the contents of `from` reach the disk before
+     * the rename, and the rename before this returns.
+     */
+    static bool replaceFile(const std::string &from, const std::string &to)
+    {
+        if (! syncPath(from))
+        {
+            return false;
+        }
+#ifdef _WIN32
+        // MOVEFILE_WRITE_THROUGH returns once the move is on disk
+        return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        if (rename(from.c_str(), to.c_str()) != 0)
+        {
+            return false;
+        }
+        const size_t slash = to.find_last_of('/');
+        return syncPath(slash == std::string::npos ? std::string(".") : to.substr(0, slash + 1));
+#endif
+    }
+
+    static cutensorStatus_t attach(cutensorHandle_t* handle,
+                                   std::vector<cutensorPlanCacheline_t> &cachelines,
+                                   uint32_t numCachelines)
+    {
+        if (! cachelines.empty())
+        {
+            cutensorHandleDetachPlanCachelines(handle);
+        }
+        cachelines.resize(numCachelines);
+        return cutensorHandleAttachPlanCachelines(handle, cachelines.data(), numCachelines);
+    }
+
+    /**
+     * Number of cachelines stored in a cache file (0 if it can't be read).
+     */
+    uint32_t countCachelines(const std::string &path) const
+    {
+        cutensorHandle_t scratch;
+        if (cutensorInit(&scratch) != CUTENSOR_STATUS_SUCCESS)
+        {
+            return 0;
+        }
+        std::vector<cutensorPlanCacheline_t> cachelines;
+        uint32_t numCachelines = numCachelines_;
+        uint32_t numCachelinesRead = 0;
+        for (int attempt = 0; attempt < 2; ++attempt)
+        {
+            if (attach(&scratch, cachelines, numCachelines) != CUTENSOR_STATUS_SUCCESS)
+            {
+                return 0;
+            }
+            const cutensorStatus_t status = cutensorHandleReadCacheFromFile(&scratch, path.c_str(), &numCachelinesRead);
+            if (status != CUTENSOR_STATUS_INSUFFICIENT_WORKSPACE)
+            {
+                cutensorHandleDetachPlanCachelines(&scratch);
+                return (status == CUTENSOR_STATUS_SUCCESS) ? numCachelinesRead : 0;
+            }
+            numCachelines = numCachelinesRead;
+        }
+        cutensorHandleDetachPlanCachelines(&scratch);
+        return 0;
+    }
+
+    static void readMeta(const std::string &path, uint64_t &generation, double &autotuneSeconds)
+    {
+        generation = 0;
+        autotuneSeconds = 0;
+        FILE* file = fopen((path + ".meta").c_str(), "r");
+        if (file == nullptr)
+        {
+            return;
+        }
+        unsigned long long gen = 0;
+        double seconds = 0;
+        if (fscanf(file, "generation %llu\nautotune_seconds %lf\n", &gen, &seconds) == 2)
+        {
+            generation = gen;
+            autotuneSeconds = seconds;
+        }
+        fclose(file);
+    }
+
+    static void writeMeta(const std::string &path, uint64_t generation, double autotuneSeconds)
+    {
+        char suffix[64];
+        snprintf(suffix, sizeof(suffix), ".meta.tmp.%d", getProcessId());
+        const std::string tmpPath = path + suffix;
+        FILE* file = fopen(tmpPath.c_str(), "w");
+        if (file == nullptr)
+        {
+            return;
+        }
+        fprintf(file, "generation %llu\nautotune_seconds %f\n", (unsigned long long) generation, autotuneSeconds);
+        fclose(file);
+        if (! replaceFile(tmpPath, path + ".meta"))
+        {
+            remove(tmpPath.c_str());
+        }
+    }
+
+    std::string directory_;
+    uint32_t numCachelines_;
+    cutensorHandle_t* handle_ = nullptr;
+    std::vector<cutensorPlanCacheline_t> cachelines_;
+    PlanCacheStoreStats stats_;
+};
@@ -92,9 +92,17 @@ class EinsumCuTensorOp : public OpKernel {
     OP_REQUIRES_OK(context, context->allocate_output(0, output_shape,
                                                      &output_tensor));
 
-    size_t worksize = myEinsum.getWorksize();
+    uint64_t worksize = 0;
+    OP_REQUIRES(context, myEinsum.getWorksize(GetCuTensorHandle(),
+                                              input_0_tensor.flat<T>().data(),
+                                              input_1_tensor.flat<T>().data(),
+                                              output_tensor->flat<T>().data(),
+                                              worksize),
+                errors::Internal("cutensor: Plan creation failed."));
+
+    // TF's allocator already pools device memory, so only request what the plan needs
     Tensor work_tensor;
-    int64 work_tensor_size = worksize / sizeof(float);
+    int64 work_tensor_size = (worksize + sizeof(float) - 1) / sizeof(float);
     TensorShape work_shape = { work_tensor_size };
     OP_REQUIRES_OK(context, context->allocate_temp(DT_FLOAT, work_shape, &work_tensor));
 
@@ -104,6 +112,7 @@ class EinsumCuTensorOp : public OpKernel {
                                 input_1_tensor.flat<T>().data(),
                                 output_tensor->flat<T>().data(),
                                 work_tensor.flat<float>().data(),
+                                work_tensor_size * sizeof(float),
                                 device.stream());
 
     OP_REQUIRES(context, ret, errors::Internal("cutensor: Launch failed."));
@@ -29,4 +29,7 @@
 # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #
 
-from .einsum import einsum, EinsumFunction, EinsumGeneral, Einsum
+from .einsum import einsum, EinsumFunction, EinsumGeneral, Einsum, einsum_path
+from .einsum import einsum_dlpack
+from .einsum import plan_cache_stats, set_plan_cache_capacity, clear_plan_cache
+from .einsum import workspace_stats, release_workspace
@@ -64,6 +64,20 @@ struct CuTensorTypeTraits<c10::complex<double>> {
   typedef c10::complex<double> ScalarType;
 };
 
+/**
+ * cuTENSOR handles arbitrary (positive) strides, so operands are passed
+ * as-is; only expanded views (stride 0 along a non-trivial extent) have to be
+ * materialized.
+ */
+torch::Tensor strided_operand(const torch::Tensor &tensor) {
+  for (int64_t i = 0; i < tensor.dim(); ++i) {
+    if (tensor.stride(i) <= 0 && tensor.size(i) > 1) {
+      return tensor.contiguous();
+    }
+  }
+  return tensor;
+}
+
 torch::Tensor einsum(
     std::string subscripts,
     torch::Tensor input_0,
@@ -72,26 +86,26 @@ torch::Tensor einsum(
     bool conjB = false
 ) {
   at::Tensor output_tensor;
+  input_0 = strided_operand(input_0);
+  input_1 = strided_operand(input_1);
   AT_DISPATCH_FLOATING_AND_COMPLEX_TYPES_AND2(at::ScalarType::Half, at::ScalarType::BFloat16, input_0.scalar_type(), "einsum", [&] {
     constexpr int kMaxNumModes_ = 64; // maximal number of modes supported by cuTENSOR
     cutensorOperator_t opA = conjA ? CUTENSOR_OP_CONJ : CUTENSOR_OP_IDENTITY;
     cutensorOperator_t opB = conjB ? CUTENSOR_OP_CONJ : CUTENSOR_OP_IDENTITY;
-    Einsum<scalar_t, int64_t, kMaxNumModes_> myEinsum(subscripts, input_0.sizes().vec(), input_1.sizes().vec(), opA, opB);
+    Einsum<scalar_t, int64_t, kMaxNumModes_> myEinsum(subscripts, input_0.sizes().vec(), input_1.sizes().vec(), opA, opB,
+                                                      input_0.strides().vec(), input_1.strides().vec());
     if (!myEinsum.isInitialized()) {
       throw std::runtime_error("cutensor: Initialization failed.");
     }
 
     output_tensor = torch::empty(myEinsum.getOutputShape(), input_0.options());
 
-    size_t worksize = myEinsum.getWorksize();
-    at::Tensor workspace = at::empty({static_cast<int>(worksize)}, at::CUDA(at::kByte));
-
+    // the workspace is taken from the (stream-ordered) einsum workspace arena
     auto stream = at::cuda::getCurrentCUDAStream().stream();
     auto ret = myEinsum.execute(GetCuTensorHandle(),
                                 input_0.data_ptr<scalar_t>(),
                                 input_1.data_ptr<scalar_t>(),
                                 output_tensor.data_ptr<scalar_t>(),
-                                workspace.data_ptr<uint8_t>(),
                                 stream);
 
     if (! ret) throw std::runtime_error("cutensor: Launch failed.");
@@ -99,6 +113,90 @@ torch::Tensor einsum(
   return output_tensor;
 }
 
+/**
+ * Resolves "..." and implicit outputs of equation and plans the order of the
+ * pairwise contractions (see einsum_path.h); runs entirely on the host.
+ */
+pybind11::dict einsum_path(
+    std::string equation,
+    std::vector<std::vector<int64_t>> shapes,
+    std::string optimize,
+    double memory_limit
+) {
+  EinsumEquation parsed;
+  if (!parseEinsumEquation(equation, shapes, parsed)) {
+    throw std::runtime_error("cutensor: Invalid equation '" + equation + "' for the given shapes.");
+  }
+
+  EinsumPathAlgo algo;
+  if (optimize == "greedy") {
+    algo = EinsumPathAlgo::GREEDY;
+  } else if (optimize == "optimal") {
+    algo = EinsumPathAlgo::OPTIMAL;
+  } else {
+    throw std::runtime_error("cutensor: Unknown optimize option '" + optimize + "' (expected 'greedy' or 'optimal').");
+  }
+
+  EinsumPath path;
+  if (!computeEinsumPath(parsed, algo, path, memory_limit)) {
+    throw std::runtime_error("cutensor: Unable to find a contraction path for '" + equation + "'.");
+  }
+
+  pybind11::list operands, equations;
+  for (const auto &step : path.steps) {
+    operands.append(pybind11::tuple(pybind11::cast(step.operands)));
+    equations.append(step.equation);
+  }
+  pybind11::dict result;
+  result["equation"] = parsed.toString();
+  result["path"] = operands;
+  result["equations"] = equations;
+  result["flops"] = path.flops;
+  result["naive_flops"] = path.naiveFlops;
+  result["largest_intermediate"] = path.largestIntermediate;
+  return result;
+}
+
+pybind11::dict plan_cache_stats() {
+  const PlanCacheStats stats = GetEinsumPlanCache()->getStats();
+  pybind11::dict result;
+  result["hits"] = stats.hits;
+  result["misses"] = stats.misses;
+  result["evictions"] = stats.evictions;
+  result["size"] = stats.size;
+  result["capacity"] = stats.capacity;
+  return result;
+}
+
+pybind11::dict workspace_stats() {
+  const WorkspaceArenaStats stats = GetEinsumWorkspaceArena()->getStats();
+  pybind11::dict result;
+  result["reserved_bytes"] = stats.reservedBytes;
+  result["high_water_mark"] = stats.highWaterMark;
+  result["allocations"] = stats.allocations;
+  result["reuses"] = stats.reuses;
+  return result;
+}
+
+void release_workspace() {
+  GetEinsumWorkspaceArena()->release();
+}
+
+void set_plan_cache_capacity(size_t capacity) {
+  GetEinsumPlanCache()->setCapacity(capacity);
+}
+
+void clear_plan_cache() {
+  GetEinsumPlanCache()->clear();
+  GetEinsumPlanCache()->resetStats();
+}
+
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
   m.def("einsum", &einsum, "Einsum");
+  m.def("einsum_path", &einsum_path, "Pairwise contraction order of an einsum");
+  m.def("plan_cache_stats", &plan_cache_stats, "Hit/miss statistics of the einsum plan cache");
+  m.def("workspace_stats", &workspace_stats, "Statistics of the einsum workspace arena");
+  m.def("release_workspace", &release_workspace, "Frees all einsum workspaces (stream-ordered)");
+  m.def("set_plan_cache_capacity", &set_plan_cache_capacity, "Sets the maximal number of cached einsum plans");
+  m.def("clear_plan_cache", &clear_plan_cache, "Drops all cached einsum plans and resets the statistics");
 }
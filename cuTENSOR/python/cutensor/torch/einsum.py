@@ -31,14 +31,43 @@
 
 import torch
 import torch.autograd
-import numpy as np
+import torch.utils.dlpack
 from .binding import einsum
+from .binding import einsum_path as _einsum_path
+from .binding import plan_cache_stats, set_plan_cache_capacity, clear_plan_cache
+from .binding import workspace_stats, release_workspace
 from ..common import normalize_subscript
 
+
+def einsum_path(equation, *shapes, optimize='greedy', memory_limit=0):
+    """Returns the pairwise contraction order chosen for an einsum.
+
+    Runs on the host only. The result is a dict with the explicit
+    `equation`, the `path` (in numpy.einsum_path's format), the
+    `equations` of the individual steps, and the estimated `flops`,
+    `naive_flops` and `largest_intermediate` (in elements).
+    """
+    if optimize is True:
+        optimize = 'greedy'
+    return _einsum_path(equation, [list(s) for s in shapes], optimize,
+                        float(memory_limit))
+
+
+def _sum_to_shape(grad, shape):
+    # undo broadcasting of extent-1 modes
+    dims = [i for i, (g, s) in enumerate(zip(grad.shape, shape)) if s == 1 and g != 1]
+    if dims:
+        grad = grad.sum(dim=dims, keepdim=True)
+    return grad
+
+
 class EinsumFunction(torch.autograd.Function):
 
     @staticmethod
     def forward(ctx, equation, input_0, input_1=None):
+        if '...' in equation:
+            shapes = [input_0.shape] if input_1 is None else [input_0.shape, input_1.shape]
+            equation = einsum_path(equation, *shapes)['equation']
         equation, isBinary = normalize_subscript(equation)
         if isBinary and input_1 is None:
             raise RuntimeError('The subscript indicates two inputs, but only one was passed')
@@ -71,6 +100,8 @@ class EinsumFunction(torch.autograd.Function):
                                input_1, False, conjugate)
             d_input_1 = einsum(modeA + ',' + modeC + '->' + modeB, input_0,
                                grad_output, conjugate, False)
+            d_input_0 = _sum_to_shape(d_input_0, input_0.shape)
+            d_input_1 = _sum_to_shape(d_input_1, input_1.shape)
             return None, d_input_0, d_input_1
         else:
             dummy = grad_output.new_empty((1,))
@@ -78,6 +109,34 @@ class EinsumFunction(torch.autograd.Function):
             return None, d_input
 
 
+def _as_cuda_tensor(operand):
+    # zero-copy import; the operand's strides are kept as they are
+    if isinstance(operand, torch.Tensor):
+        return operand
+    if hasattr(operand, '__dlpack__') or type(operand).__name__ == 'PyCapsule':
+        return torch.utils.dlpack.from_dlpack(operand)
+    if hasattr(operand, '__cuda_array_interface__'):
+        return torch.as_tensor(operand, device='cuda')
+    raise TypeError('cutensor: operand of type {} supports neither DLPack nor '
+                    '__cuda_array_interface__'.format(type(operand).__name__))
+
+
+def einsum_dlpack(equation, *operands, **kwargs):
+    """Evaluates an einsum on operands of any framework.
+
+    Operands may be DLPack capsules, objects implementing `__dlpack__`
+    (e.g. CuPy arrays, JAX arrays) or `__cuda_array_interface__` (e.g. Numba
+    device arrays). They are imported without copies and without being made
+    contiguous; cuTENSOR reads them through their strides. The result is a
+    (contiguous) torch.Tensor that can be exported via
+    torch.utils.dlpack.to_dlpack().
+    """
+    tensors = [_as_cuda_tensor(operand) for operand in operands]
+    if len(tensors) <= 2 and not kwargs:
+        return EinsumFunction.apply(equation, *tensors)
+    return EinsumGeneral(equation, *tensors, **kwargs)
+
+
 class Einsum(torch.nn.Module):
 
     def __init__(self, equation):
@@ -92,47 +151,21 @@ class Einsum(torch.nn.Module):
         return EinsumFunction.apply(self.equation, input_0, input_1)
 
 
-def _compute_target_tensor(in0, in1, target):
-    result = ""
-    for m in in0[:-1] + in1[:-1] + in1[-1] + in0[-1]:
-        if m in target and not m in result:
-            result += m
-    # reorder target modes like target
-    result = list(result)
-    for i in range(len(result)):
-        if result[i] not in target: continue
-        for j in range(i):
-            if result[j] not in target: continue
-            if target.index(result[j]) > target.index(result[i]):
-                result[i], result[j] = result[j], result[i]
-    return ''.join(result)
-
-
 def EinsumGeneral(equation, *tensors, **kwargs):
+    """Evaluates an einsum with any number of operands.
+
+    The equation is split into pairwise contractions whose order is chosen by
+    einsum_path(); `optimize` may be 'greedy' (default) or 'optimal', and
+    `memory_limit` bounds the size of intermediates for 'optimal'.
+    """
     tensors = list(tensors)
-    equation, isBinary = normalize_subscript(equation)
-    path = np.einsum_path(equation,
-                          *[np.broadcast_to(np.nan, t.shape) for t in tensors],
-                          **kwargs)
-    path = path[0][1:]
-    equation = equation.split('->')
-    eqs = equation[0].split(',')
-    target = equation[1]
-    for step in path:
+    info = einsum_path(equation, *[t.shape for t in tensors], **kwargs)
+    for step, eq in zip(info['path'], info['equations']):
         if len(step) == 1:
-            result = EinsumFunction.apply(eqs[0] + '->' + target, tensors[0])
-            continue
-        assert step[0] < step[1]
-        in0 = tensors[step[0]]
-        in1 = tensors[step[1]]
-        tensors.pop(step[1])
-        tensors.pop(step[0])
-        tgt = _compute_target_tensor(eqs[step[0]], eqs[step[1]], target)
-        assert tgt != ""
-        eq = eqs[step[0]] + ',' + eqs[step[1]] + '->' + tgt
-        eqs.pop(step[1])
-        eqs.pop(step[0])
-        eqs.append(tgt)
-        result = EinsumFunction.apply(eq, in0, in1)
+            result = EinsumFunction.apply(eq, tensors.pop(step[0]))
+        else:
+            in1 = tensors.pop(step[1])
+            in0 = tensors.pop(step[0])
+            result = EinsumFunction.apply(eq, in0, in1)
         tensors.append(result)
     return result
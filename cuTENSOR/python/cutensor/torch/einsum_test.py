@@ -111,6 +111,20 @@ class EinsumTest(unittest.TestCase):
                 equation="mlik,lkjm",
                 dtype=torch.float64,
             ),
+            param(
+                "test 9 (ellipsis)",
+                a_size=(4, 3, 30, 20),
+                b_size=(4, 3, 20, 10),
+                equation="...ij,...jk->...ik",
+                dtype=torch.float32,
+            ),
+            param(
+                "test 10 (broadcast)",
+                a_size=(4, 1, 30, 20),
+                b_size=(3, 20, 10),
+                equation="...ij,...jk->...ik",
+                dtype=torch.float32,
+            ),
             # Activate when cuTENSOR supports it
             # param(
             #     "test 8",
@@ -203,6 +217,12 @@ class EinsumTest(unittest.TestCase):
                 equation="ij->ji",
                 dtype=torch.float32,
             ),
+            param(
+                "test 5",
+                sizes=[(6, 10, 20), (6, 20, 5), (6, 5, 30), (6, 30, 8)],
+                equation="...ab,...bc,...cd,...de->...ae",
+                dtype=torch.float32,
+            ),
         ]
         # yapf: enable
     )
@@ -242,6 +262,83 @@ class EinsumTest(unittest.TestCase):
         for ct, tt in zip(cutensor_grads, torch_grads):
             torch.testing.assert_allclose(ct, tt, rtol=5e-3, atol=5e-3)
 
+    def test_einsum_path(self):
+        sizes = [(10, 100), (100, 5), (5, 200), (200, 3), (3, 50), (50, 10)]
+        equation = "ab,bc,cd,de,ef,fg->ag"
+        greedy = cutensor.einsum_path(equation, *sizes)
+        optimal = cutensor.einsum_path(equation, *sizes, optimize='optimal')
+        self.assertEqual(len(greedy['path']), len(sizes) - 1)
+        self.assertEqual(len(optimal['path']), len(sizes) - 1)
+        self.assertLessEqual(optimal['flops'], greedy['flops'])
+        self.assertLess(greedy['flops'], greedy['naive_flops'])
+        self.assertTrue(optimal['equations'][-1].endswith('->ag'))
+
+        ellipsis = cutensor.einsum_path("...ij,...jk", (7, 1, 2, 3), (5, 3, 4))
+        self.assertEqual(ellipsis['equation'], "ABij,Bjk->ABik")
+
+    def test_plan_cache(self):
+        kwargs = {'dtype': torch.float32, 'device': torch.device("cuda")}
+        a = torch.randn(32, 16, **kwargs)
+        b = torch.randn(16, 8, **kwargs)
+
+        cutensor.clear_plan_cache()
+        for _ in range(3):
+            rslt = cutensor.einsum("ik,kj->ij", a, b, False, False)
+        stats = cutensor.plan_cache_stats()
+        self.assertEqual(stats['misses'], 1)
+        self.assertEqual(stats['hits'], 2)
+        self.assertEqual(stats['size'], 1)
+        torch.testing.assert_allclose(rslt, torch.einsum("ik,kj->ij", a, b), rtol=5e-3, atol=5e-3)
+
+        # a different shape must not hit the cached plan
+        cutensor.einsum("ik,kj->ij", a[:16], b, False, False)
+        self.assertEqual(cutensor.plan_cache_stats()['misses'], 2)
+
+        cutensor.set_plan_cache_capacity(1)
+        cutensor.einsum("ik,kj->ij", a, b, False, False)
+        stats = cutensor.plan_cache_stats()
+        self.assertEqual(stats['size'], 1)
+        self.assertEqual(stats['evictions'], 2)
+        cutensor.set_plan_cache_capacity(512)
+
+    def test_workspace_arena(self):
+        kwargs = {'dtype': torch.float32, 'device': torch.device("cuda")}
+        a = torch.randn(64, 32, 16, **kwargs)
+        b = torch.randn(16, 32, 8, **kwargs)
+
+        cutensor.einsum("ikl,lkj->ij", a, b, False, False)
+        before = cutensor.workspace_stats()
+        cutensor.einsum("ikl,lkj->ij", a, b, False, False)
+        after = cutensor.workspace_stats()
+        self.assertEqual(after['allocations'], before['allocations'])
+        self.assertLessEqual(after['high_water_mark'], after['reserved_bytes'])
+        self.assertLess(after['reserved_bytes'], 1024 * 1024 * 1024)
+
+        cutensor.release_workspace()
+        self.assertEqual(cutensor.workspace_stats()['reserved_bytes'], 0)
+
+    def test_strided_operands(self):
+        kwargs = {'dtype': torch.float32, 'device': torch.device("cuda")}
+        a = torch.randn(16, 32, **kwargs).t()
+        b = torch.randn(24, 64, **kwargs)[::2, ::4]
+        self.assertFalse(a.is_contiguous())
+        self.assertFalse(b.is_contiguous())
+        rslt = cutensor.einsum("ik,kj->ij", a, b, False, False)
+        torch.testing.assert_allclose(rslt, torch.einsum("ik,kj->ij", a, b), rtol=5e-3, atol=5e-3)
+
+        # expanded (stride 0) views are materialized
+        c = torch.randn(32, 1, **kwargs).expand(32, 16)
+        rslt = cutensor.einsum("ij->j", c, c.new_empty((1,)), False, False)
+        torch.testing.assert_allclose(rslt, c.sum(0), rtol=5e-3, atol=5e-3)
+
+    def test_einsum_dlpack(self):
+        kwargs = {'dtype': torch.float32, 'device': torch.device("cuda")}
+        a = torch.randn(8, 16, 32, **kwargs).permute(2, 0, 1)
+        b = torch.randn(16, 8, **kwargs)
+        capsule = torch.utils.dlpack.to_dlpack(a)
+        rslt = cutensor.einsum_dlpack("kab,bc->kac", capsule, b)
+        torch.testing.assert_allclose(rslt, torch.einsum("kab,bc->kac", a, b), rtol=5e-3, atol=5e-3)
+
 
 if __name__ == '__main__':
     unittest.main()
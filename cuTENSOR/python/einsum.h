@@ -30,7 +30,10 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <functional>
+#include <string>
 #include <vector>
 #include <array>
 
@@ -39,6 +42,10 @@
 #include <cuComplex.h>
 #include "cutensor.h"
 
+#include "einsum_path.h"
+#include "einsum_plan_cache.h"
+#include "einsum_workspace.h"
+
 #define HANDLE_ERROR(x) { const auto err = x;\
     if (err == CUTENSOR_STATUS_NOT_SUPPORTED) { return false; }\
     if (err != CUTENSOR_STATUS_SUCCESS) {printf("cutensor: Error %s in line %d\n", cutensorGetErrorString(err), __LINE__); return false; } }
@@ -81,185 +88,185 @@ struct CuTensorTypeTraits<__half> {
   typedef float ScalarType;
 };
 
+/**
+ * Everything that execute() needs to launch a contraction/reduction; for
+ * reductions only the tensor descriptors are used.
+ */
+struct EinsumPlan
+{
+    cutensorTensorDescriptor_t descA;
+    cutensorTensorDescriptor_t descB;
+    cutensorTensorDescriptor_t descC;
+    cutensorContractionPlan_t plan;
+    uint64_t worksize; // workspace (in bytes) that execute() requires
+};
+
+typedef LruPlanCache<EinsumPlanKey, EinsumPlan, EinsumPlanKeyHash> EinsumPlanCache;
+
+/**
+ * Process-wide plan cache shared by all Einsum instances.
+ *
+ * The capacity defaults to 512 plans and can be changed via the
+ * CUTENSOR_EINSUM_PLAN_CACHE_SIZE environment variable (0 disables caching).
+ */
+inline EinsumPlanCache* GetEinsumPlanCache()
+{
+    static EinsumPlanCache cache(getenv("CUTENSOR_EINSUM_PLAN_CACHE_SIZE") ?
+            static_cast<size_t>(atoi(getenv("CUTENSOR_EINSUM_PLAN_CACHE_SIZE"))) : 512);
+    return &cache;
+}
+
+/**
+ * Serves einsum workspaces from stream-ordered device allocations.
+ */
+struct CudaWorkspaceBackend
+{
+    typedef cudaStream_t Stream;
+
+    int device() const
+    {
+        int device = 0;
+        cudaGetDevice(&device);
+        return device;
+    }
+
+    void* allocate(size_t bytes, Stream stream)
+    {
+        void* ptr = nullptr;
+        if (cudaMallocAsync(&ptr, bytes, stream) != cudaSuccess)
+        {
+            return nullptr;
+        }
+        return ptr;
+    }
+
+    void deallocate(void* ptr, Stream stream) { cudaFreeAsync(ptr, stream); }
+};
+
+typedef WorkspaceArena<CudaWorkspaceBackend> EinsumWorkspaceArena;
+
+/**
+ * Process-wide workspace arena used by Einsum::execute() when the caller
+ * doesn't provide a workspace.
+ *
+ * The arena is never destroyed: its destructor would call cudaFreeAsync()
+ * during process exit, possibly after the CUDA runtime has been torn down.
+ * The driver reclaims the buffers when the process exits.
+ */
+inline EinsumWorkspaceArena* GetEinsumWorkspaceArena()
+{
+    static EinsumWorkspaceArena* arena = new EinsumWorkspaceArena();
+    return arena;
+}
+
 template<typename ComputeType,
          typename IntType, int kMaxNumModes_>
 struct Einsum
 {
     static const std::vector<IntType> emptyVec;
 
+    /**
+     * \param[in] equation unary or binary einsum equation; supports "..."
+     *            (numpy-style broadcasting) and implicit outputs
+     * \param[in] A_strides,B_strides strides (in elements, row-major order like
+     *            the shapes); empty means packed. C is always packed.
+     */
     Einsum(const std::string &equation,
            const std::vector<IntType> &A_shape,
            const std::vector<IntType> &B_shape = emptyVec,
            const cutensorOperator_t opA = CUTENSOR_OP_IDENTITY,
-           const cutensorOperator_t opB = CUTENSOR_OP_IDENTITY
+           const cutensorOperator_t opB = CUTENSOR_OP_IDENTITY,
+           const std::vector<IntType> &A_strides = emptyVec,
+           const std::vector<IntType> &B_strides = emptyVec
            ) :
-        numModesA_(A_shape.size()),
-        numModesB_(B_shape.size()),
+        numModesA_(0),
+        numModesB_(0),
         numModesC_(0),
+        isInitialized_(false),
+        hasStridesA_(! A_strides.empty()),
+        hasStridesB_(! B_strides.empty()),
         opA_(opA),
-        opB_(opB),
-        isInitialized_(false)
+        opB_(opB)
     {
-        const auto arrow_pos = equation.find("->");
-        const auto comma_pos = equation.find(",");
-        const auto dots = equation.find("...");
-        const bool isBroadcast = (dots != std::string::npos);
-        const bool isImplicit = (arrow_pos == std::string::npos);
-        if (isBroadcast) // TODO
-        {
-            return;
-        }
-        const bool usesB = (comma_pos != std::string::npos);
-        if (! usesB)
+        const bool usesB = (equation.find(",") != std::string::npos);
+        std::vector<std::vector<int64_t>> shapes;
+        shapes.emplace_back(A_shape.begin(), A_shape.end());
+        if (usesB)
         {
-            numModesB_ = 0;
-        }
-
-        size_t a_start = 0;
-        size_t a_end = isImplicit ? ((comma_pos == std::string::npos) ? equation.size() : comma_pos) : 
-                                    ((comma_pos == std::string::npos) ? arrow_pos : comma_pos);
-        size_t b_start = usesB ? comma_pos + 1 : 0;
-        size_t b_end   = usesB ? (isImplicit ? equation.size() : arrow_pos) : 0;
-        size_t c_start = isImplicit ? equation.size() : arrow_pos + 2;
-        size_t c_end = equation.size();
-
-
-        char modeA[kMaxNumModes_ + 2];
-        uint32_t numModesA = 0;
-        for (int i = a_start; i < a_end && numModesA < kMaxNumModes_ + 2; ++i){
-            if (equation.at(i) != ' ') // skip spaces
-            {
-                modeA[numModesA++] = equation.at(i);
-            }
-        }
-
-        char modeB[kMaxNumModes_ + 2];
-        uint32_t numModesB = 0;
-        for (int i = b_start; i < b_end && numModesB < kMaxNumModes_ + 2; ++i){
-            if (equation.at(i) != ' ') // skip spaces
-            {
-                modeB[numModesB++] = equation.at(i);
-            }
-        }
-
-        char modeC[kMaxNumModes_ + 2];
-        uint32_t numModesC = 0;
-        for (int i = c_start; i < c_end && numModesC < kMaxNumModes_ + 2; ++i){
-            if (equation.at(i) != ' ') // skip spaces
-            {
-                modeC[numModesC++] = equation.at(i);
-            }
+            shapes.emplace_back(B_shape.begin(), B_shape.end());
         }
-
-        if ((numModesA != numModesA_) || (numModesB != numModesB_))
+        if ((hasStridesA_ && A_strides.size() != A_shape.size()) ||
+            (hasStridesB_ && B_strides.size() != B_shape.size()))
         {
-            // substring size and shape don't match
+            // number of strides and shape don't match
             return;
         }
-        if (numModesA_ > kMaxNumModes_ || numModesB_ > kMaxNumModes_)
+        const std::vector<int64_t> stridesA(A_strides.begin(), A_strides.end());
+        const std::vector<int64_t> stridesB(B_strides.begin(), B_strides.end());
+
+        EinsumEquation parsed;
+        if (! parseEinsumEquation(equation, shapes, parsed))
         {
-            // too many modes
+            // malformed, more than two operands, or substring size and shape don't match
             return;
         }
 
         /**
-         * Copy all modes from modeA to modeC if they don't appear in modeB
+         * Collect the modes of one operand in cuTENSOR's (column-major) order;
+         * modes with extent 1 that are broadcast against a larger extent are
+         * dropped, which doesn't change the memory layout. Strides (if any)
+         * are reordered alongside.
          */
-        auto copyModesIf = [](const char* modeA, uint32_t numModesA,
-                const char* modeB, uint32_t numModesB,
-                char* modeC, uint32_t &numModesC)
+        auto collectModes = [&parsed](const std::string &modes, const std::vector<int64_t> &shape,
+                const std::vector<int64_t> &strides,
+                std::array<int, kMaxNumModes_> &modesOut, std::array<int64_t, kMaxNumModes_> &extentOut,
+                std::array<int64_t, kMaxNumModes_> &strideOut, uint32_t &numModesOut)
         {
-            for (uint32_t i = 0; i < numModesA; i++)
+            numModesOut = 0;
+            for (int i = static_cast<int>(modes.size()) - 1; i >= 0; --i)
             {
-                auto mode = modeA[i];
-                bool found = false;
-                for(uint32_t j=0; j < numModesB; ++j){
-                    if(mode == modeB[j])
-                    {
-                        found = true;
-                        break;
-                    }
+                if (shape[i] == 1 && parsed.extent.at(modes[i]) != 1)
+                {
+                    continue;
                 }
-
-                if (!found) // is non-contracted mode
+                if (numModesOut >= kMaxNumModes_)
                 {
-                    modeC[numModesC++] = mode;
-                    if (numModesC > kMaxNumModes_)
-                    {
-                        // too many modes
-                        return false;
-                    }
+                    // too many modes
+                    return false;
                 }
+                modesOut[numModesOut] = modes[i];
+                extentOut[numModesOut] = shape[i];
+                strideOut[numModesOut] = strides.empty() ? 0 : strides[i];
+                ++numModesOut;
             }
             return true;
         };
 
-
-        std::array<char, kMaxNumModes_+1> implicitModeC;
-        char* redirectModeC;
-        if (isImplicit)
+        if (! collectModes(parsed.inputs[0], shapes[0], stridesA, modesA_, extentA_, strideA_, numModesA_))
         {
-            // we have to copy all non-contracted modes from A over to C
-            if (copyModesIf(modeA, numModesA_, modeB, numModesB_, implicitModeC.data(), numModesC_) == false)
-            {
-                return;
-            }
-            // we have to copy all non-contracted modes from B over to C
-            if (copyModesIf(modeB, numModesB_, modeA, numModesA_, implicitModeC.data(), numModesC_) == false)
-            {
-                return;
-            }
-            std::sort(implicitModeC.begin(), std::next(implicitModeC.begin(), numModesC_)); // modes are sorted w.r.t. lexical order
-            implicitModeC[numModesC_] = '\0';
-            redirectModeC = implicitModeC.data();
-        }
-        else
-        {
-            redirectModeC = modeC;
-            numModesC_ = numModesC;
+            return;
         }
-
-        for (uint32_t i = 0; i < numModesA_; i++)
+        if (usesB && ! collectModes(parsed.inputs[1], shapes[1], stridesB, modesB_, extentB_, strideB_, numModesB_))
         {
-            modesA_[i] = modeA[numModesA_ - i - 1];
-            extentA_[i] = A_shape[numModesA_ - i - 1];
+            return;
         }
-
-        for (uint32_t i = 0; i < numModesB_; i++)
+        if (parsed.output.size() > kMaxNumModes_)
         {
-            modesB_[i] = modeB[numModesB_ - i - 1];
-            extentB_[i] = B_shape[numModesB_ - i - 1];
+            // too many modes
+            return;
         }
 
+        numModesC_ = parsed.output.size();
         for (uint32_t i = 0; i < numModesC_; i++)
         {
-            const auto mode = redirectModeC[numModesC_ - i - 1];
+            const auto mode = parsed.output[numModesC_ - i - 1];
             modesC_[i] = mode;
-            bool found = false;
-            for (uint32_t j=0; j < numModesA_; ++j)
-            {
-                if (modesA_[j] == mode)
-                {
-                    extentC_[i] = extentA_[j];
-                    found = true;
-                    break;
-                }
-            }
-            for (uint32_t j=0; !found && j < numModesB_; ++j)
-            {
-                if (modesB_[j] == mode)
-                {
-                    extentC_[i] = extentB_[j];
-                    break;
-                }
-            }
+            extentC_[i] = parsed.extent.at(mode);
         }
 
         isInitialized_ = true;
     }
 
-    size_t getWorksize() const { return kWorksize_; }
-
     std::vector<IntType> getOutputShape() const
     {
         if (!isInitialized_) return {};
@@ -272,110 +279,249 @@ struct Einsum
         return extentC;
     }
 
+    /**
+     * Returns the workspace (in bytes) that execute() requires for these
+     * operands; this creates (and caches) the plan if necessary.
+     */
+    bool getWorksize(const cutensorHandle_t *handle,
+                     const void* A_raw,
+                     const void* B_raw,
+                     const void* C_raw,
+                     uint64_t &worksize) const
+    {
+        EinsumPlan plan;
+        if (! getPlan(handle, A_raw, B_raw, C_raw, plan))
+        {
+            return false;
+        }
+        worksize = plan.worksize;
+        return true;
+    }
+
     /**
      * Computes the einsum call A,B->C
      *
+     * Descriptors and plans are looked up in (and added to) the process-wide
+     * plan cache, see GetEinsumPlanCache().
+     *
      * \param[in] A_raw device pointer of A
      * \param[in] B_raw device pointer of B
      * \param[out] C_raw device pointer of C
-     * \param[out] wor_raw device pointer to the scratchpad memory
+     * \param[out] work_raw device pointer to the scratchpad memory
+     * \param[in] worksize size of work_raw in bytes; must be at least getWorksize()
      * Dispatch to contraction
      */
     bool execute(const cutensorHandle_t *handle,
                  const void* A_raw,
                  const void* B_raw,
                  void* C_raw,
-                 void *work_raw, cudaStream_t stream) const
+                 void *work_raw, uint64_t worksize, cudaStream_t stream) const
+    {
+        EinsumPlan plan;
+        if (! getPlan(handle, A_raw, B_raw, C_raw, plan))
+        {
+            return false;
+        }
+        if (worksize < plan.worksize)
+        {
+            printf("cutensor: Insufficient workspace (%llu < %llu bytes)\n",
+                    (unsigned long long) worksize, (unsigned long long) plan.worksize);
+            return false;
+        }
+        return execute(handle, plan, A_raw, B_raw, C_raw, work_raw, worksize, stream);
+    }
+
+    /**
+     * Computes the einsum call A,B->C with a workspace taken from the
+     * process-wide arena, see GetEinsumWorkspaceArena().
+     */
+    bool execute(const cutensorHandle_t *handle,
+                 const void* A_raw,
+                 const void* B_raw,
+                 void* C_raw,
+                 cudaStream_t stream) const
+    {
+        EinsumPlan plan;
+        if (! getPlan(handle, A_raw, B_raw, C_raw, plan))
+        {
+            return false;
+        }
+        // the lease keeps the workspace alive until the work is enqueued
+        const EinsumWorkspaceArena::Lease work = GetEinsumWorkspaceArena()->acquire(plan.worksize, stream);
+        if (plan.worksize > 0 && work.get() == nullptr)
+        {
+            printf("cutensor: Unable to allocate %llu bytes of workspace\n", (unsigned long long) plan.worksize);
+            return false;
+        }
+        return execute(handle, plan, A_raw, B_raw, C_raw, work.get(), plan.worksize, stream);
+    }
+
+    bool isInitialized() const { return isInitialized_; }
+
+    private:
+    bool execute(const cutensorHandle_t *handle,
+                 const EinsumPlan &plan,
+                 const void* A_raw,
+                 const void* B_raw,
+                 void* C_raw,
+                 void *work_raw, uint64_t worksize, cudaStream_t stream) const
+    {
+        cutensorComputeType_t computeType = CuTensorTypeTraits<ComputeType>::cutensorType;
+
+        typename CuTensorTypeTraits<ComputeType>::ScalarType alpha = 1;
+        typename CuTensorTypeTraits<ComputeType>::ScalarType beta = 0;
+
+        if (numModesB_ > 0)
+        {
+            // dispatch to contraction
+            HANDLE_ERROR(cutensorContraction(handle, &plan.plan,
+                        (void*) &alpha, A_raw, B_raw,
+                        (void*) &beta,  C_raw, C_raw,
+                        work_raw, worksize, stream));
+        }
+        else
+        {
+            // dispatch to reduction
+            HANDLE_ERROR(cutensorReduction(handle,
+                        (const void*)&alpha, A_raw, &plan.descA, modesA_.data(),
+                        (const void*)&beta,  A_raw, &plan.descC, modesC_.data(), // beta == 0 => will not be used
+                        C_raw, &plan.descC, modesC_.data(),
+                        CUTENSOR_OP_ADD, computeType, work_raw, worksize, stream));
+        }
+        return true;
+    }
+
+    bool getPlan(const cutensorHandle_t *handle,
+                 const void* A_raw,
+                 const void* B_raw,
+                 const void* C_raw,
+                 EinsumPlan &plan) const
     {
         if (!isInitialized_) return false;
 
+        EinsumPlanCache* cache = GetEinsumPlanCache();
+        const EinsumPlanKey key = makePlanKey(handle, A_raw, B_raw, C_raw);
+        if (! cache->find(key, plan))
+        {
+            if (! initPlan(handle, A_raw, B_raw, C_raw, plan))
+            {
+                return false;
+            }
+            cache->insert(key, plan);
+        }
+        return true;
+    }
+
+    EinsumPlanKey makePlanKey(const cutensorHandle_t *handle,
+                              const void* A_raw,
+                              const void* B_raw,
+                              const void* C_raw) const
+    {
+        EinsumPlanKey key;
+        key.handle = handle;
+        key.dataType = CuTensorTypeTraits<ComputeType>::cudaType;
+        key.computeType = CuTensorTypeTraits<ComputeType>::cutensorType;
+        key.opA = opA_;
+        key.opB = opB_;
+        key.modes[0].assign(modesA_.begin(), modesA_.begin() + numModesA_);
+        key.modes[1].assign(modesB_.begin(), modesB_.begin() + numModesB_);
+        key.modes[2].assign(modesC_.begin(), modesC_.begin() + numModesC_);
+        key.extents[0].assign(extentA_.begin(), extentA_.begin() + numModesA_);
+        key.extents[1].assign(extentB_.begin(), extentB_.begin() + numModesB_);
+        key.extents[2].assign(extentC_.begin(), extentC_.begin() + numModesC_);
+        if (hasStridesA_)
+        {
+            key.strides[0].assign(strideA_.begin(), strideA_.begin() + numModesA_);
+        }
+        if (hasStridesB_)
+        {
+            key.strides[1].assign(strideB_.begin(), strideB_.begin() + numModesB_);
+        }
+        key.alignment[0] = pointerAlignment(A_raw);
+        key.alignment[1] = (numModesB_ > 0) ? pointerAlignment(B_raw) : 0;
+        key.alignment[2] = pointerAlignment(C_raw);
+        return key;
+    }
+
+    /**
+     * Initializes all descriptors (and the plan for contractions); this is
+     * what the plan cache saves us from doing on every call.
+     */
+    bool initPlan(const cutensorHandle_t *handle,
+                  const void* A_raw,
+                  const void* B_raw,
+                  const void* C_raw,
+                  EinsumPlan &plan) const
+    {
         cudaDataType_t cudaType = CuTensorTypeTraits<ComputeType>::cudaType;
         cutensorComputeType_t computeType = CuTensorTypeTraits<ComputeType>::cutensorType;
 
-        cutensorTensorDescriptor_t descA;
         HANDLE_ERROR(cutensorInitTensorDescriptor(handle,
-                    &descA,
+                    &plan.descA,
                     numModesA_,
                     extentA_.data(),
-                    NULL /* = stride */,
+                    hasStridesA_ ? strideA_.data() : NULL /* = packed */,
                     cudaType, opA_));
 
-        cutensorTensorDescriptor_t descC;
         HANDLE_ERROR(cutensorInitTensorDescriptor(handle,
-                    &descC,
+                    &plan.descC,
                     numModesC_,
                     extentC_.data(),
                     NULL /* = stride*/,
                     cudaType, CUTENSOR_OP_IDENTITY));
 
+        if (numModesB_ == 0)
+        {
+            // reductions don't require a plan
+            HANDLE_ERROR(cutensorReductionGetWorkspaceSize(handle,
+                        A_raw, &plan.descA, modesA_.data(),
+                        C_raw, &plan.descC, modesC_.data(),
+                        C_raw, &plan.descC, modesC_.data(),
+                        CUTENSOR_OP_ADD, computeType, &plan.worksize));
+            return true;
+        }
+
         uint32_t alignmentRequirementA;
         HANDLE_ERROR(cutensorGetAlignmentRequirement(handle,
-                    A_raw, &descA, &alignmentRequirementA));
+                    A_raw, &plan.descA, &alignmentRequirementA));
 
         uint32_t alignmentRequirementC;
         HANDLE_ERROR(cutensorGetAlignmentRequirement(handle,
-                    C_raw, &descC, &alignmentRequirementC));
+                    C_raw, &plan.descC, &alignmentRequirementC));
 
+        HANDLE_ERROR(cutensorInitTensorDescriptor(handle,
+                    &plan.descB,
+                    numModesB_,
+                    extentB_.data(),
+                    hasStridesB_ ? strideB_.data() : NULL /* = packed */,
+                    cudaType, opB_));
 
-        cutensorTensorDescriptor_t descB;
         uint32_t alignmentRequirementB;
-        if (numModesB_ > 0)
-        {
-            // dispatch to contraction
-            HANDLE_ERROR(cutensorInitTensorDescriptor(handle,
-                        &descB,
-                        numModesB_,
-                        extentB_.data(),
-                        NULL /* = stride*/,
-                        cudaType, opB_));
-
-            HANDLE_ERROR(cutensorGetAlignmentRequirement(handle,
-                        B_raw, &descB, &alignmentRequirementB));
-
-            cutensorContractionDescriptor_t desc;
-            HANDLE_ERROR(cutensorInitContractionDescriptor(handle, &desc,
-                        &descA, modesA_.data(), alignmentRequirementA,
-                        &descB, modesB_.data(), alignmentRequirementB,
-                        &descC, modesC_.data(), alignmentRequirementC,
-                        &descC, modesC_.data(), alignmentRequirementC,
-                        computeType));
-
-            cutensorAlgo_t algo = CUTENSOR_ALGO_DEFAULT;
-            cutensorContractionFind_t find;
-            HANDLE_ERROR(cutensorInitContractionFind( 
-                        handle, &find, 
-                        algo));
-
-            cutensorContractionPlan_t plan;
-            HANDLE_ERROR(cutensorInitContractionPlan(handle,
-                        &plan, &desc, &find, kWorksize_));
-
-            typename CuTensorTypeTraits<ComputeType>::ScalarType alpha = 1;
-            typename CuTensorTypeTraits<ComputeType>::ScalarType beta = 0;
-
-            HANDLE_ERROR(cutensorContraction(handle, &plan,
-                        (void*) &alpha, A_raw, B_raw,
-                        (void*) &beta,  C_raw, C_raw,
-                        work_raw, kWorksize_, stream));
-        }
-        else
-        {
-            // dispatch to reduction
-            typename CuTensorTypeTraits<ComputeType>::ScalarType alpha = 1;
-            typename CuTensorTypeTraits<ComputeType>::ScalarType beta = 0;
-            HANDLE_ERROR(cutensorReduction(handle,
-                        (const void*)&alpha, A_raw, &descA, modesA_.data(),
-                        (const void*)&beta,  A_raw, &descC, modesC_.data(), // beta == 0 => will not be used
-                        C_raw, &descC, modesC_.data(),
-                        CUTENSOR_OP_ADD, computeType, work_raw, kWorksize_, stream));
-        }
+        HANDLE_ERROR(cutensorGetAlignmentRequirement(handle,
+                    B_raw, &plan.descB, &alignmentRequirementB));
+
+        cutensorContractionDescriptor_t desc;
+        HANDLE_ERROR(cutensorInitContractionDescriptor(handle, &desc,
+                    &plan.descA, modesA_.data(), alignmentRequirementA,
+                    &plan.descB, modesB_.data(), alignmentRequirementB,
+                    &plan.descC, modesC_.data(), alignmentRequirementC,
+                    &plan.descC, modesC_.data(), alignmentRequirementC,
+                    computeType));
+
+        cutensorAlgo_t algo = CUTENSOR_ALGO_DEFAULT;
+        cutensorContractionFind_t find;
+        HANDLE_ERROR(cutensorInitContractionFind(
+                    handle, &find,
+                    algo));
+
+        HANDLE_ERROR(cutensorContractionGetWorkspaceSize(handle,
+                    &desc, &find, CUTENSOR_WORKSPACE_RECOMMENDED, &plan.worksize));
+
+        HANDLE_ERROR(cutensorInitContractionPlan(handle,
+                    &plan.plan, &desc, &find, plan.worksize));
         return true;
     }
 
-    bool isInitialized() const { return isInitialized_; }
-
-    private:
-    static const size_t kWorksize_ = 1024ULL * 1024ULL * 8ULL * 128ULL;
     uint32_t numModesA_;
     uint32_t numModesB_;
     uint32_t numModesC_;
@@ -386,10 +532,17 @@ struct Einsum
     std::array<int64_t, kMaxNumModes_> extentA_;
     std::array<int64_t, kMaxNumModes_> extentB_;
     std::array<int64_t, kMaxNumModes_> extentC_;
+    bool hasStridesA_;
+    bool hasStridesB_;
+    std::array<int64_t, kMaxNumModes_> strideA_;
+    std::array<int64_t, kMaxNumModes_> strideB_;
     cutensorOperator_t opA_ = CUTENSOR_OP_IDENTITY;
     cutensorOperator_t opB_ = CUTENSOR_OP_IDENTITY;
 };
 
+template<typename ComputeType, typename IntType, int kMaxNumModes_>
+const std::vector<IntType> Einsum<ComputeType, IntType, kMaxNumModes_>::emptyVec;
+
 inline cutensorHandle_t CreateCuTensorHandle() {
   cutensorHandle_t handle;
   cutensorInit(&handle);
@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION & AFFILIATES.  All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  - Neither the name(s) of the copyright holder(s) nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/**
+ * Host-only einsum equation handling:
+ *  - parseEinsumEquation() expands "..." (with numpy-style broadcasting) and
+ *    implicit outputs into an explicit equation;
+ *  - computeEinsumPath() splits an N-operand equation into a sequence of
+ *    pairwise contractions (opt_einsum-style greedy or exhaustive search).
+ *
+ * Nothing in here depends on CUDA, so paths can be inspected on any host.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * An einsum equation with all shorthands resolved.
+ */
+struct EinsumEquation
+{
+    std::vector<std::string> inputs;  // modes of each operand (no "...", no spaces)
+    std::string output;               // modes of the result
+    std::map<char, int64_t> extent;   // broadcast extent of each mode
+
+    std::string toString() const
+    {
+        std::string equation;
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            if (i > 0) equation += ",";
+            equation += inputs[i];
+        }
+        return equation + "->" + output;
+    }
+};
+
+/**
+ * Resolves ellipses and implicit outputs of equation.
+ *
+ * Ellipses are replaced by modes that don't occur in equation; they are right-
+ * aligned across operands like numpy broadcasting dimensions. Modes with
+ * extent 1 may broadcast against larger extents of the same mode.
+ *
+ * \param[in] equation e.g. "...ij,...jk->...ik" or "ij,jk"
+ * \param[in] shapes   one shape per operand (row-major, as in the frameworks)
+ * \param[out] result
+ * \returns false if the equation is malformed or doesn't match the shapes
+ */
+inline bool parseEinsumEquation(const std::string &equation,
+                                const std::vector<std::vector<int64_t>> &shapes,
+                                EinsumEquation &result)
+{
+    result = EinsumEquation();
+
+    std::string compact;
+    for (auto c : equation)
+    {
+        if (c != ' ') compact += c;
+    }
+
+    const auto arrow_pos = compact.find("->");
+    const bool isImplicit = (arrow_pos == std::string::npos);
+    const std::string lhs = isImplicit ? compact : compact.substr(0, arrow_pos);
+    const std::string rhs = isImplicit ? "" : compact.substr(arrow_pos + 2);
+
+    std::vector<std::string> terms;
+    size_t start = 0;
+    while (true)
+    {
+        const auto comma_pos = lhs.find(',', start);
+        terms.push_back(lhs.substr(start, comma_pos - start));
+        if (comma_pos == std::string::npos) break;
+        start = comma_pos + 1;
+    }
+    if (terms.size() != shapes.size())
+    {
+        return false;
+    }
+
+    // find unused modes for the ellipsis
+    std::string freeModes;
+    for (char c = 'A'; c <= 'Z'; ++c) if (compact.find(c) == std::string::npos) freeModes += c;
+    for (char c = 'a'; c <= 'z'; ++c) if (compact.find(c) == std::string::npos) freeModes += c;
+
+    auto isMode = [](char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); };
+
+    std::vector<int> numEllipsisModes(terms.size(), 0);
+    int maxEllipsisModes = 0;
+    for (size_t i = 0; i < terms.size(); ++i)
+    {
+        const auto dots = terms[i].find("...");
+        int numExplicit = 0;
+        for (auto c : terms[i])
+        {
+            if (isMode(c)) ++numExplicit;
+            else if (c != '.') return false;
+        }
+        if (dots == std::string::npos)
+        {
+            if (numExplicit != static_cast<int>(shapes[i].size())) return false;
+            if (terms[i].find('.') != std::string::npos) return false;
+            continue;
+        }
+        if (terms[i].find('.', dots + 3) != std::string::npos) return false; // more than one ellipsis
+        numEllipsisModes[i] = static_cast<int>(shapes[i].size()) - numExplicit;
+        if (numEllipsisModes[i] < 0) return false;
+        maxEllipsisModes = std::max(maxEllipsisModes, numEllipsisModes[i]);
+    }
+    if (maxEllipsisModes > static_cast<int>(freeModes.size()))
+    {
+        return false;
+    }
+    const std::string ellipsisModes = freeModes.substr(0, maxEllipsisModes);
+
+    for (size_t i = 0; i < terms.size(); ++i)
+    {
+        std::string modes = terms[i];
+        const auto dots = modes.find("...");
+        if (dots != std::string::npos)
+        {
+            modes.replace(dots, 3, ellipsisModes.substr(maxEllipsisModes - numEllipsisModes[i]));
+        }
+        for (size_t j = 0; j < modes.size(); ++j)
+        {
+            const auto extent = shapes[i][j];
+            auto it = result.extent.find(modes[j]);
+            if (it == result.extent.end() || it->second == 1)
+            {
+                result.extent[modes[j]] = extent;
+            }
+            else if (extent != 1 && extent != it->second)
+            {
+                return false; // extents don't match and can't be broadcast
+            }
+        }
+        result.inputs.push_back(modes);
+    }
+
+    if (isImplicit)
+    {
+        // numpy: broadcast modes followed by all modes that appear exactly once (sorted)
+        result.output = ellipsisModes;
+        std::string once;
+        for (const auto &it : result.extent)
+        {
+            const char mode = it.first;
+            if (ellipsisModes.find(mode) != std::string::npos) continue;
+            int count = 0;
+            for (const auto &modes : result.inputs) count += std::count(modes.begin(), modes.end(), mode);
+            if (count == 1) once += mode;
+        }
+        result.output += once; // std::map iterates in sorted order
+    }
+    else
+    {
+        std::string modes = rhs;
+        const auto dots = modes.find("...");
+        if (dots != std::string::npos)
+        {
+            modes.replace(dots, 3, ellipsisModes);
+        }
+        for (auto c : modes)
+        {
+            if (! isMode(c)) return false;
+            if (result.extent.find(c) == result.extent.end()) return false; // unknown output mode
+            if (std::count(modes.begin(), modes.end(), c) != 1) return false;
+        }
+        result.output = modes;
+    }
+    return true;
+}
+
+enum class EinsumPathAlgo
+{
+    GREEDY,  ///< pick the locally cheapest pair at each step
+    OPTIMAL, ///< exhaustive dynamic programming over all operand subsets
+};
+
+/**
+ * A single step of an einsum path.
+ *
+ * Operand indices refer to the list of operands *at that step* (the
+ * contracted operands are removed and the result is appended), i.e. the
+ * same "linear" format as numpy.einsum_path and opt_einsum.
+ */
+struct EinsumPathStep
+{
+    std::vector<int> operands; // one (unary) or two (pairwise) indices, ascending
+    std::string equation;      // e.g. "ij,jk->ik"
+    double flops = 0;
+    double outputSize = 0;     // number of elements of the intermediate/result
+};
+
+struct EinsumPath
+{
+    std::vector<EinsumPathStep> steps;
+    double flops = 0;               // estimated cost of the path
+    double naiveFlops = 0;          // cost of evaluating the equation in a single loop nest
+    double largestIntermediate = 0; // elements of the largest intermediate tensor
+};
+
+/**
+ * Plans the evaluation of an N-operand einsum as a sequence of pairwise
+ * contractions.
+ *
+ * The cost model counts 2 flops per multiply-add of each pairwise contraction
+ * (1 if no mode is summed over); between equally expensive candidates the one
+ * with the smaller intermediate wins.
+ *
+ * \param[in] equation as returned by parseEinsumEquation()
+ * \param[in] algo OPTIMAL falls back to GREEDY beyond kMaxOptimalOperands operands
+ * \param[in] memoryLimit maximal number of elements of any intermediate (0 = unlimited);
+ *            only honored by OPTIMAL
+ * \param[out] path
+ * \returns false if the equation uses more than 64 distinct modes or no path satisfies memoryLimit
+ */
+inline bool computeEinsumPath(const EinsumEquation &equation,
+                              EinsumPathAlgo algo,
+                              EinsumPath &path,
+                              double memoryLimit = 0)
+{
+    static const int kMaxOptimalOperands = 14;
+    typedef uint64_t ModeMask;
+
+    path = EinsumPath();
+    const int numOperands = static_cast<int>(equation.inputs.size());
+    if (numOperands == 0 || equation.extent.size() > 64)
+    {
+        return false;
+    }
+
+    // assign a bit to each mode
+    std::map<char, int> bit;
+    std::vector<double> extentOfBit;
+    for (const auto &it : equation.extent)
+    {
+        bit[it.first] = static_cast<int>(extentOfBit.size());
+        extentOfBit.push_back(static_cast<double>(it.second));
+    }
+    auto toMask = [&bit](const std::string &modes)
+    {
+        ModeMask mask = 0;
+        for (auto c : modes) mask |= ModeMask(1) << bit.at(c);
+        return mask;
+    };
+    auto sizeOf = [&extentOfBit](ModeMask mask)
+    {
+        double size = 1;
+        for (size_t i = 0; i < extentOfBit.size(); ++i)
+        {
+            if (mask & (ModeMask(1) << i)) size *= extentOfBit[i];
+        }
+        return size;
+    };
+    // cost of contracting a with b into result
+    auto flopsOf = [&sizeOf](ModeMask a, ModeMask b, ModeMask result)
+    {
+        const ModeMask all = a | b;
+        return sizeOf(all) * ((all & ~result) ? 2 : 1);
+    };
+    // keep the order in which the modes appear in the operands
+    auto orderModes = [](const std::string &a, const std::string &b, const std::string &keep)
+    {
+        std::string result;
+        for (auto c : a + b)
+        {
+            if (keep.find(c) != std::string::npos && result.find(c) == std::string::npos) result += c;
+        }
+        return result;
+    };
+
+    const ModeMask outputMask = toMask(equation.output);
+    ModeMask allModes = 0;
+    std::vector<ModeMask> inputMasks;
+    for (const auto &modes : equation.inputs)
+    {
+        inputMasks.push_back(toMask(modes));
+        allModes |= inputMasks.back();
+    }
+    path.naiveFlops = sizeOf(allModes) * std::max(numOperands, 2);
+
+    std::vector<std::string> modes = equation.inputs;
+    auto modesOfMask = [&](ModeMask mask, const std::string &a, const std::string &b, bool isFinal)
+    {
+        if (isFinal) return equation.output;
+        std::string keep;
+        for (const auto &it : bit) if (mask & (ModeMask(1) << it.second)) keep += it.first;
+        return orderModes(a, b, keep);
+    };
+    auto appendStep = [&](std::vector<int> operands, ModeMask result, double flops, bool isFinal)
+    {
+        EinsumPathStep step;
+        step.operands = operands;
+        std::string lhs = modes[operands[0]];
+        std::string rhs = (operands.size() > 1) ? modes[operands[1]] : "";
+        const std::string out = modesOfMask(result, lhs, rhs, isFinal);
+        step.equation = lhs + (operands.size() > 1 ? "," + rhs : "") + "->" + out;
+        step.flops = flops;
+        step.outputSize = sizeOf(result);
+        path.flops += flops;
+        if (! isFinal) path.largestIntermediate = std::max(path.largestIntermediate, step.outputSize);
+        for (auto it = operands.rbegin(); it != operands.rend(); ++it) modes.erase(modes.begin() + *it);
+        modes.push_back(out);
+        path.steps.push_back(step);
+    };
+
+    if (numOperands == 1)
+    {
+        appendStep({0}, outputMask, sizeOf(inputMasks[0]), true);
+        return true;
+    }
+
+    if (algo == EinsumPathAlgo::OPTIMAL && numOperands <= kMaxOptimalOperands)
+    {
+        const uint32_t full = (1u << numOperands) - 1;
+        // modes of the (intermediate) result of each subset of operands
+        std::vector<ModeMask> unionOf(full + 1, 0);
+        for (uint32_t s = 1; s <= full; ++s)
+        {
+            int lowest = 0;
+            while (! (s & (1u << lowest))) ++lowest;
+            unionOf[s] = unionOf[s & (s - 1)] | inputMasks[lowest];
+        }
+        std::vector<ModeMask> resultOf(full + 1, 0);
+        for (uint32_t s = 1; s <= full; ++s)
+        {
+            resultOf[s] = unionOf[s] & (outputMask | unionOf[full & ~s]);
+        }
+        // single operands enter their first contraction with all of their
+        // modes (no unary reduction step is emitted for them)
+        for (int i = 0; i < numOperands; ++i) resultOf[1u << i] = inputMasks[i];
+
+        const double inf = std::numeric_limits<double>::infinity();
+        std::vector<double> cost(full + 1, inf);
+        std::vector<double> peak(full + 1, 0);
+        std::vector<uint32_t> split(full + 1, 0);
+        for (int i = 0; i < numOperands; ++i) cost[1u << i] = 0;
+
+        for (uint32_t s = 1; s <= full; ++s)
+        {
+            if ((s & (s - 1)) == 0) continue; // single operand
+            const double size = sizeOf(resultOf[s]);
+            if (s != full && memoryLimit > 0 && size > memoryLimit) continue;
+            // enumerate each unordered split {s1, s2} once
+            const uint32_t lowest = s & (~s + 1);
+            for (uint32_t s1 = (s - 1) & s; s1 > 0; s1 = (s1 - 1) & s)
+            {
+                if (! (s1 & lowest)) continue;
+                const uint32_t s2 = s ^ s1;
+                if (cost[s1] == inf || cost[s2] == inf) continue;
+                const double total = cost[s1] + cost[s2] + flopsOf(resultOf[s1], resultOf[s2], resultOf[s]);
+                const double totalPeak = std::max(std::max(peak[s1], peak[s2]), s == full ? 0 : size);
+                if (total < cost[s] || (total == cost[s] && totalPeak < peak[s]))
+                {
+                    cost[s] = total;
+                    peak[s] = totalPeak;
+                    split[s] = s1;
+                }
+            }
+        }
+        if (cost[full] == inf)
+        {
+            return false;
+        }
+
+        // post-order traversal; `ids` tracks which subset each current operand represents
+        std::vector<uint32_t> ids;
+        for (int i = 0; i < numOperands; ++i) ids.push_back(1u << i);
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> stack{full};
+        while (! stack.empty())
+        {
+            const uint32_t s = stack.back();
+            stack.pop_back();
+            if ((s & (s - 1)) == 0) continue;
+            order.push_back(s);
+            stack.push_back(split[s]);
+            stack.push_back(s ^ split[s]);
+        }
+        for (auto it = order.rbegin(); it != order.rend(); ++it)
+        {
+            const uint32_t s = *it;
+            int a = static_cast<int>(std::find(ids.begin(), ids.end(), split[s]) - ids.begin());
+            int b = static_cast<int>(std::find(ids.begin(), ids.end(), s ^ split[s]) - ids.begin());
+            if (a > b) std::swap(a, b);
+            appendStep({a, b}, resultOf[s], flopsOf(resultOf[split[s]], resultOf[s ^ split[s]], resultOf[s]), s == full);
+            ids.erase(ids.begin() + b);
+            ids.erase(ids.begin() + a);
+            ids.push_back(s);
+        }
+        return true;
+    }
+
+    // greedy
+    std::vector<ModeMask> current = inputMasks;
+    while (current.size() > 1)
+    {
+        const bool isFinal = (current.size() == 2);
+        int bestA = -1, bestB = -1;
+        bool bestShares = false;
+        double bestScore = 0, bestFlops = 0;
+        ModeMask bestResult = 0;
+        for (size_t a = 0; a < current.size(); ++a)
+        {
+            for (size_t b = a + 1; b < current.size(); ++b)
+            {
+                ModeMask others = outputMask;
+                for (size_t k = 0; k < current.size(); ++k)
+                {
+                    if (k != a && k != b) others |= current[k];
+                }
+                const ModeMask result = (current[a] | current[b]) & others;
+                const bool shares = (current[a] & current[b]) != 0;
+                const double flops = flopsOf(current[a], current[b], result);
+                // opt_einsum's heuristic: minimize the growth in memory
+                const double score = shares ? sizeOf(result) - sizeOf(current[a]) - sizeOf(current[b])
+                                            : sizeOf(result); // outer products only as a last resort
+                const bool better = (bestA < 0) ||
+                    (shares && ! bestShares) ||
+                    (shares == bestShares && (score < bestScore || (score == bestScore && flops < bestFlops)));
+                if (better)
+                {
+                    bestA = static_cast<int>(a);
+                    bestB = static_cast<int>(b);
+                    bestShares = shares;
+                    bestScore = score;
+                    bestFlops = flops;
+                    bestResult = result;
+                }
+            }
+        }
+        appendStep({bestA, bestB}, bestResult, bestFlops, isFinal);
+        current.erase(current.begin() + bestB);
+        current.erase(current.begin() + bestA);
+        current.push_back(bestResult);
+    }
+    return true;
+}
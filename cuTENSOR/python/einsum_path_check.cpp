@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION & AFFILIATES.  All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  - Neither the name(s) of the copyright holder(s) nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// CPU-only check of the einsum path planners (einsum_path.h).
+//
+// Recounts the flops and intermediate sizes of every emitted step from its
+// equation and the mode extents, replays the steps on the operand list and
+// compares the totals with what the planner reported, for the greedy and the
+// optimal planner on fixed and random equations. The optimal path must never
+// cost more than the greedy one and must respect the memory limit.
+//
+// Build: g++ -O2 -std=c++11 einsum_path_check.cpp -o einsum_path_check
+// Usage: ./einsum_path_check
+
+#include "einsum_path.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define EXPECT(cond, what)                                          \
+    do                                                              \
+    {                                                               \
+        if (!(cond))                                                \
+        {                                                           \
+            printf("FAILED: %s: %s (line %d)\n", what, #cond, __LINE__); \
+            failures++;                                             \
+        }                                                           \
+    } while (0)
+
+static bool same(double a, double b)
+{
+    return std::fabs(a - b) <= 1e-9 * std::max(std::fabs(a), std::fabs(b));
+}
+
+static EinsumEquation makeEquation(const std::vector<std::string> &inputs, const std::string &output,
+                                   const std::map<char, int64_t> &extent)
+{
+    EinsumEquation equation;
+    equation.inputs = inputs;
+    equation.output = output;
+    equation.extent = extent;
+    return equation;
+}
+
+/**
+ * Replays path on the operands of equation and recounts every step with the
+ * cost model of computeEinsumPath(); returns the recounted flops.
+ */
+static double recount(const EinsumEquation &equation, const EinsumPath &path, const std::string &what)
+{
+    std::vector<std::string> operands = equation.inputs;
+    double flops = 0, largest = 0;
+    for (size_t i = 0; i < path.steps.size(); ++i)
+    {
+        const EinsumPathStep &step = path.steps[i];
+        const bool isFinal = (i + 1 == path.steps.size());
+        const auto arrow = step.equation.find("->");
+        const std::string lhs = step.equation.substr(0, arrow);
+        const std::string out = step.equation.substr(arrow + 2);
+        const auto comma = lhs.find(',');
+        std::vector<std::string> terms{lhs.substr(0, comma)};
+        if (comma != std::string::npos) terms.push_back(lhs.substr(comma + 1));
+
+        EXPECT(terms.size() == step.operands.size(), what.c_str());
+        std::string all;
+        for (size_t k = 0; k < terms.size() && k < step.operands.size(); ++k)
+        {
+            EXPECT(step.operands[k] < static_cast<int>(operands.size()) &&
+                   operands[step.operands[k]] == terms[k], what.c_str());
+            all += terms[k];
+        }
+        double size = 1, outputSize = 1;
+        bool summed = false;
+        for (const auto &it : equation.extent)
+        {
+            if (all.find(it.first) == std::string::npos) continue;
+            size *= static_cast<double>(it.second);
+            if (out.find(it.first) == std::string::npos) summed = true;
+            else outputSize *= static_cast<double>(it.second);
+        }
+        const double stepFlops = (terms.size() == 1) ? size : size * (summed ? 2 : 1);
+        EXPECT(same(step.flops, stepFlops), what.c_str());
+        EXPECT(same(step.outputSize, outputSize), what.c_str());
+        flops += stepFlops;
+        if (! isFinal) largest = std::max(largest, outputSize);
+
+        for (auto it = step.operands.rbegin(); it != step.operands.rend(); ++it) operands.erase(operands.begin() + *it);
+        operands.push_back(out);
+    }
+    EXPECT(operands.size() == 1 && operands[0] == equation.output, what.c_str());
+    EXPECT(same(path.flops, flops), what.c_str());
+    EXPECT(same(path.largestIntermediate, largest), what.c_str());
+    return flops;
+}
+
+static void checkBoth(const EinsumEquation &equation, double memoryLimit = 0)
+{
+    const std::string what = equation.toString();
+    EinsumPath greedy, optimal;
+    EXPECT(computeEinsumPath(equation, EinsumPathAlgo::GREEDY, greedy), what.c_str());
+    EXPECT(computeEinsumPath(equation, EinsumPathAlgo::OPTIMAL, optimal), what.c_str());
+    const double greedyFlops = recount(equation, greedy, what + " (greedy)");
+    const double optimalFlops = recount(equation, optimal, what + " (optimal)");
+    EXPECT(optimalFlops <= greedyFlops * (1 + 1e-9), what.c_str());
+
+    if (memoryLimit > 0)
+    {
+        EinsumPath limited;
+        if (computeEinsumPath(equation, EinsumPathAlgo::OPTIMAL, limited, memoryLimit))
+        {
+            recount(equation, limited, what + " (optimal, limited)");
+            EXPECT(limited.largestIntermediate <= memoryLimit, what.c_str());
+            EXPECT(limited.flops >= optimalFlops * (1 - 1e-9), what.c_str());
+        }
+    }
+}
+
+static void checkFixed()
+{
+    // summed modes private to one operand: the optimal planner used to drop
+    // them for free and report less than the emitted steps cost
+    const EinsumEquation chain = makeEquation({"ij", "jk", "kl"}, "", {{'i', 2}, {'j', 3}, {'k', 4}, {'l', 5}});
+    checkBoth(chain);
+    EinsumPath path;
+    computeEinsumPath(chain, EinsumPathAlgo::OPTIMAL, path);
+    EXPECT(same(path.flops, recount(chain, path, "ij,jk,kl->")), "ij,jk,kl->");
+
+    checkBoth(makeEquation({"ab", "bc", "cd", "de"}, "ae", {{'a', 10}, {'b', 100}, {'c', 5}, {'d', 200}, {'e', 3}}));
+    checkBoth(makeEquation({"abx", "bcy", "cd"}, "ad", {{'a', 7}, {'b', 8}, {'c', 9}, {'d', 2}, {'x', 30}, {'y', 40}}));
+    checkBoth(makeEquation({"ij", "kl"}, "ijkl", {{'i', 2}, {'j', 3}, {'k', 4}, {'l', 5}}));
+    checkBoth(makeEquation({"ij"}, "i", {{'i', 2}, {'j', 3}}));
+}
+
+static void checkRandom()
+{
+    std::mt19937 rng(1234);
+    const std::string pool = "abcdefgh";
+    for (int trial = 0; trial < 2000; ++trial)
+    {
+        const int numOperands = 2 + static_cast<int>(rng() % 5);
+        std::map<char, int64_t> extent;
+        std::vector<std::string> inputs;
+        for (int i = 0; i < numOperands; ++i)
+        {
+            std::string modes;
+            const int rank = 1 + static_cast<int>(rng() % 3);
+            for (int k = 0; k < rank; ++k)
+            {
+                const char c = pool[rng() % pool.size()];
+                if (modes.find(c) != std::string::npos) continue;
+                modes += c;
+                if (! extent.count(c)) extent[c] = 1 + static_cast<int64_t>(rng() % 6);
+            }
+            inputs.push_back(modes);
+        }
+        std::string output;
+        for (const auto &it : extent)
+        {
+            if (rng() % 3 == 0) output += it.first;
+        }
+        checkBoth(makeEquation(inputs, output, extent), 20);
+    }
+}
+
+int main()
+{
+    checkFixed();
+    checkRandom();
+    printf("einsum path check: %s\n", failures ? "FAILED" : "ok");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
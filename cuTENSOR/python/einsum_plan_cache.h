@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION & AFFILIATES.  All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  - Neither the name(s) of the copyright holder(s) nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/**
+ * Host-only building blocks for caching einsum plans across calls.
+ *
+ * Nothing in this file depends on CUDA or cuTENSOR: the cache is
+ * parameterized on the value it stores, so the keying and eviction logic can
+ * be exercised with any host-side value type (e.g. a mock plan).
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Uniquely identifies a contraction/reduction plan.
+ *
+ * Two einsum calls that produce equal keys can share the same descriptors and
+ * plan. Modes are stored after the equation has been parsed, so "ij,jk->ik"
+ * and "ab,bc->ac" map to different keys even though they are equivalent; this
+ * is intentional since it keeps the key cheap to build.
+ */
+struct EinsumPlanKey
+{
+    static const int kNumOperands = 3; // A, B, C
+
+    const void* handle = nullptr;
+    int32_t dataType = 0;
+    int32_t computeType = 0;
+    int32_t opA = 0;
+    int32_t opB = 0;
+    std::vector<int32_t> modes[kNumOperands];
+    std::vector<int64_t> extents[kNumOperands];
+    std::vector<int64_t> strides[kNumOperands]; // empty => packed
+    uint32_t alignment[kNumOperands] = {0, 0, 0};
+
+    bool operator==(const EinsumPlanKey &other) const
+    {
+        if (handle != other.handle ||
+            dataType != other.dataType ||
+            computeType != other.computeType ||
+            opA != other.opA ||
+            opB != other.opB)
+        {
+            return false;
+        }
+        for (int i = 0; i < kNumOperands; ++i)
+        {
+            if (alignment[i] != other.alignment[i] ||
+                modes[i] != other.modes[i] ||
+                extents[i] != other.extents[i] ||
+                strides[i] != other.strides[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+struct EinsumPlanKeyHash
+{
+    size_t operator()(const EinsumPlanKey &key) const
+    {
+        // FNV-1a over all fields
+        uint64_t hash = 14695981039346656037ULL;
+        auto combine = [&hash](uint64_t value)
+        {
+            hash ^= value;
+            hash *= 1099511628211ULL;
+        };
+        combine(reinterpret_cast<uintptr_t>(key.handle));
+        combine(static_cast<uint64_t>(key.dataType));
+        combine(static_cast<uint64_t>(key.computeType));
+        combine(static_cast<uint64_t>(key.opA));
+        combine(static_cast<uint64_t>(key.opB));
+        for (int i = 0; i < EinsumPlanKey::kNumOperands; ++i)
+        {
+            combine(key.alignment[i]);
+            combine(key.modes[i].size());
+            for (auto mode : key.modes[i]) combine(static_cast<uint64_t>(mode));
+            for (auto extent : key.extents[i]) combine(static_cast<uint64_t>(extent));
+            combine(key.strides[i].size());
+            for (auto stride : key.strides[i]) combine(static_cast<uint64_t>(stride));
+        }
+        return static_cast<size_t>(hash);
+    }
+};
+
+/**
+ * Returns the largest power-of-two alignment (capped at maxAlignment) of ptr.
+ *
+ * cuTENSOR's alignment requirement only depends on the pointer's alignment
+ * (for a fixed descriptor), so this is sufficient to key on without having to
+ * query the library for every call.
+ */
+inline uint32_t pointerAlignment(const void* ptr, uint32_t maxAlignment = 256)
+{
+    const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+    uint32_t alignment = 1;
+    while (alignment < maxAlignment && (address % (2 * alignment)) == 0)
+    {
+        alignment *= 2;
+    }
+    return alignment;
+}
+
+struct PlanCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t size = 0;
+    size_t capacity = 0;
+};
+
+/**
+ * Thread-safe, capacity-bounded LRU cache.
+ *
+ * \tparam Key   key type (must be equality comparable)
+ * \tparam Value value type (must be copyable); lookups return a copy so that
+ *               callers never hold a reference into the cache
+ * \tparam Hash  hash functor for Key
+ */
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruPlanCache
+{
+    public:
+    explicit LruPlanCache(size_t capacity) : capacity_(capacity) {}
+
+    LruPlanCache(const LruPlanCache&) = delete;
+    LruPlanCache& operator=(const LruPlanCache&) = delete;
+
+    /**
+     * Looks up key and, on a hit, marks the entry as most-recently used.
+     *
+     * \param[in] key
+     * \param[out] value is only written on a hit
+     * \returns true on a hit
+     */
+    bool find(const Key &key, Value &value)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it == index_.end())
+        {
+            ++stats_.misses;
+            return false;
+        }
+        ++stats_.hits;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        value = it->second->second;
+        return true;
+    }
+
+    /**
+     * Inserts (or replaces) key; evicts the least-recently used entries if the
+     * capacity is exceeded. A capacity of zero disables caching entirely.
+     */
+    void insert(const Key &key, const Value &value)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (capacity_ == 0)
+        {
+            return;
+        }
+        auto it = index_.find(key);
+        if (it != index_.end())
+        {
+            it->second->second = value;
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return;
+        }
+        entries_.emplace_front(key, value);
+        index_.emplace(key, entries_.begin());
+        evictLocked();
+    }
+
+    void setCapacity(size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = capacity;
+        evictLocked();
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index_.clear();
+        entries_.clear();
+    }
+
+    void resetStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.hits = 0;
+        stats_.misses = 0;
+        stats_.evictions = 0;
+    }
+
+    PlanCacheStats getStats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        PlanCacheStats stats = stats_;
+        stats.size = entries_.size();
+        stats.capacity = capacity_;
+        return stats;
+    }
+
+    private:
+    typedef std::list<std::pair<Key, Value>> EntryList;
+
+    void evictLocked()
+    {
+        while (entries_.size() > capacity_)
+        {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+            ++stats_.evictions;
+        }
+    }
+
+    mutable std::mutex mutex_;
+    size_t capacity_;
+    EntryList entries_; // front == most-recently used
+    std::unordered_map<Key, typename EntryList::iterator, Hash> index_;
+    PlanCacheStats stats_;
+};
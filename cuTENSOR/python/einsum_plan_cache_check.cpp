@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION & AFFILIATES.  All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  - Neither the name(s) of the copyright holder(s) nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// CPU-only check of the einsum plan cache (einsum_plan_cache.h).
+//
+// Keys that differ in any field (strides, alignment, data type, modes,
+// extents, operators, handle) must compare unequal, equal keys must hash
+// equally, and the LRU cache must evict the least-recently used entry under
+// capacity pressure, with lookups and replacements refreshing an entry.
+//
+// Build: g++ -O2 -std=c++11 -pthread einsum_plan_cache_check.cpp -o einsum_plan_cache_check
+// Usage: ./einsum_plan_cache_check
+
+#include "einsum_plan_cache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+static int failures = 0;
+
+#define EXPECT(cond, what)                                          \
+    do                                                              \
+    {                                                               \
+        if (!(cond))                                                \
+        {                                                           \
+            printf("FAILED: %s: %s (line %d)\n", what, #cond, __LINE__); \
+            failures++;                                             \
+        }                                                           \
+    } while (0)
+
+// a plan of "ij,jk->ik" on packed 64x32 and 32x16 float tensors
+static EinsumPlanKey makeKey()
+{
+    EinsumPlanKey key;
+    key.handle = reinterpret_cast<const void*>(0x1000);
+    key.dataType = 0;
+    key.computeType = 4;
+    key.modes[0] = {'i', 'j'};
+    key.modes[1] = {'j', 'k'};
+    key.modes[2] = {'i', 'k'};
+    key.extents[0] = {64, 32};
+    key.extents[1] = {32, 16};
+    key.extents[2] = {64, 16};
+    key.alignment[0] = key.alignment[1] = key.alignment[2] = 256;
+    return key;
+}
+
+static void checkKeys()
+{
+    const EinsumPlanKeyHash hash;
+    const EinsumPlanKey key = makeKey();
+    const EinsumPlanKey same = makeKey();
+    EXPECT(key == same, "equal keys");
+    EXPECT(hash(key) == hash(same), "equal keys hash equally");
+
+    // each variant differs from key in one field
+    std::vector<std::pair<std::string, EinsumPlanKey>> variants;
+    EinsumPlanKey k;
+
+    k = makeKey(); k.strides[0] = {32, 1};
+    variants.push_back({"explicit strides", k});
+    k = makeKey(); k.strides[0] = {1, 64};
+    variants.push_back({"transposed strides", k});
+    k = makeKey(); k.strides[1] = {16, 1};
+    variants.push_back({"strides of B", k});
+    k = makeKey(); k.alignment[1] = 128;
+    variants.push_back({"alignment of B", k});
+    k = makeKey(); k.alignment[2] = 16;
+    variants.push_back({"alignment of C", k});
+    k = makeKey(); k.dataType = 1;
+    variants.push_back({"data type", k});
+    k = makeKey(); k.computeType = 2;
+    variants.push_back({"compute type", k});
+    k = makeKey(); k.opA = 1;
+    variants.push_back({"operator of A", k});
+    k = makeKey(); k.handle = reinterpret_cast<const void*>(0x2000);
+    variants.push_back({"handle", k});
+    k = makeKey(); k.modes[2] = {'k', 'i'};
+    variants.push_back({"output modes", k});
+    k = makeKey(); k.extents[0] = {64, 33};
+    variants.push_back({"extents", k});
+    // the same values split differently between modes and extents
+    k = makeKey(); k.modes[0].push_back('l'); k.extents[0].push_back(1);
+    variants.push_back({"extra mode", k});
+
+    for (size_t i = 0; i < variants.size(); ++i)
+    {
+        const std::string what = variants[i].first;
+        EXPECT(!(variants[i].second == key), what.c_str());
+        EXPECT(hash(variants[i].second) != hash(key), (what + " hash").c_str());
+        for (size_t j = i + 1; j < variants.size(); ++j)
+        {
+            EXPECT(!(variants[i].second == variants[j].second), (what + " vs " + variants[j].first).c_str());
+        }
+    }
+
+    // packed strides are empty, not spelled out
+    k = makeKey(); k.strides[0] = {};
+    EXPECT(k == key && hash(k) == hash(key), "empty strides");
+
+    EXPECT(pointerAlignment(reinterpret_cast<const void*>(0x1000)) == 256, "alignment capped");
+    EXPECT(pointerAlignment(reinterpret_cast<const void*>(0x1010)) == 16, "16-byte alignment");
+    EXPECT(pointerAlignment(reinterpret_cast<const void*>(0x1003)) == 1, "odd address");
+}
+
+typedef LruPlanCache<EinsumPlanKey, int, EinsumPlanKeyHash> Cache;
+
+static EinsumPlanKey keyOf(int i)
+{
+    EinsumPlanKey key = makeKey();
+    key.extents[0][0] = 64 + i;
+    key.extents[2][0] = 64 + i;
+    return key;
+}
+
+static void checkEviction()
+{
+    Cache cache(3);
+    int value = -1;
+    for (int i = 0; i < 3; ++i)
+    {
+        cache.insert(keyOf(i), i);
+    }
+    // 0 becomes the most recently used, so 1 is evicted next
+    EXPECT(cache.find(keyOf(0), value) && value == 0, "hit");
+    cache.insert(keyOf(3), 3);
+    EXPECT(!cache.find(keyOf(1), value), "least recently used evicted");
+    EXPECT(cache.find(keyOf(0), value) && value == 0, "refreshed entry kept");
+    EXPECT(cache.find(keyOf(2), value) && value == 2, "entry kept");
+    EXPECT(cache.find(keyOf(3), value) && value == 3, "new entry");
+
+    // replacing refreshes the entry: order is now 2, 0, 3 from oldest
+    cache.insert(keyOf(2), 20);
+    cache.insert(keyOf(4), 4);
+    cache.insert(keyOf(5), 5);
+    EXPECT(!cache.find(keyOf(0), value), "evicted second");
+    EXPECT(!cache.find(keyOf(3), value), "evicted third");
+    EXPECT(cache.find(keyOf(2), value) && value == 20, "replaced value");
+
+    PlanCacheStats stats = cache.getStats();
+    EXPECT(stats.size == 3 && stats.capacity == 3, "size");
+    EXPECT(stats.evictions == 3, "evictions counted");
+    EXPECT(stats.hits == 5 && stats.misses == 3, "hits and misses counted");
+
+    // shrinking evicts from the oldest end: 4, 5, 2 -> 2
+    cache.setCapacity(1);
+    EXPECT(cache.getStats().size == 1, "shrunk");
+    EXPECT(cache.find(keyOf(2), value), "most recent kept on shrink");
+
+    cache.setCapacity(0);
+    cache.insert(keyOf(6), 6);
+    EXPECT(cache.getStats().size == 0, "capacity 0 disables the cache");
+
+    cache.setCapacity(8);
+    cache.insert(keyOf(7), 7);
+    cache.clear();
+    EXPECT(!cache.find(keyOf(7), value) && cache.getStats().size == 0, "clear");
+    cache.resetStats();
+    stats = cache.getStats();
+    EXPECT(stats.hits == 0 && stats.misses == 0 && stats.evictions == 0, "reset stats");
+}
+
+// several threads share a small cache; every hit must return the value that
+// was inserted for its key
+static void checkThreads()
+{
+    Cache cache(16);
+    const int kThreads = 4;
+    std::vector<std::thread> threads;
+    std::vector<int> wrong(kThreads, 0);
+    for (int t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&cache, &wrong, t]()
+        {
+            for (int i = 0; i < 20000; ++i)
+            {
+                const int id = (i * 7 + t) % 40;
+                int value = -1;
+                if (cache.find(keyOf(id), value))
+                {
+                    wrong[t] += value != id;
+                }
+                else
+                {
+                    cache.insert(keyOf(id), id);
+                }
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    int total = 0;
+    for (int w : wrong) total += w;
+    EXPECT(total == 0, "concurrent lookups");
+    EXPECT(cache.getStats().size <= 16, "capacity respected");
+}
+
+int main()
+{
+    checkKeys();
+    checkEviction();
+    checkThreads();
+    printf("einsum plan cache check: %s\n", failures ? "FAILED" : "ok");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION & AFFILIATES.  All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  - Neither the name(s) of the copyright holder(s) nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/**
+ * Stream-ordered workspace arena for einsum calls.
+ *
+ * Each (device, stream) pair owns a single scratch buffer. Work submitted to
+ * one stream executes in order, so consecutive einsums on the same stream can
+ * safely reuse that buffer; it only grows (stream-ordered) when a plan needs
+ * more workspace than any previous one.
+ *
+ * acquire() returns a Lease that keeps its buffer alive until the caller has
+ * enqueued its work and drops the lease. If another thread grows the buffer
+ * of the same stream (or calls release()) in the meantime, the old buffer is
+ * retired and freed, stream-ordered, when its last lease is dropped, i.e.
+ * after the work that uses it was enqueued.
+ *
+ * The arena is parameterized on a Backend that provides
+ *
+ *     typedef ... Stream;
+ *     int   device();                              // current device
+ *     void* allocate(size_t bytes, Stream stream); // nullptr on failure
+ *     void  deallocate(void* ptr, Stream stream);
+ *
+ * which keeps the allocator logic testable with HostWorkspaceBackend.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <utility>
+
+struct WorkspaceArenaStats
+{
+    size_t reservedBytes = 0;  // currently allocated across all streams
+    size_t highWaterMark = 0;  // largest workspace ever requested
+    uint64_t allocations = 0;  // calls into the backend's allocate()
+    uint64_t reuses = 0;       // requests served without allocating
+};
+
+template<typename Backend>
+class WorkspaceArena
+{
+    struct Block;
+
+    public:
+    typedef typename Backend::Stream Stream;
+
+    /**
+     * A workspace buffer in use; the buffer is not freed while the lease is
+     * alive. Drop the lease once the work using it has been enqueued.
+     */
+    class Lease
+    {
+        public:
+        Lease() = default;
+        Lease(Lease &&other) noexcept : arena_(other.arena_), block_(other.block_)
+        {
+            other.arena_ = nullptr;
+            other.block_ = nullptr;
+        }
+        Lease& operator=(Lease &&other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                std::swap(arena_, other.arena_);
+                std::swap(block_, other.block_);
+            }
+            return *this;
+        }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease() { reset(); }
+
+        void* get() const { return block_ != nullptr ? block_->ptr : nullptr; }
+        size_t size() const { return block_ != nullptr ? block_->size : 0; }
+
+        void reset()
+        {
+            if (block_ != nullptr)
+            {
+                arena_->drop(block_);
+            }
+            arena_ = nullptr;
+            block_ = nullptr;
+        }
+
+        private:
+        friend class WorkspaceArena;
+        Lease(WorkspaceArena* arena, Block* block) : arena_(arena), block_(block) {}
+
+        WorkspaceArena* arena_ = nullptr;
+        Block* block_ = nullptr;
+    };
+
+    /**
+     * \param[in] granularity allocations are rounded up to a multiple of this
+     *            (avoids re-growing for slightly larger plans)
+     */
+    explicit WorkspaceArena(Backend backend = Backend(), size_t granularity = 2ULL * 1024ULL * 1024ULL) :
+        backend_(backend), granularity_(granularity) {}
+
+    /**
+     * Frees the buffers; all leases must have been dropped.
+     */
+    ~WorkspaceArena() { release(); }
+
+    WorkspaceArena(const WorkspaceArena&) = delete;
+    WorkspaceArena& operator=(const WorkspaceArena&) = delete;
+
+    /**
+     * Returns a lease on a buffer of at least `bytes` for work enqueued on
+     * `stream`.
+     *
+     * \returns an empty lease (get() == nullptr) for bytes == 0 or if the
+     *          allocation failed
+     */
+    Lease acquire(size_t bytes, Stream stream)
+    {
+        if (bytes == 0)
+        {
+            return Lease();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (bytes > stats_.highWaterMark)
+        {
+            stats_.highWaterMark = bytes;
+        }
+
+        Block* &block = blocks_[std::make_pair(backend_.device(), stream)];
+        if (block != nullptr && block->size >= bytes)
+        {
+            ++stats_.reuses;
+            ++block->users;
+            return Lease(this, block);
+        }
+
+        if (block != nullptr)
+        {
+            // freed after all prior work on this stream, or once the
+            // leases still using it are dropped
+            retireLocked(block);
+            block = nullptr;
+        }
+
+        const size_t size = ((bytes + granularity_ - 1) / granularity_) * granularity_;
+        void* ptr = backend_.allocate(size, stream);
+        if (ptr == nullptr)
+        {
+            return Lease();
+        }
+        block = new Block();
+        block->ptr = ptr;
+        block->size = size;
+        block->stream = stream;
+        block->users = 1;
+        stats_.reservedBytes += size;
+        ++stats_.allocations;
+        return Lease(this, block);
+    }
+
+    /**
+     * Frees all buffers (stream-ordered); buffers that are still leased are
+     * freed when their last lease is dropped. The high-water mark is kept.
+     */
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto &it : blocks_)
+        {
+            if (it.second != nullptr)
+            {
+                retireLocked(it.second);
+            }
+        }
+        blocks_.clear();
+    }
+
+    WorkspaceArenaStats getStats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    private:
+    struct Block
+    {
+        void* ptr = nullptr;
+        size_t size = 0;
+        Stream stream = Stream();
+        int users = 0;          // live leases
+        bool retired = false;   // no longer in blocks_, free with the last lease
+    };
+
+    void retireLocked(Block* block)
+    {
+        if (block->users == 0)
+        {
+            freeLocked(block);
+        }
+        else
+        {
+            block->retired = true;
+        }
+    }
+
+    void freeLocked(Block* block)
+    {
+        backend_.deallocate(block->ptr, block->stream);
+        stats_.reservedBytes -= block->size;
+        delete block;
+    }
+
+    void drop(Block* block)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--block->users == 0 && block->retired)
+        {
+            freeLocked(block);
+        }
+    }
+
+    mutable std::mutex mutex_;
+    Backend backend_;
+    size_t granularity_;
+    std::map<std::pair<int, Stream>, Block*> blocks_;
+    WorkspaceArenaStats stats_;
+};
+
+/**
+ * Backend that serves workspaces from host memory.
+ */
+struct HostWorkspaceBackend
+{
+    typedef const void* Stream;
+
+    int device() const { return 0; }
+    void* allocate(size_t bytes, Stream) { return malloc(bytes); }
+    void deallocate(void* ptr, Stream) { free(ptr); }
+};
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION & AFFILIATES.  All rights reserved.
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  - Neither the name(s) of the copyright holder(s) nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// CPU-only check of the einsum workspace arena (einsum_workspace.h).
+//
+// Runs the arena on host memory: buffers are reused per stream and only grow
+// when needed, a buffer that is still leased is not freed when another
+// caller on the same stream grows it or calls release(), and threads that
+// share one stream never see their buffer freed under them. Every buffer is
+// freed exactly once.
+//
+// Build: g++ -O2 -std=c++11 -pthread einsum_workspace_check.cpp -o einsum_workspace_check
+// Usage: ./einsum_workspace_check
+
+#include "einsum_workspace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+#define EXPECT(cond, what)                                          \
+    do                                                              \
+    {                                                               \
+        if (!(cond))                                                \
+        {                                                           \
+            printf("FAILED: %s: %s (line %d)\n", what, #cond, __LINE__); \
+            failures++;                                             \
+        }                                                           \
+    } while (0)
+
+// host memory, with a record of the live buffers
+struct CountingBackend
+{
+    typedef const void* Stream;
+
+    struct Record
+    {
+        std::mutex mutex;
+        std::set<void*> live;
+        uint64_t allocations = 0;
+        uint64_t deallocations = 0;
+        uint64_t doubleFrees = 0;
+        bool fail = false;
+    };
+
+    Record* record;
+
+    int device() const { return 0; }
+
+    void* allocate(size_t bytes, Stream stream)
+    {
+        std::lock_guard<std::mutex> lock(record->mutex);
+        if (record->fail)
+        {
+            return nullptr;
+        }
+        void* ptr = HostWorkspaceBackend().allocate(bytes, stream);
+        record->live.insert(ptr);
+        ++record->allocations;
+        return ptr;
+    }
+
+    void deallocate(void* ptr, Stream stream)
+    {
+        std::lock_guard<std::mutex> lock(record->mutex);
+        record->doubleFrees += record->live.erase(ptr) == 0;
+        ++record->deallocations;
+        HostWorkspaceBackend().deallocate(ptr, stream);
+    }
+
+    bool isLive(void* ptr)
+    {
+        std::lock_guard<std::mutex> lock(record->mutex);
+        return record->live.count(ptr) != 0;
+    }
+};
+
+typedef WorkspaceArena<CountingBackend> Arena;
+
+static const size_t kMiB = 1024 * 1024;
+static const void* const kStream0 = reinterpret_cast<const void*>(0x10);
+static const void* const kStream1 = reinterpret_cast<const void*>(0x20);
+
+static void checkReuse()
+{
+    CountingBackend::Record record;
+    {
+        Arena arena(CountingBackend{&record}, 2 * kMiB);
+        void* first = nullptr;
+        {
+            Arena::Lease lease = arena.acquire(kMiB, kStream0);
+            first = lease.get();
+            EXPECT(first != nullptr && lease.size() == 2 * kMiB, "rounded to the granularity");
+        }
+        {
+            Arena::Lease lease = arena.acquire(kMiB + kMiB / 2, kStream0);
+            EXPECT(lease.get() == first, "reused");
+        }
+        {
+            Arena::Lease lease = arena.acquire(3 * kMiB, kStream0);
+            EXPECT(lease.get() != nullptr && lease.size() == 4 * kMiB, "grown");
+            EXPECT(!record.live.count(first), "unleased buffer freed when grown");
+        }
+        {
+            Arena::Lease other = arena.acquire(kMiB, kStream1);
+            EXPECT(other.size() == 2 * kMiB, "one buffer per stream");
+        }
+        EXPECT(!arena.acquire(0, kStream0).get(), "empty lease for 0 bytes");
+
+        WorkspaceArenaStats stats = arena.getStats();
+        EXPECT(stats.reservedBytes == 6 * kMiB, "reserved bytes");
+        EXPECT(stats.highWaterMark == 3 * kMiB, "high-water mark");
+        EXPECT(stats.allocations == 3 && stats.reuses == 1, "allocations and reuses");
+
+        arena.release();
+        EXPECT(record.live.empty() && arena.getStats().reservedBytes == 0, "release frees all");
+
+        record.fail = true;
+        EXPECT(!arena.acquire(kMiB, kStream0).get(), "empty lease on failure");
+        record.fail = false;
+
+        // moves hand the buffer over without dropping it
+        Arena::Lease a = arena.acquire(kMiB, kStream0);
+        void* ptr = a.get();
+        Arena::Lease b(std::move(a));
+        EXPECT(!a.get() && b.get() == ptr, "move constructed");
+        Arena::Lease c;
+        c = std::move(b);
+        arena.release();
+        EXPECT(record.live.count(ptr), "moved lease keeps the buffer");
+        c.reset();
+        EXPECT(!record.live.count(ptr), "freed with the moved lease");
+    }
+    EXPECT(record.live.empty() && record.doubleFrees == 0, "no leaks or double frees");
+}
+
+// two callers on one stream: the second grows the buffer while the first
+// still has to enqueue its work
+static void checkGrowWhileLeased()
+{
+    CountingBackend::Record record;
+    CountingBackend backend{&record};
+    {
+        Arena arena(backend, kMiB);
+        Arena::Lease first = arena.acquire(kMiB, kStream0);
+        void* ptr = first.get();
+        Arena::Lease second = arena.acquire(4 * kMiB, kStream0);
+        EXPECT(second.get() != ptr, "grown buffer is new");
+        EXPECT(backend.isLive(ptr), "leased buffer not freed when grown");
+        memset(ptr, 1, first.size());
+        EXPECT(arena.getStats().reservedBytes == 5 * kMiB, "retired buffer still reserved");
+
+        // a third caller gets the grown buffer, not the retired one
+        Arena::Lease third = arena.acquire(kMiB, kStream0);
+        EXPECT(third.get() == second.get(), "grown buffer reused");
+
+        first.reset();
+        EXPECT(!backend.isLive(ptr), "retired buffer freed with its last lease");
+        EXPECT(arena.getStats().reservedBytes == 4 * kMiB, "reserved bytes after retiring");
+
+        // release() while leased defers the free as well
+        ptr = second.get();
+        arena.release();
+        EXPECT(backend.isLive(ptr), "leased buffer not freed by release()");
+        second.reset();
+        EXPECT(backend.isLive(ptr), "still leased by the third caller");
+        third.reset();
+        EXPECT(!backend.isLive(ptr), "freed with the last lease after release()");
+    }
+    EXPECT(record.live.empty() && record.doubleFrees == 0, "no leaks or double frees");
+}
+
+// threads on one stream acquire growing and shrinking workspaces; the
+// buffer of a stream is shared by its callers (their work is serialized on
+// the stream), so only its lifetime is checked while it is leased
+static void checkThreads()
+{
+    CountingBackend::Record record;
+    CountingBackend backend{&record};
+    int stale = 0;
+    {
+        Arena arena(backend, 4096);
+        const int kThreads = 4;
+        std::vector<std::thread> threads;
+        std::vector<int> staleByThread(kThreads, 0);
+        for (int t = 0; t < kThreads; ++t)
+        {
+            threads.emplace_back([&arena, &backend, &staleByThread, t]()
+            {
+                std::mt19937 rng(t);
+                for (int i = 0; i < 3000; ++i)
+                {
+                    const size_t bytes = 1 + rng() % (64 * 1024 + i * 16);
+                    Arena::Lease lease = arena.acquire(bytes, kStream0);
+                    staleByThread[t] += !backend.isLive(lease.get());
+                    if (i % 500 == 499)
+                    {
+                        arena.release();
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        for (int s : staleByThread) stale += s;
+    }
+    EXPECT(stale == 0, "leased buffers stay allocated");
+    EXPECT(record.live.empty() && record.doubleFrees == 0, "no leaks or double frees");
+    EXPECT(record.allocations == record.deallocations, "every buffer freed once");
+}
+
+int main()
+{
+    checkReuse();
+    checkGrowWhileLeased();
+    checkThreads();
+    printf("einsum workspace check: %s\n", failures ? "FAILED" : "ok");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
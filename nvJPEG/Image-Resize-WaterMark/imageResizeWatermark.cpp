@@ -435,6 +435,24 @@ int processArgs(image_resize_params_t param)
     {
         return error_code;
     }
+
+    if (param.pipeline)
+    {
+        thumbnail_pipeline_params_t pipeline_params;
+        pipeline_params.output_dir = sOutputPath;
+        pipeline_params.quality = resize_quality;
+        pipeline_params.ladder = param.ladder;
+        pipeline_params.width = resizeWidth;
+        pipeline_params.height = resizeHeight;
+        pipeline_params.in_flight = param.in_flight;
+        pipeline_params.batch_size = param.batch_size;
+        pipeline_params.streams = param.streams;
+        pipeline_params.watermark = "NVLogo.jpg";
+        pipeline_params.watermark_alpha = ALPHA_BLEND;
+
+        ThumbnailPipeline pipeline(nvjpeg_handle, pipeline_params);
+        return pipeline.run(inputFiles) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
     for (unsigned int i = 0; i < inputFiles.size(); i++)
     {
         std::string &sFileName = inputFiles[i];
@@ -473,13 +491,21 @@ int main(int argc, const char *argv[])
     (pidx = findParamIndex(argv, argc, "--help")) != -1) {
         std::cout << "Usage: " << argv[0]
           << " -i images-dir  [-o output-dir]"
-             "[-q jpeg-quality][-rw resize-width ] [-rh resize-height]\n";
+             "[-q jpeg-quality][-rw resize-width ] [-rh resize-height]"
+             "[-pipeline][-ladder w1[:q1],w2[:q2],...][-inflight N][-batch N][-streams N]\n";
         std::cout << "Parameters: " << std::endl;
         std::cout << "\timages-dir\t:\tPath to single image or directory of images" << std::endl;
         std::cout << "\toutput-dir\t:\tWrite resized images to this directory [default resize_watermark_output]" << std::endl;
         std::cout << "\tJPEG Quality\t:\tUse image quality [default 85]" << std::endl;
         std::cout << "\tResize Width\t:\t Resize width [default original_img_width/2]" << std::endl;
         std::cout << "\tResize Height\t:\t Resize height [default original_img_height/2]" << std::endl;
+        std::cout << "\tpipeline\t:\tStream the images through read, batched decode, resize, "
+                  << "watermark, encode and write stages" << std::endl;
+        std::cout << "\tladder\t\t:\tDecode once and write a rendition per width (and quality), keeping the aspect ratio;" << std::endl;
+        std::cout << "\t\t\t\teach from the next larger rendition, implies -pipeline" << std::endl;
+        std::cout << "\tinflight\t:\tPipeline: images in flight [default 32]" << std::endl;
+        std::cout << "\tbatch\t\t:\tPipeline: images per decode, resize and encode batch [default 8]" << std::endl;
+        std::cout << "\tstreams\t\t:\tPipeline: CUDA streams (workers) per GPU stage [default 2]" << std::endl;
         return EXIT_SUCCESS;
     }
 
@@ -519,6 +545,31 @@ int main(int argc, const char *argv[])
     params.height = std::atoi(argv[pidx + 1]);
     }
 
+    params.pipeline = findParamIndex(argv, argc, "-pipeline") != -1;
+
+    params.in_flight = 32;
+    if ((pidx = findParamIndex(argv, argc, "-inflight")) != -1) {
+    params.in_flight = std::atoi(argv[pidx + 1]);
+    }
+
+    params.batch_size = 8;
+    if ((pidx = findParamIndex(argv, argc, "-batch")) != -1) {
+    params.batch_size = std::atoi(argv[pidx + 1]);
+    }
+
+    params.streams = 2;
+    if ((pidx = findParamIndex(argv, argc, "-streams")) != -1) {
+    params.streams = std::atoi(argv[pidx + 1]);
+    }
+
+    if ((pidx = findParamIndex(argv, argc, "-ladder")) != -1) {
+    if (parseLadder(argv[pidx + 1], params.ladder)) {
+      std::cout << "Invalid resize ladder: " << argv[pidx + 1] << std::endl;
+      return EXIT_FAILURE;
+    }
+    params.pipeline = true;
+    }
+
     nvjpegDevAllocator_t dev_allocator = {&dev_malloc, &dev_free};
     CHECK_NVJPEG(nvjpegCreate(impl, &dev_allocator, &nvjpeg_handle));
     CHECK_NVJPEG(nvjpegJpegStateCreate(nvjpeg_handle, &nvjpeg_decoder_state));
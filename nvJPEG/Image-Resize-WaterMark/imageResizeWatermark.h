@@ -67,6 +67,8 @@
         }                                                                       \
     }
 
+#include "../../common/thumbnail_pipeline.h"
+
 namespace fs = std::filesystem;
 
 struct image_resize_params_t {
@@ -76,6 +78,11 @@ struct image_resize_params_t {
   int width;
   int height;
   int dev;
+  bool pipeline;          // stream the images through ThumbnailPipeline
+  int in_flight;
+  int batch_size;
+  int streams;
+  std::vector<LadderStep> ladder;  // implies pipeline
 };
 
 
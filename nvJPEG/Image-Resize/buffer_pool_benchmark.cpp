@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// CPU-only check of the buffer pool (common/buffer_pool.h) on the buffer
+// sizes of a thumbnail workload.
+//
+// Every image acquires a decode buffer (3 * width * height), a half size
+// resize buffer and a bitstream buffer, as decodeResizeEncodeOneImage does,
+// from worker threads. Host malloc() stands in for cudaMalloc() and the
+// allocator calls of each pass over the image set are counted. The first
+// pass warms the pool up. With one thread the following passes must not call
+// the allocator at all; with more threads a pass may still allocate when
+// more images of one size class than before happen to be in flight at once,
+// so the calls are only reported. Also reports the time per acquire/release
+// pair and the memory held by the pools against the buffers of the largest
+// image.
+//
+// Build: g++ -O2 -std=c++17 -pthread buffer_pool_benchmark.cpp -o buffer_pool_benchmark
+// Usage: ./buffer_pool_benchmark [-t threads] [-i images] [-p passes]
+
+#include "../../common/buffer_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+struct bench_params_t {
+  int threads = 4;
+  int images = 5000;
+  int passes = 4;
+};
+
+static std::atomic<uint64_t> allocator_calls(0);
+
+static int counting_malloc(void **p, size_t s) {
+  allocator_calls++;
+  *p = malloc(s);
+  return *p ? 0 : 1;
+}
+
+static int counting_free(void *p) {
+  allocator_calls++;
+  free(p);
+  return 0;
+}
+
+struct ImageSize {
+  int width, height;
+  size_t bitstream;
+};
+
+// camera, web and scanned sizes, both orientations
+static std::vector<ImageSize> make_images(int count) {
+  static const int dims[][2] = {{640, 480}, {800, 600}, {1024, 768}, {1280, 720}, {1920, 1080},
+                                {2048, 1536}, {3264, 2448}, {4032, 3024}, {500, 375}, {1200, 1600}};
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> pick(0, sizeof(dims) / sizeof(dims[0]) - 1);
+  std::uniform_real_distribution<double> ratio(0.05, 0.15);
+  std::vector<ImageSize> images(count);
+  for (auto &img : images) {
+    const int d = pick(rng);
+    const bool portrait = rng() & 1;
+    img.width = dims[d][portrait ? 1 : 0];
+    img.height = dims[d][portrait ? 0 : 1];
+    // encoded thumbnails vary in size with the content
+    img.bitstream = static_cast<size_t>(ratio(rng) * 3 * (img.width / 2) * (img.height / 2));
+  }
+  return images;
+}
+
+// processes images[first, last) like decodeResizeEncodeOneImage; returns the
+// number of failed acquisitions
+static int process(const std::vector<ImageSize> &images, size_t first, size_t last,
+                   BufferPool &device_pool, BufferPool &pinned_pool) {
+  int failures = 0;
+  for (size_t i = first; i < last; i++) {
+    const ImageSize &img = images[i];
+    PooledBuffer decoded = device_pool.acquire_image(3 * img.width, img.height);
+    PooledBuffer resized = device_pool.acquire_image(3 * (img.width / 2), img.height / 2);
+    PooledBuffer bitstream = pinned_pool.acquire(img.bitstream);
+    if (!decoded || !resized || !bitstream) {
+      failures++;
+      continue;
+    }
+    // touch the buffers, as the decoder and encoder would
+    decoded.get()[0] = resized.get()[0] = bitstream.get()[0] = 1;
+  }
+  return failures;
+}
+
+int main(int argc, const char *argv[]) {
+  bench_params_t params;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      printf("Usage: %s [-t threads] [-i images] [-p passes]\n", argv[0]);
+      return EXIT_SUCCESS;
+    }
+    if (i + 1 >= argc) break;
+    if (strcmp(argv[i], "-t") == 0) params.threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-i") == 0) params.images = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-p") == 0) params.passes = atoi(argv[++i]);
+  }
+  params.threads = std::max(1, params.threads);
+  params.passes = std::max(2, params.passes);
+
+  const std::vector<ImageSize> images = make_images(params.images);
+  size_t largest = 0;  // bytes one image holds at most
+  for (const auto &img : images) {
+    largest = std::max(largest, BufferPool::size_class(3 * img.width * img.height) +
+                                    BufferPool::size_class(3 * (img.width / 2) * (img.height / 2)) +
+                                    BufferPool::size_class(img.bitstream));
+  }
+
+  BufferPool device_pool(&counting_malloc, &counting_free);
+  BufferPool pinned_pool(&counting_malloc, &counting_free);
+
+  printf("threads: %d, images: %d, passes: %d\n", params.threads, params.images, params.passes);
+  printf("without a pool: %.0f allocator calls per pass\n", 6.0 * images.size());
+
+  int failures = 0;
+  uint64_t steady_calls = 0;
+  double steady_seconds = 0;
+  for (int pass = 0; pass < params.passes; pass++) {
+    const uint64_t calls_before = allocator_calls;
+    std::atomic<int> pass_failures(0);
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < params.threads; t++) {
+      const size_t first = images.size() * t / params.threads;
+      const size_t last = images.size() * (t + 1) / params.threads;
+      workers.emplace_back([&, first, last] {
+        pass_failures += process(images, first, last, device_pool, pinned_pool);
+      });
+    }
+    for (auto &w : workers) w.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const uint64_t calls = allocator_calls - calls_before;
+    printf("pass %d: %llu allocator calls, %.2f ms\n", pass, static_cast<unsigned long long>(calls),
+           seconds * 1e3);
+    if (pass > 0) {
+      steady_calls += calls;
+      steady_seconds += seconds;
+    }
+    failures += pass_failures;
+  }
+  const double pairs = 3.0 * images.size() * (params.passes - 1);
+  printf("steady state: %.1f ns per acquire/release and thread\n",
+         steady_seconds * 1e9 * params.threads / pairs);
+  device_pool.print(std::cout, "Device buffer");
+  pinned_pool.print(std::cout, "Pinned buffer");
+  const size_t held = device_pool.stats().high_water_allocated + pinned_pool.stats().high_water_allocated;
+  printf("held by the pools: %.1f MiB, buffers of the largest image: %.1f MiB\n", held / 1048576.0,
+         largest / 1048576.0);
+
+  if (failures || (params.threads == 1 && steady_calls != 0)) {
+    printf("FAILED: %d failed acquisitions, %llu allocator calls after the first pass\n", failures,
+           static_cast<unsigned long long>(steady_calls));
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
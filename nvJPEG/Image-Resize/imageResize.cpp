@@ -51,7 +51,11 @@ nvjpegJpegEncoding_t nvjpeg_encoding;
 // *****************************************************************************
 // Decode, Resize and Encoder function
 // -----------------------------------------------------------------------------
-int decodeResizeEncodeOneImage(std::string sImagePath, std::string sOutputPath, double &time, int resizeWidth, int resizeHeight, int resize_quality)
+// Device buffers for the decoded and resized images and the pinned buffer
+// for the encoded bitstream come from the pools, so once the image sizes of
+// a run have been seen no further CUDA allocations are made.
+int decodeResizeEncodeOneImage(std::string sImagePath, std::string sOutputPath, double &time, int resizeWidth, int resizeHeight, int resize_quality,
+                               BufferPool &device_pool, BufferPool &pinned_pool)
 {
     // Decode, Encoder format
     nvjpegOutputFormat_t oformat = NVJPEG_OUTPUT_BGR;
@@ -92,9 +96,9 @@ int decodeResizeEncodeOneImage(std::string sImagePath, std::string sOutputPath,
     std::streamsize nSize = oInputStream.tellg();
     oInputStream.seekg(0, std::ios::beg);
 
-    // Image buffers. 
-    unsigned char * pBuffer = NULL; 
-    unsigned char * pResizeBuffer = NULL;
+    // Image buffers, returned to the pools when they go out of scope.
+    PooledBuffer decodeBuffer;
+    PooledBuffer resizeBuffer;
     
     std::vector<char> vBuffer(nSize);
     if (oInputStream.read(vBuffer.data(), nSize))
@@ -144,18 +148,20 @@ int decodeResizeEncodeOneImage(std::string sImagePath, std::string sOutputPath,
             pitchResize = 3 * resizeWidth;
         }
 
-        cudaError_t eCopy = cudaMalloc(&pBuffer, pitchDesc * heights[0]);
-        if (cudaSuccess != eCopy)
+        decodeBuffer = device_pool.acquire_image(pitchDesc, heights[0]);
+        if (!decodeBuffer)
         {
-            std::cerr << "cudaMalloc failed : " << cudaGetErrorString(eCopy) << std::endl;
+            std::cerr << "Cannot allocate the decode buffer: " << cudaGetErrorString(cudaGetLastError()) << std::endl;
             return EXIT_FAILURE;
         }
-        cudaError_t eCopy1 = cudaMalloc(&pResizeBuffer, pitchResize * resizeHeight);
-        if (cudaSuccess != eCopy1)
+        resizeBuffer = device_pool.acquire_image(pitchResize, resizeHeight);
+        if (!resizeBuffer)
         {
-            std::cerr << "cudaMalloc failed : " << cudaGetErrorString(eCopy) << std::endl;
+            std::cerr << "Cannot allocate the resize buffer: " << cudaGetErrorString(cudaGetLastError()) << std::endl;
             return EXIT_FAILURE;
         }
+        unsigned char * pBuffer = decodeBuffer.get();
+        unsigned char * pResizeBuffer = resizeBuffer.get();
 
 
         imgDesc.channel[0] = pBuffer;
@@ -248,7 +254,6 @@ int decodeResizeEncodeOneImage(std::string sImagePath, std::string sOutputPath,
             NULL));
 
         // retrive the encoded bitstream for file writing
-        std::vector<unsigned char> obuffer;
         size_t length;
         CHECK_NVJPEG(nvjpegEncodeRetrieveBitstream(
             nvjpeg_handle,
@@ -257,12 +262,17 @@ int decodeResizeEncodeOneImage(std::string sImagePath, std::string sOutputPath,
             &length,
             NULL));
 
-        obuffer.resize(length);
+        PooledBuffer obuffer = pinned_pool.acquire(length);
+        if (!obuffer)
+        {
+            std::cerr << "Cannot allocate the bitstream buffer: " << cudaGetErrorString(cudaGetLastError()) << std::endl;
+            return EXIT_FAILURE;
+        }
 
         CHECK_NVJPEG(nvjpegEncodeRetrieveBitstream(
             nvjpeg_handle,
             nvjpeg_encoder_state,
-            obuffer.data(),
+            obuffer.get(),
             &length,
             NULL));
 
@@ -289,15 +299,14 @@ int decodeResizeEncodeOneImage(std::string sImagePath, std::string sOutputPath,
 
         std::cout << "Writing JPEG file: " << output_filename << std::endl;
         std::ofstream outputFile(output_filename.c_str(), std::ios::out | std::ios::binary);
-        outputFile.write(reinterpret_cast<const char *>(obuffer.data()), static_cast<int>(length));
+        outputFile.write(obuffer.get<const char>(), static_cast<int>(length));
     }
-    // Free memory
-    CHECK_CUDA(cudaFree(pBuffer));
-    CHECK_CUDA(cudaFree(pResizeBuffer));
 
     // get timing
     CHECK_CUDA(cudaEventElapsedTime(&resize_time, start, stop));
     time = (double)resize_time;
+    CHECK_CUDA(cudaEventDestroy(start));
+    CHECK_CUDA(cudaEventDestroy(stop));
 
     return EXIT_SUCCESS;
 }
@@ -323,12 +332,34 @@ int processArgs(image_resize_params_t param)
     {
         return error_code;
     }
+
+    if (param.pipeline)
+    {
+        thumbnail_pipeline_params_t pipeline_params;
+        pipeline_params.output_dir = sOutputPath;
+        pipeline_params.quality = resize_quality;
+        pipeline_params.ladder = param.ladder;
+        pipeline_params.width = resizeWidth;
+        pipeline_params.height = resizeHeight;
+        pipeline_params.in_flight = param.in_flight;
+        pipeline_params.batch_size = param.batch_size;
+        pipeline_params.streams = param.streams;
+
+        ThumbnailPipeline pipeline(nvjpeg_handle, pipeline_params);
+        return pipeline.run(inputFiles) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // shared by the decode, resize and encode stages of all images
+    BufferPool device_pool(&dev_malloc, &dev_free);
+    BufferPool pinned_pool(&pinned_malloc, &pinned_free);
+
     for (unsigned int i = 0; i < inputFiles.size(); i++)
     {
         std::string &sFileName = inputFiles[i];
         std::cout << "Processing file: " << sFileName << std::endl;
 
-        int image_error_code = decodeResizeEncodeOneImage(sFileName, sOutputPath, decode_time, resizeWidth, resizeHeight, resize_quality);
+        int image_error_code = decodeResizeEncodeOneImage(sFileName, sOutputPath, decode_time, resizeWidth, resizeHeight, resize_quality,
+                                                            device_pool, pinned_pool);
 
         if (image_error_code)
         {
@@ -346,6 +377,8 @@ int processArgs(image_resize_params_t param)
     std::cout << "Total images resized: " << total_images << std::endl;
     std::cout << "Total time spent on resizing: " << total_time << " (ms)" << std::endl;
     std::cout << "Avg time/image: " << total_time/total_images << " (ms)" << std::endl;
+    device_pool.print(std::cout, "Device buffer");
+    pinned_pool.print(std::cout, "Pinned buffer");
     std::cout << "------------------------------------------------------------- " << std::endl;
     return EXIT_SUCCESS;
 }
@@ -361,13 +394,21 @@ int main(int argc, const char *argv[])
     (pidx = findParamIndex(argv, argc, "--help")) != -1) {
         std::cout << "Usage: " << argv[0]
           << " -i images-dir  [-o output-dir]"
-             "[-q jpeg-quality][-rw resize-width ] [-rh resize-height]\n";
+             "[-q jpeg-quality][-rw resize-width ] [-rh resize-height]"
+             "[-pipeline][-ladder w1[:q1],w2[:q2],...][-inflight N][-batch N][-streams N]\n";
         std::cout << "Parameters: " << std::endl;
         std::cout << "\timages-dir\t:\tPath to single image or directory of images" << std::endl;
         std::cout << "\toutput-dir\t:\tWrite resized images to this directory [default resize_output]" << std::endl;
         std::cout << "\tJPEG Quality\t:\tUse image quality [default 85]" << std::endl;
         std::cout << "\tResize Width\t:\t Resize width [default original_img_width/2]" << std::endl;
         std::cout << "\tResize Height\t:\t Resize height [default original_img_height/2]" << std::endl;
+        std::cout << "\tpipeline\t:\tStream the images through read, batched decode, resize, "
+                  << "encode and write stages" << std::endl;
+        std::cout << "\tladder\t\t:\tDecode once and write a rendition per width (and quality), keeping the aspect ratio;" << std::endl;
+        std::cout << "\t\t\t\teach from the next larger rendition, implies -pipeline" << std::endl;
+        std::cout << "\tinflight\t:\tPipeline: images in flight [default 32]" << std::endl;
+        std::cout << "\tbatch\t\t:\tPipeline: images per decode, resize and encode batch [default 8]" << std::endl;
+        std::cout << "\tstreams\t\t:\tPipeline: CUDA streams (workers) per GPU stage [default 2]" << std::endl;
         return EXIT_SUCCESS;
     }
 
@@ -407,6 +448,31 @@ int main(int argc, const char *argv[])
     params.height = std::atoi(argv[pidx + 1]);
     }
 
+    params.pipeline = findParamIndex(argv, argc, "-pipeline") != -1;
+
+    params.in_flight = 32;
+    if ((pidx = findParamIndex(argv, argc, "-inflight")) != -1) {
+    params.in_flight = std::atoi(argv[pidx + 1]);
+    }
+
+    params.batch_size = 8;
+    if ((pidx = findParamIndex(argv, argc, "-batch")) != -1) {
+    params.batch_size = std::atoi(argv[pidx + 1]);
+    }
+
+    params.streams = 2;
+    if ((pidx = findParamIndex(argv, argc, "-streams")) != -1) {
+    params.streams = std::atoi(argv[pidx + 1]);
+    }
+
+    if ((pidx = findParamIndex(argv, argc, "-ladder")) != -1) {
+    if (parseLadder(argv[pidx + 1], params.ladder)) {
+      std::cout << "Invalid resize ladder: " << argv[pidx + 1] << std::endl;
+      return EXIT_FAILURE;
+    }
+    params.pipeline = true;
+    }
+
     nvjpegDevAllocator_t dev_allocator = {&dev_malloc, &dev_free};
     CHECK_NVJPEG(nvjpegCreate(impl, &dev_allocator, &nvjpeg_handle));
     CHECK_NVJPEG(nvjpegJpegStateCreate(nvjpeg_handle, &nvjpeg_decoder_state));
@@ -45,6 +45,8 @@
 #include <nvjpeg.h>
 #include <nppi_geometry_transforms.h>
 
+#include "../../common/buffer_pool.h"
+
 
 #define CHECK_CUDA(call)                                                        \
     {                                                                           \
@@ -66,6 +68,8 @@
         }                                                                       \
     }
 
+#include "../../common/thumbnail_pipeline.h"
+
 namespace fs = std::filesystem;
 
 struct image_resize_params_t {
@@ -75,6 +79,11 @@ struct image_resize_params_t {
   int width;
   int height;
   int dev;
+  bool pipeline;          // stream the images through ThumbnailPipeline
+  int in_flight;
+  int batch_size;
+  int streams;
+  std::vector<LadderStep> ladder;  // implies pipeline
 };
 
 
@@ -94,6 +103,16 @@ int dev_free(void* p)
     return (int)cudaFree(p);
 }
 
+int pinned_malloc(void** p, size_t s)
+{
+    return (int)cudaMallocHost(p, s);
+}
+
+int pinned_free(void* p)
+{
+    return (int)cudaFreeHost(p);
+}
+
 bool is_interleaved(nvjpegOutputFormat_t format)
 {
     if (format == NVJPEG_OUTPUT_RGBI || format == NVJPEG_OUTPUT_BGRI)
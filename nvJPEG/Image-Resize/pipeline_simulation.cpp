@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// CPU-only check of the stage pipeline (common/stage_pipeline.h) used by the
+// -pipeline mode of the resize samples.
+//
+// The stages of the thumbnail pipeline are replaced by stubs that sleep for
+// a synthetic time: read, batched decode (a fixed cost per batch plus a cost
+// per image), resize to every size of a ladder, watermark, encode and write.
+// Every 17th image fails to decode. Checks that every image leaves the
+// pipeline once, that the stages ran in order and failed images skipped the
+// stages after the decode, that the in-flight bound held, and that with 4 or
+// more images in flight the pipeline is faster than running the same stages
+// one image at a time.
+//
+// Build: g++ -O2 -std=c++17 -pthread pipeline_simulation.cpp -o pipeline_simulation
+// Usage: ./pipeline_simulation [-n images] [-f in_flight] [-b batch_size] [-s gpu_streams] [-l ladder_sizes]
+
+#include "../../common/stage_pipeline.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+struct sim_params_t {
+  int images = 400;
+  int in_flight = 32;
+  int batch_size = 8;
+  int streams = 2;
+  int ladder = 3;
+};
+
+struct StubImage {
+  int index = 0;
+  int status = 0;
+  int outputs = 0;
+  std::vector<int> trace;  // stages that processed the image
+};
+
+// synthetic stage times, in microseconds
+static const int kRead = 150, kDecodeBatch = 400, kDecodeImage = 250, kResize = 80,
+                 kWatermark = 40, kEncode = 200, kWrite = 60;
+
+static void busy(int us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+
+int main(int argc, const char *argv[]) {
+  sim_params_t params;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      printf("Usage: %s [-n images] [-f in_flight] [-b batch_size] [-s gpu_streams] [-l ladder_sizes]\n",
+             argv[0]);
+      return EXIT_SUCCESS;
+    }
+    if (i + 1 >= argc) break;
+    if (strcmp(argv[i], "-n") == 0) params.images = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-f") == 0) params.in_flight = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0) params.batch_size = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0) params.streams = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-l") == 0) params.ladder = atoi(argv[++i]);
+  }
+  const int ladder = std::max(1, params.ladder);
+
+  auto visit = [](const std::vector<StubImage *> &batch, int stage) {
+    for (StubImage *img : batch) img->trace.push_back(stage);
+  };
+
+  StagePipeline<StubImage> pipeline(params.in_flight);
+  pipeline.add_stage("read", [&](const std::vector<StubImage *> &batch, int) {
+    visit(batch, 0);
+    busy(kRead);
+  }, 2);
+  pipeline.add_stage("decode", [&](const std::vector<StubImage *> &batch, int) {
+    visit(batch, 1);
+    busy(kDecodeBatch + kDecodeImage * static_cast<int>(batch.size()));
+    for (StubImage *img : batch)
+      if (img->index % 17 == 16) img->status = 1;
+  }, params.streams, params.batch_size);
+  pipeline.add_stage("resize", [&](const std::vector<StubImage *> &batch, int) {
+    visit(batch, 2);
+    busy(kResize * ladder * static_cast<int>(batch.size()));
+    for (StubImage *img : batch) img->outputs = ladder;
+  }, params.streams, params.batch_size);
+  pipeline.add_stage("watermark", [&](const std::vector<StubImage *> &batch, int) {
+    visit(batch, 3);
+    busy(kWatermark * ladder * static_cast<int>(batch.size()));
+  }, 1, params.batch_size);
+  pipeline.add_stage("encode", [&](const std::vector<StubImage *> &batch, int) {
+    visit(batch, 4);
+    busy(kEncode * ladder * static_cast<int>(batch.size()));
+  }, params.streams, params.batch_size);
+  pipeline.add_stage("write", [&](const std::vector<StubImage *> &batch, int) {
+    visit(batch, 5);
+    busy(kWrite * ladder);
+  }, 2);
+
+  std::vector<int> seen(params.images, 0);
+  int errors = 0;
+  pipeline.start([&](StubImage &img) {
+    seen[img.index]++;
+    const bool failed = img.index % 17 == 16;
+    std::vector<int> expected = failed ? std::vector<int>{0, 1} : std::vector<int>{0, 1, 2, 3, 4, 5};
+    if (img.trace != expected || (img.status != 0) != failed) errors++;
+  });
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < params.images; i++) {
+    StubImage img;
+    img.index = i;
+    pipeline.submit(std::move(img));
+  }
+  pipeline.finish();
+  const double pipelined = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // the same stages, one image at a time, as the serial loop of the samples
+  const auto serial_start = std::chrono::steady_clock::now();
+  const int serial_images = std::min(params.images, 40);
+  for (int i = 0; i < serial_images; i++) {
+    busy(kRead);
+    busy(kDecodeBatch + kDecodeImage);
+    busy(kResize * ladder);
+    busy(kWatermark * ladder);
+    busy(kEncode * ladder);
+    busy(kWrite * ladder);
+  }
+  const double serial = std::chrono::duration<double>(std::chrono::steady_clock::now() - serial_start).count() *
+                        params.images / serial_images;
+
+  pipeline.print_stats(std::cout, true);
+  for (int count : seen)
+    if (count != 1) errors++;
+  const double speedup = serial / pipelined;
+  printf("images: %d, in flight: %d (max seen %zu), batch size: %d, streams: %d, ladder: %d\n",
+         params.images, params.in_flight, pipeline.max_observed_in_flight(), params.batch_size,
+         params.streams, ladder);
+  printf("serial: %.1f ms, pipelined: %.1f ms, speedup %.2fx\n", serial * 1e3, pipelined * 1e3, speedup);
+
+  // with a few images in flight the stages overlap
+  const bool too_slow = params.in_flight >= 4 && speedup < 1.5;
+  if (errors || pipeline.max_observed_in_flight() > static_cast<size_t>(std::max(1, params.in_flight)) ||
+      too_slow) {
+    printf("FAILED: %d items with a wrong trace or count%s\n", errors, too_slow ? ", no speedup" : "");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -86,23 +86,42 @@ float get_scale_factor(nvjpegChromaSubsampling_t chroma_subsampling)
   return scale_factor;
 }
 
-bool pick_gpu_backend(nvjpegJpegStream_t&  jpeg_stream)
+// what the backend scheduler routes on: frame size weighted by the chroma
+// subsampling, and whether the stream is progressive
+int get_jpeg_features(nvjpegJpegStream_t&  jpeg_stream, JpegFeatures& features)
 {
   unsigned int frame_width,frame_height;
   nvjpegChromaSubsampling_t chroma_subsampling;
-      
+  nvjpegJpegEncoding_t encoding;
+
   CHECK_NVJPEG(nvjpegJpegStreamGetFrameDimensions(jpeg_stream,
         &frame_width, &frame_height));
   CHECK_NVJPEG(nvjpegJpegStreamGetChromaSubsampling(jpeg_stream,&chroma_subsampling));
-  auto scale_factor = get_scale_factor(chroma_subsampling);
+  CHECK_NVJPEG(nvjpegJpegStreamGetJpegEncoding(jpeg_stream, &encoding));
+  features.samples = static_cast<double>(frame_width) * frame_height * get_scale_factor(chroma_subsampling);
+  features.progressive = encoding == NVJPEG_ENCODING_PROGRESSIVE_DCT_HUFFMAN;
+  return EXIT_SUCCESS;
+}
 
-  bool use_gpu_backend = false;
-  // use NVJPEG_BACKEND_GPU_HYBRID when dimensions are greater than 512x512
-  if( frame_height*frame_width * scale_factor > 512*512 * 3)
-  {
-    use_gpu_backend = true;
+// waits for this thread's stream and reports host + device time of the images
+// whose device work was queued on it; on a CUDA error the pending tickets are
+// still released, without a timing
+int report_decode_timings(decode_params_t &params, decode_per_thread_params& per_thread_params)
+{
+  cudaError_t status = cudaStreamSynchronize(per_thread_params.stream);
+  for (int stage = 0; stage < pipeline_stages; stage++) {
+    if (!per_thread_params.timing_pending[stage])
+      continue;
+    float device_ms = 0;
+    if (status == cudaSuccess)
+      status = cudaEventElapsedTime(&device_ms, per_thread_params.device_start[stage],
+                                    per_thread_params.device_stop[stage]);
+    params.backend_scheduler->complete(per_thread_params.tickets[stage],
+        status == cudaSuccess ? per_thread_params.host_seconds[stage] + 0.001 * device_ms : 0);
+    per_thread_params.timing_pending[stage] = false;
   }
-  return use_gpu_backend;
+  CHECK_CUDA(status);
+  return EXIT_SUCCESS;
 }
 
 bool check_roi(const FileData &img_data, const std::vector<size_t> &img_len, 
@@ -136,26 +155,28 @@ bool check_roi(const FileData &img_data, const std::vector<size_t> &img_len,
   return valid_roi;
 }
 
-void select_backend(nvjpegJpegDecoder_t& decoder, nvjpegJpegState_t& decoder_state, 
-                    decode_per_thread_params& per_thread_params, decode_params_t &params,
-                    int &buffer_index){
-  bool use_gpu_backend =  pick_gpu_backend(per_thread_params.jpeg_streams[buffer_index]);
-  decoder = use_gpu_backend ?  per_thread_params.nvjpeg_dec_gpu: per_thread_params.nvjpeg_dec_cpu;
-  decoder_state = use_gpu_backend ? per_thread_params.dec_state_gpu:per_thread_params.dec_state_cpu;
+int select_backend(nvjpegJpegDecoder_t& decoder, nvjpegJpegState_t& decoder_state, 
+                   decode_per_thread_params& per_thread_params, decode_params_t &params,
+                   int &buffer_index, BackendTicket &ticket){
+  JpegFeatures features;
+  if (get_jpeg_features(per_thread_params.jpeg_streams[buffer_index], features))
+    return EXIT_FAILURE;
 
   switch(params.backend_enum){
     case 0:
+      ticket = params.backend_scheduler->pick(features);
       break;
     case 1:
-      decoder =   per_thread_params.nvjpeg_dec_cpu;
-      decoder_state = per_thread_params.dec_state_cpu;
+      ticket = params.backend_scheduler->assign(features, DecodeBackend::Hybrid);
       break;
     case 2:
-      decoder =   per_thread_params.nvjpeg_dec_gpu;
-      decoder_state = per_thread_params.dec_state_gpu;
+      ticket = params.backend_scheduler->assign(features, DecodeBackend::GpuHybrid);
       break;
   }
-  return;
+  bool use_gpu_backend = ticket.backend == DecodeBackend::GpuHybrid;
+  decoder = use_gpu_backend ?  per_thread_params.nvjpeg_dec_gpu: per_thread_params.nvjpeg_dec_cpu;
+  decoder_state = use_gpu_backend ? per_thread_params.dec_state_gpu:per_thread_params.dec_state_cpu;
+  return EXIT_SUCCESS;
 }
 
 int decode_images(const FileData &img_data, const std::vector<size_t> &img_len,
@@ -198,39 +219,54 @@ int decode_images(const FileData &img_data, const std::vector<size_t> &img_len,
 
         nvjpegJpegDecoder_t decoder;
         nvjpegJpegState_t decoder_state;
-        select_backend(decoder, decoder_state, per_thread_params, params, buffer_index);
+        BackendTicket picked;
+        if (select_backend(decoder, decoder_state, per_thread_params, params, buffer_index, picked))
+          return EXIT_FAILURE;
+        BackendTicketGuard ticket(*params.backend_scheduler, picked);
 
         CHECK_NVJPEG(nvjpegStateAttachPinnedBuffer(decoder_state,
             per_thread_params.pinned_buffers[buffer_index]));
 
+        auto host_start = std::chrono::steady_clock::now();
         CHECK_NVJPEG(nvjpegDecodeJpegHost(params.nvjpeg_handle, decoder, decoder_state,
             decode_params[i], per_thread_params.jpeg_streams[buffer_index]));
+        double host_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - host_start).count();
 
-        CHECK_CUDA(cudaStreamSynchronize(per_thread_params.stream));
+        // waits for the previous image's device work
+        if (report_decode_timings(params, per_thread_params))
+          return EXIT_FAILURE;
 
+        CHECK_CUDA(cudaEventRecord(per_thread_params.device_start[buffer_index], per_thread_params.stream));
         CHECK_NVJPEG(nvjpegDecodeJpegTransferToDevice(params.nvjpeg_handle, decoder, decoder_state,
             per_thread_params.jpeg_streams[buffer_index], per_thread_params.stream));
 
         CHECK_NVJPEG(nvjpegDecodeJpegDevice(params.nvjpeg_handle, decoder, decoder_state,
             &out[i], per_thread_params.stream));
+        CHECK_CUDA(cudaEventRecord(per_thread_params.device_stop[buffer_index], per_thread_params.stream));
+        per_thread_params.tickets[buffer_index] = ticket.release();
+        per_thread_params.host_seconds[buffer_index] = host_seconds;
+        per_thread_params.timing_pending[buffer_index] = true;
 
         CHECK_NVJPEG(nvjpegDecodeParamsDestroy(decode_params[i]));
 
         buffer_index = (buffer_index+1)%pipeline_stages; // switch pinned buffer in pipeline mode to avoid an extra sync
 
     }
-    CHECK_CUDA(cudaStreamSynchronize(per_thread_params.stream));
+    if (report_decode_timings(params, per_thread_params))
+      return EXIT_FAILURE;
   }
   else
   {
     std::vector<int> buffer_indices(params.num_threads, 0);
+    std::vector<ThreadPool::Task> tasks;
+    tasks.reserve(params.batch_size);
     
     for (int i = 0; i < params.batch_size; i++) {
         if (params.roi_on){
           check_roi(img_data, img_len, params, i, widths, heights, valid_images);
         }
         
-        workers.enqueue(std::bind(
+        tasks.emplace_back(std::bind(
             [&params, &buffer_indices, &out, &img_data, &img_len, &valid_images](int iidx, int thread_idx)
                 {
                   nvjpegDecodeParams_t decode_params;
@@ -253,23 +289,36 @@ int decode_images(const FileData &img_data, const std::vector<size_t> &img_len,
                   CHECK_NVJPEG(nvjpegJpegStreamParse(params.nvjpeg_handle, (const unsigned char *)img_data[iidx].data(), img_len[iidx],
                     0, 0, per_thread_params.jpeg_streams[buffer_indices[thread_idx]]));
       
+                  const int stage = buffer_indices[thread_idx];
                   nvjpegJpegDecoder_t decoder;
                   nvjpegJpegState_t decoder_state;
-                  select_backend(decoder, decoder_state, per_thread_params, params, buffer_indices[thread_idx]);
+                  BackendTicket picked;
+                  if (select_backend(decoder, decoder_state, per_thread_params, params, buffer_indices[thread_idx], picked))
+                    return EXIT_FAILURE;
+                  BackendTicketGuard ticket(*params.backend_scheduler, picked);
 
                   CHECK_NVJPEG(nvjpegStateAttachPinnedBuffer(decoder_state,
-                    per_thread_params.pinned_buffers[buffer_indices[thread_idx]]));
+                    per_thread_params.pinned_buffers[stage]));
 
+                  auto host_start = std::chrono::steady_clock::now();
                   CHECK_NVJPEG(nvjpegDecodeJpegHost(params.nvjpeg_handle, decoder, decoder_state,
-                    decode_params, per_thread_params.jpeg_streams[buffer_indices[thread_idx]]));
+                    decode_params, per_thread_params.jpeg_streams[stage]));
+                  double host_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - host_start).count();
 
-                  CHECK_CUDA(cudaStreamSynchronize(per_thread_params.stream));
+                  // waits for the previous image of this thread on the device
+                  if (report_decode_timings(params, per_thread_params))
+                    return EXIT_FAILURE;
 
+                  CHECK_CUDA(cudaEventRecord(per_thread_params.device_start[stage], per_thread_params.stream));
                   CHECK_NVJPEG(nvjpegDecodeJpegTransferToDevice(params.nvjpeg_handle, decoder, decoder_state,
-                    per_thread_params.jpeg_streams[buffer_indices[thread_idx]], per_thread_params.stream));
+                    per_thread_params.jpeg_streams[stage], per_thread_params.stream));
 
                   CHECK_NVJPEG(nvjpegDecodeJpegDevice(params.nvjpeg_handle, decoder, decoder_state,
                     &out[iidx], per_thread_params.stream));
+                  CHECK_CUDA(cudaEventRecord(per_thread_params.device_stop[stage], per_thread_params.stream));
+                  per_thread_params.tickets[stage] = ticket.release();
+                  per_thread_params.host_seconds[stage] = host_seconds;
+                  per_thread_params.timing_pending[stage] = true;
 
                   CHECK_NVJPEG(nvjpegDecodeParamsDestroy(decode_params));
                   // switch pinned buffer in pipeline mode to avoid an extra sync
@@ -279,9 +328,12 @@ int decode_images(const FileData &img_data, const std::vector<size_t> &img_len,
                 )
             );
     }
+    // one submission for the whole batch, idle workers steal from busy ones
+    workers.enqueue_batch(tasks.begin(), tasks.end());
     workers.wait();
     for ( auto& per_thread_params : params.nvjpeg_per_thread_data) {
-        CHECK_CUDA(cudaStreamSynchronize(per_thread_params.stream));
+        if (report_decode_timings(params, per_thread_params))
+          return EXIT_FAILURE;
     }
   }
   
@@ -408,7 +460,7 @@ int main(int argc, const char *argv[]) {
               << std::endl;
     std::cout << "\troi_regions\t:\tSpecify the ROI in the following format [x_offset, y_offset, roi_width, roi_height]"
               << std::endl;
-    std::cout << "\tbackend_eum\t:\tType of backend for the nvJPEG (0 - NVJPEG_BACKEND_DEFAULT"
+    std::cout << "\tbackend_eum\t:\tType of backend for the nvJPEG (0 - chosen per image by the backend scheduler"
               << ", 1 - NVJPEG_BACKEND_HYBRID,\n \t\t\t\t2 - NVJPEG_BACKEND_GPU_HYBRID)"
               << std::endl;
     std::cout << "\tbatch_size\t:\tDecode images from input by batches of "
@@ -528,6 +580,12 @@ int main(int argc, const char *argv[]) {
   }
 
   params.nvjpeg_per_thread_data.resize(params.num_threads);
+
+  // hybrid decodes run on the worker threads, GPU hybrid decodes share the GPU
+  BackendSchedulerConfig scheduler_config;
+  scheduler_config.lanes[static_cast<int>(DecodeBackend::Hybrid)] = params.num_threads;
+  scheduler_config.lanes[static_cast<int>(DecodeBackend::GpuHybrid)] = 1;
+  params.backend_scheduler.reset(new BackendScheduler(scheduler_config));
   nvjpegDevAllocator_t dev_allocator = {&dev_malloc, &dev_free};
   nvjpegPinnedAllocator_t pinned_allocator ={&host_malloc, &host_free};
 
@@ -567,6 +625,8 @@ int main(int argc, const char *argv[]) {
                         params.batch_size)
             << " (s)" << std::endl;
 
+  params.backend_scheduler->print(std::cout);
+
   for(auto& nvjpeg_data : params.nvjpeg_per_thread_data)
     destroy_nvjpeg_data(nvjpeg_data);
 
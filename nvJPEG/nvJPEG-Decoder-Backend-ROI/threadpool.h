@@ -1,50 +1,89 @@
-#pragma once 
+#pragma once
 
 #include <vector>
-#include <queue>
+#include <deque>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <type_traits>
+#include <iterator>
 
+// Work-stealing thread pool.
+//
+// Every worker owns a deque guarded by its own (mostly uncontended) lock:
+// the owner pops from the back (LIFO, cache friendly), idle workers steal from
+// the front of the other deques. Tasks submitted from outside the pool are
+// distributed round-robin over the deques, so there is no single queue lock
+// that all threads fight over. Completion is tracked with an atomic counter,
+// wait() only blocks on a condition variable once the counter is non-zero.
+//
+// Tasks receive the index of the executing worker as their first argument.
 class ThreadPool {
 public:
+    typedef std::function<void(int)> Task;
+
     ThreadPool(size_t);
+
     template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) 
-        -> std::future<typename std::result_of<F(int, Args...)>::type>
+    auto enqueue(F&& f, Args&&... args)
+        -> std::future<std::invoke_result_t<F, int, Args...>>
         {
-            //using return_type = typename std::result_of<F(Args...)>::type;
+            using return_type = std::invoke_result_t<F, int, Args...>;
 
-            auto task = std::make_shared< std::packaged_task<int(int)> >(
+            auto task = std::make_shared< std::packaged_task<return_type(int)> >(
                     std::bind(std::forward<F>(f), std::placeholders::_1, std::forward<Args>(args)...)
                 );
-                
-            std::future<int> res = task->get_future();
-            {
-                std::unique_lock<std::mutex> lock(queue_mutex);
-
-                // don't allow enqueueing after stopping the pool
-                if(stop)
-                    throw std::runtime_error("enqueue on stopped ThreadPool");
 
-                tasks.emplace([task](int tid){ (*task)(tid); });
-            }
-            condition.notify_one();
+            std::future<return_type> res = task->get_future();
+            push([task](int tid){ (*task)(tid); });
             return res;
         }
+
+    // Submits all tasks in [first, last) taking each worker's lock at most
+    // once. No futures are created; use wait() to synchronize.
+    template<class Iterator>
+    void enqueue_batch(Iterator first, Iterator last)
+    {
+        const size_t count = std::distance(first, last);
+        if (count == 0)
+            return;
+        check_running();
+        pending.fetch_add(count);
+
+        const size_t num_queues = queues.size();
+        const size_t start = next_queue.fetch_add(1) % num_queues;
+        const size_t chunk = (count + num_queues - 1) / num_queues;
+        for (size_t q = 0; q < num_queues && first != last; ++q) {
+            WorkQueue &queue = *queues[(start + q) % num_queues];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            for (size_t n = 0; n < chunk && first != last; ++n, ++first)
+                queue.tasks.emplace_back(*first);
+        }
+        queued.fetch_add(count);
+        wake_workers(count);
+    }
+
     void wait()
     {
-        std::unique_lock<std::mutex> lock(this->queue_mutex);
-        completed.wait(lock, [this]{return this->in_flight == 0 && this->tasks.empty();});
+        if (pending.load() == 0)
+            return;
+        std::unique_lock<std::mutex> lock(completed_mutex);
+        waiters++;
+        completed.wait(lock, [this]{ return this->pending.load() == 0; });
+        waiters--;
     }
+
+    size_t size() const { return workers.size(); }
+
     ~ThreadPool()
     {
         {
-            std::unique_lock<std::mutex> lock(queue_mutex);
+            std::unique_lock<std::mutex> lock(sleep_mutex);
             stop = true;
         }
         condition.notify_all();
@@ -52,47 +91,123 @@ public:
             worker.join();
     }
 private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void check_running() const
+    {
+        // don't allow enqueueing after stopping the pool
+        if(stop.load())
+            throw std::runtime_error("enqueue on stopped ThreadPool");
+    }
+
+    void push(Task task)
+    {
+        check_running();
+        pending.fetch_add(1);
+        WorkQueue &queue = *queues[next_queue.fetch_add(1) % queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.emplace_back(std::move(task));
+        }
+        queued.fetch_add(1);
+        wake_workers(1);
+    }
+
+    void wake_workers(size_t count)
+    {
+        // queued was incremented before idle is read and workers increment
+        // idle before re-checking queued, so a wakeup can't get lost
+        if (idle.load() == 0)
+            return;
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        if (count == 1)
+            condition.notify_one();
+        else
+            condition.notify_all();
+    }
+
+    // own deque first (newest task), then steal the oldest task of the others;
+    // busy deques are skipped on the first pass
+    bool pop(size_t self, Task &task)
+    {
+        for (int pass = 0; pass < 2; ++pass) {
+            for (size_t n = 0; n < queues.size(); ++n) {
+                WorkQueue &queue = *queues[(self + n) % queues.size()];
+                std::unique_lock<std::mutex> lock(queue.mutex, std::defer_lock);
+                if (n == 0 || pass == 1)
+                    lock.lock();
+                else if (!lock.try_lock())
+                    continue;
+                if (queue.tasks.empty())
+                    continue;
+                if (n == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                queued.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self)
+    {
+        for(;;)
+        {
+            Task task;
+            if (queued.load() > 0 && pop(self, task)) {
+                task(static_cast<int>(self));
+                if (pending.fetch_sub(1) == 1 && waiters > 0) {
+                    std::lock_guard<std::mutex> lock(completed_mutex);
+                    completed.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            idle++;
+            this->condition.wait(lock,
+                [this]{ return this->stop || this->queued.load() > 0; });
+            idle--;
+            if(this->stop && this->queued.load() == 0)
+                return;
+        }
+    }
+
     // need to keep track of threads so we can join them
     std::vector< std::thread > workers;
-    // the task queue
-    std::queue< std::function<void(int)> > tasks;
-    
-    // synchronization
-    std::mutex queue_mutex;
+    // one task deque per worker
+    std::vector< std::unique_ptr<WorkQueue> > queues;
+    std::atomic<size_t> next_queue;
+
+    // tasks sitting in a deque / tasks not yet finished
+    std::atomic<size_t> queued;
+    std::atomic<size_t> pending;
+
+    // synchronization for idle workers and wait()
+    std::mutex sleep_mutex;
     std::condition_variable condition;
+    std::atomic<int> idle;
+    std::mutex completed_mutex;
     std::condition_variable completed;
-    int in_flight;
-    bool stop;
+    std::atomic<int> waiters;
+    std::atomic<bool> stop;
 };
- 
+
 // the constructor just launches some amount of workers
 inline ThreadPool::ThreadPool(size_t threads)
-    :   stop(false), in_flight(0), workers(threads)
+    :   workers(threads), queues(threads == 0 ? 1 : threads), next_queue(0),
+        queued(0), pending(0), idle(0), waiters(0), stop(false)
 {
+    for(auto &queue : queues)
+        queue.reset(new WorkQueue());
     for(size_t i = 0;i<threads;++i)
-        workers[i] = std::thread(
-            [this, i]
-            {
-                for(;;)
-                {
-                    std::function<void(int)> task;
-
-                    {
-                        std::unique_lock<std::mutex> lock(this->queue_mutex);
-                        this->condition.wait(lock,
-                            [this]{ return this->stop || !this->tasks.empty(); });
-                        if(this->stop && this->tasks.empty())
-                            return;
-                        task = std::move(this->tasks.front());
-                        this->tasks.pop();
-                        in_flight++;
-                    }
-                    task(i);
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    in_flight--;
-                    if ((this->in_flight == 0) && this->tasks.empty())
-                        completed.notify_one();
-                }
-            }
-        );
-}
\ No newline at end of file
+        workers[i] = std::thread([this, i]{ this->run(i); });
+}
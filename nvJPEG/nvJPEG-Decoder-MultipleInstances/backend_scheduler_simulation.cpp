@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// CPU-only check of the backend routing policy (backend_scheduler.h) with
+// synthetic decode timings.
+//
+// A batch is decoded by worker threads that pull images in order, as the
+// sample's thread pool does. A hybrid decode occupies its worker for the
+// whole decode; a GPU hybrid decode occupies the worker for a short host
+// phase and then waits for the (shared, serial) GPU. For each scenario the
+// batch makespan of the old fixed rule is compared with the scheduler, which
+// learns from the simulated timings. Exits with a failure if the scheduler
+// is slower than the fixed rule or its learned models are off.
+//
+// Build: g++ -O2 -std=c++17 -pthread backend_scheduler_simulation.cpp -o backend_scheduler_simulation
+// Usage: ./backend_scheduler_simulation [-j workers] [-b batch_size] [-n batches]
+
+#include "../../common/backend_scheduler.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+struct sim_params_t {
+  int workers = 4;
+  int batch_size = 64;
+  int batches = 50;
+};
+
+// the "hardware" of a scenario, in seconds and seconds per sample
+struct TrueCost {
+  const char *name;
+  double hybrid_overhead, hybrid_per_sample;
+  double gpu_host, gpu_overhead, gpu_per_sample;
+  double progressive_factor;  // progressive streams are this much slower on both
+
+  double hybrid(const JpegFeatures &f) const {
+    return (hybrid_overhead + hybrid_per_sample * f.samples) * (f.progressive ? progressive_factor : 1);
+  }
+  double gpu_device(const JpegFeatures &f) const {
+    return (gpu_overhead + gpu_per_sample * f.samples) * (f.progressive ? progressive_factor : 1);
+  }
+};
+
+// the rule the samples used before: GPU above 512x512 4:4:4
+static DecodeBackend fixed_rule(const JpegFeatures &f) {
+  return f.samples > 512 * 512 * 3 ? DecodeBackend::GpuHybrid : DecodeBackend::Hybrid;
+}
+
+// mixed traffic: mostly thumbnails and web sized 4:2:0 images, some camera
+// sized ones, a few progressive
+static std::vector<JpegFeatures> make_batch(std::mt19937 &rng, int size) {
+  static const int dims[][2] = {{160, 120}, {320, 240}, {640, 480}, {800, 600},
+                                {1024, 768}, {1920, 1080}, {3264, 2448}, {4032, 3024}};
+  static const double weights[] = {20, 25, 20, 10, 8, 8, 5, 4};
+  std::discrete_distribution<int> pick_dim(std::begin(weights), std::end(weights));
+  std::uniform_real_distribution<double> u(0, 1);
+  std::vector<JpegFeatures> batch(size);
+  for (auto &f : batch) {
+    const int d = pick_dim(rng);
+    const double scale = u(rng) < 0.8 ? 1.5 : 3.0;  // 4:2:0 or 4:4:4
+    f.samples = dims[d][0] * dims[d][1] * scale;
+    f.progressive = u(rng) < 0.1;
+  }
+  return batch;
+}
+
+struct InFlight {
+  double finish;
+  BackendTicket ticket;
+  double observed;
+};
+
+// simulated time of one batch; the scheduler (if any) is fed the observed
+// per-image times as the sample does
+static double run_batch(const std::vector<JpegFeatures> &batch, const TrueCost &cost, int workers,
+                        BackendScheduler *scheduler) {
+  std::vector<double> worker_free(workers, 0.0);
+  double gpu_free = 0;
+  double makespan = 0;
+  std::vector<InFlight> in_flight;
+
+  auto retire = [&](double now) {
+    std::sort(in_flight.begin(), in_flight.end(),
+              [](const InFlight &a, const InFlight &b) { return a.finish < b.finish; });
+    size_t n = 0;
+    for (; n < in_flight.size() && in_flight[n].finish <= now; n++)
+      if (scheduler) scheduler->complete(in_flight[n].ticket, in_flight[n].observed);
+    in_flight.erase(in_flight.begin(), in_flight.begin() + n);
+  };
+
+  for (const auto &f : batch) {
+    const int w = static_cast<int>(std::min_element(worker_free.begin(), worker_free.end()) -
+                                   worker_free.begin());
+    const double start = worker_free[w];
+    retire(start);
+
+    BackendTicket ticket;
+    if (scheduler)
+      ticket = scheduler->pick(f);
+    else
+      ticket.backend = fixed_rule(f);
+
+    // observed: host time plus device execution, as the sample measures it;
+    // waiting for the GPU is covered by the scheduler's in-flight accounting
+    double finish, observed;
+    if (ticket.backend == DecodeBackend::Hybrid) {
+      observed = cost.hybrid(f);
+      finish = start + observed;
+    } else {
+      const double gpu_start = std::max(start + cost.gpu_host, gpu_free);
+      finish = gpu_start + cost.gpu_device(f);
+      gpu_free = finish;
+      observed = cost.gpu_host + cost.gpu_device(f);
+    }
+    worker_free[w] = finish;
+    makespan = std::max(makespan, finish);
+    in_flight.push_back({finish, ticket, observed});
+  }
+  retire(makespan);
+  return makespan;
+}
+
+int main(int argc, const char *argv[]) {
+  sim_params_t params;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      printf("Usage: %s [-j workers] [-b batch_size] [-n batches]\n", argv[0]);
+      return EXIT_SUCCESS;
+    }
+    if (i + 1 >= argc) break;
+    if (strcmp(argv[i], "-j") == 0) params.workers = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0) params.batch_size = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-n") == 0) params.batches = atoi(argv[++i]);
+  }
+
+  const TrueCost scenarios[] = {
+      // close to the prior, the fixed rule is about right
+      {"prior-like", 50e-6, 2.0e-9, 30e-6, 1.2e-3, 0.5e-9, 1.5},
+      // fast GPU, slow host: the GPU wins well below 512x512
+      {"fast gpu", 80e-6, 6.0e-9, 30e-6, 0.3e-3, 0.4e-9, 1.5},
+      // fast host, busy GPU: the hybrid backend wins up to larger sizes
+      {"fast host", 20e-6, 1.0e-9, 30e-6, 2.0e-3, 0.9e-9, 2.0},
+  };
+
+  int failures = 0;
+  printf("workers: %d, batch size: %d, batches: %d\n", params.workers, params.batch_size,
+         params.batches);
+  printf("%12s %16s %16s %8s %16s\n", "scenario", "fixed rule [ms]", "scheduler [ms]", "speedup",
+         "model error 4MP");
+  for (const auto &cost : scenarios) {
+    BackendSchedulerConfig config;
+    config.lanes[0] = params.workers;
+    config.lanes[1] = 1;
+    BackendScheduler scheduler(config);
+
+    std::mt19937 rng(42);
+    double fixed_total = 0, scheduled_total = 0;
+    for (int n = 0; n < params.batches; n++) {
+      auto batch = make_batch(rng, params.batch_size);
+      fixed_total += run_batch(batch, cost, params.workers, nullptr);
+      scheduled_total += run_batch(batch, cost, params.workers, &scheduler);
+    }
+
+    // the learned GPU model against the true cost of a 4000x3000 4:2:0 image
+    JpegFeatures large;
+    large.samples = 4000 * 3000 * 1.5;
+    const double gpu_true = cost.gpu_host + cost.gpu_device(large);
+    const double err = std::fabs(scheduler.predict(DecodeBackend::GpuHybrid, large) - gpu_true) / gpu_true;
+
+    const double speedup = fixed_total / scheduled_total;
+    printf("%12s %16.2f %16.2f %7.2fx %15.1f%%\n", cost.name, fixed_total * 1e3,
+           scheduled_total * 1e3, speedup, err * 100);
+    scheduler.print(std::cout);
+    if (speedup < 0.97 || err > 0.1) {
+      printf("FAILED: %s\n", cost.name);
+      failures++;
+    }
+  }
+
+  // tickets dropped on an error path must not stay in flight: if they did,
+  // the small image would eventually be pushed to the GPU backend
+  {
+    BackendSchedulerConfig config;
+    config.explore_interval = 0;
+    BackendScheduler scheduler(config);
+    JpegFeatures small;
+    small.samples = 64 * 64 * 3;
+    for (int n = 0; n < 1000; n++) {
+      BackendTicketGuard ticket(scheduler, scheduler.pick(small));
+      if (ticket.get().backend != DecodeBackend::Hybrid) {
+        printf("FAILED: abandoned tickets still in flight after %d picks\n", n);
+        failures++;
+        break;
+      }
+    }
+  }
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
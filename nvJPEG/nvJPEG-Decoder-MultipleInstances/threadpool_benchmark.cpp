@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// CPU-only micro-benchmark: task throughput of the work-stealing ThreadPool
+// (threadpool.h) versus the previous single-queue pool.
+//
+// Build: g++ -O2 -std=c++17 -pthread threadpool_benchmark.cpp -o threadpool_benchmark
+// Usage: ./threadpool_benchmark [-t max_threads] [-n tasks] [-w work_per_task] [-r repeats]
+
+#include "threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <string>
+
+// The pool this sample shipped with before: one mutex-protected queue and a
+// condition variable shared by all workers.
+class LegacyThreadPool {
+public:
+    LegacyThreadPool(size_t threads) : workers(threads), in_flight(0), stop(false)
+    {
+        for(size_t i = 0;i<threads;++i)
+            workers[i] = std::thread(
+                [this, i]
+                {
+                    for(;;)
+                    {
+                        std::function<void(int)> task;
+                        {
+                            std::unique_lock<std::mutex> lock(this->queue_mutex);
+                            this->condition.wait(lock,
+                                [this]{ return this->stop || !this->tasks.empty(); });
+                            if(this->stop && this->tasks.empty())
+                                return;
+                            task = std::move(this->tasks.front());
+                            this->tasks.pop();
+                            in_flight++;
+                        }
+                        task(i);
+                        std::unique_lock<std::mutex> lock(this->queue_mutex);
+                        in_flight--;
+                        if ((this->in_flight == 0) && this->tasks.empty())
+                            completed.notify_one();
+                    }
+                }
+            );
+    }
+
+    template<class F, class... Args>
+    auto enqueue(F&& f, Args&&... args)
+        -> std::future<std::invoke_result_t<F, int, Args...>>
+    {
+        using return_type = std::invoke_result_t<F, int, Args...>;
+        auto task = std::make_shared< std::packaged_task<return_type(int)> >(
+                std::bind(std::forward<F>(f), std::placeholders::_1, std::forward<Args>(args)...));
+        std::future<return_type> res = task->get_future();
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            tasks.emplace([task](int tid){ (*task)(tid); });
+        }
+        condition.notify_one();
+        return res;
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(this->queue_mutex);
+        completed.wait(lock, [this]{return this->in_flight == 0 && this->tasks.empty();});
+    }
+
+    ~LegacyThreadPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            stop = true;
+        }
+        condition.notify_all();
+        for(std::thread &worker: workers)
+            worker.join();
+    }
+private:
+    std::vector< std::thread > workers;
+    std::queue< std::function<void(int)> > tasks;
+    std::mutex queue_mutex;
+    std::condition_variable condition;
+    std::condition_variable completed;
+    int in_flight;
+    bool stop;
+};
+
+struct bench_params_t {
+    int max_threads = 32;
+    int num_tasks = 200000;
+    int work = 200;
+    int repeats = 3;
+};
+
+// a few hundred ns of arithmetic, roughly the size of a small host-side task
+static int spin(int work, int seed)
+{
+    volatile unsigned x = seed;
+    for (int i = 0; i < work; i++)
+        x = x * 1664525u + 1013904223u;
+    return static_cast<int>(x & 1);
+}
+
+template<class Pool, class Submit>
+static double tasks_per_second(const bench_params_t &params, int threads, Submit submit)
+{
+    double best = 0;
+    Pool pool(threads);
+    for (int r = 0; r < params.repeats; r++) {
+        auto start = std::chrono::steady_clock::now();
+        submit(pool);
+        pool.wait();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::max(best, params.num_tasks / seconds);
+    }
+    return best;
+}
+
+int main(int argc, const char *argv[])
+{
+    bench_params_t params;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            printf("Usage: %s [-t max_threads] [-n tasks] [-w work_per_task] [-r repeats]\n", argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (i + 1 >= argc) break;
+        if (strcmp(argv[i], "-t") == 0) params.max_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0) params.num_tasks = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0) params.work = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0) params.repeats = atoi(argv[++i]);
+    }
+
+    std::vector<int> sink(params.max_threads + 1, 0);
+    auto task = [&params, &sink](int tid, int i) { sink[tid] += spin(params.work, i); return 0; };
+
+    printf("tasks: %d, work per task: %d, best of %d\n", params.num_tasks, params.work, params.repeats);
+    printf("%8s %16s %16s %16s %8s\n", "threads", "legacy [task/s]", "stealing [task/s]", "batched [task/s]", "speedup");
+    for (int threads = 1; threads <= params.max_threads; threads *= 2) {
+        double legacy = tasks_per_second<LegacyThreadPool>(params, threads, [&](LegacyThreadPool &pool) {
+            for (int i = 0; i < params.num_tasks; i++)
+                pool.enqueue(task, i);
+        });
+        double stealing = tasks_per_second<ThreadPool>(params, threads, [&](ThreadPool &pool) {
+            for (int i = 0; i < params.num_tasks; i++)
+                pool.enqueue(task, i);
+        });
+        std::vector<ThreadPool::Task> batch;
+        batch.reserve(params.num_tasks);
+        for (int i = 0; i < params.num_tasks; i++)
+            batch.emplace_back([&task, i](int tid) { task(tid, i); });
+        double batched = tasks_per_second<ThreadPool>(params, threads, [&](ThreadPool &pool) {
+            pool.enqueue_batch(batch.begin(), batch.end());
+        });
+        printf("%8d %16.0f %16.0f %16.0f %7.2fx\n", threads, legacy, stealing, batched,
+               std::max(stealing, batched) / legacy);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Batch formation stage for nvjpegDecodeBatched.
+//
+// Images are buffered in a window and grouped by decode path (baseline
+// Huffman streams the batched decoder takes, everything else), chroma
+// subsampling and size class (decoded samples, `classes_per_octave` classes
+// per power of two), so that a batch does not wait for one large image or
+// split between the batched and the serial decode path. A group is emitted
+//  - as soon as it holds max_batch images,
+//  - when its oldest image has waited max_wait (the latency bound, so rare
+//    sizes are not starved),
+//  - when the window is full: the largest group goes first.
+// Within a group images keep their arrival order. A batch emitted before it
+// is full is topped up with images of the same decode path and subsampling
+// from smaller size classes, which do not make it take longer.
+//
+// Time is whatever clock the caller passes in (seconds, or an image
+// counter). Only host code is used, so the policy can be exercised with
+// synthetic descriptors (see batch_former_simulation.cpp). Not thread safe;
+// the decode loop owns it.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include "../../common/jpeg_scanner.h"
+
+struct BatchFormerConfig
+{
+    size_t max_batch = 64;
+    size_t window = 256;    // images buffered at most
+    double max_wait = 0;    // longest time an image is buffered, 0: no bound
+    int classes_per_octave = 2;
+};
+
+struct FormedImage
+{
+    size_t id = 0;  // the caller's handle
+    JpegDescriptor desc;
+    double arrival = 0;
+};
+
+struct BatchFormerStats
+{
+    enum Reason { Full = 0, Deadline, Window, Flush, kReasons };
+
+    size_t images = 0;
+    size_t batches = 0;
+    size_t by_reason[kReasons] = {0, 0, 0, 0};
+    double max_wait = 0;  // longest time an image was buffered
+};
+
+class BatchFormer
+{
+  public:
+    explicit BatchFormer(const BatchFormerConfig &config = BatchFormerConfig()) : config_(config)
+    {
+        config_.max_batch = std::max<size_t>(1, config_.max_batch);
+        config_.window = std::max(config_.window, config_.max_batch);
+        config_.classes_per_octave = std::max(1, config_.classes_per_octave);
+    }
+
+    // images that can share a batch have the same key
+    uint32_t key(const JpegDescriptor &desc) const
+    {
+        if (!desc.ok())
+            return std::numeric_limits<uint32_t>::max();
+        const double samples = std::max<double>(1, static_cast<double>(desc.samples()));
+        const uint32_t size_class = static_cast<uint32_t>(std::log2(samples) * config_.classes_per_octave);
+        return (desc.baseline() ? 0u : 1u) << 24 | static_cast<uint32_t>(desc.subsampling) << 16 | size_class;
+    }
+
+    void push(size_t id, const JpegDescriptor &desc, double now)
+    {
+        FormedImage image;
+        image.id = id;
+        image.desc = desc;
+        image.arrival = now;
+        groups_[key(desc)].push_back(image);
+        buffered_++;
+    }
+
+    size_t buffered() const { return buffered_; }
+
+    // the caller should pop() before pushing more
+    bool full() const { return buffered_ >= config_.window; }
+
+    // time at which the oldest buffered image is due, +inf if none or no bound
+    double next_deadline() const
+    {
+        double arrival = std::numeric_limits<double>::infinity();
+        if (config_.max_wait <= 0)
+            return arrival;
+        for (const auto &group : groups_)
+            arrival = std::min(arrival, group.second.front().arrival);
+        return arrival + config_.max_wait;
+    }
+
+    /**
+     * Moves the next batch that is due at `now` into batch (cleared first).
+     * Returns false if no group needs to be emitted yet.
+     */
+    bool pop(std::vector<FormedImage> &batch, double now)
+    {
+        batch.clear();
+        if (groups_.empty())
+            return false;
+        // full groups first, the one holding the oldest image
+        Groups::iterator pick = groups_.end();
+        for (auto it = groups_.begin(); it != groups_.end(); ++it)
+        {
+            if (it->second.size() >= config_.max_batch &&
+                (pick == groups_.end() || it->second.front().arrival < pick->second.front().arrival))
+                pick = it;
+        }
+        if (pick != groups_.end())
+            return take(pick, batch, now, BatchFormerStats::Full);
+        if (config_.max_wait > 0 && now >= next_deadline())
+            return take(oldest(), batch, now, BatchFormerStats::Deadline);
+        if (buffered_ >= config_.window)
+        {
+            for (auto it = groups_.begin(); it != groups_.end(); ++it)
+            {
+                if (pick == groups_.end() || it->second.size() > pick->second.size())
+                    pick = it;
+            }
+            return take(pick, batch, now, BatchFormerStats::Window);
+        }
+        return false;
+    }
+
+    // emits what is left, group of the oldest image first
+    bool flush(std::vector<FormedImage> &batch, double now)
+    {
+        batch.clear();
+        if (groups_.empty())
+            return false;
+        return take(oldest(), batch, now, BatchFormerStats::Flush);
+    }
+
+    const BatchFormerStats &stats() const { return stats_; }
+
+    void print(std::ostream &os) const
+    {
+        os << "Batch former: " << stats_.images << " images in " << stats_.batches << " batches (avg "
+           << (stats_.batches ? double(stats_.images) / stats_.batches : 0.0) << "), emitted "
+           << stats_.by_reason[BatchFormerStats::Full] << " full, "
+           << stats_.by_reason[BatchFormerStats::Deadline] << " on deadline, "
+           << stats_.by_reason[BatchFormerStats::Window] << " on full window, "
+           << stats_.by_reason[BatchFormerStats::Flush] << " on flush; longest wait " << stats_.max_wait
+           << std::endl;
+    }
+
+  private:
+    typedef std::map<uint32_t, std::deque<FormedImage>> Groups;
+
+    // group holding the oldest buffered image; groups_ must not be empty
+    Groups::iterator oldest()
+    {
+        Groups::iterator pick = groups_.begin();
+        for (auto it = groups_.begin(); it != groups_.end(); ++it)
+        {
+            if (it->second.front().arrival < pick->second.front().arrival)
+                pick = it;
+        }
+        return pick;
+    }
+
+    bool take(Groups::iterator group, std::vector<FormedImage> &batch, double now, int reason)
+    {
+        std::deque<FormedImage> &images = group->second;
+        const size_t n = std::min(images.size(), config_.max_batch);
+        batch.assign(images.begin(), images.begin() + n);
+        images.erase(images.begin(), images.begin() + n);
+        const uint32_t family = group->first >> 16;
+        // it: past the groups that may top up this batch
+        Groups::iterator it = images.empty() ? groups_.erase(group) : group;
+        if (reason != BatchFormerStats::Full)
+        {
+            // keys of the same path and subsampling sort by size class, the
+            // smaller classes come right before this one
+            while (batch.size() < config_.max_batch && it != groups_.begin())
+            {
+                --it;
+                if (it->first >> 16 != family)
+                    break;
+                std::deque<FormedImage> &smaller = it->second;
+                const size_t m = std::min(smaller.size(), config_.max_batch - batch.size());
+                batch.insert(batch.end(), smaller.begin(), smaller.begin() + m);
+                smaller.erase(smaller.begin(), smaller.begin() + m);
+                if (smaller.empty())
+                    it = groups_.erase(it);
+            }
+        }
+        buffered_ -= batch.size();
+        for (const auto &image : batch)
+            stats_.max_wait = std::max(stats_.max_wait, now - image.arrival);
+        stats_.images += batch.size();
+        stats_.batches++;
+        stats_.by_reason[reason]++;
+        return true;
+    }
+
+    BatchFormerConfig config_;
+    Groups groups_;
+    size_t buffered_ = 0;
+    BatchFormerStats stats_;
+};
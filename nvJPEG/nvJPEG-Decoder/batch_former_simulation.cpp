@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// CPU-only check of the batch formation policy (batch_former.h) with
+// synthetic image descriptors and a model of nvjpegDecodeBatched.
+//
+// Images arrive at a fixed mean rate: mostly thumbnails, some camera sized
+// and a few 8K images, some progressive. One decoder takes a batch whenever
+// it is free. A batched decode takes
+//   launch + max(sum of samples / throughput, largest image samples / per image rate)
+// so a large image in a batch of thumbnails makes the whole batch wait, while
+// a batch of large images runs at full throughput. Streams the batched
+// decoder does not take (progressive) are decoded one after the other.
+// Directory order batching (with the same latency bound) is compared with
+// the batch former. Exits with a failure if an image is lost or duplicated,
+// a batch mixes groups, an image is held past its deadline while the
+// decoder is idle, or bucketing is not faster offline.
+//
+// Build: g++ -O2 -std=c++17 -pthread batch_former_simulation.cpp -o batch_former_simulation
+// Usage: ./batch_former_simulation [-n images] [-r images_per_second] [-b max_batch] [-w window] [-l max_wait_ms]
+
+#include "batch_former.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <vector>
+
+struct sim_params_t {
+  int images = 20000;
+  double rate = 600;  // images per second of the online scenario
+  int max_batch = 64;
+  int window = 512;
+  double max_wait = 0.05;  // seconds
+};
+
+// model of the decoder, in seconds and seconds per sample
+struct DecodeCost {
+  double launch = 200e-6;
+  double batched_per_sample = 0.25e-9;     // whole GPU busy
+  double single_image_per_sample = 1e-9;   // what one image can use of it
+  double serial_overhead = 100e-6;
+  double serial_per_sample = 3e-9;
+
+  double batch(const std::vector<FormedImage> &images) const {
+    double sum = 0, largest = 0, serial = 0;
+    bool batched = false;
+    for (const auto &image : images) {
+      const double samples = static_cast<double>(image.desc.samples());
+      if (image.desc.baseline()) {
+        sum += samples;
+        largest = std::max(largest, samples);
+        batched = true;
+      } else {
+        serial += serial_overhead + serial_per_sample * samples;
+      }
+    }
+    return (batched ? launch + std::max(sum * batched_per_sample, largest * single_image_per_sample) : 0) +
+           serial;
+  }
+};
+
+static JpegDescriptor make_descriptor(int width, int height, bool progressive, bool css444) {
+  JpegDescriptor d;
+  d.status = JpegScanStatus::Ok;
+  d.width = static_cast<uint16_t>(width);
+  d.height = static_cast<uint16_t>(height);
+  d.components = 3;
+  d.precision = 8;
+  d.sof_marker = progressive ? 0xC2 : 0xC0;
+  if (progressive) d.flags |= JpegDescriptor::kProgressive;
+  d.sampling[0] = css444 ? 0x11 : 0x22;
+  d.sampling[1] = d.sampling[2] = 0x11;
+  d.subsampling = css444 ? JpegSubsampling::CSS_444 : JpegSubsampling::CSS_420;
+  return d;
+}
+
+// rate 0: all images are there at the start
+static std::vector<FormedImage> make_workload(const sim_params_t &params, double rate) {
+  static const int dims[][2] = {{160, 120}, {320, 240}, {480, 360}, {640, 480}, {1920, 1080},
+                                {3264, 2448}, {4032, 3024}, {7680, 4320}};
+  static const double weights[] = {30, 30, 15, 15, 4, 2, 2, 2};
+  std::mt19937 rng(42);
+  std::discrete_distribution<int> pick_dim(std::begin(weights), std::end(weights));
+  std::exponential_distribution<double> gap(rate > 0 ? rate : 1);
+  std::uniform_real_distribution<double> u(0, 1);
+  std::vector<FormedImage> images(params.images);
+  double t = 0;
+  for (int i = 0; i < params.images; i++) {
+    const int d = pick_dim(rng);
+    if (rate > 0) t += gap(rng);
+    images[i].id = i;
+    images[i].arrival = t;
+    images[i].desc = make_descriptor(dims[d][0], dims[d][1], u(rng) < 0.05, u(rng) < 0.2);
+  }
+  return images;
+}
+
+struct Result {
+  double makespan = 0;
+  double mean_latency = 0, p99_latency = 0, max_latency = 0;
+  double p99_small_latency = 0;  // images up to 640x480
+  double max_buffered = 0;       // longest time an image waited for its batch
+  size_t batches = 0;
+};
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, static_cast<size_t>(p * v.size()))];
+}
+
+// directory order: batches in arrival order, emitted when full or when the
+// oldest image is due
+class DirectoryOrder {
+ public:
+  DirectoryOrder(size_t max_batch, double max_wait) : max_batch_(max_batch), max_wait_(max_wait) {}
+  void push(const FormedImage &image, double) { queue_.push_back(image); }
+  bool full() const { return false; }
+  double next_deadline() const {
+    return queue_.empty() || max_wait_ <= 0 ? std::numeric_limits<double>::infinity()
+                                            : queue_.front().arrival + max_wait_;
+  }
+  bool pop(std::vector<FormedImage> &batch, double now) {
+    if (queue_.size() >= max_batch_ || (!queue_.empty() && now >= next_deadline())) return flush(batch, now);
+    return false;
+  }
+  bool flush(std::vector<FormedImage> &batch, double) {
+    const size_t n = std::min(queue_.size(), max_batch_);
+    batch.assign(queue_.begin(), queue_.begin() + n);
+    queue_.erase(queue_.begin(), queue_.begin() + n);
+    return n > 0;
+  }
+
+ private:
+  size_t max_batch_;
+  double max_wait_;
+  std::deque<FormedImage> queue_;
+};
+
+struct Adapter {
+  BatchFormer &former;
+  // images age from the time they enter the window
+  void push(const FormedImage &image, double now) { former.push(image.id, image.desc, now); }
+  bool full() const { return former.full(); }
+  double next_deadline() const { return former.next_deadline(); }
+  bool pop(std::vector<FormedImage> &batch, double now) { return former.pop(batch, now); }
+  bool flush(std::vector<FormedImage> &batch, double now) { return former.flush(batch, now); }
+};
+
+static int failures = 0;
+
+template <typename Policy>
+static Result run(const std::vector<FormedImage> &images, const DecodeCost &cost, Policy &policy,
+                  const BatchFormer *former, size_t max_batch) {
+  Result result;
+  std::vector<double> latency(images.size(), -1), small;
+  std::vector<FormedImage> batch;
+  size_t next = 0, done = 0;
+  double t = 0;
+  while (done < images.size()) {
+    while (next < images.size() && images[next].arrival <= t && !policy.full())
+      policy.push(images[next], std::max(t, images[next].arrival)), next++;
+    bool got = policy.pop(batch, t);
+    if (!got && policy.next_deadline() <= t) {
+      printf("FAILED: an image is held past its deadline while the decoder is idle\n");
+      failures++;
+    }
+    if (!got) {
+      const double wake = std::min(next < images.size() && !policy.full() ? images[next].arrival
+                                                        : std::numeric_limits<double>::infinity(),
+                                   policy.next_deadline());
+      if (wake != std::numeric_limits<double>::infinity()) {
+        t = std::max(t, wake);
+        continue;
+      }
+      got = policy.flush(batch, t);
+      if (!got) break;
+    }
+    if (batch.size() > max_batch) {
+      printf("FAILED: batch of %zu images\n", batch.size());
+      failures++;
+    }
+    if (former) {
+      for (const auto &image : batch) {
+        // same decode path and subsampling, nothing larger than the first group
+        const uint32_t first = former->key(batch[0].desc), key = former->key(image.desc);
+        if (key >> 16 != first >> 16 || key > first) {
+          printf("FAILED: batch mixes groups\n");
+          failures++;
+          break;
+        }
+      }
+    }
+    for (const auto &image : batch)
+      result.max_buffered = std::max(result.max_buffered, t - image.arrival);
+    t += cost.batch(batch);
+    for (const auto &image : batch) {
+      if (latency[image.id] >= 0) {
+        printf("FAILED: image %zu decoded twice\n", image.id);
+        failures++;
+      }
+      latency[image.id] = t - image.arrival;
+      if (image.desc.width * image.desc.height <= 640 * 480) small.push_back(latency[image.id]);
+    }
+    done += batch.size();
+    result.batches++;
+  }
+  double sum = 0;
+  for (double l : latency) {
+    if (l < 0) {
+      printf("FAILED: image lost\n");
+      failures++;
+      break;
+    }
+    sum += l;
+    result.max_latency = std::max(result.max_latency, l);
+  }
+  result.makespan = t;
+  result.mean_latency = sum / images.size();
+  result.p99_latency = percentile(latency, 0.99);
+  result.p99_small_latency = percentile(small, 0.99);
+  return result;
+}
+
+static void print(const char *name, const Result &r, size_t images) {
+  printf("%18s %10.1f %8zu %10.2f %10.2f %10.2f %12.2f\n", name, images / r.makespan, r.batches,
+         r.mean_latency * 1e3, r.p99_latency * 1e3, r.max_latency * 1e3, r.p99_small_latency * 1e3);
+}
+
+int main(int argc, const char *argv[]) {
+  sim_params_t params;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      printf("Usage: %s [-n images] [-r images_per_second] [-b max_batch] [-w window] [-l max_wait_ms]\n",
+             argv[0]);
+      return EXIT_SUCCESS;
+    }
+    if (i + 1 >= argc) break;
+    if (strcmp(argv[i], "-n") == 0) params.images = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-r") == 0) params.rate = atof(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0) params.max_batch = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-w") == 0) params.window = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-l") == 0) params.max_wait = atof(argv[++i]) * 1e-3;
+  }
+
+  const DecodeCost cost;
+  printf("images: %d, max batch: %d, window: %d, max wait: %.1f ms\n", params.images, params.max_batch,
+         params.window, params.max_wait * 1e3);
+
+  // offline: the whole input is available, as in the sample, so only the
+  // window limits the grouping; online: arrivals below the decoder's capacity
+  for (double rate : {0.0, params.rate}) {
+    const std::vector<FormedImage> images = make_workload(params, rate);
+    if (rate > 0)
+      printf("\nonline, %.0f images/s\n", rate);
+    else
+      printf("\noffline\n");
+    printf("%18s %10s %8s %10s %10s %10s %12s\n", "policy", "images/s", "batches", "mean [ms]", "p99 [ms]",
+           "max [ms]", "p99 small");
+
+    DirectoryOrder directory(params.max_batch, params.max_wait);
+    const Result baseline = run(images, cost, directory, nullptr, params.max_batch);
+    print("directory order", baseline, images.size());
+
+    BatchFormerConfig config;
+    config.max_batch = params.max_batch;
+    config.window = params.window;
+    config.max_wait = params.max_wait;
+    BatchFormer former(config);
+    Adapter adapter{former};
+    const Result bucketed = run(images, cost, adapter, &former, params.max_batch);
+    print("size buckets", bucketed, images.size());
+    former.print(std::cout);
+
+    if (rate > 0) {
+      // images that are due go out as soon as the decoder is free (checked
+      // in run()), the rest of the wait is queueing behind other batches
+      printf("longest wait for a batch: %.2f ms, directory order %.2f ms\n", bucketed.max_buffered * 1e3,
+             baseline.max_buffered * 1e3);
+      printf("p99 latency: %.2fx lower, p99 of small images %.2fx lower\n",
+             baseline.p99_latency / bucketed.p99_latency,
+             baseline.p99_small_latency / bucketed.p99_small_latency);
+    } else {
+      const double speedup = baseline.makespan / bucketed.makespan;
+      printf("speedup: %.2fx\n", speedup);
+      if (speedup < 1.0) {
+        printf("FAILED: bucketing is slower\n");
+        failures++;
+      }
+    }
+  }
+  if (failures) printf("%d checks FAILED\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
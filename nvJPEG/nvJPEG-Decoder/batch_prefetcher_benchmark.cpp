@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// CPU-only benchmark: files/s of the synchronous read_next_batch() loop versus
+// BatchPrefetcher, optionally with a simulated per-batch decode time that the
+// prefetcher can overlap with I/O.
+//
+// Build: g++ -O2 -std=c++17 -pthread batch_prefetcher_benchmark.cpp -o batch_prefetcher_benchmark
+// Usage: ./batch_prefetcher_benchmark [-i images_dir] [-n files] [-s file_size]
+//        [-b batch_size] [-t total_images] [-d decode_us_per_batch] [-prefetch batches] [-j io_threads]
+//
+// Without -i, files of random content are generated in a temporary directory.
+// Note that repeated runs are served from the page cache unless it is dropped.
+
+#include "../../common/batch_prefetcher.h"
+
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+namespace fs = std::filesystem;
+
+typedef std::vector<std::string> FileNames;
+typedef std::vector<std::vector<char> > FileData;
+
+// the reader used by the decoder samples before BatchPrefetcher
+int read_next_batch(FileNames &image_names, int batch_size,
+                    FileNames::iterator &cur_iter, FileData &raw_data,
+                    std::vector<size_t> &raw_len, FileNames &current_names) {
+  int counter = 0;
+
+  while (counter < batch_size) {
+    if (cur_iter == image_names.end()) {
+      cur_iter = image_names.begin();
+    }
+
+    if (image_names.size() == 0) {
+      std::cerr << "No valid images left in the input list, exit" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    std::ifstream input(cur_iter->c_str(),
+                        std::ios::in | std::ios::binary | std::ios::ate);
+    if (!(input.is_open())) {
+      image_names.erase(cur_iter);
+      continue;
+    }
+
+    std::streamsize file_size = input.tellg();
+    input.seekg(0, std::ios::beg);
+    if (raw_data[counter].size() < static_cast<size_t>(file_size)) {
+      raw_data[counter].resize(file_size);
+    }
+    if (!input.read(raw_data[counter].data(), file_size)) {
+      image_names.erase(cur_iter);
+      continue;
+    }
+    raw_len[counter] = file_size;
+    current_names[counter] = *cur_iter;
+
+    counter++;
+    cur_iter++;
+  }
+  return EXIT_SUCCESS;
+}
+
+struct bench_params_t {
+  std::string input_dir;
+  int num_files = 2000;
+  int file_size = 64 * 1024;
+  int batch_size = 64;
+  int total_images = 20000;
+  int decode_us = 0;
+  int prefetch = 2;
+  int io_threads = 4;
+};
+
+// stands in for the decoder: touches every page, then blocks for decode_us
+// like a host thread waiting in cudaStreamSynchronize()
+static size_t consume(const FileData &data, const std::vector<size_t> &len, int decode_us) {
+  size_t checksum = 0;
+  for (size_t i = 0; i < data.size(); i++)
+    for (size_t j = 0; j < len[i]; j += 4096) checksum += data[i][j];
+  if (decode_us > 0)
+    std::this_thread::sleep_for(std::chrono::microseconds(decode_us));
+  return checksum;
+}
+
+int main(int argc, const char *argv[]) {
+  bench_params_t params;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      std::cout << "Usage: " << argv[0]
+                << " [-i images_dir] [-n files] [-s file_size] [-b batch_size] [-t total_images]"
+                   " [-d decode_us_per_batch] [-prefetch batches] [-j io_threads]" << std::endl;
+      return EXIT_SUCCESS;
+    }
+    if (i + 1 >= argc) break;
+    if (strcmp(argv[i], "-i") == 0) params.input_dir = argv[++i];
+    else if (strcmp(argv[i], "-n") == 0) params.num_files = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0) params.file_size = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-b") == 0) params.batch_size = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-t") == 0) params.total_images = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-d") == 0) params.decode_us = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-prefetch") == 0) params.prefetch = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-j") == 0) params.io_threads = atoi(argv[++i]);
+  }
+
+  FileNames image_names;
+  fs::path tmp_dir;
+  if (!params.input_dir.empty()) {
+    for (auto const &it : fs::recursive_directory_iterator(params.input_dir))
+      if (it.symlink_status().type() == fs::file_type::regular)
+        image_names.push_back(it.path().string());
+  } else {
+    tmp_dir = fs::temp_directory_path() / ("prefetch_bench_" + std::to_string(std::random_device()()));
+    fs::create_directories(tmp_dir);
+    std::mt19937 rng(42);
+    std::vector<char> content(params.file_size);
+    for (int i = 0; i < params.num_files; i++) {
+      for (auto &c : content) c = static_cast<char>(rng());
+      std::string name = (tmp_dir / ("img" + std::to_string(i) + ".jpg")).string();
+      std::ofstream(name, std::ios::binary).write(content.data(), content.size());
+      image_names.push_back(name);
+    }
+  }
+  if (image_names.empty()) {
+    std::cerr << "No input files" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const int batches = params.total_images / params.batch_size;
+  size_t checksum = 0;
+  std::cout << image_names.size() << " files, " << batches << " batches of " << params.batch_size
+            << ", simulated decode " << params.decode_us << " us/batch" << std::endl;
+
+  {
+    FileData file_data(params.batch_size);
+    std::vector<size_t> file_len(params.batch_size);
+    FileNames current_names(params.batch_size);
+    FileNames names = image_names;
+    FileNames::iterator file_iter = names.begin();
+    auto start = std::chrono::steady_clock::now();
+    for (int b = 0; b < batches; b++) {
+      if (read_next_batch(names, params.batch_size, file_iter, file_data, file_len, current_names))
+        return EXIT_FAILURE;
+      checksum += consume(file_data, file_len, params.decode_us);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "synchronous : " << batches * params.batch_size / seconds << " files/s" << std::endl;
+  }
+
+  {
+    FileData file_data(params.batch_size);
+    std::vector<size_t> file_len(params.batch_size);
+    FileNames current_names(params.batch_size);
+    auto start = std::chrono::steady_clock::now();
+    BatchPrefetcher prefetcher(image_names, params.batch_size, params.prefetch, params.io_threads, false);
+    for (int b = 0; b < batches; b++) {
+      if (prefetcher.next_batch(file_data, file_len, current_names))
+        return EXIT_FAILURE;
+      checksum += consume(file_data, file_len, params.decode_us);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    PrefetchStats stats = prefetcher.stats();
+    std::cout << "prefetch " << params.prefetch << "/" << params.io_threads
+              << ": " << batches * params.batch_size / seconds << " files/s (consumer stalled "
+              << stats.stall_seconds << " s)" << std::endl;
+  }
+
+  if (!tmp_dir.empty()) fs::remove_all(tmp_dir);
+  return checksum == 0x5eed ? EXIT_FAILURE : EXIT_SUCCESS; // keeps consume() from being optimized out
+}
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// CPU-only check of the JPEG header scanner (common/jpeg_scanner.h).
+//
+// Scans synthetic streams with known headers (baseline, progressive,
+// restart interval, EXIF orientation in both byte orders, stuffed and
+// restart markers in the entropy data), every truncated prefix and random
+// corruptions of them, and the images of a directory, then times the batch
+// scanner against a single thread. Exits with a failure if a descriptor is
+// wrong or a damaged stream is reported as valid.
+//
+// Build: g++ -O2 -std=c++17 -pthread jpeg_scanner_check.cpp -o jpeg_scanner_check
+// Usage: ./jpeg_scanner_check [-i images_dir] [-j threads] [-n images]
+
+#include "../../common/jpeg_scanner.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct check_params_t {
+  std::string input_dir = "../input_images";
+  int threads = 4;
+  int images = 20000;
+};
+
+static int failures = 0;
+
+#define EXPECT(cond, what)                                        \
+  do {                                                            \
+    if (!(cond)) {                                                \
+      printf("FAILED: %s: %s (line %d)\n", what, #cond, __LINE__); \
+      failures++;                                                 \
+    }                                                             \
+  } while (0)
+
+typedef std::vector<unsigned char> Bytes;
+
+static void put16(Bytes &b, int v) {
+  b.push_back(static_cast<unsigned char>(v >> 8));
+  b.push_back(static_cast<unsigned char>(v));
+}
+
+static void segment(Bytes &b, int marker, const Bytes &payload) {
+  b.push_back(0xFF);
+  b.push_back(static_cast<unsigned char>(marker));
+  put16(b, static_cast<int>(payload.size()) + 2);
+  b.insert(b.end(), payload.begin(), payload.end());
+}
+
+// APP1 Exif with an IFD0 holding a dummy tag and the orientation
+static Bytes exif(int orientation, bool little_endian) {
+  Bytes t = {'E', 'x', 'i', 'f', 0, 0};
+  auto p16 = [&](int v) {
+    if (little_endian) {
+      t.push_back(v & 255);
+      t.push_back(v >> 8);
+    } else {
+      put16(t, v);
+    }
+  };
+  auto p32 = [&](int v) {
+    if (little_endian) {
+      p16(v & 0xFFFF);
+      p16(v >> 16);
+    } else {
+      p16(v >> 16);
+      p16(v & 0xFFFF);
+    }
+  };
+  t.push_back(little_endian ? 'I' : 'M');
+  t.push_back(little_endian ? 'I' : 'M');
+  p16(42);
+  p32(8);
+  p16(2);  // entries
+  p16(0x010F), p16(2), p32(4), p32(0);  // Make
+  p16(0x0112), p16(3), p32(1), p16(orientation), p16(0);
+  p32(0);
+  return t;
+}
+
+struct Synthetic {
+  const char *name;
+  int sof;
+  int width, height;
+  std::vector<int> sampling;  // (h << 4) | v per component
+  int restart;
+  int orientation;  // 0: no Exif
+  bool little_endian;
+  int scans;
+  JpegSubsampling subsampling;
+};
+
+// a header plus fake entropy data for every scan
+static Bytes build(const Synthetic &s, size_t *sos_end = nullptr) {
+  Bytes b = {0xFF, 0xD8};
+  segment(b, 0xE0, {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0});
+  if (s.orientation) segment(b, 0xE1, exif(s.orientation, s.little_endian));
+  segment(b, 0xDB, Bytes(65, 1));
+  Bytes sof = {8};
+  put16(sof, s.height);
+  put16(sof, s.width);
+  sof.push_back(static_cast<unsigned char>(s.sampling.size()));
+  for (size_t c = 0; c < s.sampling.size(); c++) {
+    sof.push_back(static_cast<unsigned char>(c + 1));
+    sof.push_back(static_cast<unsigned char>(s.sampling[c]));
+    sof.push_back(c ? 1 : 0);
+  }
+  segment(b, s.sof, sof);
+  if (s.restart) {
+    Bytes dri;
+    put16(dri, s.restart);
+    segment(b, 0xDD, dri);
+  }
+  for (int scan = 0; scan < s.scans; scan++) {
+    b.push_back(0xFF);  // fill byte before a marker
+    segment(b, 0xC4, Bytes(29, 0));
+    Bytes sos = {1, 1, 0, 0, 63, 0};
+    segment(b, 0xDA, sos);
+    if (scan == 0 && sos_end) *sos_end = b.size();
+    // entropy data with a stuffed 0xFF and a restart marker
+    for (int i = 0; i < 40; i++) b.push_back(static_cast<unsigned char>(i * 7));
+    b.push_back(0xFF), b.push_back(0x00);
+    b.push_back(0x12);
+    b.push_back(0xFF), b.push_back(0xD0 + scan % 8);
+    b.push_back(0x34);
+  }
+  b.push_back(0xFF), b.push_back(0xD9);
+  return b;
+}
+
+static void check_synthetic() {
+  const Synthetic cases[] = {
+      {"baseline 4:2:0", 0xC0, 640, 427, {0x22, 0x11, 0x11}, 0, 0, false, 1, JpegSubsampling::CSS_420},
+      {"baseline 4:2:2 dri", 0xC0, 1921, 1080, {0x21, 0x11, 0x11}, 120, 0, false, 1,
+       JpegSubsampling::CSS_422},
+      {"extended 4:4:0 exif mm", 0xC1, 33, 17, {0x12, 0x11, 0x11}, 0, 6, false, 1, JpegSubsampling::CSS_440},
+      {"progressive exif ii", 0xC2, 4032, 3024, {0x22, 0x11, 0x11}, 0, 8, true, 10,
+       JpegSubsampling::CSS_420},
+      {"gray", 0xC0, 64, 64, {0x11}, 4, 0, false, 1, JpegSubsampling::CSS_GRAY},
+      {"4:1:1", 0xC0, 100, 50, {0x41, 0x11, 0x11}, 0, 3, true, 1, JpegSubsampling::CSS_411},
+      {"cmyk", 0xC0, 10, 10, {0x11, 0x11, 0x11, 0x11}, 0, 0, false, 1, JpegSubsampling::CSS_444},
+      {"4:4:4 sampled 2x2", 0xC0, 16, 16, {0x22, 0x22, 0x22}, 0, 0, false, 1, JpegSubsampling::CSS_444},
+      {"odd chroma", 0xC0, 16, 16, {0x32, 0x21, 0x11}, 0, 0, false, 1, JpegSubsampling::CSS_UNKNOWN},
+      {"lossless", 0xC3, 16, 16, {0x11, 0x11, 0x11}, 0, 0, false, 1, JpegSubsampling::CSS_444},
+      {"arithmetic progressive", 0xCA, 16, 16, {0x22, 0x11, 0x11}, 0, 0, false, 3,
+       JpegSubsampling::CSS_420},
+  };
+
+  for (const auto &s : cases) {
+    size_t sos_end = 0;
+    const Bytes b = build(s, &sos_end);
+    for (bool full : {false, true}) {
+      const JpegDescriptor d = scan_jpeg(b.data(), b.size(), full);
+      EXPECT(d.ok(), s.name);
+      EXPECT(d.width == s.width && d.height == s.height, s.name);
+      EXPECT(d.components == s.sampling.size(), s.name);
+      EXPECT(d.sof_marker == s.sof, s.name);
+      EXPECT(d.subsampling == s.subsampling, s.name);
+      EXPECT(d.restart_interval == s.restart, s.name);
+      EXPECT(d.orientation == (s.orientation ? s.orientation : 1), s.name);
+      EXPECT(d.progressive() == (s.sof == 0xC2 || s.sof == 0xCA), s.name);
+      EXPECT(d.arithmetic() == (s.sof == 0xCA), s.name);
+      EXPECT(d.lossless() == (s.sof == 0xC3), s.name);
+      EXPECT(d.baseline() == (s.sof == 0xC0 || s.sof == 0xC1), s.name);
+      EXPECT(d.scan_data_offset == sos_end, s.name);
+      EXPECT(b[d.sof_offset] == 0xFF && b[d.sof_offset + 1] == s.sof, s.name);
+      EXPECT(b[d.dht_offset] == 0xFF && b[d.dht_offset + 1] == 0xC4, s.name);
+      EXPECT(b[d.sos_offset] == 0xFF && b[d.sos_offset + 1] == 0xDA, s.name);
+      EXPECT(d.scans == (full ? s.scans : 1), s.name);
+      EXPECT(d.dht_count == (full ? s.scans : 1), s.name);
+      EXPECT(d.dqt_count == 1, s.name);
+    }
+    // chroma planes round up, as nvjpegGetImageInfo reports them
+    const JpegDescriptor d = scan_jpeg(b.data(), b.size());
+    if (s.subsampling == JpegSubsampling::CSS_420) {
+      EXPECT(d.component_width(1) == (s.width + 1) / 2 && d.component_height(1) == (s.height + 1) / 2,
+             s.name);
+    }
+
+    // every prefix that ends before the first scan's data is incomplete
+    for (size_t n = 0; n < b.size(); n++) {
+      const JpegDescriptor t = scan_jpeg(b.data(), n, true);
+      if (n < sos_end) EXPECT(!t.ok(), s.name);
+      else EXPECT(t.ok() && t.width == s.width, s.name);
+    }
+  }
+
+  // damaged streams must not crash or read out of bounds (see -fsanitize=address)
+  std::mt19937 rng(7);
+  const Bytes base = build(cases[3]);
+  for (int i = 0; i < 200000; i++) {
+    Bytes b = base;
+    const int flips = 1 + rng() % 4;
+    for (int f = 0; f < flips; f++) b[rng() % b.size()] = static_cast<unsigned char>(rng());
+    b.resize(rng() % (b.size() + 1));
+    const JpegDescriptor d = scan_jpeg(b.data(), b.size(), i & 1);
+    if (d.ok()) EXPECT(d.components >= 1 && d.components <= 4 && d.width && d.height, "fuzz");
+  }
+
+  const unsigned char not_jpeg[] = {'B', 'M', 0, 0, 0, 0};
+  EXPECT(scan_jpeg(not_jpeg, sizeof(not_jpeg)).status == JpegScanStatus::NotJpeg, "not jpeg");
+}
+
+static Bytes read_file(const fs::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  return Bytes(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static const char *subsampling_name(JpegSubsampling s) {
+  static const char *names[] = {"4:4:4", "4:2:2", "4:2:0", "4:4:0", "4:1:1", "4:1:0", "gray", "4:1:0v", "unknown"};
+  return names[static_cast<int>(s)];
+}
+
+int main(int argc, const char *argv[]) {
+  check_params_t params;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      printf("Usage: %s [-i images_dir] [-j threads] [-n images]\n", argv[0]);
+      return EXIT_SUCCESS;
+    }
+    if (i + 1 >= argc) break;
+    if (strcmp(argv[i], "-i") == 0) params.input_dir = argv[++i];
+    else if (strcmp(argv[i], "-j") == 0) params.threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-n") == 0) params.images = atoi(argv[++i]);
+  }
+
+  check_synthetic();
+  printf("synthetic streams: %s\n", failures ? "FAILED" : "ok");
+
+  std::vector<Bytes> files;
+  std::error_code ec;
+  for (const auto &entry : fs::directory_iterator(params.input_dir, ec)) {
+    Bytes b = read_file(entry.path());
+    const JpegDescriptor d = scan_jpeg(b.data(), b.size());
+    const JpegDescriptor f = scan_jpeg(b.data(), b.size(), true);
+    const std::string name = entry.path().filename().string();
+    if (!d.ok()) {
+      printf("%-20s not scanned (status %d)\n", name.c_str(), static_cast<int>(d.status));
+      continue;
+    }
+    printf("%-20s %5d x %-5d %d comp %-7s SOF%-2d %3d scans restart %-4d orientation %d\n", name.c_str(),
+           d.width, d.height, d.components, subsampling_name(d.subsampling), d.sof_marker - 0xC0, f.scans,
+           d.restart_interval, d.orientation);
+    EXPECT(f.ok() && f.width == d.width && f.height == d.height && f.scans >= 1, name.c_str());
+    for (size_t n = 0; n < b.size(); n++) scan_jpeg(b.data(), n, true);  // must not crash
+    files.push_back(std::move(b));
+  }
+  if (files.empty()) {
+    printf("no images in %s, timing synthetic streams\n", params.input_dir.c_str());
+    files.push_back(build({"", 0xC0, 1920, 1080, {0x22, 0x11, 0x11}, 0, 1, false, 1, JpegSubsampling::CSS_420}));
+  }
+
+  // the header scan of a large batch, one thread against the batch scanner
+  std::vector<const unsigned char *> data(params.images);
+  std::vector<size_t> lengths(params.images);
+  for (int i = 0; i < params.images; i++) {
+    data[i] = files[i % files.size()].data();
+    lengths[i] = files[i % files.size()].size();
+  }
+  std::vector<JpegDescriptor> serial(params.images), parallel;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < params.images; i++) serial[i] = scan_jpeg(data[i], lengths[i]);
+  auto t1 = std::chrono::steady_clock::now();
+  JpegBatchScanner scanner(params.threads);
+  scanner.scan(data, lengths, parallel);  // warm up the workers
+  auto t2 = std::chrono::steady_clock::now();
+  scanner.scan(data, lengths, parallel);
+  auto t3 = std::chrono::steady_clock::now();
+  for (int i = 0; i < params.images; i++)
+    EXPECT(memcmp(&serial[i], &parallel[i], sizeof(JpegDescriptor)) == 0, "batch scan");
+
+  // small batches, as the decoder scans them
+  const int batch = 64;
+  int rounds = 0;
+  auto t4 = std::chrono::steady_clock::now();
+  for (int i = 0; i + batch <= params.images; i += batch, rounds++)
+    scanner.scan(data.data() + i, lengths.data() + i, batch, parallel.data() + i);
+  auto t5 = std::chrono::steady_clock::now();
+
+  const double serial_us = std::chrono::duration<double, std::micro>(t1 - t0).count();
+  const double parallel_us = std::chrono::duration<double, std::micro>(t3 - t2).count();
+  const double batch_us = std::chrono::duration<double, std::micro>(t5 - t4).count();
+  printf("descriptor: %zu bytes\n", sizeof(JpegDescriptor));
+  printf("%d images: 1 thread %.3f us/image, %d threads %.3f us/image, batches of %d %.2f us/batch\n",
+         params.images, serial_us / params.images, params.threads, parallel_us / params.images, batch,
+         rounds ? batch_us / rounds : 0.0);
+
+  if (failures) printf("%d checks FAILED\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -30,7 +30,7 @@
 #include "nvjpegDecoder.h"
 
 
-int decode_images(const FileData &img_data, const std::vector<size_t> &img_len,
+int decode_images(const FilePointers &img_data, const std::vector<size_t> &img_len,
                   std::vector<nvjpegImage_t> &out, decode_params_t &params,
                   double &time) {
   CHECK_CUDA(cudaStreamSynchronize(params.stream));
@@ -51,25 +51,34 @@ int decode_images(const FileData &img_data, const std::vector<size_t> &img_len,
   std::vector<nvjpegImage_t> otherdecode_output;
 
   if(params.hw_decode_available){
-    for(int i = 0; i < params.batch_size; i++){
+    for(int i = 0; i < img_data.size(); i++){
+      // progressive, lossless and arithmetic coded streams are never
+      // supported, no need to have nvJPEG parse them again
+      const JpegDescriptor &desc = params.descriptors[i];
+      if (desc.ok() && !desc.baseline()) {
+        otherdecode_bitstreams.push_back(img_data[i]);
+        otherdecode_bitstreams_size.push_back(img_len[i]);
+        otherdecode_output.push_back(out[i]);
+        continue;
+      }
       // extract bitstream meta data to figure out whether a bit-stream can be decoded
-      nvjpegJpegStreamParseHeader(params.nvjpeg_handle, (const unsigned char *)img_data[i].data(), img_len[i], params.jpeg_streams[0]);
+      nvjpegJpegStreamParseHeader(params.nvjpeg_handle, img_data[i], img_len[i], params.jpeg_streams[0]);
       int isSupported = -1;
       nvjpegDecodeBatchedSupported(params.nvjpeg_handle, params.jpeg_streams[0], &isSupported);
 
       if(isSupported == 0){
-        batched_bitstreams.push_back((const unsigned char *)img_data[i].data());
+        batched_bitstreams.push_back(img_data[i]);
         batched_bitstreams_size.push_back(img_len[i]);
         batched_output.push_back(out[i]);
       } else {
-        otherdecode_bitstreams.push_back((const unsigned char *)img_data[i].data());
+        otherdecode_bitstreams.push_back(img_data[i]);
         otherdecode_bitstreams_size.push_back(img_len[i]);
         otherdecode_output.push_back(out[i]);
       }
     }
   } else {
-    for(int i = 0; i < params.batch_size; i++) {
-      otherdecode_bitstreams.push_back((const unsigned char *)img_data[i].data());
+    for(int i = 0; i < img_data.size(); i++) {
+      otherdecode_bitstreams.push_back(img_data[i]);
       otherdecode_bitstreams_size.push_back(img_len[i]);
       otherdecode_output.push_back(out[i]);
     }
@@ -93,7 +102,7 @@ int decode_images(const FileData &img_data, const std::vector<size_t> &img_len,
           CHECK_NVJPEG(nvjpegStateAttachDeviceBuffer(params.nvjpeg_decoupled_state, params.device_buffer));
           int buffer_index = 0;
           CHECK_NVJPEG(nvjpegDecodeParamsSetOutputFormat(params.nvjpeg_decode_params, params.fmt));
-          for (int i = 0; i < params.batch_size; i++) {
+          for (int i = 0; i < otherdecode_bitstreams.size(); i++) {
               CHECK_NVJPEG(
                   nvjpegJpegStreamParse(params.nvjpeg_handle, otherdecode_bitstreams[i], otherdecode_bitstreams_size[i],
                   0, 0, params.jpeg_streams[buffer_index]));
@@ -127,8 +136,8 @@ int decode_images(const FileData &img_data, const std::vector<size_t> &img_len,
 
 int write_images(std::vector<nvjpegImage_t> &iout, std::vector<int> &widths,
                  std::vector<int> &heights, decode_params_t &params,
-                 FileNames &filenames) {
-  for (int i = 0; i < params.batch_size; i++) {
+                 FileNames &filenames, AsyncImageWriter *async_writer) {
+  for (int i = 0; i < filenames.size(); i++) {
     // Get the file name, without extension.
     // This will be used to rename the output file.
     size_t position = filenames[i].rfind("/");
@@ -141,7 +150,29 @@ int write_images(std::vector<nvjpegImage_t> &iout, std::vector<int> &widths,
                                                 : sFileName.substr(0, position);
     std::string fname(params.output_dir + "/" + sFileName + ".bmp");
 
-    int err;
+    const bool interleaved = params.fmt == NVJPEG_OUTPUT_RGBI ||
+                             params.fmt == NVJPEG_OUTPUT_BGRI;
+    if (async_writer) {
+      // only the device to host copy happens here, encoding and file I/O
+      // overlap with decoding the next batch
+      auto host = std::make_shared<std::vector<unsigned char>>();
+      int err = interleaved
+                    ? copyInterleavedToHost(*host, iout[i].channel[0], iout[i].pitch[0],
+                                            widths[i], heights[i])
+                    : copyPlanarToHost(*host, iout[i].channel[0], iout[i].pitch[0],
+                                       iout[i].channel[1], iout[i].pitch[1], iout[i].channel[2],
+                                       iout[i].pitch[2], widths[i], heights[i]);
+      if (err) return EXIT_FAILURE;
+      const int width = widths[i], height = heights[i];
+      async_writer->submit([host, fname, width, height, interleaved](ImageWriter &writer) {
+        int err = writeBMPHost(fname.c_str(), host->data(), width, height, interleaved, writer);
+        if (err) std::cout << "Cannot write output file: " << fname << std::endl;
+        return err;
+      });
+      continue;
+    }
+
+    int err = 0;
     if (params.fmt == NVJPEG_OUTPUT_RGB || params.fmt == NVJPEG_OUTPUT_BGR) {
       err = writeBMP(fname.c_str(), iout[i].channel[0], iout[i].pitch[0],
                      iout[i].channel[1], iout[i].pitch[1], iout[i].channel[2],
@@ -161,10 +192,12 @@ int write_images(std::vector<nvjpegImage_t> &iout, std::vector<int> &widths,
   return EXIT_SUCCESS;
 }
 
-double process_images(FileNames &image_names, decode_params_t &params,
-                      double &total) {
+double process_images(FileNames &image_names, const PackedArchive &archive,
+                      decode_params_t &params, double &total) {
   // vector for storing raw files and file lengths
   FileData file_data(params.batch_size);
+  FilePointers file_ptrs(params.batch_size);
+  size_t archive_index = 0;
   std::vector<size_t> file_len(params.batch_size);
   FileNames current_names(params.batch_size);
   std::vector<int> widths(params.batch_size);
@@ -191,32 +224,156 @@ double process_images(FileNames &image_names, decode_params_t &params,
     }
   }
 
+  // disk reads of the next batches overlap with decoding the current one
+  std::unique_ptr<BatchPrefetcher> prefetcher;
+  if (params.prefetch > 0 && archive.count() == 0)
+    prefetcher.reset(new BatchPrefetcher(image_names, params.batch_size, params.prefetch));
+
+  // BMP encoding and file writes of the decoded images run in the background
+  std::unique_ptr<AsyncImageWriter> async_writer;
+  if (params.write_decoded && params.async_write > 0)
+    async_writer.reset(new AsyncImageWriter(params.async_write));
+
+  // with size bucketing (-bucket) the images wait in a window and are decoded
+  // in batches of similar size and decode path, see batch_former.h; the
+  // clock of the former is the number of images read
+  std::unique_ptr<BatchFormer> former;
+  FileData window_data;  // copies of the files in the window, unless mapped
+  FilePointers window_ptrs;
+  std::vector<size_t> window_len;
+  FileNames window_names;
+  std::vector<size_t> free_slots;
+  if (params.bucket_window > 0) {
+    BatchFormerConfig config;
+    config.max_batch = params.batch_size;
+    config.window = std::max(params.bucket_window, params.batch_size);
+    config.max_wait = params.bucket_wait;
+    former.reset(new BatchFormer(config));
+    window_data.resize(config.window);
+    window_ptrs.resize(config.window);
+    window_len.resize(config.window);
+    window_names.resize(config.window);
+    for (size_t slot = config.window; slot > 0; slot--) free_slots.push_back(slot - 1);
+  }
+  std::vector<FormedImage> formed;
+  FilePointers formed_ptrs;
+  std::vector<size_t> formed_len;
+  FileNames formed_names;
+  size_t images_read = 0;
+
   double test_time = 0;
   int warmup = 0;
-  while (total_processed < params.total_images) {
-    if (read_next_batch(image_names, params.batch_size, file_iter, file_data,
-                        file_len, current_names))
-      return EXIT_FAILURE;
 
-    if (prepare_buffers(file_data, file_len, widths, heights, iout, isz,
-                        current_names, params))
+  // params.descriptors must hold the descriptors of the batch
+  auto decode_batch = [&](const FilePointers &ptrs, std::vector<size_t> &lens,
+                          FileNames &names) {
+    if (prepare_buffers(ptrs, lens, widths, heights, iout, isz, names, params))
       return EXIT_FAILURE;
 
     double time;
-    if (decode_images(file_data, file_len, iout, params, time))
+    if (decode_images(ptrs, lens, iout, params, time))
       return EXIT_FAILURE;
     if (warmup < params.warmup) {
       warmup++;
     } else {
-      total_processed += params.batch_size;
+      total_processed += ptrs.size();
       test_time += time;
     }
 
-    if (params.write_decoded)
-      write_images(iout, widths, heights, params, current_names);
+    if (params.write_decoded &&
+        write_images(iout, widths, heights, params, names, async_writer.get()))
+      return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+  };
+
+  // decodes the batch in `formed` and gives its window slots back
+  auto decode_formed = [&]() {
+    formed_ptrs.resize(formed.size());
+    formed_len.resize(formed.size());
+    formed_names.resize(formed.size());
+    params.descriptors.resize(formed.size());
+    for (size_t i = 0; i < formed.size(); i++) {
+      const size_t slot = formed[i].id;
+      formed_ptrs[i] = window_ptrs[slot];
+      formed_len[i] = window_len[slot];
+      formed_names[i] = window_names[slot];
+      params.descriptors[i] = formed[i].desc;
+    }
+    if (decode_batch(formed_ptrs, formed_len, formed_names)) return EXIT_FAILURE;
+    for (const auto &image : formed) free_slots.push_back(image.id);
+    return EXIT_SUCCESS;
+  };
+
+  while (total_processed < params.total_images) {
+    if (archive.count() > 0) {
+      if (read_next_batch(archive, params.batch_size, archive_index, file_ptrs,
+                          file_len, current_names))
+        return EXIT_FAILURE;
+    } else {
+      if (prefetcher) {
+        if (prefetcher->next_batch(file_data, file_len, current_names))
+          return EXIT_FAILURE;
+      } else if (read_next_batch(image_names, params.batch_size, file_iter, file_data,
+                                 file_len, current_names))
+        return EXIT_FAILURE;
+      for (int i = 0; i < params.batch_size; i++)
+        file_ptrs[i] = (const unsigned char *)file_data[i].data();
+    }
+
+    // one pass over the headers of the whole batch, in parallel
+    params.scanner->scan(file_ptrs, file_len, params.descriptors);
+
+    // warmup batches are decoded as read
+    if (!former || warmup < params.warmup) {
+      if (decode_batch(file_ptrs, file_len, current_names)) return EXIT_FAILURE;
+      continue;
+    }
+
+    std::vector<JpegDescriptor> descriptors;
+    descriptors.swap(params.descriptors);
+    for (int i = 0; i < params.batch_size; i++) {
+      while (former->full()) {
+        former->pop(formed, images_read);
+        if (decode_formed()) return EXIT_FAILURE;
+      }
+      const size_t slot = free_slots.back();
+      free_slots.pop_back();
+      if (archive.count() > 0) {
+        window_ptrs[slot] = file_ptrs[i];
+      } else {
+        window_data[slot].assign(file_ptrs[i], file_ptrs[i] + file_len[i]);
+        window_ptrs[slot] = (const unsigned char *)window_data[slot].data();
+      }
+      window_len[slot] = file_len[i];
+      window_names[slot] = current_names[i];
+      former->push(slot, descriptors[i], images_read++);
+    }
+    while (former->pop(formed, images_read)) {
+      if (decode_formed()) return EXIT_FAILURE;
+    }
+    // all images of the run are read
+    if (images_read >= static_cast<size_t>(params.total_images)) {
+      while (former->flush(formed, images_read)) {
+        if (decode_formed()) return EXIT_FAILURE;
+      }
+    }
   }
   total = test_time;
 
+  if (async_writer) {
+    if (async_writer->flush()) return EXIT_FAILURE;
+    std::cout << "Done writing decoded images to: " << params.output_dir << std::endl;
+  }
+
+  if (former) former->print(std::cout);
+
+  if (prefetcher) {
+    PrefetchStats stats = prefetcher->stats();
+    std::cout << "Prefetch: " << stats.files << " files, " << stats.bytes / (1024 * 1024)
+              << " MiB read in " << stats.read_seconds << " s, decoder stalled for "
+              << stats.stall_seconds << " s" << std::endl;
+  }
+
   release_buffers(iout);
 
   CHECK_CUDA(cudaStreamDestroy(params.stream));
@@ -232,10 +389,13 @@ int main(int argc, const char *argv[]) {
       (pidx = findParamIndex(argv, argc, "--help")) != -1) {
     std::cout << "Usage: " << argv[0]
               << " -i images_dir [-b batch_size] [-t total_images] "
-                 "[-w warmup_iterations] [-o output_dir] "
-                 "[-pipelined] [-batched] [-fmt output_format]\n";
+                 "[-w warmup_iterations] [-o output_dir] [-v verbose] "
+                 "[-pipelined] [-batched] [-fmt output_format] [-prefetch batches] "
+                 "[-async_write images] [-scan_threads threads] [-bucket window] "
+                 "[-bucket_wait images]\n";
     std::cout << "Parameters: " << std::endl;
-    std::cout << "\timages_dir\t:\tPath to single image or directory of images"
+    std::cout << "\timages_dir\t:\tPath to single image, directory of images "
+                 "or packed archive (see pack_images)"
               << std::endl;
     std::cout << "\tbatch_size\t:\tDecode images from input by batches of "
                  "specified size"
@@ -251,11 +411,29 @@ int main(int argc, const char *argv[]) {
     std::cout
         << "\toutput_dir\t:\tWrite decoded images as BMPs to this directory"
         << std::endl;
+    std::cout << "\tverbose\t\t:\tLog the channels, subsampling and "
+                 "orientation of every image to console"
+              << std::endl;
     std::cout << "\tpipelined\t:\tUse decoding in phases" << std::endl;
     std::cout << "\tbatched\t\t:\tUse batched interface" << std::endl;
     std::cout << "\toutput_format\t:\tnvJPEG output format for decoding. One "
                  "of [rgb, rgbi, bgr, bgri, yuv, y, unchanged]"
               << std::endl;
+    std::cout << "\tprefetch\t:\tRead this many batches ahead in the "
+                 "background, 0 reads synchronously (default 2)"
+              << std::endl;
+    std::cout << "\tasync_write\t:\tWrite BMPs on a background thread, "
+                 "queueing up to this many images (default 0, synchronous)"
+              << std::endl;
+    std::cout << "\tscan_threads\t:\tThreads that parse the JPEG headers of a "
+                 "batch before decoding (default 4)"
+              << std::endl;
+    std::cout << "\tbucket\t\t:\tBuffer this many images and decode them in "
+                 "batches of similar size and type (default 0, off)"
+              << std::endl;
+    std::cout << "\tbucket_wait\t:\tDecode a buffered image at the latest "
+                 "after this many more images are read (default: window)"
+              << std::endl;
     return EXIT_SUCCESS;
   }
 
@@ -289,6 +467,11 @@ int main(int argc, const char *argv[]) {
     params.warmup = std::atoi(argv[pidx + 1]);
   }
 
+  params.prefetch = 2;
+  if ((pidx = findParamIndex(argv, argc, "-prefetch")) != -1) {
+    params.prefetch = std::atoi(argv[pidx + 1]);
+  }
+
   params.fmt = NVJPEG_OUTPUT_RGB;
   if ((pidx = findParamIndex(argv, argc, "-fmt")) != -1) {
     std::string sfmt = argv[pidx + 1];
@@ -325,6 +508,32 @@ int main(int argc, const char *argv[]) {
     params.write_decoded = true;
   }
 
+  params.verbose = false;
+  if ((pidx = findParamIndex(argv, argc, "-v")) != -1) {
+    params.verbose = true;
+  }
+
+  params.async_write = 0;
+  if ((pidx = findParamIndex(argv, argc, "-async_write")) != -1) {
+    params.async_write = std::atoi(argv[pidx + 1]);
+  }
+
+  params.bucket_window = 0;
+  if ((pidx = findParamIndex(argv, argc, "-bucket")) != -1) {
+    params.bucket_window = std::max(0, std::atoi(argv[pidx + 1]));
+  }
+  params.bucket_wait = params.bucket_window;
+  if ((pidx = findParamIndex(argv, argc, "-bucket_wait")) != -1) {
+    params.bucket_wait = std::max(1, std::atoi(argv[pidx + 1]));
+  }
+
+  int scan_threads = 4;
+  if ((pidx = findParamIndex(argv, argc, "-scan_threads")) != -1) {
+    scan_threads = std::max(1, std::atoi(argv[pidx + 1]));
+  }
+  JpegBatchScanner scanner(scan_threads);
+  params.scanner = &scanner;
+
   nvjpegDevAllocator_t dev_allocator = {&dev_malloc, &dev_free};
   nvjpegPinnedAllocator_t pinned_allocator ={&host_malloc, &host_free};
 
@@ -347,12 +556,18 @@ int main(int argc, const char *argv[]) {
 
   create_decoupled_api_handles(params);
 
-  // read source images
+  // read source images, either from a packed archive (see pack_images) or
+  // as individual files
   FileNames image_names;
-  readInput(params.input_dir, image_names);
+  PackedArchive archive;
+  if (PackedArchive::is_archive(params.input_dir)) {
+    if (archive.open(params.input_dir)) return EXIT_FAILURE;
+  } else {
+    readInput(params.input_dir, image_names);
+  }
 
   if (params.total_images == -1) {
-    params.total_images = image_names.size();
+    params.total_images = archive.count() > 0 ? archive.count() : image_names.size();
   } else if (params.total_images % params.batch_size) {
     params.total_images =
         ((params.total_images) / params.batch_size) * params.batch_size;
@@ -366,7 +581,7 @@ int main(int argc, const char *argv[]) {
             << params.batch_size << std::endl;
 
   double total;
-  if (process_images(image_names, params, total)) return EXIT_FAILURE;
+  if (process_images(image_names, archive, params, total)) return EXIT_FAILURE;
   std::cout << "Total decoding time: " << total << " (s)" << std::endl;
   std::cout << "Avg decoding time per image: " << total / params.total_images 
             << " (s)" << std::endl;
@@ -32,6 +32,7 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <memory>
 #include <filesystem> // stdc++17
 
 #include <string.h>  // strcmpi
@@ -44,6 +45,12 @@
 #include <cuda_runtime_api.h>
 #include <nvjpeg.h>
 
+#include "../../common/batch_prefetcher.h"
+#include "../../common/image_writer.h"
+#include "../../common/jpeg_scanner.h"
+#include "batch_former.h"
+#include "packed_archive.h"
+
 
 #define CHECK_CUDA(call)                                                        \
     {                                                                           \
@@ -77,6 +84,8 @@ int host_free(void* p) { return (int)cudaFreeHost(p); }
 
 typedef std::vector<std::string> FileNames;
 typedef std::vector<std::vector<char> > FileData;
+// bitstreams of the current batch, either into FileData or into a mapped archive
+typedef std::vector<const unsigned char *> FilePointers;
 
 struct decode_params_t {
   std::string input_dir;
@@ -84,6 +93,7 @@ struct decode_params_t {
   int total_images;
   int dev;
   int warmup;
+  int prefetch; // batches read ahead in the background, 0: read synchronously
 
   nvjpegJpegState_t nvjpeg_state;
   nvjpegHandle_t nvjpeg_handle;
@@ -100,8 +110,17 @@ struct decode_params_t {
   nvjpegOutputFormat_t fmt;
   bool write_decoded;
   std::string output_dir;
+  bool verbose; // per-image header information on the console
+  int async_write; // images queued for the background writer, 0: write synchronously
 
   bool hw_decode_available;
+
+  // headers of each batch are parsed on the host before decoding
+  JpegBatchScanner *scanner;
+  std::vector<JpegDescriptor> descriptors; // of the current batch
+
+  int bucket_window; // images buffered for size bucketing, 0: off
+  int bucket_wait;   // images read before a buffered image is due
 };
 
 int read_next_batch(FileNames &image_names, int batch_size,
@@ -155,8 +174,74 @@ int read_next_batch(FileNames &image_names, int batch_size,
   return EXIT_SUCCESS;
 }
 
-// prepare buffers for RGBi output format
-int prepare_buffers(FileData &file_data, std::vector<size_t> &file_len,
+// fills the batch with pointers into the mapped archive (no copies); wraps
+// around like read_next_batch and prefetches the following batch
+int read_next_batch(const PackedArchive &archive, int batch_size,
+                    size_t &cur_index, FilePointers &raw_data,
+                    std::vector<size_t> &raw_len, FileNames &current_names) {
+  if (archive.count() == 0) {
+    std::cerr << "No valid images left in the input list, exit" << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (int counter = 0; counter < batch_size; counter++) {
+    if (cur_index >= archive.count()) {
+      cur_index = 0;
+    }
+    raw_data[counter] = archive.data(cur_index);
+    raw_len[counter] = archive.size(cur_index);
+    current_names[counter] = archive.entry(cur_index).name;
+    cur_index++;
+  }
+  archive.will_need(cur_index, std::min(cur_index + batch_size, archive.count()));
+  return EXIT_SUCCESS;
+}
+
+// logs the frame of an image (-v)
+void print_image_info(const std::string &name, int channels,
+                      nvjpegChromaSubsampling_t subsampling, const int *widths,
+                      const int *heights, int orientation) {
+  std::cout << "Processing: " << name << std::endl;
+  std::cout << "Image is " << channels << " channels." << std::endl;
+  for (int c = 0; c < channels; c++) {
+    std::cout << "Channel #" << c << " size: " << widths[c] << " x "
+              << heights[c] << std::endl;
+  }
+
+  switch (subsampling) {
+    case NVJPEG_CSS_444:
+      std::cout << "YUV 4:4:4 chroma subsampling" << std::endl;
+      break;
+    case NVJPEG_CSS_440:
+      std::cout << "YUV 4:4:0 chroma subsampling" << std::endl;
+      break;
+    case NVJPEG_CSS_422:
+      std::cout << "YUV 4:2:2 chroma subsampling" << std::endl;
+      break;
+    case NVJPEG_CSS_420:
+      std::cout << "YUV 4:2:0 chroma subsampling" << std::endl;
+      break;
+    case NVJPEG_CSS_411:
+      std::cout << "YUV 4:1:1 chroma subsampling" << std::endl;
+      break;
+    case NVJPEG_CSS_410:
+      std::cout << "YUV 4:1:0 chroma subsampling" << std::endl;
+      break;
+    case NVJPEG_CSS_GRAY:
+      std::cout << "Grayscale JPEG " << std::endl;
+      break;
+    default:
+      std::cout << "Unknown chroma subsampling" << std::endl;
+      break;
+  }
+  if (orientation != 1) {
+    std::cout << "EXIF orientation " << orientation << " (not applied)"
+              << std::endl;
+  }
+}
+
+// prepare buffers for RGBi output format; params.descriptors holds the
+// scanned headers of the batch
+int prepare_buffers(const FilePointers &file_data, std::vector<size_t> &file_len,
                     std::vector<int> &img_width, std::vector<int> &img_height,
                     std::vector<nvjpegImage_t> &ibuf,
                     std::vector<nvjpegImage_t> &isz, FileNames &current_names,
@@ -167,45 +252,31 @@ int prepare_buffers(FileData &file_data, std::vector<size_t> &file_len,
   nvjpegChromaSubsampling_t subsampling;
 
   for (int i = 0; i < file_data.size(); i++) {
-    CHECK_NVJPEG(nvjpegGetImageInfo(
-        params.nvjpeg_handle, (unsigned char *)file_data[i].data(), file_len[i],
-        &channels, &subsampling, widths, heights));
+    const JpegDescriptor &desc = params.descriptors[i];
+    if (desc.ok() && desc.subsampling != JpegSubsampling::CSS_UNKNOWN) {
+      channels = desc.components;
+      subsampling = static_cast<nvjpegChromaSubsampling_t>(desc.subsampling);
+      for (int c = 0; c < channels; c++) {
+        widths[c] = desc.component_width(c);
+        heights[c] = desc.component_height(c);
+      }
+    } else {
+      // let nvJPEG have a look at what the scanner did not understand
+      CHECK_NVJPEG(nvjpegGetImageInfo(
+          params.nvjpeg_handle, file_data[i], file_len[i],
+          &channels, &subsampling, widths, heights));
+    }
 
     img_width[i] = widths[0];
     img_height[i] = heights[0];
 
-    std::cout << "Processing: " << current_names[i] << std::endl;
-    std::cout << "Image is " << channels << " channels." << std::endl;
-    for (int c = 0; c < channels; c++) {
-      std::cout << "Channel #" << c << " size: " << widths[c] << " x "
-                << heights[c] << std::endl;
+    if (subsampling == NVJPEG_CSS_UNKNOWN) {
+      std::cout << "Unknown chroma subsampling: " << current_names[i] << std::endl;
+      return EXIT_FAILURE;
     }
-
-    switch (subsampling) {
-      case NVJPEG_CSS_444:
-        std::cout << "YUV 4:4:4 chroma subsampling" << std::endl;
-        break;
-      case NVJPEG_CSS_440:
-        std::cout << "YUV 4:4:0 chroma subsampling" << std::endl;
-        break;
-      case NVJPEG_CSS_422:
-        std::cout << "YUV 4:2:2 chroma subsampling" << std::endl;
-        break;
-      case NVJPEG_CSS_420:
-        std::cout << "YUV 4:2:0 chroma subsampling" << std::endl;
-        break;
-      case NVJPEG_CSS_411:
-        std::cout << "YUV 4:1:1 chroma subsampling" << std::endl;
-        break;
-      case NVJPEG_CSS_410:
-        std::cout << "YUV 4:1:0 chroma subsampling" << std::endl;
-        break;
-      case NVJPEG_CSS_GRAY:
-        std::cout << "Grayscale JPEG " << std::endl;
-        break;
-      case NVJPEG_CSS_UNKNOWN:
-        std::cout << "Unknown chroma subsampling" << std::endl;
-        return EXIT_FAILURE;
+    if (params.verbose) {
+      print_image_info(current_names[i], channels, subsampling, widths, heights,
+                       params.descriptors[i].ok() ? params.descriptors[i].orientation : 1);
     }
 
     int mul = 1;
@@ -372,244 +443,61 @@ int getInputDir(std::string &input_dir, const char *executable_path) {
   return found;
 }
 
+// write bmp from host memory: planar (R plane, G plane, B plane) or
+// interleaved RGB, both tightly packed
+int writeBMPHost(const char *filename, const unsigned char *chan, int width,
+                 int height, bool interleaved, ImageWriter &writer) {
+  if (interleaved) {
+    return writer.write_bmp(filename, HostImage<unsigned char>::interleaved(
+                                          chan, (size_t)width * 3, 3, 3, width, height));
+  }
+  const size_t plane = (size_t)width * height;
+  const unsigned char *planes[3] = {chan, chan + plane, chan + 2 * plane};
+  const size_t pitches[3] = {(size_t)width, (size_t)width, (size_t)width};
+  return writer.write_bmp(filename, HostImage<unsigned char>::planar(planes, pitches, 3, width, height));
+}
+
+// copy planar RGB from the device into one tightly packed host buffer
+int copyPlanarToHost(std::vector<unsigned char> &host, const unsigned char *d_chanR, int pitchR,
+                     const unsigned char *d_chanG, int pitchG,
+                     const unsigned char *d_chanB, int pitchB, int width, int height) {
+  const size_t plane = (size_t)width * height;
+  host.resize(plane * 3);
+  CHECK_CUDA(cudaMemcpy2D(host.data(), (size_t)width, d_chanR, (size_t)pitchR,
+                          width, height, cudaMemcpyDeviceToHost));
+  CHECK_CUDA(cudaMemcpy2D(host.data() + plane, (size_t)width, d_chanG, (size_t)pitchG,
+                          width, height, cudaMemcpyDeviceToHost));
+  CHECK_CUDA(cudaMemcpy2D(host.data() + 2 * plane, (size_t)width, d_chanB, (size_t)pitchB,
+                          width, height, cudaMemcpyDeviceToHost));
+  return 0;
+}
+
+// copy interleaved RGB from the device into a tightly packed host buffer
+int copyInterleavedToHost(std::vector<unsigned char> &host, const unsigned char *d_RGB,
+                          int pitch, int width, int height) {
+  host.resize((size_t)width * height * 3);
+  CHECK_CUDA(cudaMemcpy2D(host.data(), (size_t)width * 3, d_RGB, (size_t)pitch,
+                          width * 3, height, cudaMemcpyDeviceToHost));
+  return 0;
+}
+
 // write bmp, input - RGB, device
 int writeBMP(const char *filename, const unsigned char *d_chanR, int pitchR,
              const unsigned char *d_chanG, int pitchG,
              const unsigned char *d_chanB, int pitchB, int width, int height) {
-  unsigned int headers[13];
-  FILE *outfile;
-  int extrabytes;
-  int paddedsize;
-  int x;
-  int y;
-  int n;
-  int red, green, blue;
-
-  std::vector<unsigned char> vchanR(height * width);
-  std::vector<unsigned char> vchanG(height * width);
-  std::vector<unsigned char> vchanB(height * width);
-  unsigned char *chanR = vchanR.data();
-  unsigned char *chanG = vchanG.data();
-  unsigned char *chanB = vchanB.data();
-  CHECK_CUDA(cudaMemcpy2D(chanR, (size_t)width, d_chanR, (size_t)pitchR,
-                               width, height, cudaMemcpyDeviceToHost));
-  CHECK_CUDA(cudaMemcpy2D(chanG, (size_t)width, d_chanG, (size_t)pitchR,
-                               width, height, cudaMemcpyDeviceToHost));
-  CHECK_CUDA(cudaMemcpy2D(chanB, (size_t)width, d_chanB, (size_t)pitchR,
-                               width, height, cudaMemcpyDeviceToHost));
-
-  extrabytes =
-      4 - ((width * 3) % 4);  // How many bytes of padding to add to each
-  // horizontal line - the size of which must
-  // be a multiple of 4 bytes.
-  if (extrabytes == 4) extrabytes = 0;
-
-  paddedsize = ((width * 3) + extrabytes) * height;
-
-  // Headers...
-  // Note that the "BM" identifier in bytes 0 and 1 is NOT included in these
-  // "headers".
-
-  headers[0] = paddedsize + 54;  // bfSize (whole file size)
-  headers[1] = 0;                // bfReserved (both)
-  headers[2] = 54;               // bfOffbits
-  headers[3] = 40;               // biSize
-  headers[4] = width;            // biWidth
-  headers[5] = height;           // biHeight
-
-  // Would have biPlanes and biBitCount in position 6, but they're shorts.
-  // It's easier to write them out separately (see below) than pretend
-  // they're a single int, especially with endian issues...
-
-  headers[7] = 0;           // biCompression
-  headers[8] = paddedsize;  // biSizeImage
-  headers[9] = 0;           // biXPelsPerMeter
-  headers[10] = 0;          // biYPelsPerMeter
-  headers[11] = 0;          // biClrUsed
-  headers[12] = 0;          // biClrImportant
-
-  if (!(outfile = fopen(filename, "wb"))) {
-    std::cerr << "Cannot open file: " << filename << std::endl;
+  // kept between calls, so only a larger image allocates
+  static thread_local std::vector<unsigned char> host;
+  if (copyPlanarToHost(host, d_chanR, pitchR, d_chanG, pitchG, d_chanB, pitchB, width, height))
     return 1;
-  }
-
-  //
-  // Headers begin...
-  // When printing ints and shorts, we write out 1 character at a time to avoid
-  // endian issues.
-  //
-  fprintf(outfile, "BM");
-
-  for (n = 0; n <= 5; n++) {
-    fprintf(outfile, "%c", headers[n] & 0x000000FF);
-    fprintf(outfile, "%c", (headers[n] & 0x0000FF00) >> 8);
-    fprintf(outfile, "%c", (headers[n] & 0x00FF0000) >> 16);
-    fprintf(outfile, "%c", (headers[n] & (unsigned int)0xFF000000) >> 24);
-  }
-
-  // These next 4 characters are for the biPlanes and biBitCount fields.
-
-  fprintf(outfile, "%c", 1);
-  fprintf(outfile, "%c", 0);
-  fprintf(outfile, "%c", 24);
-  fprintf(outfile, "%c", 0);
-
-  for (n = 7; n <= 12; n++) {
-    fprintf(outfile, "%c", headers[n] & 0x000000FF);
-    fprintf(outfile, "%c", (headers[n] & 0x0000FF00) >> 8);
-    fprintf(outfile, "%c", (headers[n] & 0x00FF0000) >> 16);
-    fprintf(outfile, "%c", (headers[n] & (unsigned int)0xFF000000) >> 24);
-  }
-
-  //
-  // Headers done, now write the data...
-  //
-
-  for (y = height - 1; y >= 0;
-       y--)  // BMP image format is written from bottom to top...
-  {
-    for (x = 0; x <= width - 1; x++) {
-      red = chanR[y * width + x];
-      green = chanG[y * width + x];
-      blue = chanB[y * width + x];
-
-      if (red > 255) red = 255;
-      if (red < 0) red = 0;
-      if (green > 255) green = 255;
-      if (green < 0) green = 0;
-      if (blue > 255) blue = 255;
-      if (blue < 0) blue = 0;
-      // Also, it's written in (b,g,r) format...
-
-      fprintf(outfile, "%c", blue);
-      fprintf(outfile, "%c", green);
-      fprintf(outfile, "%c", red);
-    }
-    if (extrabytes)  // See above - BMP lines must be of lengths divisible by 4.
-    {
-      for (n = 1; n <= extrabytes; n++) {
-        fprintf(outfile, "%c", 0);
-      }
-    }
-  }
-
-  fclose(outfile);
-  return 0;
+  return writeBMPHost(filename, host.data(), width, height, false, thread_image_writer());
 }
 
 // write bmp, input - RGB, device
 int writeBMPi(const char *filename, const unsigned char *d_RGB, int pitch,
               int width, int height) {
-  unsigned int headers[13];
-  FILE *outfile;
-  int extrabytes;
-  int paddedsize;
-  int x;
-  int y;
-  int n;
-  int red, green, blue;
-
-  std::vector<unsigned char> vchanRGB(height * width * 3);
-  unsigned char *chanRGB = vchanRGB.data();
-  CHECK_CUDA(cudaMemcpy2D(chanRGB, (size_t)width * 3, d_RGB, (size_t)pitch,
-                               width * 3, height, cudaMemcpyDeviceToHost));
-
-  extrabytes =
-      4 - ((width * 3) % 4);  // How many bytes of padding to add to each
-  // horizontal line - the size of which must
-  // be a multiple of 4 bytes.
-  if (extrabytes == 4) extrabytes = 0;
-
-  paddedsize = ((width * 3) + extrabytes) * height;
-
-  // Headers...
-  // Note that the "BM" identifier in bytes 0 and 1 is NOT included in these
-  // "headers".
-  headers[0] = paddedsize + 54;  // bfSize (whole file size)
-  headers[1] = 0;                // bfReserved (both)
-  headers[2] = 54;               // bfOffbits
-  headers[3] = 40;               // biSize
-  headers[4] = width;            // biWidth
-  headers[5] = height;           // biHeight
-
-  // Would have biPlanes and biBitCount in position 6, but they're shorts.
-  // It's easier to write them out separately (see below) than pretend
-  // they're a single int, especially with endian issues...
-
-  headers[7] = 0;           // biCompression
-  headers[8] = paddedsize;  // biSizeImage
-  headers[9] = 0;           // biXPelsPerMeter
-  headers[10] = 0;          // biYPelsPerMeter
-  headers[11] = 0;          // biClrUsed
-  headers[12] = 0;          // biClrImportant
-
-  if (!(outfile = fopen(filename, "wb"))) {
-    std::cerr << "Cannot open file: " << filename << std::endl;
-    return 1;
-  }
-
-  //
-  // Headers begin...
-  // When printing ints and shorts, we write out 1 character at a time to avoid
-  // endian issues.
-  //
-
-  fprintf(outfile, "BM");
-
-  for (n = 0; n <= 5; n++) {
-    fprintf(outfile, "%c", headers[n] & 0x000000FF);
-    fprintf(outfile, "%c", (headers[n] & 0x0000FF00) >> 8);
-    fprintf(outfile, "%c", (headers[n] & 0x00FF0000) >> 16);
-    fprintf(outfile, "%c", (headers[n] & (unsigned int)0xFF000000) >> 24);
-  }
-
-  // These next 4 characters are for the biPlanes and biBitCount fields.
-
-  fprintf(outfile, "%c", 1);
-  fprintf(outfile, "%c", 0);
-  fprintf(outfile, "%c", 24);
-  fprintf(outfile, "%c", 0);
-
-  for (n = 7; n <= 12; n++) {
-    fprintf(outfile, "%c", headers[n] & 0x000000FF);
-    fprintf(outfile, "%c", (headers[n] & 0x0000FF00) >> 8);
-    fprintf(outfile, "%c", (headers[n] & 0x00FF0000) >> 16);
-    fprintf(outfile, "%c", (headers[n] & (unsigned int)0xFF000000) >> 24);
-  }
-
-  //
-  // Headers done, now write the data...
-  //
-  for (y = height - 1; y >= 0;
-       y--)  // BMP image format is written from bottom to top...
-  {
-    for (x = 0; x <= width - 1; x++) {
-      red = chanRGB[(y * width + x) * 3];
-      green = chanRGB[(y * width + x) * 3 + 1];
-      blue = chanRGB[(y * width + x) * 3 + 2];
-
-      if (red > 255) red = 255;
-      if (red < 0) red = 0;
-      if (green > 255) green = 255;
-      if (green < 0) green = 0;
-      if (blue > 255) blue = 255;
-      if (blue < 0) blue = 0;
-      // Also, it's written in (b,g,r) format...
-
-      fprintf(outfile, "%c", blue);
-      fprintf(outfile, "%c", green);
-      fprintf(outfile, "%c", red);
-    }
-    if (extrabytes)  // See above - BMP lines must be of lengths divisible by 4.
-    {
-      for (n = 1; n <= extrabytes; n++) {
-        fprintf(outfile, "%c", 0);
-      }
-    }
-  }
-
-  fclose(outfile);
-  return 0;
+  static thread_local std::vector<unsigned char> host;
+  if (copyInterleavedToHost(host, d_RGB, pitch, width, height)) return 1;
+  return writeBMPHost(filename, host.data(), width, height, true, thread_image_writer());
 }
 
 
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Packs a directory of images into a single archive (see packed_archive.h)
+// that nvjpegDecoder can consume through a memory mapping.
+//
+// Build: g++ -O2 -std=c++17 pack_images.cpp -o pack_images
+// Usage: ./pack_images -i images_dir -o archive [-x extension]
+
+#include "packed_archive.h"
+
+#include <algorithm>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+int main(int argc, const char *argv[]) {
+  std::string input_dir, output, extension;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      std::cout << "Usage: " << argv[0] << " -i images_dir -o archive [-x extension]\n";
+      std::cout << "Parameters: " << std::endl;
+      std::cout << "\timages_dir\t:\tDirectory of images, walked recursively" << std::endl;
+      std::cout << "\tarchive\t\t:\tOutput file" << std::endl;
+      std::cout << "\textension\t:\tOnly pack files with this extension (e.g. .jpg)" << std::endl;
+      return EXIT_SUCCESS;
+    }
+    if (i + 1 >= argc) break;
+    if (strcmp(argv[i], "-i") == 0) input_dir = argv[++i];
+    else if (strcmp(argv[i], "-o") == 0) output = argv[++i];
+    else if (strcmp(argv[i], "-x") == 0) extension = argv[++i];
+  }
+  if (input_dir.empty() || output.empty()) {
+    std::cerr << "Please specify the input directory (-i) and the archive (-o)" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::vector<fs::path> files;
+  try {
+    for (auto const &it : fs::recursive_directory_iterator(input_dir)) {
+      if (it.symlink_status().type() != fs::file_type::regular) continue;
+      if (!extension.empty() && it.path().extension() != extension) continue;
+      files.push_back(it.path());
+    }
+  } catch (fs::filesystem_error &err) {
+    std::cerr << "Error: " << err.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  // deterministic order, so that archives of the same directory are identical
+  std::sort(files.begin(), files.end());
+
+  PackedArchiveWriter writer;
+  if (!writer.open(output)) {
+    std::cerr << "Cannot create archive: " << output << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::vector<char> buffer;
+  uint64_t bytes = 0;
+  for (const auto &path : files) {
+    std::ifstream input(path.string().c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+    if (!input.is_open()) {
+      std::cerr << "Cannot open file: " << path << ", skipping it" << std::endl;
+      continue;
+    }
+    std::streamsize file_size = input.tellg();
+    input.seekg(0, std::ios::beg);
+    buffer.resize(file_size);
+    if (!input.read(buffer.data(), file_size)) {
+      std::cerr << "Cannot read from file: " << path << ", skipping it" << std::endl;
+      continue;
+    }
+    const std::string name = fs::relative(path, input_dir).generic_string();
+    if (!writer.add(name, buffer.data(), file_size)) {
+      std::cerr << "Cannot write to archive: " << output << std::endl;
+      return EXIT_FAILURE;
+    }
+    bytes += file_size;
+  }
+  if (!writer.close()) {
+    std::cerr << "Cannot finalize archive: " << output << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "Packed " << writer.count() << " files (" << bytes << " bytes) into " << output << std::endl;
+  return EXIT_SUCCESS;
+}
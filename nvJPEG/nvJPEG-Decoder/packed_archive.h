@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Packed image archive: many small files stored back to back in one file,
+// followed by an index, so that a dataset can be consumed through a single
+// memory mapping instead of one open()/read() per image.
+//
+// Layout (all integers little endian):
+//
+//   header  : "NVPKARC1" | uint64 count | uint64 index_offset
+//   data    : file contents, each starting at a multiple of kPackedAlignment
+//   index   : count x { uint64 offset | uint64 size | uint32 name_len | name }
+//
+// PackedArchiveWriter produces archives (see pack_images.cpp), PackedArchive
+// maps them read-only and hands out pointers into the mapping.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char kPackedMagic[8] = {'N', 'V', 'P', 'K', 'A', 'R', 'C', '1'};
+static const uint64_t kPackedHeaderSize = 24;
+static const uint64_t kPackedAlignment = 64;
+
+struct PackedEntry {
+  uint64_t offset;
+  uint64_t size;
+  std::string name;
+};
+
+namespace packed_detail {
+inline void put_u64(std::vector<char> &out, uint64_t v) {
+  for (int i = 0; i < 8; i++) out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+}
+inline void put_u32(std::vector<char> &out, uint32_t v) {
+  for (int i = 0; i < 4; i++) out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+}
+inline uint64_t get_u64(const unsigned char *p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+  return v;
+}
+inline uint32_t get_u32(const unsigned char *p) {
+  uint32_t v = 0;
+  for (int i = 3; i >= 0; i--) v = (v << 8) | p[i];
+  return v;
+}
+}  // namespace packed_detail
+
+class PackedArchiveWriter {
+ public:
+  // returns false if the output cannot be created
+  bool open(const std::string &path) {
+    out_.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out_.is_open()) return false;
+    std::vector<char> header(kPackedHeaderSize, 0);  // patched in close()
+    out_.write(header.data(), header.size());
+    pos_ = kPackedHeaderSize;
+    return true;
+  }
+
+  // appends one file under the given name
+  bool add(const std::string &name, const char *data, uint64_t size) {
+    const uint64_t padding = (kPackedAlignment - pos_ % kPackedAlignment) % kPackedAlignment;
+    static const char zeros[kPackedAlignment] = {0};
+    out_.write(zeros, padding);
+    pos_ += padding;
+    entries_.push_back({pos_, size, name});
+    out_.write(data, size);
+    pos_ += size;
+    return out_.good();
+  }
+
+  // writes the index and the header
+  bool close() {
+    std::vector<char> index;
+    for (const auto &e : entries_) {
+      packed_detail::put_u64(index, e.offset);
+      packed_detail::put_u64(index, e.size);
+      packed_detail::put_u32(index, static_cast<uint32_t>(e.name.size()));
+      index.insert(index.end(), e.name.begin(), e.name.end());
+    }
+    out_.write(index.data(), index.size());
+
+    std::vector<char> header(kPackedMagic, kPackedMagic + sizeof(kPackedMagic));
+    packed_detail::put_u64(header, entries_.size());
+    packed_detail::put_u64(header, pos_);
+    out_.seekp(0);
+    out_.write(header.data(), header.size());
+    out_.close();
+    return !out_.fail();
+  }
+
+  size_t count() const { return entries_.size(); }
+
+ private:
+  std::ofstream out_;
+  uint64_t pos_ = 0;
+  std::vector<PackedEntry> entries_;
+};
+
+class PackedArchive {
+ public:
+  PackedArchive() {}
+  ~PackedArchive() { close(); }
+  PackedArchive(const PackedArchive &) = delete;
+  PackedArchive &operator=(const PackedArchive &) = delete;
+
+  // true if path is a regular file starting with the archive magic
+  static bool is_archive(const std::string &path) {
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    char magic[sizeof(kPackedMagic)];
+    return in.read(magic, sizeof(magic)) && memcmp(magic, kPackedMagic, sizeof(magic)) == 0;
+  }
+
+  // maps the archive and parses its index; returns 0 on success
+  int open(const std::string &path) {
+    close();
+    if (map(path)) {
+      std::cerr << "Cannot map archive: " << path << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (size_ < kPackedHeaderSize || memcmp(base_, kPackedMagic, sizeof(kPackedMagic)) != 0) {
+      std::cerr << "Not a packed archive: " << path << std::endl;
+      close();
+      return EXIT_FAILURE;
+    }
+    const uint64_t count = packed_detail::get_u64(base_ + 8);
+    uint64_t pos = packed_detail::get_u64(base_ + 16);
+    entries_.reserve(std::min<uint64_t>(count, size_ / 20));
+    for (uint64_t i = 0; i < count; i++) {
+      // compared by subtraction: offsets come from the file and must not wrap
+      if (pos > size_ || size_ - pos < 20) break;
+      PackedEntry e;
+      e.offset = packed_detail::get_u64(base_ + pos);
+      e.size = packed_detail::get_u64(base_ + pos + 8);
+      const uint32_t name_len = packed_detail::get_u32(base_ + pos + 16);
+      pos += 20;
+      if (name_len > size_ - pos) break;
+      if (e.offset > size_ || e.size > size_ - e.offset) break;
+      e.name.assign(reinterpret_cast<const char *>(base_ + pos), name_len);
+      pos += name_len;
+      entries_.push_back(e);
+    }
+    if (entries_.size() != count) {
+      std::cerr << "Truncated archive index: " << path << std::endl;
+      close();
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  void close() {
+    entries_.clear();
+    if (!base_) return;
+#if defined(_WIN32) || defined(_WIN64)
+    UnmapViewOfFile(base_);
+    CloseHandle(mapping_);
+    CloseHandle(file_);
+#else
+    munmap(const_cast<unsigned char *>(base_), size_);
+#endif
+    base_ = nullptr;
+    size_ = 0;
+  }
+
+  size_t count() const { return entries_.size(); }
+  const PackedEntry &entry(size_t i) const { return entries_[i]; }
+  const unsigned char *data(size_t i) const { return base_ + entries_[i].offset; }
+  uint64_t size(size_t i) const { return entries_[i].size; }
+
+  // asks the kernel to start reading [first, last) entries in the background
+  void will_need(size_t first, size_t last) const {
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (first >= last || last > entries_.size()) return;
+    const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = reinterpret_cast<uintptr_t>(data(first)) & ~(page - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(data(last - 1) + size(last - 1));
+    madvise(reinterpret_cast<void *>(begin), end - begin, MADV_WILLNEED);
+#else
+    (void)first;
+    (void)last;
+#endif
+  }
+
+ private:
+  int map(const std::string &path) {
+#if defined(_WIN32) || defined(_WIN64)
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file_ == INVALID_HANDLE_VALUE) return EXIT_FAILURE;
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file_, &file_size);
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping_) {
+      CloseHandle(file_);
+      return EXIT_FAILURE;
+    }
+    base_ = static_cast<const unsigned char *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (!base_) {
+      CloseHandle(mapping_);
+      CloseHandle(file_);
+      return EXIT_FAILURE;
+    }
+    size_ = static_cast<uint64_t>(file_size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return EXIT_FAILURE;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      ::close(fd);
+      return EXIT_FAILURE;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);  // the mapping keeps the file alive
+    if (p == MAP_FAILED) return EXIT_FAILURE;
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    base_ = static_cast<const unsigned char *>(p);
+    size_ = static_cast<uint64_t>(st.st_size);
+#endif
+    return EXIT_SUCCESS;
+  }
+
+  const unsigned char *base_ = nullptr;
+  uint64_t size_ = 0;
+  std::vector<PackedEntry> entries_;
+#if defined(_WIN32) || defined(_WIN64)
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  HANDLE mapping_ = NULL;
+#endif
+};
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// CPU-only check of the packed archive reader (packed_archive.h).
+//
+// Writes a small archive and reads it back, then opens every truncated
+// prefix of it and copies whose header or index entries point past the end
+// of the file, including offsets and sizes chosen so that offset + size
+// wraps around. Exits with a failure if a damaged archive is accepted.
+//
+// Build: g++ -O2 -std=c++17 packed_archive_check.cpp -o packed_archive_check
+// Usage: ./packed_archive_check [-o scratch_file]
+
+#include "packed_archive.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static int failures = 0;
+
+#define EXPECT(cond, what)                                        \
+  do {                                                            \
+    if (!(cond)) {                                                \
+      printf("FAILED: %s: %s (line %d)\n", what, #cond, __LINE__); \
+      failures++;                                                 \
+    }                                                             \
+  } while (0)
+
+typedef std::vector<unsigned char> Bytes;
+
+static const char *kNames[] = {"a.jpg", "second.jpg", "c"};
+static const size_t kSizes[] = {100, 1, 300};
+
+static Bytes read_file(const std::string &path) {
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  return Bytes(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string &path, const Bytes &b, size_t length) {
+  std::ofstream out(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(b.data()), length);
+}
+
+static void set_u64(Bytes &b, uint64_t pos, uint64_t v) {
+  for (int i = 0; i < 8; i++) b[pos + i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+static void set_u32(Bytes &b, uint64_t pos, uint32_t v) {
+  for (int i = 0; i < 4; i++) b[pos + i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+// position of index entry i in a well-formed archive
+static uint64_t entry_pos(const Bytes &b, size_t i) {
+  uint64_t pos = packed_detail::get_u64(b.data() + 16);
+  for (size_t k = 0; k < i; k++) pos += 20 + packed_detail::get_u32(b.data() + pos + 16);
+  return pos;
+}
+
+static bool opens(const std::string &path, const Bytes &b) {
+  write_file(path, b, b.size());
+  PackedArchive archive;
+  return archive.open(path) == EXIT_SUCCESS;
+}
+
+static Bytes write_archive(const std::string &path) {
+  PackedArchiveWriter writer;
+  EXPECT(writer.open(path), "create archive");
+  for (size_t i = 0; i < 3; i++) {
+    const std::string data(kSizes[i], static_cast<char>('0' + i));
+    EXPECT(writer.add(kNames[i], data.data(), data.size()), "add file");
+  }
+  EXPECT(writer.close(), "close archive");
+  return read_file(path);
+}
+
+static void check_round_trip(const std::string &path) {
+  PackedArchive archive;
+  EXPECT(archive.open(path) == EXIT_SUCCESS, "open archive");
+  EXPECT(archive.count() == 3, "entry count");
+  for (size_t i = 0; i < archive.count() && i < 3; i++) {
+    EXPECT(archive.entry(i).name == kNames[i], "entry name");
+    EXPECT(archive.size(i) == kSizes[i], "entry size");
+    EXPECT(archive.entry(i).offset % kPackedAlignment == 0, "entry alignment");
+    EXPECT(archive.data(i)[0] == '0' + i && archive.data(i)[kSizes[i] - 1] == '0' + i, "entry data");
+  }
+}
+
+static void check_truncated(const std::string &path, const Bytes &good) {
+  // the index is at the end, so every prefix loses at least part of it
+  for (size_t n = 1; n < good.size(); n++) {
+    write_file(path, good, n);
+    PackedArchive archive;
+    if (archive.open(path) == EXIT_SUCCESS) {
+      printf("FAILED: prefix of %zu bytes accepted\n", n);
+      failures++;
+    }
+  }
+}
+
+static void check_overflow(const std::string &path, const Bytes &good) {
+  const uint64_t kWrap = ~static_cast<uint64_t>(0);
+  const uint64_t size = good.size();
+  struct Case {
+    const char *what;
+    int field;  // 0: count, 1: index offset, 2: entry offset, 3: entry size, 4: name length
+    size_t entry;
+    uint64_t value;
+  };
+  const Case cases[] = {
+      {"huge count", 0, 0, kWrap},
+      {"one entry too many", 0, 0, 4},
+      {"index offset past the end", 1, 0, size + 1},
+      {"index offset near the end", 1, 0, size - 19},
+      {"wrapping index offset", 1, 0, kWrap - 8},
+      {"entry offset past the end", 2, 1, size},
+      {"wrapping entry offset", 2, 1, kWrap - 7},  // + size 16 wraps to 8
+      {"entry size past the end", 3, 2, size},
+      {"wrapping entry size", 3, 0, kWrap - 63},  // offset 64 + size wraps to 0
+      {"name past the end", 4, 2, 2},
+      {"huge name", 4, 0, 0xFFFFFFFFu},
+  };
+  for (const auto &c : cases) {
+    Bytes b = good;
+    switch (c.field) {
+      case 0: set_u64(b, 8, c.value); break;
+      case 1: set_u64(b, 16, c.value); break;
+      case 2:
+        set_u64(b, entry_pos(good, c.entry), c.value);
+        if (c.value == kWrap - 7) set_u64(b, entry_pos(good, c.entry) + 8, 16);
+        break;
+      case 3:
+        if (c.value == kWrap - 63) EXPECT(packed_detail::get_u64(b.data() + entry_pos(good, c.entry)) == 64, c.what);
+        set_u64(b, entry_pos(good, c.entry) + 8, c.value);
+        break;
+      case 4: set_u32(b, entry_pos(good, c.entry) + 16, static_cast<uint32_t>(c.value)); break;
+    }
+    EXPECT(!opens(path, b), c.what);
+  }
+
+  // an empty archive and a damaged magic
+  Bytes empty(kPackedMagic, kPackedMagic + sizeof(kPackedMagic));
+  empty.resize(kPackedHeaderSize, 0);
+  set_u64(empty, 16, kPackedHeaderSize);
+  EXPECT(opens(path, empty), "empty archive");
+  Bytes magic = good;
+  magic[7] = '2';
+  EXPECT(!opens(path, magic), "wrong magic");
+}
+
+int main(int argc, const char *argv[]) {
+  std::string path = (fs::temp_directory_path() / "packed_archive_check.nvpk").string();
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      printf("Usage: %s [-o scratch_file]\n", argv[0]);
+      return EXIT_SUCCESS;
+    }
+    if (i + 1 >= argc) break;
+    if (strcmp(argv[i], "-o") == 0) path = argv[++i];
+  }
+
+  const Bytes good = write_archive(path);
+  check_round_trip(path);
+  printf("round trip: %s\n", failures ? "FAILED" : "ok");
+
+  // the reader reports every rejected archive on stderr
+  check_truncated(path, good);
+  check_overflow(path, good);
+  fs::remove(path);
+
+  printf("packed archive check: %s\n", failures ? "FAILED" : "ok");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -44,8 +44,9 @@ int write_image(std::string output_path, std::string filename, const nvjpeg2kIma
 
     int err = EXIT_SUCCESS;
     
-    // For single component image output as PGM channel
-    if (num_components == 1)
+    // For single component image output as PGM channel, for two components
+    // only the first one is written
+    if (num_components == 1 || num_components == 2)
     {
         std::string fname(output_path + separator + sFileName + ".pgm");
         if (imgdesc.pixel_type == NVJPEG2K_UINT8)
@@ -65,11 +66,12 @@ int write_image(std::string output_path, std::string filename, const nvjpeg2kIma
         }
        
     }
-    else if (num_components == 3 || num_components == 4)
+    else if (num_components >= 3)
     {
-        if(num_components == 4 && verbose)
+        if(num_components > 3 && verbose)
         {
-            std::cout<<"Discarding the alpha channel and writing the 4 component image as a .bmp file"<<std::endl;
+            std::cout<<"Discarding components past the third and writing the "<<num_components
+                     <<" component image as a .bmp file"<<std::endl;
         }
         std::string fname(output_path + separator + sFileName + ".bmp");
         if (imgdesc.pixel_type == NVJPEG2K_UINT8)
@@ -95,87 +97,106 @@ int write_image(std::string output_path, std::string filename, const nvjpeg2kIma
     }
     else
     {
-        std::cout << "only 1 and 3 channel outputs supported\n";
+        std::cout << "images without components cannot be written\n";
         return EXIT_FAILURE;
     }
     
     return err;
 }
 
-int prepare_buffers(FileData &file_data, std::vector<size_t> &file_len,
-                    std::vector<nvjpeg2ksample_img> &ibuf,
-                    std::vector<nvjpeg2ksample_img_sz> &isz, 
-                    FileNames &current_names,
-                    decode_params_t &params,
-                    double& parse_time) {
-
+// parses image i of the batch and grows its output buffers if required
+int prepare_buffer(int i, FileData &file_data, std::vector<size_t> &file_len,
+                   std::vector<nvjpeg2ksample_img> &ibuf,
+                   std::vector<nvjpeg2ksample_img_sz> &isz,
+                   decode_params_t &params)
+{
     nvjpeg2kImageInfo_t image_info;
-    nvjpeg2kImageComponentInfo_t image_comp_info[NUM_COMPONENTS];
-    parse_time = 0;
-    for (uint32_t i = 0; i < file_data.size(); i++) 
-    {
-        double time = Wtime();
-        CHECK_NVJPEG2K(nvjpeg2kStreamParse(params.nvjpeg2k_handle, (unsigned char*)file_data[i].data(), file_len[i],
-                0, 0, params.jpeg2k_streams[i]));
-        parse_time += Wtime() - time;
-        
-        CHECK_NVJPEG2K(nvjpeg2kStreamGetImageInfo(params.jpeg2k_streams[i], &image_info));
+    CHECK_NVJPEG2K(nvjpeg2kStreamParse(params.nvjpeg2k_handle, (unsigned char*)file_data[i].data(), file_len[i],
+            0, 0, params.jpeg2k_streams[i]));
 
-        if( image_info.num_components > NUM_COMPONENTS) 
+    CHECK_NVJPEG2K(nvjpeg2kStreamGetImageInfo(params.jpeg2k_streams[i], &image_info));
+
+    std::vector<nvjpeg2kImageComponentInfo_t> image_comp_info(image_info.num_components);
+    for (uint32_t c = 0; c < image_info.num_components; c++) 
+    {
+        CHECK_NVJPEG2K(nvjpeg2kStreamGetImageComponentInfo(params.jpeg2k_streams[i], &image_comp_info[c], c));
+        if( image_comp_info[c].precision > MAX_PRECISION)
         {
-            std::cout<<"Num Components > "<< NUM_COMPONENTS<<"not supported by this sample"<<std::endl;
+            std::cout<<"Precision > "<< MAX_PRECISION<<"not supported by this sample"<<std::endl;
             return EXIT_FAILURE;
         }
-        for (uint32_t c = 0; c < image_info.num_components; c++) 
-        {
-            CHECK_NVJPEG2K(nvjpeg2kStreamGetImageComponentInfo(params.jpeg2k_streams[i], &image_comp_info[c], c));
-            if( image_comp_info[0].precision > MAX_PRECISION)
-            {
-                std::cout<<"Precision > "<< MAX_PRECISION<<"not supported by this sample"<<std::endl;
-                return EXIT_FAILURE;
-            }
-        }
+    }
 
-        ibuf[i].num_comps = image_info.num_components;
-        // realloc output buffer if required
-        for (uint32_t c = 0; c < image_info.num_components; c++) 
+    ibuf[i].num_comps = image_info.num_components;
+    if (ibuf[i].component.size() < image_info.num_components)
+    {
+        ibuf[i].component.resize(image_info.num_components, nullptr);
+        ibuf[i].pitch_in_bytes.resize(image_info.num_components, 0);
+        isz[i].comp_sz.resize(image_info.num_components, 0);
+    }
+    // realloc output buffer if required
+    for (uint32_t c = 0; c < image_info.num_components; c++) 
+    {
+        uint32_t bytes_per_element = (MAX_PRECISION/8);
+        // for JPEG 2000 bitstreams with 420/422 subsampling, this sample enables RGB output
+        // we are allocating assuming that all component dimensions are the same
+        uint32_t aw = bytes_per_element * image_info.image_width;
+        uint32_t ah = image_info.image_height;
+        uint32_t sz = aw * ah;
+        ibuf[i].pitch_in_bytes[c] = aw;
+        if (sz > isz[i].comp_sz[c]) 
         {
-            uint32_t bytes_per_element = (MAX_PRECISION/8);
-            // for JPEG 2000 bitstreams with 420/422 subsampling, this sample enables RGB output
-            // we are allocating assuming that all component dimensions are the same
-            uint32_t aw = bytes_per_element * image_info.image_width;
-            uint32_t ah = image_info.image_height;
-            uint32_t sz = aw * ah;
-            ibuf[i].pitch_in_bytes[c] = aw;
-            if (sz > isz[i].comp_sz[c]) 
+            if (ibuf[i].component[c]) 
             {
-                if (ibuf[i].component[c]) 
-                {
-                    CHECK_CUDA(cudaFree(ibuf[i].component[c]));
-                }
-                CHECK_CUDA(cudaMalloc((void**)&ibuf[i].component[c], sz));
-                isz[i].comp_sz[c] = sz;
+                CHECK_CUDA(cudaFree(ibuf[i].component[c]));
             }
+            CHECK_CUDA(cudaMalloc((void**)&ibuf[i].component[c], sz));
+            isz[i].comp_sz[c] = sz;
         }
     }
     return EXIT_SUCCESS;
 }
 
-
-int decode_images(FileNames &current_names, std::vector<nvjpeg2ksample_img> &out,
-                  decode_params_t &params, double &time)
+// creates or destroys decode states, streams and events to run `stages`
+// decodes in flight
+int resize_pipeline(decode_params_t &params, int stages)
 {
-    cudaEvent_t startEvent = NULL, stopEvent = NULL;
-    float loopTime = 0;
-
-    cudaEvent_t pipeline_events[PIPELINE_STAGES];
-
-    for (int p = 0; p < PIPELINE_STAGES; p++)
+    int current = static_cast<int>(params.nvjpeg2k_decode_states.size());
+    for (int p = current; p < stages; p++)
     {
-        CHECK_CUDA(cudaEventCreate(&pipeline_events[p]));
+        nvjpeg2kDecodeState_t state;
+        cudaStream_t stream;
+        cudaEvent_t event;
+        CHECK_NVJPEG2K(nvjpeg2kDecodeStateCreate(params.nvjpeg2k_handle, &state));
+        CHECK_CUDA(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+        CHECK_CUDA(cudaEventCreateWithFlags(&event, cudaEventDisableTiming));
+        params.nvjpeg2k_decode_states.push_back(state);
+        params.stream.push_back(stream);
+        params.stage_events.push_back(event);
     }
-    CHECK_CUDA(cudaEventCreateWithFlags(&startEvent, cudaEventBlockingSync));
-    CHECK_CUDA(cudaEventCreateWithFlags(&stopEvent, cudaEventBlockingSync));
+    for (int p = current - 1; p >= stages; p--)
+    {
+        CHECK_CUDA(cudaStreamSynchronize(params.stream[p]));
+        CHECK_NVJPEG2K(nvjpeg2kDecodeStateDestroy(params.nvjpeg2k_decode_states[p]));
+        CHECK_CUDA(cudaStreamDestroy(params.stream[p]));
+        CHECK_CUDA(cudaEventDestroy(params.stage_events[p]));
+        params.nvjpeg2k_decode_states.pop_back();
+        params.stream.pop_back();
+        params.stage_events.pop_back();
+    }
+    params.pipeline_stages = stages;
+    return EXIT_SUCCESS;
+}
+
+// Parses and decodes the batch. Each image goes to a free stage; stages are
+// retired from the completion queue with cudaEventQuery, so parsing the next
+// image only waits for the GPU when every stage is busy, and then only for
+// the oldest one.
+int decode_images(FileData &file_data, std::vector<size_t> &file_len,
+                  FileNames &current_names, std::vector<nvjpeg2ksample_img> &out,
+                  std::vector<nvjpeg2ksample_img_sz> &isz,
+                  decode_params_t &params, double &time)
+{
     nvjpeg2kDecodeParams_t decode_params;
     CHECK_NVJPEG2K(nvjpeg2kDecodeParamsCreate(&decode_params));
 
@@ -187,50 +208,72 @@ int decode_images(FileNames &current_names, std::vector<nvjpeg2ksample_img> &out
     std::vector<nvjpeg2kImage_t> nvjpeg2k_output;
     nvjpeg2k_output.resize(params.batch_size);
 
-    for( int i = 0; i < params.batch_size; i++) 
+    std::deque<int> free_stages;
+    for (int p = 0; p < params.pipeline_stages; p++)
+    {
+        free_stages.push_back(p);
+    }
+    std::deque<int> in_flight; // stages in issue order
+
+    // moves the stages whose decode completed back to free_stages, without blocking
+    auto retire_completed = [&]() {
+        for (auto it = in_flight.begin(); it != in_flight.end();)
+        {
+            cudaError_t status = cudaEventQuery(params.stage_events[*it]);
+            if (status == cudaErrorNotReady)
+            {
+                ++it;
+                continue;
+            }
+            CHECK_CUDA(status);
+            free_stages.push_back(*it);
+            it = in_flight.erase(it);
+        }
+        return EXIT_SUCCESS;
+    };
+
+    double start = Wtime();
+    for( int i = 0; i < params.batch_size; i++)
     {
+        // host side parse, overlaps with the decodes in flight
+        if (prepare_buffer(i, file_data, file_len, out, isz, params))
+            return EXIT_FAILURE;
+
 #ifdef USE8BITOUTPUT
         nvjpeg2k_output[i].pixel_type = NVJPEG2K_UINT8;
 #else
         nvjpeg2k_output[i].pixel_type = NVJPEG2K_UINT16;
 #endif        
         nvjpeg2k_output[i].num_components = out[i].num_comps;
-        nvjpeg2k_output[i].pixel_data =  (void**)out[i].component;
-        nvjpeg2k_output[i].pitch_in_bytes = out[i].pitch_in_bytes;
-    }
-    
-    int buffer_index = 0;
-    CHECK_CUDA(cudaEventRecord(startEvent, params.stream[0]));
-    for( int i = 0; i < params.batch_size; i++)
-    {
-        if( i >= PIPELINE_STAGES)
+        nvjpeg2k_output[i].pixel_data =  (void**)out[i].component.data();
+        nvjpeg2k_output[i].pitch_in_bytes = out[i].pitch_in_bytes.data();
+
+        if (retire_completed())
+            return EXIT_FAILURE;
+        if (free_stages.empty())
         {
-            // make sure that the previous stage are done
-            CHECK_CUDA(cudaEventSynchronize(pipeline_events[buffer_index]));
+            // every stage is busy, wait for the oldest one
+            CHECK_CUDA(cudaEventSynchronize(params.stage_events[in_flight.front()]));
+            free_stages.push_back(in_flight.front());
+            in_flight.pop_front();
         }
+        const int stage = free_stages.front();
+        free_stages.pop_front();
 #if (NVJPEG2K_VER_MAJOR == 0 && NVJPEG2K_VER_MINOR >= 3)
-        CHECK_NVJPEG2K(nvjpeg2kDecodeImage(params.nvjpeg2k_handle, params.nvjpeg2k_decode_states[buffer_index],
-            params.jpeg2k_streams[i], decode_params, &nvjpeg2k_output[i], params.stream[buffer_index]));
+        CHECK_NVJPEG2K(nvjpeg2kDecodeImage(params.nvjpeg2k_handle, params.nvjpeg2k_decode_states[stage],
+            params.jpeg2k_streams[i], decode_params, &nvjpeg2k_output[i], params.stream[stage]));
 #else  
-        CHECK_NVJPEG2K(nvjpeg2kDecode(params.nvjpeg2k_handle, params.nvjpeg2k_decode_states[buffer_index],
-            params.jpeg2k_streams[i], &nvjpeg2k_output[i], params.stream[buffer_index]));
+        CHECK_NVJPEG2K(nvjpeg2kDecode(params.nvjpeg2k_handle, params.nvjpeg2k_decode_states[stage],
+            params.jpeg2k_streams[i], &nvjpeg2k_output[i], params.stream[stage]));
 #endif        
-        CHECK_CUDA(cudaEventRecord(pipeline_events[buffer_index], params.stream[buffer_index]))
-
-        buffer_index++;
-        buffer_index = buffer_index%PIPELINE_STAGES;
-
+        CHECK_CUDA(cudaEventRecord(params.stage_events[stage], params.stream[stage]))
+        in_flight.push_back(stage);
     }
-    for (int p = 0; p < PIPELINE_STAGES; p++)
+    for (int stage : in_flight)
     {
-        CHECK_CUDA(cudaEventSynchronize(pipeline_events[p]));
+        CHECK_CUDA(cudaEventSynchronize(params.stage_events[stage]));
     }
-
-    CHECK_CUDA(cudaEventRecord(stopEvent, params.stream[0]));
-    
-    CHECK_CUDA(cudaEventSynchronize(stopEvent));
-    CHECK_CUDA(cudaEventElapsedTime(&loopTime, startEvent, stopEvent));
-    time += static_cast<double>(loopTime/1000.0); // loopTime is in milliseconds
+    time += Wtime() - start;
     
     if (params.write_decoded)
     {
@@ -248,16 +291,19 @@ int decode_images(FileNames &current_names, std::vector<nvjpeg2ksample_img> &out
     }
     
     CHECK_NVJPEG2K(nvjpeg2kDecodeParamsDestroy(decode_params));
-    for(int p = 0; p < PIPELINE_STAGES; p++)
-    {
-        CHECK_CUDA(cudaEventDestroy(pipeline_events[p]));
-    }
-    CHECK_CUDA(cudaEventDestroy(stopEvent));
-    CHECK_CUDA(cudaEventDestroy(startEvent));
     
     return EXIT_SUCCESS;
 }
 
+// device memory in use, to measure what the pipeline takes
+size_t device_memory_in_use()
+{
+    size_t free_bytes = 0, total_bytes = 0;
+    if (cudaMemGetInfo(&free_bytes, &total_bytes) != cudaSuccess)
+        return 0;
+    return total_bytes - free_bytes;
+}
+
 double process_images(FileNames &image_names, decode_params_t &params,
                       double &total)
 {
@@ -272,28 +318,56 @@ double process_images(FileNames &image_names, decode_params_t &params,
   // output buffer
    std::vector<nvjpeg2ksample_img_sz> isz(params.batch_size);
 
-    // stream for decoding
-    for (int p =0; p < PIPELINE_STAGES; p++)
+    // with -auto_stages the depth grows between batches while that pays off
+    std::unique_ptr<PipelineDepthTuner> tuner;
+    if (params.auto_stages)
     {
-        CHECK_CUDA(cudaStreamCreateWithFlags(&params.stream[p], cudaStreamNonBlocking));
+        DepthTunerConfig config;
+        config.max_stages = std::max(1, params.batch_size);
+        config.memory_budget = params.memory_budget;
+        tuner.reset(new PipelineDepthTuner(config, params.pipeline_stages));
+        params.pipeline_stages = tuner->stages();
     }
+    // only the device memory taken by new stages counts against the budget,
+    // not the output buffers, which scale with the batch size
+    auto resize = [&](int stages) {
+        const int current = static_cast<int>(params.nvjpeg2k_decode_states.size());
+        const size_t before = device_memory_in_use();
+        if (resize_pipeline(params, stages))
+            return EXIT_FAILURE;
+        const size_t after = device_memory_in_use();
+        if (tuner && stages > current && after > before)
+            tuner->set_bytes_per_stage((after - before) / (stages - current));
+        return EXIT_SUCCESS;
+    };
+    if (resize(params.pipeline_stages))
+        return EXIT_FAILURE;
 
     int total_processed = 0;
 
+    // disk reads of the next batches overlap with decoding the current one
+    std::unique_ptr<BatchPrefetcher> prefetcher;
+    if (params.prefetch > 0)
+    {
+        prefetcher.reset(new BatchPrefetcher(image_names, params.batch_size, params.prefetch,
+                                             4, params.verbose));
+    }
+
     double test_time = 0;
     int warmup = 0;
     while (total_processed < params.total_images)
     {
-        if (read_next_batch(image_names, params.batch_size, file_iter, file_data,
-                            file_len, current_names, params.verbose))
-            return EXIT_FAILURE;
-        double parsetime = 0;
-        if (prepare_buffers(file_data, file_len, iout, isz,
-                        current_names, params, parsetime))
+        if (prefetcher)
+        {
+            if (prefetcher->next_batch(file_data, file_len, current_names))
+                return EXIT_FAILURE;
+        }
+        else if (read_next_batch(image_names, params.batch_size, file_iter, file_data,
+                                 file_len, current_names, params.verbose))
             return EXIT_FAILURE;
 
         double time = 0;
-        if (decode_images(current_names, iout, params, time))
+        if (decode_images(file_data, file_len, current_names, iout, isz, params, time))
             return EXIT_FAILURE;
         if (warmup < params.warmup)
         {
@@ -302,13 +376,42 @@ double process_images(FileNames &image_names, decode_params_t &params,
         else
         {
             total_processed += params.batch_size;
-            test_time += time + parsetime;
+            test_time += time;
+        }
+
+        // warmup batches are measured as well, so the depth settles early;
+        // the tuner skips the first one, which allocates the output buffers
+        if (tuner && !tuner->settled())
+        {
+            const int stages = tuner->record(params.batch_size, time);
+            if (stages != params.pipeline_stages && resize(stages))
+                return EXIT_FAILURE;
         }
     }
     total = test_time;
-    for (int p = 0; p < PIPELINE_STAGES; p++)
+    if (tuner)
     {
-        CHECK_CUDA(cudaStreamDestroy(params.stream[p]));
+        tuner->print(std::cout);
+    }
+    if (prefetcher && params.verbose)
+    {
+        PrefetchStats stats = prefetcher->stats();
+        std::cout << "Prefetch: " << stats.files << " files, " << stats.bytes / (1024 * 1024)
+                  << " MiB read in " << stats.read_seconds << " s, decoder stalled for "
+                  << stats.stall_seconds << " s" << std::endl;
+    }
+    if (resize_pipeline(params, 0))
+        return EXIT_FAILURE;
+
+    for (auto &img : iout)
+    {
+        for (auto component : img.component)
+        {
+            if (component)
+            {
+                CHECK_CUDA(cudaFree(component));
+            }
+        }
     }
 
     return EXIT_SUCCESS;
@@ -323,7 +426,8 @@ int main(int argc, const char *argv[])
     {
         std::cout << "Usage: " << argv[0]
                   << " -i images_dir [-b batch_size] [-t total_images] "
-                     "[-w warmup_iterations] [-o output_dir] [-v verbose]";
+                     "[-w warmup_iterations] [-o output_dir] [-v verbose] [-prefetch batches] "
+                     "[-stages stages] [-auto_stages] [-mem_budget MiB]\n";
         std::cout << "Parameters: " << std::endl;
         std::cout << "\timages_dir\t:\tPath to single image or directory of images"
                   << std::endl;
@@ -344,6 +448,17 @@ int main(int argc, const char *argv[])
         std::cout
             << "\tverbose\t\t:\tLog verbose messages to console"
             << std::endl;
+        std::cout << "\tprefetch\t:\tRead this many batches ahead in the "
+                     "background, 0 reads synchronously (default 2)"
+                  << std::endl;
+        std::cout << "\tstages\t\t:\tDecode this many images concurrently, each with "
+                     "its own decode state and stream (default 10, 2 with -auto_stages)"
+                  << std::endl;
+        std::cout << "\tauto_stages\t:\tAdd stages while throughput improves"
+                  << std::endl;
+        std::cout << "\tmem_budget\t:\tDevice memory in MiB the decode states may use "
+                     "with -auto_stages (default 0, no limit)"
+                  << std::endl;
         return EXIT_SUCCESS;
     }
 
@@ -383,6 +498,25 @@ int main(int argc, const char *argv[])
         params.warmup = std::atoi(argv[pidx + 1]);
     }
 
+    params.prefetch = 2;
+    if ((pidx = findParamIndex(argv, argc, "-prefetch")) != -1)
+    {
+        params.prefetch = std::atoi(argv[pidx + 1]);
+    }
+
+    params.auto_stages = findParamIndex(argv, argc, "-auto_stages") != -1;
+    params.pipeline_stages = params.auto_stages ? 2 : DEFAULT_PIPELINE_STAGES;
+    if ((pidx = findParamIndex(argv, argc, "-stages")) != -1)
+    {
+        params.pipeline_stages = std::max(1, std::atoi(argv[pidx + 1]));
+    }
+
+    params.memory_budget = 0;
+    if ((pidx = findParamIndex(argv, argc, "-mem_budget")) != -1)
+    {
+        params.memory_budget = static_cast<size_t>(std::max(0, std::atoi(argv[pidx + 1]))) << 20;
+    }
+
     params.write_decoded = false;
     if ((pidx = findParamIndex(argv, argc, "-o")) != -1)
     {
@@ -415,12 +549,6 @@ int main(int argc, const char *argv[])
     CHECK_NVJPEG2K(nvjpeg2kCreate(NVJPEG2K_BACKEND_DEFAULT, &dev_allocator,
                                   &pinned_allocator, &params.nvjpeg2k_handle));
 
-    for(int p = 0; p < PIPELINE_STAGES; p++)
-    {
-        CHECK_NVJPEG2K(
-        nvjpeg2kDecodeStateCreate(params.nvjpeg2k_handle, &params.nvjpeg2k_decode_states[p]));
-    }
-    
     params.jpeg2k_streams.resize(params.batch_size);
 
     for(auto& stream : params.jpeg2k_streams)
@@ -466,10 +594,6 @@ int main(int argc, const char *argv[])
     {
         CHECK_NVJPEG2K(nvjpeg2kStreamDestroy(stream));
     }
-    for(int i =0; i < PIPELINE_STAGES; i++)
-    {
-        CHECK_NVJPEG2K(nvjpeg2kDecodeStateDestroy(params.nvjpeg2k_decode_states[i]));
-    }
     CHECK_NVJPEG2K(nvjpeg2kDestroy(params.nvjpeg2k_handle));
 
     return EXIT_SUCCESS;
@@ -32,6 +32,8 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <deque>
+#include <memory>
 
 #include <string.h> // strcmpi
 
@@ -53,6 +55,10 @@ namespace fs = std::experimental::filesystem::v1;
 #include <cuda_runtime_api.h>
 #include <nvjpeg2k.h>
 
+#include "../../common/batch_prefetcher.h"
+#include "../../common/image_writer.h"
+#include "pipeline_depth_tuner.h"
+
 #define CHECK_CUDA(call)                                                                                          \
     {                                                                                                             \
         cudaError_t _e = (call);                                                                                  \
@@ -73,36 +79,31 @@ namespace fs = std::experimental::filesystem::v1;
         }                                                                                                   \
     }
 
-constexpr int PIPELINE_STAGES = 10;
-constexpr int NUM_COMPONENTS = 4;
+// decode states and streams in flight, see -stages / -auto_stages
+constexpr int DEFAULT_PIPELINE_STAGES = 10;
 
 //#define USE8BITOUTPUT
 
 #ifdef USE8BITOUTPUT
 constexpr int MAX_PRECISION = 8;
-typedef struct
-{
-    uint16_t num_comps;
-    unsigned char *component[NUM_COMPONENTS];
-    size_t    pitch_in_bytes[NUM_COMPONENTS];
-} nvjpeg2ksample_img;
-
+typedef unsigned char nvjpeg2ksample_t;
 #else
 constexpr int MAX_PRECISION = 16;
+typedef unsigned short nvjpeg2ksample_t;
+#endif
+
+// output image with any number of components; the vectors only grow, so
+// component buffers are reused across images
 typedef struct
 {
     uint16_t num_comps;
-    unsigned short *component[NUM_COMPONENTS];
-    size_t    pitch_in_bytes[NUM_COMPONENTS];
+    std::vector<nvjpeg2ksample_t *> component;
+    std::vector<size_t> pitch_in_bytes;
 } nvjpeg2ksample_img;
-#endif
-
-
-
 
 typedef struct
 {
-    size_t    comp_sz[NUM_COMPONENTS];
+    std::vector<size_t> comp_sz;
 } nvjpeg2ksample_img_sz;
 
 int dev_malloc(void **p, size_t s) { return (int)cudaMalloc(p, s); }
@@ -123,10 +124,16 @@ struct decode_params_t
     int total_images;
     int dev;
     int warmup;
+    int prefetch; // batches read ahead in the background, 0: read synchronously
 
-    nvjpeg2kDecodeState_t nvjpeg2k_decode_states[PIPELINE_STAGES];
     nvjpeg2kHandle_t nvjpeg2k_handle;
-    cudaStream_t stream[PIPELINE_STAGES];
+    // one decode state, stream and completion event per pipeline stage
+    int pipeline_stages;
+    bool auto_stages;        // grow the depth while throughput improves
+    size_t memory_budget;    // device bytes of the decode states for auto_stages, 0: no limit
+    std::vector<nvjpeg2kDecodeState_t> nvjpeg2k_decode_states;
+    std::vector<cudaStream_t> stream;
+    std::vector<cudaEvent_t> stage_events;
     std::vector<nvjpeg2kStream_t> jpeg2k_streams;
     bool verbose;
     bool write_decoded;
@@ -340,41 +347,14 @@ int getInputDir(std::string &input_dir, const char *executable_path)
 template <typename D>
 int writePGM(const char *filename, const D *pSrc, size_t nSrcStep, int nWidth, int nHeight, uint8_t precision)
 {
-    std::ofstream rOutputStream(filename, std::fstream::binary);
-    if (!rOutputStream)
-    {
-        std::cerr << "Cannot open output file: " << filename << std::endl;
-        return 1;
-    }
-    std::vector<D> img(nHeight * (nSrcStep / sizeof(D)));
-    D *hpSrc = img.data();
-
-    CHECK_CUDA(cudaMemcpy2D(hpSrc, nSrcStep, pSrc, nSrcStep, nWidth * sizeof(D), nHeight, cudaMemcpyDeviceToHost));
-
-    rOutputStream << "P5\n";
-    rOutputStream << "#nvJPEG2000\n";
-    rOutputStream << nWidth << " " << nHeight << "\n";
-    rOutputStream << (1 << precision) - 1 << "\n";
-
-    D *pTemp = hpSrc;
-    const D *pEndRow = pTemp + nHeight * (nSrcStep / sizeof(D));
-    for (; pTemp < pEndRow; pTemp += (nSrcStep / sizeof(D)))
-    {
-        const D *pRow = pTemp;
-        const D *pEndColumn = pRow + nWidth;
-        for (; pRow < pEndColumn; ++pRow)
-        {
-            if (precision == 8)
-            {
-                rOutputStream << static_cast<unsigned char>(*pRow);
-            }
-            else
-            {
-                rOutputStream << static_cast<unsigned char>((*pRow) >> 8) << static_cast<unsigned char>((*pRow) & 0xff);
-            }
-        }
-    }
-    return 0;
+    // kept between calls, so only a larger image allocates
+    static thread_local std::vector<D> img;
+    img.resize(nHeight * (nSrcStep / sizeof(D)));
+    CHECK_CUDA(cudaMemcpy2D(img.data(), nSrcStep, pSrc, nSrcStep, nWidth * sizeof(D), nHeight, cudaMemcpyDeviceToHost));
+
+    const D *planes[1] = {img.data()};
+    return thread_image_writer().write_pnm(filename,
+        HostImage<D>::planar(planes, &nSrcStep, 1, nWidth, nHeight, precision), "nvJPEG2000");
 }
 
 // write bmp, input - RGB, device
@@ -387,137 +367,25 @@ int writeBMP(const char *filename,
              uint8_t precision,
              bool verbose)
 {
+    // planar R, G, B; kept between calls, so only a larger image allocates
+    static thread_local std::vector<D> host;
+    const size_t plane = (size_t)width * height;
+    host.resize(plane * 3);
+    CHECK_CUDA(cudaMemcpy2D(host.data(), (size_t)width * sizeof(D), d_chanR, pitchR, width * sizeof(D), height, cudaMemcpyDeviceToHost));
 
-    unsigned int headers[13];
-    FILE *outfile;
-    int extrabytes;
-    int paddedsize;
-    int x;
-    int y;
-    int n;
-    int red, green, blue;
-
-    std::vector<D> vchanR(height * width);
-    std::vector<D> vchanG(height * width);
-    std::vector<D> vchanB(height * width);
-    D *chanR = vchanR.data();
-    D *chanG = vchanG.data();
-    D *chanB = vchanB.data();
-    CHECK_CUDA(cudaMemcpy2D(chanR, (size_t)width * sizeof(D), d_chanR, pitchR, width * sizeof(D), height, cudaMemcpyDeviceToHost));
-    
-    CHECK_CUDA(cudaMemcpy2D(chanG, (size_t)width * sizeof(D), d_chanG, pitchG, width * sizeof(D), height, cudaMemcpyDeviceToHost));
-    
-    CHECK_CUDA(cudaMemcpy2D(chanB, (size_t)width * sizeof(D), d_chanB, pitchB, width * sizeof(D), height, cudaMemcpyDeviceToHost));
-
-    extrabytes = 4 - ((width * 3) % 4); // How many bytes of padding to add to each
-    // horizontal line - the size of which must
-    // be a multiple of 4 bytes.
-    if (extrabytes == 4)
-        extrabytes = 0;
-
-    paddedsize = ((width * 3) + extrabytes) * height;
+    CHECK_CUDA(cudaMemcpy2D(host.data() + plane, (size_t)width * sizeof(D), d_chanG, pitchG, width * sizeof(D), height, cudaMemcpyDeviceToHost));
 
-    headers[0] = paddedsize + 54; // bfSize (whole file size)
-    headers[1] = 0;               // bfReserved (both)
-    headers[2] = 54;              // bfOffbits
-    headers[3] = 40;              // biSize
-    headers[4] = width;           // biWidth
-    headers[5] = height;          // biHeight
+    CHECK_CUDA(cudaMemcpy2D(host.data() + 2 * plane, (size_t)width * sizeof(D), d_chanB, pitchB, width * sizeof(D), height, cudaMemcpyDeviceToHost));
 
-  
-
-    headers[7] = 0;          // biCompression
-    headers[8] = paddedsize; // biSizeImage
-    headers[9] = 0;          // biXPelsPerMeter
-    headers[10] = 0;         // biYPelsPerMeter
-    headers[11] = 0;         // biClrUsed
-    headers[12] = 0;         // biClrImportant
-
-    if (!(outfile = fopen(filename, "wb")))
-    {
-        std::cerr << "Cannot open file: " << filename << std::endl;
-        return 1;
-    }
-
-    fprintf(outfile, "BM");
-
-    for (n = 0; n <= 5; n++)
-    {
-        fprintf(outfile, "%c", headers[n] & 0x000000FF);
-        fprintf(outfile, "%c", (headers[n] & 0x0000FF00) >> 8);
-        fprintf(outfile, "%c", (headers[n] & 0x00FF0000) >> 16);
-        fprintf(outfile, "%c", (headers[n] & (unsigned int)0xFF000000) >> 24);
-    }
-
-    // These next 4 characters are for the biPlanes and biBitCount fields.
-
-    fprintf(outfile, "%c", 1);
-    fprintf(outfile, "%c", 0);
-    fprintf(outfile, "%c", 24);
-    fprintf(outfile, "%c", 0);
-
-    for (n = 7; n <= 12; n++)
-    {
-        fprintf(outfile, "%c", headers[n] & 0x000000FF);
-        fprintf(outfile, "%c", (headers[n] & 0x0000FF00) >> 8);
-        fprintf(outfile, "%c", (headers[n] & 0x00FF0000) >> 16);
-        fprintf(outfile, "%c", (headers[n] & (unsigned int)0xFF000000) >> 24);
-    }
-    
     if (verbose && precision > 8)
     {
         std::cout<<"BMP write - truncating "<< (int)precision <<" bit data to 8 bit"<<std::endl;
     }
 
-    //
-    // Headers done, now write the data...
-    //
-    for (y = height - 1; y >= 0; y--) // BMP image format is written from bottom to top...
-    {
-        for (x = 0; x <= width - 1; x++)
-        {
-            red = chanR[y * width + x];
-            green = chanG[y * width + x];
-            blue = chanB[y * width + x];
-
-            int scale = precision - 8;
-            if (scale > 0) 
-            {
-                red = ((red >> scale) + ((red >> (scale - 1)) % 2));
-                green = ((green >> scale) + ((green >> (scale - 1)) % 2));
-                blue = ((blue >> scale) + ((blue >> (scale - 1)) % 2));
-            }
-
-
-            if (red > 255)
-                red = 255;
-            if (red < 0)
-                red = 0;
-            if (green > 255)
-                green = 255;
-            if (green < 0)
-                green = 0;
-            if (blue > 255)
-                blue = 255;
-            if (blue < 0)
-                blue = 0;
-            // Also, it's written in (b,g,r) format...
-
-            fprintf(outfile, "%c", blue);
-            fprintf(outfile, "%c", green);
-            fprintf(outfile, "%c", red);
-        }
-        if (extrabytes) // See above - BMP lines must be of lengths divisible by 4.
-        {
-            for (n = 1; n <= extrabytes; n++)
-            {
-                fprintf(outfile, "%c", 0);
-            }
-        }
-    }
-
-    fclose(outfile);
-    return 0;
+    const D *planes[3] = {host.data(), host.data() + plane, host.data() + 2 * plane};
+    const size_t pitches[3] = {width * sizeof(D), width * sizeof(D), width * sizeof(D)};
+    return thread_image_writer().write_bmp(filename,
+        HostImage<D>::planar(planes, pitches, 3, width, height, precision));
 }
 
 // *****************************************************************************
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// CPU-only check of the pipeline depth tuner (pipeline_depth_tuner.h) with
+// a synthetic throughput curve.
+//
+// A batch of images is parsed on the host (parse seconds each) and decoded
+// on the GPU (decode seconds each), which runs up to `gpu_lanes` decodes
+// concurrently. With S stages in flight the throughput is
+//   min(1 / parse, S / (parse + decode), gpu_lanes / decode)
+// measured with a few percent of noise, and each stage costs a fixed amount
+// of device memory. The first batch is three times slower, as the real one
+// also allocates the output buffers. For each scenario the tuner must reach
+// at least 90% of the best throughput, stay within the memory budget and
+// settle, and keep the initial depth when no deeper pipeline pays off.
+//
+// Build: g++ -O2 -std=c++17 pipeline_depth_simulation.cpp -o pipeline_depth_simulation
+// Usage: ./pipeline_depth_simulation [-b batch_size] [-s initial_stages] [-noise percent]
+
+#include "pipeline_depth_tuner.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+struct sim_params_t
+{
+    int batch_size = 64;
+    int initial_stages = 2;
+    double noise = 0.03;
+};
+
+struct Scenario
+{
+    const char *name;
+    double parse, decode;  // seconds per image
+    int gpu_lanes;
+    size_t bytes_per_stage;
+    size_t memory_budget;  // 0: none
+
+    double rate(int stages) const
+    {
+        return std::min({1.0 / parse, stages / (parse + decode), gpu_lanes / decode});
+    }
+};
+
+int main(int argc, const char *argv[])
+{
+    sim_params_t params;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-h") == 0)
+        {
+            printf("Usage: %s [-b batch_size] [-s initial_stages] [-noise percent]\n", argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (i + 1 >= argc)
+            break;
+        if (strcmp(argv[i], "-b") == 0)
+            params.batch_size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0)
+            params.initial_stages = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-noise") == 0)
+            params.noise = atof(argv[++i]) / 100;
+    }
+
+    const size_t MiB = 1024 * 1024;
+    const Scenario scenarios[] = {
+        // small images, parsing dominates: a few stages hide the GPU
+        {"parse bound", 400e-6, 600e-6, 8, 40 * MiB, 0},
+        // large images, many decodes fit on the GPU
+        {"gpu lanes", 200e-6, 4e-3, 16, 120 * MiB, 0},
+        // as above, but memory runs out first
+        {"memory bound", 200e-6, 4e-3, 16, 120 * MiB, 1000 * MiB},
+        // the GPU is saturated by one decode: nothing to gain
+        {"serial gpu", 100e-6, 2e-3, 1, 120 * MiB, 0},
+    };
+
+    int failures = 0;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> noise(1 - params.noise, 1 + params.noise);
+    printf("%14s %8s %8s %12s %12s %10s %8s\n", "scenario", "stages", "batches", "images/s", "best", "memory", "ideal");
+    for (const auto &s : scenarios)
+    {
+        DepthTunerConfig config;
+        config.max_stages = std::max(1, params.batch_size);
+        config.memory_budget = s.memory_budget;
+        PipelineDepthTuner tuner(config, params.initial_stages);
+        tuner.set_bytes_per_stage(s.bytes_per_stage);
+
+        int batches = 0;
+        for (; batches < 100 && !tuner.settled(); batches++)
+        {
+            const int stages = tuner.stages();
+            const double seconds = params.batch_size / (s.rate(stages) * noise(rng)) * (batches == 0 ? 3 : 1);
+            tuner.record(params.batch_size, seconds);
+        }
+
+        // the best depth the budget allows, and the fewest stages reaching it
+        int max_stages = config.max_stages;
+        if (s.memory_budget)
+            max_stages = std::min<int>(max_stages, s.memory_budget / s.bytes_per_stage);
+        int ideal = 1;
+        while (ideal < max_stages && s.rate(ideal) < s.rate(max_stages))
+            ideal++;
+
+        const int stages = tuner.stages();
+        const double rate = s.rate(stages), best = s.rate(max_stages);
+        const size_t memory = stages * s.bytes_per_stage;
+        printf("%14s %8d %8d %12.0f %12.0f %7zu MiB %8d\n", s.name, stages, batches, rate, best, memory / MiB, ideal);
+        tuner.print(std::cout);
+        if (!tuner.settled() || rate < 0.9 * best || (s.memory_budget && memory > s.memory_budget) ||
+            (ideal <= params.initial_stages && stages != params.initial_stages))
+        {
+            printf("FAILED: %s\n", s.name);
+            failures++;
+        }
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
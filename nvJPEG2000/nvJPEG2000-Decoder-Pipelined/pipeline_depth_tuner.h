@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Chooses the number of pipeline stages (decode state + stream pairs) of the
+// pipelined decoder at runtime.
+//
+// Starting from the configured depth, the tuner measures the throughput of
+// `samples_per_depth` batches, then grows the depth by `growth` while that
+// improves throughput by at least `min_gain`. It settles on the best depth
+// seen once throughput plateaus, max_stages is reached, or the next depth
+// would exceed the memory budget. The budget covers the decode states only:
+// the caller measures the device memory a stage takes when it resizes the
+// pipeline (set_bytes_per_stage()), while output buffers, which scale with
+// the batch size and not the depth, are left out. The first `skip_batches`
+// batches are not measured, since they also allocate those buffers.
+//
+// Only host code is used, so the policy can be exercised with a synthetic
+// throughput curve (see pipeline_depth_simulation.cpp).
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+struct DepthTunerConfig
+{
+    int min_stages = 1;
+    int max_stages = 64;
+    double growth = 1.5;          // depth multiplier per step, at least one more stage
+    double min_gain = 0.03;       // relative throughput gain that is worth the memory
+    int samples_per_depth = 2;    // batches measured at each depth
+    int skip_batches = 1;         // cold batches at the start that are not measured
+    size_t memory_budget = 0;     // device bytes the pipeline may use, 0: no limit
+};
+
+class PipelineDepthTuner
+{
+  public:
+    PipelineDepthTuner(const DepthTunerConfig &config, int initial_stages) : config_(config)
+    {
+        config_.min_stages = std::max(1, config_.min_stages);
+        config_.max_stages = std::max(config_.min_stages, config_.max_stages);
+        config_.samples_per_depth = std::max(1, config_.samples_per_depth);
+        skip_ = std::max(0, config_.skip_batches);
+        stages_ = std::min(std::max(initial_stages, config_.min_stages), config_.max_stages);
+    }
+
+    int stages() const { return stages_; }
+    bool settled() const { return settled_; }
+
+    /**
+     * Device memory of one stage (decode state and stream), as measured by
+     * the caller around creating stages; the largest value reported counts.
+     */
+    void set_bytes_per_stage(size_t bytes) { bytes_per_stage_ = std::max(bytes_per_stage_, bytes); }
+
+    /**
+     * Reports a batch decoded with stages() stages: images decoded in
+     * seconds. Returns the depth to use for the next batch.
+     */
+    int record(size_t images, double seconds)
+    {
+        if (settled_ || seconds <= 0)
+            return stages_;
+        if (skip_ > 0)
+        {
+            skip_--;
+            return stages_;
+        }
+        images_ += images;
+        seconds_ += seconds;
+        if (++samples_ < config_.samples_per_depth)
+            return stages_;
+
+        const double rate = images_ / seconds_;
+        history_.push_back({stages_, rate, bytes_per_stage_ * stages_});
+        images_ = 0;
+        seconds_ = 0;
+        samples_ = 0;
+
+        if (best_rate_ > 0 && rate < best_rate_ * (1 + config_.min_gain))
+        {
+            // plateau: back to the smallest depth that reached it
+            settle(best_stages_);
+            return stages_;
+        }
+        best_rate_ = rate;
+        best_stages_ = stages_;
+
+        int next = std::max(stages_ + 1, static_cast<int>(std::ceil(stages_ * config_.growth)));
+        next = std::min(next, config_.max_stages);
+        if (config_.memory_budget > 0 && bytes_per_stage_ > 0)
+        {
+            next = std::min(next, static_cast<int>(config_.memory_budget / bytes_per_stage_));
+        }
+        if (next <= stages_)
+        {
+            settle(stages_);
+            return stages_;
+        }
+        stages_ = next;
+        return stages_;
+    }
+
+    void print(std::ostream &os) const
+    {
+        os << "Pipeline depth: " << stages_ << (settled_ ? "" : " (still tuning)");
+        for (const auto &step : history_)
+        {
+            os << ", " << step.stages << " stages: " << step.rate << " images/s, "
+               << step.bytes / (1024 * 1024) << " MiB";
+        }
+        os << std::endl;
+    }
+
+  private:
+    struct Step
+    {
+        int stages;
+        double rate;
+        size_t bytes;
+    };
+
+    void settle(int stages)
+    {
+        stages_ = stages;
+        settled_ = true;
+    }
+
+    DepthTunerConfig config_;
+    int stages_ = 1;
+    bool settled_ = false;
+    int best_stages_ = 0;
+    double best_rate_ = 0;
+    int skip_ = 0;
+    size_t bytes_per_stage_ = 0;
+    // measurements at the current depth
+    size_t images_ = 0;
+    double seconds_ = 0;
+    int samples_ = 0;
+    std::vector<Step> history_;
+};
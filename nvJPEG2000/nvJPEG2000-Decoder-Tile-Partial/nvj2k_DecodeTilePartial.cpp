@@ -114,6 +114,8 @@ int prepare_buffers(FileData &file_data, std::vector<size_t> &file_len,
     nvjpeg2kImageInfo_t image_info;
     nvjpeg2kImageComponentInfo_t image_comp_info[NUM_COMPONENTS];
     parse_time = 0;
+    params.windows.resize(file_data.size());
+    params.file_ids.resize(file_data.size());
     for (uint32_t i = 0; i < file_data.size(); i++) 
     {
         double time = Wtime();
@@ -139,9 +141,41 @@ int prepare_buffers(FileData &file_data, std::vector<size_t> &file_len,
             }
         }
         img_width[i] = image_info.image_width;
-        img_height[i] = image_info.image_width;
+        img_height[i] = image_info.image_height;
         ibuf[i].num_comps = image_info.num_components;
         ibuf[i].pixel_type = NVJPEG2K_UINT16;
+
+        // tiles are cached per file, across batches
+        auto file = params.file_index.emplace(current_names[i], static_cast<uint32_t>(params.file_index.size()));
+        params.file_ids[i] = file.first->second;
+
+        decode_window_t &window = params.windows[i];
+        window.area.x0 = 0;
+        window.area.y0 = 0;
+        window.area.x1 = image_info.image_width;
+        window.area.y1 = image_info.image_height;
+        if(params.partial_decode)
+        {
+            window.area.x0 = params.win_x0;
+            window.area.y0 = params.win_y0;
+            window.area.x1 = (std::min)(params.win_x1, image_info.image_width);
+            window.area.y1 = (std::min)(params.win_y1, image_info.image_height);
+            if (window.area.empty())
+            {
+                std::cout<<"Decode area is outside of image "<<current_names[i]<<std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        // at least the lowest resolution has to remain
+        uint32_t num_resolutions = 0;
+        CHECK_NVJPEG2K(nvjpeg2kStreamGetResolutionsInTile(params.jpeg2k_streams[i], 0, &num_resolutions));
+        window.reduce = num_resolutions > 0 ? (std::min)(params.reduce, num_resolutions - 1) : 0;
+        if (window.reduce != params.reduce && params.verbose)
+        {
+            std::cout<<current_names[i]<<" has "<<num_resolutions<<" resolutions, discarding "<<window.reduce<<std::endl;
+        }
+        window.output = reduce_rect(window.area, window.reduce);
+
         // realloc output buffer if required
        
         for (uint32_t c = 0; c < image_info.num_components; c++) 
@@ -149,13 +183,8 @@ int prepare_buffers(FileData &file_data, std::vector<size_t> &file_len,
             uint32_t bytes_per_element = (MAX_PRECISION/8);
             // for JPEG 2000 bitstreams with 420/422 subsampling, this sample enables RGB output
             // we are allocating assuming that all component dimensions are the same
-            uint32_t aw = bytes_per_element * image_info.image_width;
-            uint32_t ah = image_info.image_height;
-            if(params.partial_decode)
-            {
-                aw = bytes_per_element * (params.win_x1 - params.win_x0);
-                ah = (params.win_y1 - params.win_y0);
-            }
+            uint32_t aw = bytes_per_element * window.output.width();
+            uint32_t ah = window.output.height();
             uint32_t sz = aw * ah;
             ibuf[i].pitch_in_bytes[c] = aw;
             if (sz > isz[i].comp_sz[c]) 
@@ -172,166 +201,220 @@ int prepare_buffers(FileData &file_data, std::vector<size_t> &file_len,
     return EXIT_SUCCESS;
 }
 
-struct partial_decode_info
+int alloc_tile_buffer(tile_buffer_t &buf, uint32_t num_comps, uint32_t width, uint32_t height)
 {
-    unsigned int win_tilex0;
-    unsigned int win_tilex1;
-    unsigned int win_tiley0;
-    unsigned int win_tiley1;
-    unsigned int tile_id;
-};
-
-void determine_tiles_to_decode(const nvjpeg2kImageInfo_t& image_info, decode_params_t &params,
-    std::vector<partial_decode_info>& tile_window_data)
-{
-    uint32_t tile_id = 0;
-    for(uint32_t tile_y0 = 0; tile_y0 < image_info.image_height; tile_y0 += image_info.tile_height)
+    size_t pitch_in_bytes = sizeof(*buf.pixel_data[0]) * width;
+    size_t sz = pitch_in_bytes * height * num_comps;
+    if (sz > buf.bytes)
     {
-        for(uint32_t tile_x0 = 0; tile_x0 < image_info.image_width; tile_x0 += image_info.tile_width)
+        if (buf.pixel_data[0])
         {
-            // include min and max functions in braces for windows builds issues
-            uint32_t tile_y1 = (std::min)(tile_y0 + image_info.tile_height, image_info.image_height);
-            uint32_t tile_x1 = (std::min)(tile_x0 + image_info.tile_width, image_info.image_width);
-
-            if( params.win_x0 < tile_x1 && params.win_x1 > tile_x0 &&
-                params.win_y0 < tile_y1 && params.win_y1 > tile_y0)
-            {
-                partial_decode_info decode_data;
-                decode_data.tile_id = tile_id;
-                decode_data.win_tilex0 = (std::max)(tile_x0, params.win_x0);
-                decode_data.win_tilex1 = (std::min)(tile_x1, params.win_x1);
-                decode_data.win_tiley0 = (std::max)(tile_y0, params.win_y0);
-                decode_data.win_tiley1 = (std::min)(tile_y1, params.win_y1);
-                tile_window_data.push_back(decode_data);
-                
-            }
-            tile_id++;
-            
+            CHECK_CUDA(cudaFree(buf.pixel_data[0]));
+            buf.pixel_data[0] = NULL;
+            buf.bytes = 0;
         }
+        CHECK_CUDA(cudaMalloc((void**)&buf.pixel_data[0], sz));
+        buf.bytes = sz;
     }
+    if (!buf.ready)
+    {
+        CHECK_CUDA(cudaEventCreateWithFlags(&buf.ready, cudaEventDisableTiming));
+    }
+    for (uint32_t c = 0; c < num_comps; c++)
+    {
+        buf.pixel_data[c] = buf.pixel_data[0] + c * width * height;
+        buf.pitch_in_bytes[c] = pitch_in_bytes;
+    }
+    buf.num_comps = num_comps;
+    buf.width = width;
+    buf.height = height;
+    return EXIT_SUCCESS;
 }
 
-int decode_images_partial(FileNames &current_names, std::vector<nvjpeg2kImage16u_t> &out,
-                  decode_params_t &params, double &time)
+int free_tile_buffer(tile_buffer_t &buf)
 {
-    cudaEvent_t startEvent = NULL, stopEvent = NULL;
-    nvjpeg2kDecodeParams_t decode_params;
-    CHECK_NVJPEG2K(nvjpeg2kDecodeParamsCreate(&decode_params));
-    float loopTime = 0;
-
-    cudaEvent_t pipeline_events[PIPELINE_STAGES];
-
-    for (int p = 0; p < PIPELINE_STAGES; p++)
+    if (buf.pixel_data[0])
     {
-        CHECK_CUDA(cudaEventCreate(&pipeline_events[p]));
-        CHECK_CUDA(cudaEventRecord(pipeline_events[p], params.stream[p]));
+        CHECK_CUDA(cudaFree(buf.pixel_data[0]));
+    }
+    if (buf.ready)
+    {
+        CHECK_CUDA(cudaEventDestroy(buf.ready));
     }
-    CHECK_CUDA(cudaEventCreateWithFlags(&startEvent, cudaEventBlockingSync));
-    CHECK_CUDA(cudaEventCreateWithFlags(&stopEvent, cudaEventBlockingSync));
+    buf = tile_buffer_t();
+    return EXIT_SUCCESS;
+}
 
-#if (NVJPEG2K_VER_MAJOR == 0 && NVJPEG2K_VER_MINOR >= 3) 
-    // set RGB  output for the entire batch
-    CHECK_NVJPEG2K(nvjpeg2kDecodeParamsSetRGBOutput(decode_params, 1));
-#endif
-    CHECK_CUDA(cudaEventRecord(startEvent, params.stream[0]));
-    int buffer_index = 0;
-    for(int batch_id = 0; batch_id < params.batch_size; batch_id++)
+// decodes a whole tile, at the resolution of the window, into buf
+int decode_whole_tile(const TileWork &work, const decode_window_t &window, nvjpeg2kStream_t jpeg2k_stream,
+    uint32_t num_comps, nvjpeg2kDecodeState_t decode_state, nvjpeg2kDecodeParams_t decode_params,
+    tile_buffer_t &buf, decode_params_t &params, cudaStream_t stream)
+{
+    const TileRect tile = reduce_rect(work.tile, window.reduce);
+    if (alloc_tile_buffer(buf, num_comps, tile.width(), tile.height()))
     {
-        nvjpeg2kImageInfo_t image_info;
-        CHECK_NVJPEG2K(nvjpeg2kStreamGetImageInfo(params.jpeg2k_streams[batch_id], &image_info));
+        return EXIT_FAILURE;
+    }
+    uint32_t num_resolutions = 0;
+    CHECK_NVJPEG2K(nvjpeg2kStreamGetResolutionsInTile(jpeg2k_stream, work.tile_id, &num_resolutions));
+    if (num_resolutions <= window.reduce)
+    {
+        std::cout<<"Tile "<<work.tile_id<<" has only "<<num_resolutions<<" resolutions"<<std::endl;
+        return EXIT_FAILURE;
+    }
 
-        std::vector<partial_decode_info> tile_window_data;
-        determine_tiles_to_decode(image_info, params, tile_window_data);
-
-        uint32_t out_width = 0;
-        uint32_t out_height = 0;
-        for( uint32_t i = 0; i < tile_window_data.size(); i++)
-        {
-            // make sure that the previous stage are done
-            CHECK_CUDA(cudaEventSynchronize(pipeline_events[buffer_index]));
-            nvjpeg2kImage16u_t tile_decode_out;
-            
-            auto& decode_data = tile_window_data[i];
-            tile_decode_out.num_comps = out[batch_id].num_comps;
-            tile_decode_out.pixel_type = out[batch_id].pixel_type;
-            uint32_t bytes_per_comp = sizeof(*tile_decode_out.pixel_data[0]);
-            for(uint32_t c = 0; c < out[batch_id].num_comps; c++)
-            {
-                size_t pitch_in_pixels = out[batch_id].pitch_in_bytes[c]/bytes_per_comp;
-                tile_decode_out.pixel_data[c] = out[batch_id].pixel_data[c] + out_height * pitch_in_pixels + (out_width);
-                tile_decode_out.pitch_in_bytes[c] = out[batch_id].pitch_in_bytes[c];
-            }
-            out_width += decode_data.win_tilex1 - decode_data.win_tilex0;
-                
-            if( out_width == params.win_x1 - params.win_x0)
-            {
-                out_width = 0;
-                out_height += decode_data.win_tiley1 - decode_data.win_tiley0;
-            }
+    nvjpeg2kImage_t nvjpeg2k_out;
+    nvjpeg2k_out.num_components = buf.num_comps;
+    nvjpeg2k_out.pixel_data = (void**)buf.pixel_data;
+    nvjpeg2k_out.pitch_in_bytes = buf.pitch_in_bytes;
+    nvjpeg2k_out.pixel_type = NVJPEG2K_UINT16;
 
-            nvjpeg2kImage_t nvjpeg2k_out;
-            nvjpeg2k_out.num_components = tile_decode_out.num_comps;
-            nvjpeg2k_out.pixel_data = (void**)tile_decode_out.pixel_data;
-            nvjpeg2k_out.pitch_in_bytes = tile_decode_out.pitch_in_bytes;
-            nvjpeg2k_out.pixel_type = tile_decode_out.pixel_type;
+    // an all zero decode area decodes the whole tile
+    CHECK_NVJPEG2K(nvjpeg2kDecodeParamsSetDecodeArea(decode_params, 0, 0, 0, 0));
+    CHECK_NVJPEG2K(nvjpeg2kDecodeTile(params.nvjpeg2k_handle, decode_state, jpeg2k_stream, decode_params,
+        work.tile_id, num_resolutions - window.reduce, &nvjpeg2k_out, stream));
+    CHECK_CUDA(cudaEventRecord(buf.ready, stream));
+    return EXIT_SUCCESS;
+}
 
-            CHECK_NVJPEG2K(nvjpeg2kDecodeParamsSetDecodeArea(decode_params, decode_data.win_tilex0, decode_data.win_tilex1,
-                decode_data.win_tiley0, decode_data.win_tiley1));
-            CHECK_NVJPEG2K(nvjpeg2kDecodeTile(params.nvjpeg2k_handle, params.nvjpeg2k_decode_states[buffer_index],
-                params.jpeg2k_streams[batch_id], decode_params, decode_data.tile_id, 0,
-                &nvjpeg2k_out, params.stream[buffer_index]));
-            
-            CHECK_CUDA(cudaEventRecord(pipeline_events[buffer_index], params.stream[buffer_index]));
+// decodes the part of a tile inside the window of image batch_id on a pipeline stage and
+// places it into the output image
+int decode_tile(const TileWork &work, int batch_id, int stage, nvjpeg2kDecodeParams_t decode_params,
+    std::vector<nvjpeg2kImage16u_t> &out, decode_params_t &params, std::vector<TileKey> &pinned)
+{
+    const decode_window_t &window = params.windows[batch_id];
+    const nvjpeg2kImage16u_t &dst = out[batch_id];
+    cudaStream_t stream = params.stream[stage];
+    const TileRect area = reduce_rect(work.area, window.reduce);
+    const uint32_t out_x = area.x0 - window.output.x0;
+    const uint32_t out_y = area.y0 - window.output.y0;
+    const uint32_t bytes_per_comp = sizeof(*dst.pixel_data[0]);
+
+    if (!params.tile_cache && window.reduce == 0)
+    {
+        // full resolution and nothing to keep: decode the area straight into the output
+        nvjpeg2kImage16u_t tile_decode_out;
+        tile_decode_out.num_comps = dst.num_comps;
+        tile_decode_out.pixel_type = dst.pixel_type;
+        for(uint32_t c = 0; c < dst.num_comps; c++)
+        {
+            size_t pitch_in_pixels = dst.pitch_in_bytes[c]/bytes_per_comp;
+            tile_decode_out.pixel_data[c] = dst.pixel_data[c] + out_y * pitch_in_pixels + out_x;
+            tile_decode_out.pitch_in_bytes[c] = dst.pitch_in_bytes[c];
+        }
 
-            buffer_index++;
-            buffer_index = buffer_index%PIPELINE_STAGES;
+        nvjpeg2kImage_t nvjpeg2k_out;
+        nvjpeg2k_out.num_components = tile_decode_out.num_comps;
+        nvjpeg2k_out.pixel_data = (void**)tile_decode_out.pixel_data;
+        nvjpeg2k_out.pitch_in_bytes = tile_decode_out.pitch_in_bytes;
+        nvjpeg2k_out.pixel_type = tile_decode_out.pixel_type;
 
+        const bool whole_tile = work.area.x0 == work.tile.x0 && work.area.x1 == work.tile.x1 &&
+                                work.area.y0 == work.tile.y0 && work.area.y1 == work.tile.y1;
+        if (whole_tile)
+        {
+            CHECK_NVJPEG2K(nvjpeg2kDecodeParamsSetDecodeArea(decode_params, 0, 0, 0, 0));
+        }
+        else
+        {
+            CHECK_NVJPEG2K(nvjpeg2kDecodeParamsSetDecodeArea(decode_params, work.area.x0, work.area.x1,
+                work.area.y0, work.area.y1));
         }
+        CHECK_NVJPEG2K(nvjpeg2kDecodeTile(params.nvjpeg2k_handle, params.nvjpeg2k_decode_states[stage],
+            params.jpeg2k_streams[batch_id], decode_params, work.tile_id, 0,
+            &nvjpeg2k_out, stream));
+        return EXIT_SUCCESS;
     }
-    for (int p = 0; p < PIPELINE_STAGES; p++)
+
+    // decode the whole tile, into the cache when enabled, and copy the part inside the window
+    tile_buffer_t *buf = &params.scratch[stage];
+    bool decode = true;
+    TileKey key = {params.file_ids[batch_id], work.tile_id, window.reduce};
+    if (params.tile_cache)
     {
-        CHECK_CUDA(cudaEventSynchronize(pipeline_events[p]));
+        buf = &params.tile_cache->acquire(key, decode);
+        pinned.push_back(key);
     }
-
-    CHECK_CUDA(cudaEventRecord(stopEvent, params.stream[0]));
-    
-    CHECK_CUDA(cudaEventSynchronize(stopEvent));
-    CHECK_CUDA(cudaEventElapsedTime(&loopTime, startEvent, stopEvent));
-    time += static_cast<double>(loopTime/1000.0); // loopTime is in milliseconds
-    
-    if (params.write_decoded)
+    if (decode)
     {
-        for( int i = 0; i < params.batch_size; i++)
+        if (decode_whole_tile(work, window, params.jpeg2k_streams[batch_id], dst.num_comps,
+                params.nvjpeg2k_decode_states[stage], decode_params, *buf, params, stream))
         {
-            nvjpeg2kImageInfo_t image_info;
-            nvjpeg2kImageComponentInfo_t comp_info;
-            CHECK_NVJPEG2K(nvjpeg2kStreamGetImageInfo(params.jpeg2k_streams[i], &image_info));
-            // assume all components have the same precision
-            CHECK_NVJPEG2K(nvjpeg2kStreamGetImageComponentInfo(params.jpeg2k_streams[i], &comp_info, 0));
-            write_image(params.output_dir, current_names[i], out[i], params.win_x1 - params.win_x0, 
-                params.win_x1 - params.win_x0, image_info.num_components, comp_info.precision,
-                params.verbose);
+            if (params.tile_cache)
+            {
+                params.tile_cache->abandon(key);
+                pinned.pop_back();
+            }
+            return EXIT_FAILURE;
+        }
+        if (params.tile_cache)
+        {
+            params.tile_cache->publish(key, buf->bytes);
         }
     }
+    else
+    {
+        // the tile may still be decoding on another stage
+        CHECK_CUDA(cudaStreamWaitEvent(stream, buf->ready, 0));
+    }
 
-    for(int p = 0; p < PIPELINE_STAGES; p++)
+    const TileRect tile = reduce_rect(work.tile, window.reduce);
+    for(uint32_t c = 0; c < dst.num_comps; c++)
     {
-        CHECK_CUDA(cudaEventDestroy(pipeline_events[p]));
+        size_t dst_pitch_in_pixels = dst.pitch_in_bytes[c]/bytes_per_comp;
+        size_t src_pitch_in_pixels = buf->pitch_in_bytes[c]/bytes_per_comp;
+        CHECK_CUDA(cudaMemcpy2DAsync(dst.pixel_data[c] + out_y * dst_pitch_in_pixels + out_x, dst.pitch_in_bytes[c],
+            buf->pixel_data[c] + (area.y0 - tile.y0) * src_pitch_in_pixels + (area.x0 - tile.x0), buf->pitch_in_bytes[c],
+            area.width() * bytes_per_comp, area.height(), cudaMemcpyDeviceToDevice, stream));
     }
-    CHECK_CUDA(cudaEventDestroy(stopEvent));
-    CHECK_CUDA(cudaEventDestroy(startEvent));
-    CHECK_NVJPEG2K(nvjpeg2kDecodeParamsDestroy(decode_params));
-    
     return EXIT_SUCCESS;
 }
 
+struct tile_job_t
+{
+    int batch_id;
+    TileWork work;
+};
+
+// claims tiles of the batch until none are left. Thread t uses the pipeline stages
+// t, t + num_threads, ... in turn
+int decode_tiles(int thread_id, int num_threads, const std::vector<tile_job_t> &jobs,
+    std::atomic<size_t> &next_job, std::atomic<bool> &failed, cudaEvent_t *pipeline_events,
+    std::vector<nvjpeg2kImage16u_t> &out, decode_params_t &params, std::vector<TileKey> &pinned)
+{
+    nvjpeg2kDecodeParams_t decode_params;
+    CHECK_NVJPEG2K(nvjpeg2kDecodeParamsCreate(&decode_params));
+#if (NVJPEG2K_VER_MAJOR == 0 && NVJPEG2K_VER_MINOR >= 3) 
+    // set RGB  output for the entire batch
+    CHECK_NVJPEG2K(nvjpeg2kDecodeParamsSetRGBOutput(decode_params, 1));
+#endif
+
+    int ret_val = EXIT_SUCCESS;
+    int stage = thread_id;
+    for (size_t i = next_job++; i < jobs.size() && !failed; i = next_job++)
+    {
+        // make sure that the previous stage are done
+        CHECK_CUDA(cudaEventSynchronize(pipeline_events[stage]));
+        ret_val = decode_tile(jobs[i].work, jobs[i].batch_id, stage, decode_params, out, params, pinned);
+        if (ret_val)
+        {
+            break;
+        }
+        CHECK_CUDA(cudaEventRecord(pipeline_events[stage], params.stream[stage]));
+
+        stage += num_threads;
+        if (stage >= PIPELINE_STAGES)
+        {
+            stage = thread_id;
+        }
+    }
+    CHECK_NVJPEG2K(nvjpeg2kDecodeParamsDestroy(decode_params));
+    return ret_val;
+}
 
 int decode_images(FileNames &current_names, std::vector<nvjpeg2kImage16u_t> &out,
                   decode_params_t &params, double &time)
 {
-    cudaEvent_t startEvent = NULL, stopEvent = NULL;
-    float loopTime = 0;
-
     cudaEvent_t pipeline_events[PIPELINE_STAGES];
 
     for (int p = 0; p < PIPELINE_STAGES; p++)
@@ -339,74 +422,76 @@ int decode_images(FileNames &current_names, std::vector<nvjpeg2kImage16u_t> &out
         CHECK_CUDA(cudaEventCreate(&pipeline_events[p]));
         CHECK_CUDA(cudaEventRecord(pipeline_events[p], params.stream[p]));
     }
-    CHECK_CUDA(cudaEventCreateWithFlags(&startEvent, cudaEventBlockingSync));
-    CHECK_CUDA(cudaEventCreateWithFlags(&stopEvent, cudaEventBlockingSync));
-
-    nvjpeg2kDecodeParams_t decode_params;
-    CHECK_NVJPEG2K(nvjpeg2kDecodeParamsCreate(&decode_params));
 
-#if (NVJPEG2K_VER_MAJOR == 0 && NVJPEG2K_VER_MINOR >= 3) 
-    // set RGB  output for the entire batch
-    CHECK_NVJPEG2K(nvjpeg2kDecodeParamsSetRGBOutput(decode_params, 1));
-#endif
-
-    CHECK_CUDA(cudaEventRecord(startEvent, params.stream[0]));
-    int buffer_index = 0;
+    // the tiles of all images in the batch, each intersecting the decode window
+    std::vector<tile_job_t> jobs;
+    std::vector<TileWork> tiles;
     for(int batch_id = 0; batch_id < params.batch_size; batch_id++)
     {
         nvjpeg2kImageInfo_t image_info;
         CHECK_NVJPEG2K(nvjpeg2kStreamGetImageInfo(params.jpeg2k_streams[batch_id], &image_info));
-
-        uint32_t tile_id = 0;
-        for(uint32_t tile_y0 = 0; tile_y0 < image_info.image_height; tile_y0 += image_info.tile_height)
+        determine_tiles_to_decode(image_info.image_width, image_info.image_height, image_info.tile_width,
+            image_info.tile_height, params.windows[batch_id].area, tiles);
+        for (const auto &work : tiles)
         {
-            for(uint32_t tile_x0 = 0; tile_x0 < image_info.image_width; tile_x0 += image_info.tile_width)
-            {
-                // make sure that the previous stage are done
-                CHECK_CUDA(cudaEventSynchronize(pipeline_events[buffer_index]));
-                nvjpeg2kImage16u_t tile_decode_out;
-                tile_decode_out.num_comps = out[batch_id].num_comps;
-                tile_decode_out.pixel_type = out[batch_id].pixel_type;
-                uint32_t bytes_per_comp = sizeof(*tile_decode_out.pixel_data[0]);
-                for(uint32_t c = 0; c < out[batch_id].num_comps; c++)
-                {
-                    size_t pitch_in_pixels = out[batch_id].pitch_in_bytes[c]/bytes_per_comp;
-                    tile_decode_out.pixel_data[c] = out[batch_id].pixel_data[c] + tile_y0 * pitch_in_pixels + (tile_x0);
-                    tile_decode_out.pitch_in_bytes[c] = out[batch_id].pitch_in_bytes[c];
-                }
-                // make sure that the previous stage are done before reusing
-                CHECK_CUDA(cudaEventSynchronize(pipeline_events[buffer_index]));
-            
-                nvjpeg2kImage_t nvjpeg2k_out;
-                nvjpeg2k_out.num_components = tile_decode_out.num_comps;
-                nvjpeg2k_out.pixel_data = (void**)tile_decode_out.pixel_data;
-                nvjpeg2k_out.pitch_in_bytes = tile_decode_out.pitch_in_bytes;
-                nvjpeg2k_out.pixel_type = tile_decode_out.pixel_type;
-
-                CHECK_NVJPEG2K(nvjpeg2kDecodeTile(params.nvjpeg2k_handle, params.nvjpeg2k_decode_states[buffer_index],
-                    params.jpeg2k_streams[batch_id], decode_params, tile_id, 0,
-                    &nvjpeg2k_out, params.stream[buffer_index]));
-                
-                CHECK_CUDA(cudaEventRecord(pipeline_events[buffer_index], params.stream[buffer_index]));
-
-                buffer_index++;
-                buffer_index = buffer_index%PIPELINE_STAGES;
-                tile_id++;
+            jobs.push_back({batch_id, work});
+        }
+    }
 
-            }
+    double start = Wtime();
+    const int num_threads = (std::min)((std::max)(params.num_threads, 1), PIPELINE_STAGES);
+    std::atomic<size_t> next_job(0);
+    std::atomic<bool> failed(false);
+    std::vector<int> results(num_threads, EXIT_SUCCESS);
+    std::vector<std::vector<TileKey>> pinned(num_threads);
+    auto run = [&](int t)
+    {
+        results[t] = decode_tiles(t, num_threads, jobs, next_job, failed, pipeline_events, out, params, pinned[t]);
+        if (results[t])
+        {
+            failed = true;
         }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < num_threads; t++)
+    {
+        threads.emplace_back(run, t);
+    }
+    run(0);
+    for (auto &thread : threads)
+    {
+        thread.join();
     }
     for (int p = 0; p < PIPELINE_STAGES; p++)
     {
         CHECK_CUDA(cudaEventSynchronize(pipeline_events[p]));
     }
+    time += Wtime() - start;
+
+    // the window is complete, its tiles may be evicted again
+    if (params.tile_cache)
+    {
+        std::vector<tile_buffer_t> evicted;
+        for (const auto &keys : pinned)
+        {
+            for (const auto &key : keys)
+            {
+                params.tile_cache->release(key, evicted);
+            }
+        }
+        for (auto &buf : evicted)
+        {
+            if (free_tile_buffer(buf))
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if (failed)
+    {
+        return EXIT_FAILURE;
+    }
 
-    CHECK_CUDA(cudaEventRecord(stopEvent, params.stream[0]));
-    
-    CHECK_CUDA(cudaEventSynchronize(stopEvent));
-    CHECK_CUDA(cudaEventElapsedTime(&loopTime, startEvent, stopEvent));
-    time += static_cast<double>(loopTime/1000.0); // loopTime is in milliseconds
-    
     if (params.write_decoded)
     {
         for( int i = 0; i < params.batch_size; i++)
@@ -416,9 +501,8 @@ int decode_images(FileNames &current_names, std::vector<nvjpeg2kImage16u_t> &out
             CHECK_NVJPEG2K(nvjpeg2kStreamGetImageInfo(params.jpeg2k_streams[i], &image_info));
             // assume all components have the same precision
             CHECK_NVJPEG2K(nvjpeg2kStreamGetImageComponentInfo(params.jpeg2k_streams[i], &comp_info, 0));
-            
-            write_image(params.output_dir, current_names[i], out[i], image_info.image_width, 
-                image_info.image_height, image_info.num_components, comp_info.precision,
+            write_image(params.output_dir, current_names[i], out[i], params.windows[i].output.width(),
+                params.windows[i].output.height(), image_info.num_components, comp_info.precision,
                 params.verbose);
         }
     }
@@ -427,9 +511,6 @@ int decode_images(FileNames &current_names, std::vector<nvjpeg2kImage16u_t> &out
     {
         CHECK_CUDA(cudaEventDestroy(pipeline_events[p]));
     }
-    CHECK_CUDA(cudaEventDestroy(stopEvent));
-    CHECK_CUDA(cudaEventDestroy(startEvent));
-    CHECK_NVJPEG2K(nvjpeg2kDecodeParamsDestroy(decode_params));
 
     return EXIT_SUCCESS;
 }
@@ -471,16 +552,7 @@ double process_images(FileNames &image_names, decode_params_t &params,
             return EXIT_FAILURE;
 
         double time = 0;
-        int ret_val = 0;
-        if (params.partial_decode)
-        {
-            ret_val = decode_images_partial(current_names, iout, params, time);
-        }
-        else
-        {
-            ret_val = decode_images(current_names, iout, params, time);
-        }
-        if(ret_val)
+        if (decode_images(current_names, iout, params, time))
         {
             return EXIT_FAILURE;
         }
@@ -497,8 +569,21 @@ double process_images(FileNames &image_names, decode_params_t &params,
     total = test_time;
     for (int p = 0; p < PIPELINE_STAGES; p++)
     {
+        if (free_tile_buffer(params.scratch[p]))
+            return EXIT_FAILURE;
         CHECK_CUDA(cudaStreamDestroy(params.stream[p]));
     }
+    if (params.tile_cache)
+    {
+        params.tile_cache->print(std::cout);
+        std::vector<tile_buffer_t> evicted;
+        params.tile_cache->clear(evicted);
+        for (auto &buf : evicted)
+        {
+            if (free_tile_buffer(buf))
+                return EXIT_FAILURE;
+        }
+    }
 
     return EXIT_SUCCESS;
 }
@@ -550,7 +635,8 @@ int main(int argc, const char *argv[])
     {
         std::cout << "Usage: " << argv[0]
                   << " -i images_dir [-b batch_size] [-t total_images] "
-                     "[-w warmup_iterations] [-o output_dir] [-da decode_area_of_interest] [-v verbose]\n";
+                     "[-w warmup_iterations] [-o output_dir] [-da decode_area_of_interest] "
+                     "[-threads num_threads] [-reduce levels | -zoom zoom] [-tile_cache MiB] [-v verbose]\n";
         std::cout << "Parameters: " << std::endl;
         std::cout << "\timages_dir\t:\tPath to single image or directory of images"
                   << std::endl;
@@ -568,6 +654,17 @@ int main(int argc, const char *argv[])
         std::cout << "\tdecode_area_of_interest: Image coordinates specifying an area "
                   << "to be decoded"
                   << std::endl;
+        std::cout << "\tnum_threads\t:\tCPU threads submitting tile decodes, each using "
+                  << PIPELINE_STAGES << "/num_threads decode states and streams"
+                  << std::endl;
+        std::cout << "\tlevels\t\t:\tDiscard this many of the highest resolution levels"
+                  << std::endl;
+        std::cout << "\tzoom\t\t:\tDisplay scale (e.g. 0.25), discards the resolution levels "
+                     "it does not show"
+                  << std::endl;
+        std::cout << "\tMiB\t\t:\tKeep up to this much device memory of decoded tiles "
+                     "for reuse by later windows"
+                  << std::endl;
         std::cout
             << "\toutput_dir\t:\tWrite decoded images in BMP/PGM format to this directory"
             << std::endl;
@@ -639,6 +736,38 @@ int main(int argc, const char *argv[])
         
     }
 
+    params.num_threads = 1;
+    if ((pidx = findParamIndex(argv, argc, "-threads")) != -1)
+    {
+        params.num_threads = (std::max)(1, std::atoi(argv[pidx + 1]));
+    }
+
+    params.reduce = 0;
+    if ((pidx = findParamIndex(argv, argc, "-reduce")) != -1)
+    {
+        params.reduce = (std::max)(0, std::atoi(argv[pidx + 1]));
+    }
+    else if ((pidx = findParamIndex(argv, argc, "-zoom")) != -1)
+    {
+        params.reduce = reduction_for_zoom(std::atof(argv[pidx + 1]));
+    }
+
+    for (int p = 0; p < PIPELINE_STAGES; p++)
+    {
+        params.scratch[p] = tile_buffer_t();
+    }
+    std::unique_ptr<TileCache<tile_buffer_t>> tile_cache;
+    params.tile_cache = NULL;
+    if ((pidx = findParamIndex(argv, argc, "-tile_cache")) != -1)
+    {
+        size_t cache_mib = std::strtoull(argv[pidx + 1], NULL, 10);
+        if (cache_mib > 0)
+        {
+            tile_cache.reset(new TileCache<tile_buffer_t>(cache_mib << 20));
+            params.tile_cache = tile_cache.get();
+        }
+    }
+
     if( params.verbose)
     {
         if(params.write_decoded) 
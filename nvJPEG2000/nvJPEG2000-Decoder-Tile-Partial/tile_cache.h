@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Tile geometry and a cache of decoded tiles for the tile / partial decode
+// sample.
+//
+// A decode window is given in full resolution image coordinates. Decoding
+// with `reduce` resolution levels discarded halves the image `reduce` times;
+// JPEG 2000 maps a coordinate x to ceil(x / 2^reduce) at that resolution, so
+// the reduced parts of the tiles inside a window cover the reduced window
+// exactly once. The tile grid is assumed to start at the image origin, as
+// elsewhere in the sample.
+//
+// TileCache keeps decoded tiles keyed by (file, tile, resolution) in least
+// recently used order, so windows that overlap earlier ones (a viewer
+// panning over a slide) reuse the tiles decoded before. Entries in use are
+// pinned and never evicted; the cache may exceed its capacity while the
+// pinned entries alone do. Evicted values are handed back to the caller,
+// which owns the device memory in them.
+//
+// Only host code is used, so the geometry and the cache can be exercised
+// without a GPU (see tile_cache_simulation.cpp). TileCache is thread safe.
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+struct TileRect
+{
+    uint32_t x0 = 0;
+    uint32_t y0 = 0;
+    uint32_t x1 = 0;
+    uint32_t y1 = 0;
+
+    uint32_t width() const { return x1 - x0; }
+    uint32_t height() const { return y1 - y0; }
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+};
+
+// ceil(x / 2^reduce), the coordinate x at a resolution reduced `reduce` times
+inline uint32_t reduce_coordinate(uint32_t x, uint32_t reduce)
+{
+    return static_cast<uint32_t>((static_cast<uint64_t>(x) + (uint64_t(1) << reduce) - 1) >> reduce);
+}
+
+inline TileRect reduce_rect(const TileRect &r, uint32_t reduce)
+{
+    TileRect out;
+    out.x0 = reduce_coordinate(r.x0, reduce);
+    out.y0 = reduce_coordinate(r.y0, reduce);
+    out.x1 = reduce_coordinate(r.x1, reduce);
+    out.y1 = reduce_coordinate(r.y1, reduce);
+    return out;
+}
+
+// resolution levels that can be discarded when the image is shown at `zoom`
+// (1: full resolution, 0.25: a quarter of the width), keeping at least the
+// displayed detail
+inline uint32_t reduction_for_zoom(double zoom)
+{
+    if (!(zoom > 0) || zoom >= 1)
+        return 0;
+    return static_cast<uint32_t>(std::floor(std::log2(1.0 / zoom) + 1e-9));
+}
+
+// one tile of a decode window
+struct TileWork
+{
+    uint32_t tile_id;
+    TileRect tile;   // tile bounds, full resolution
+    TileRect area;   // part of the tile inside the window, full resolution
+};
+
+/**
+ * Lists the tiles of an image_width x image_height image, tiled by
+ * tile_width x tile_height, that intersect window. Tiles are listed largest
+ * area first, so threads that claim them in order finish together.
+ */
+inline void determine_tiles_to_decode(uint32_t image_width, uint32_t image_height,
+    uint32_t tile_width, uint32_t tile_height, const TileRect &window,
+    std::vector<TileWork> &tiles)
+{
+    tiles.clear();
+    if (tile_width == 0 || tile_height == 0)
+        return;
+    const uint32_t tiles_x = (image_width + tile_width - 1) / tile_width;
+    const uint32_t first_x = window.x0 / tile_width;
+    const uint32_t last_x = (std::min)(tiles_x, (window.x1 + tile_width - 1) / tile_width);
+    const uint32_t first_y = window.y0 / tile_height;
+    const uint32_t last_y = (std::min)((image_height + tile_height - 1) / tile_height,
+                                       (window.y1 + tile_height - 1) / tile_height);
+    for (uint32_t ty = first_y; ty < last_y; ty++)
+    {
+        for (uint32_t tx = first_x; tx < last_x; tx++)
+        {
+            TileWork work;
+            work.tile_id = ty * tiles_x + tx;
+            work.tile.x0 = tx * tile_width;
+            work.tile.y0 = ty * tile_height;
+            work.tile.x1 = (std::min)(work.tile.x0 + tile_width, image_width);
+            work.tile.y1 = (std::min)(work.tile.y0 + tile_height, image_height);
+            work.area.x0 = (std::max)(work.tile.x0, window.x0);
+            work.area.y0 = (std::max)(work.tile.y0, window.y0);
+            work.area.x1 = (std::min)(work.tile.x1, window.x1);
+            work.area.y1 = (std::min)(work.tile.y1, window.y1);
+            if (!work.area.empty())
+                tiles.push_back(work);
+        }
+    }
+    std::stable_sort(tiles.begin(), tiles.end(), [](const TileWork &a, const TileWork &b) {
+        return uint64_t(a.area.width()) * a.area.height() > uint64_t(b.area.width()) * b.area.height();
+    });
+}
+
+struct TileKey
+{
+    uint32_t file;
+    uint32_t tile;
+    uint32_t resolution;   // resolution levels discarded
+
+    bool operator==(const TileKey &o) const
+    {
+        return file == o.file && tile == o.tile && resolution == o.resolution;
+    }
+};
+
+struct TileKeyHash
+{
+    size_t operator()(const TileKey &k) const
+    {
+        uint64_t h = (uint64_t(k.file) << 32) ^ (uint64_t(k.tile) << 5) ^ k.resolution;
+        return std::hash<uint64_t>()(h);
+    }
+};
+
+struct TileCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t bytes = 0;
+    size_t entries = 0;
+};
+
+template <typename V>
+class TileCache
+{
+  public:
+    explicit TileCache(size_t capacity_bytes) : capacity_(capacity_bytes) {}
+
+    size_t capacity() const { return capacity_; }
+
+    /**
+     * Pins the entry of key and returns its value. If the tile is not
+     * cached, a new empty entry is created and owner is set: the caller
+     * fills the value and calls publish(), or abandon() if that failed.
+     * Blocks while another thread is filling the entry.
+     */
+    V &acquire(const TileKey &key, bool &owner)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            auto found = index_.find(key);
+            if (found == index_.end())
+            {
+                entries_.emplace_front();
+                Entry &entry = entries_.front();
+                entry.key = key;
+                entry.pins = 1;
+                index_.emplace(key, entries_.begin());
+                stats_.misses++;
+                owner = true;
+                return entry.value;
+            }
+            Entry &entry = *found->second;
+            if (entry.ready)
+            {
+                entries_.splice(entries_.begin(), entries_, found->second);
+                entry.pins++;
+                stats_.hits++;
+                owner = false;
+                return entry.value;
+            }
+            // being filled by another thread, which may also give up on it
+            filled_.wait(lock);
+        }
+    }
+
+    /** Marks the entry of key, holding bytes of tile data, as filled. */
+    void publish(const TileKey &key, size_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Entry &entry = *index_.at(key);
+            entry.bytes = bytes;
+            entry.ready = true;
+            stats_.bytes += bytes;
+        }
+        filled_.notify_all();
+    }
+
+    /** Drops the entry of key that the caller failed to fill. */
+    void abandon(const TileKey &key)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = index_.find(key);
+            if (found != index_.end())
+            {
+                entries_.erase(found->second);
+                index_.erase(found);
+            }
+        }
+        filled_.notify_all();
+    }
+
+    /**
+     * Unpins the entry of key and evicts least recently used entries that
+     * are not pinned until the cache fits its capacity. Their values are
+     * appended to evicted.
+     */
+    void release(const TileKey &key, std::vector<V> &evicted)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = index_.find(key);
+        if (found != index_.end() && found->second->pins > 0)
+            found->second->pins--;
+        trim(capacity_, evicted);
+    }
+
+    /** Evicts all entries that are not pinned. */
+    void clear(std::vector<V> &evicted)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        trim(0, evicted);
+    }
+
+    TileCacheStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        TileCacheStats s = stats_;
+        s.entries = entries_.size();
+        return s;
+    }
+
+    void print(std::ostream &os) const
+    {
+        TileCacheStats s = stats();
+        const uint64_t lookups = s.hits + s.misses;
+        os << "Tile cache: " << s.entries << " tiles, " << s.bytes / (1024 * 1024) << " of "
+           << capacity_ / (1024 * 1024) << " MiB, " << s.hits << " hits, " << s.misses << " misses ("
+           << (lookups ? 100.0 * s.hits / lookups : 0.0) << "% hit rate), " << s.evictions
+           << " evictions" << std::endl;
+    }
+
+  private:
+    struct Entry
+    {
+        TileKey key{};
+        V value{};
+        size_t bytes = 0;
+        int pins = 0;
+        bool ready = false;
+    };
+
+    void trim(size_t limit, std::vector<V> &evicted)
+    {
+        auto it = entries_.end();
+        while (stats_.bytes > limit && it != entries_.begin())
+        {
+            --it;
+            if (it->pins > 0 || !it->ready)
+                continue;
+            stats_.bytes -= it->bytes;
+            stats_.evictions++;
+            evicted.push_back(std::move(it->value));
+            index_.erase(it->key);
+            it = entries_.erase(it);
+        }
+    }
+
+    size_t capacity_;
+    mutable std::mutex mutex_;
+    std::condition_variable filled_;
+    std::list<Entry> entries_;   // most recently used first
+    std::unordered_map<TileKey, typename std::list<Entry>::iterator, TileKeyHash> index_;
+    TileCacheStats stats_;
+};
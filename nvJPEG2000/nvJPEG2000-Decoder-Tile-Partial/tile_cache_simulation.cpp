@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// CPU-only check of the tile geometry and the decoded tile cache
+// (tile_cache.h).
+//
+// 1. Random images, tile grids, windows and resolution reductions: the
+//    reduced parts of the listed tiles must cover the reduced window exactly
+//    once and lie inside their reduced tiles.
+// 2. A viewer pans over a whole-slide image and zooms out and back in. The
+//    decoded pixels are counted for the previous behaviour (full resolution,
+//    only the window part of each tile, nothing kept), for reduced resolution
+//    decode, and for reduced resolution decode with the cache. Panning back
+//    over tiles that fit into the cache must decode nothing.
+// 3. Threads claim the tiles of overlapping windows as the sample does, with
+//    each tile listed twice, and fill missing cache entries. Every entry must
+//    be filled once and be seen filled by all other threads.
+//
+// Build: g++ -O2 -std=c++17 -pthread tile_cache_simulation.cpp -o tile_cache_simulation
+// Usage: ./tile_cache_simulation [-threads n] [-cache MiB] [-tile size]
+
+#include "tile_cache.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <set>
+#include <thread>
+
+struct sim_params_t
+{
+    int threads = 4;
+    size_t cache_mib = 1024;
+    uint32_t tile = 512;
+};
+
+// stands in for the device buffer of a decoded tile
+struct SimTile
+{
+    TileKey key{};
+    size_t bytes = 0;
+};
+
+static int check_geometry(std::mt19937 &rng)
+{
+    std::uniform_int_distribution<uint32_t> image_dim(1, 3000), tile_dim(16, 700), reduce_dist(0, 6);
+    std::vector<TileWork> tiles;
+    std::vector<uint8_t> covered;
+    for (int trial = 0; trial < 3000; trial++)
+    {
+        const uint32_t w = image_dim(rng), h = image_dim(rng);
+        const uint32_t tw = tile_dim(rng), th = tile_dim(rng);
+        TileRect window;
+        window.x0 = std::uniform_int_distribution<uint32_t>(0, w - 1)(rng);
+        window.y0 = std::uniform_int_distribution<uint32_t>(0, h - 1)(rng);
+        window.x1 = std::uniform_int_distribution<uint32_t>(window.x0 + 1, std::min(w, window.x0 + 800))(rng);
+        window.y1 = std::uniform_int_distribution<uint32_t>(window.y0 + 1, std::min(h, window.y0 + 800))(rng);
+        const uint32_t reduce = reduce_dist(rng);
+
+        determine_tiles_to_decode(w, h, tw, th, window, tiles);
+        const TileRect out = reduce_rect(window, reduce);
+        covered.assign(size_t(out.width()) * out.height(), 0);
+        const uint32_t tiles_x = (w + tw - 1) / tw;
+        for (const auto &work : tiles)
+        {
+            const TileRect tile = reduce_rect(work.tile, reduce);
+            const TileRect area = reduce_rect(work.area, reduce);
+            if (work.tile.x0 != (work.tile_id % tiles_x) * tw || work.tile.y0 != (work.tile_id / tiles_x) * th ||
+                area.x0 < tile.x0 || area.x1 > tile.x1 || area.y0 < tile.y0 || area.y1 > tile.y1 ||
+                area.x0 < out.x0 || area.x1 > out.x1 || area.y0 < out.y0 || area.y1 > out.y1)
+            {
+                printf("FAILED: geometry, tile %u of %ux%u tiled %ux%u\n", work.tile_id, w, h, tw, th);
+                return 1;
+            }
+            for (uint32_t y = area.y0; y < area.y1; y++)
+                for (uint32_t x = area.x0; x < area.x1; x++)
+                    covered[size_t(y - out.y0) * out.width() + (x - out.x0)]++;
+        }
+        for (uint8_t c : covered)
+        {
+            if (c != 1)
+            {
+                printf("FAILED: geometry, reduced window of %ux%u tiled %ux%u covered %d times\n", w, h, tw, th, c);
+                return 1;
+            }
+        }
+    }
+    printf("geometry: 3000 windows covered exactly once\n");
+    return 0;
+}
+
+// decodes the tiles of a viewport, returns the decoded pixels
+static uint64_t view(TileCache<SimTile> *cache, uint32_t w, uint32_t h, uint32_t tile, const TileRect &window,
+                     uint32_t reduce, std::vector<TileWork> &tiles)
+{
+    uint64_t pixels = 0;
+    determine_tiles_to_decode(w, h, tile, tile, window, tiles);
+    std::vector<TileKey> pinned;
+    for (const auto &work : tiles)
+    {
+        if (!cache && reduce == 0)
+        {
+            pixels += uint64_t(work.area.width()) * work.area.height();
+            continue;
+        }
+        const TileRect t = reduce_rect(work.tile, reduce);
+        const uint64_t tile_pixels = uint64_t(t.width()) * t.height();
+        if (!cache)
+        {
+            pixels += tile_pixels;
+            continue;
+        }
+        TileKey key = {0, work.tile_id, reduce};
+        bool owner = false;
+        SimTile &entry = cache->acquire(key, owner);
+        pinned.push_back(key);
+        if (owner)
+        {
+            entry.key = key;
+            entry.bytes = tile_pixels * 3 * sizeof(unsigned short);
+            cache->publish(key, entry.bytes);
+            pixels += tile_pixels;
+        }
+    }
+    std::vector<SimTile> evicted;
+    for (const auto &key : pinned)
+        cache->release(key, evicted);
+    return pixels;
+}
+
+static int check_panning(const sim_params_t &params)
+{
+    const uint32_t w = 100000, h = 80000, screen_w = 1920, screen_h = 1080;
+    // pan right, zoom out, zoom back in, pan left over the same tiles
+    struct Step { double x, y, zoom; };
+    std::vector<Step> path;
+    for (int i = 0; i <= 40; i++)
+        path.push_back({20000.0 + i * 256 / 0.25, 30000, 0.25});
+    for (double z : {0.125, 0.0625, 0.125, 0.25})
+        path.push_back({path.back().x, 30000, z});
+    for (int i = 40; i >= 0; i--)
+        path.push_back({20000.0 + i * 256 / 0.25, 30000, 0.25});
+    const size_t forward_steps = 41;
+
+    TileCache<SimTile> cache(params.cache_mib << 20);
+    std::vector<TileWork> tiles;
+    uint64_t full = 0, reduced = 0, cached = 0, cached_back = 0;
+    std::set<std::pair<uint32_t, uint32_t>> seen;
+    for (size_t s = 0; s < path.size(); s++)
+    {
+        const Step &step = path[s];
+        TileRect window;
+        window.x0 = static_cast<uint32_t>(step.x);
+        window.y0 = static_cast<uint32_t>(step.y);
+        window.x1 = std::min(w, window.x0 + static_cast<uint32_t>(screen_w / step.zoom));
+        window.y1 = std::min(h, window.y0 + static_cast<uint32_t>(screen_h / step.zoom));
+        const uint32_t reduce = reduction_for_zoom(step.zoom);
+        full += view(nullptr, w, h, params.tile, window, 0, tiles);
+        reduced += view(nullptr, w, h, params.tile, window, reduce, tiles);
+        const uint64_t decoded = view(&cache, w, h, params.tile, window, reduce, tiles);
+        cached += decoded;
+        if (s >= path.size() - forward_steps)
+            cached_back += decoded;
+        for (const auto &work : tiles)
+            seen.insert({work.tile_id, reduce});
+    }
+
+    const TileCacheStats stats = cache.stats();
+    const double MP = 1e6;
+    printf("panning: %zu views of %ux%u screen pixels over %ux%u, %u tiles\n", path.size(), screen_w, screen_h,
+           w, h, params.tile);
+    printf("%28s %12.1f MP\n", "full resolution, no cache", full / MP);
+    printf("%28s %12.1f MP %7.1fx\n", "reduced resolution", reduced / MP, double(full) / reduced);
+    printf("%28s %12.1f MP %7.1fx\n", "reduced, cached", cached / MP, double(full) / std::max<uint64_t>(cached, 1));
+    cache.print(std::cout);
+    // with room for every tile viewed, each is decoded once and panning back decodes nothing
+    const size_t viewed_bytes = seen.size() * size_t(params.tile) * params.tile * 3 * sizeof(unsigned short);
+    if (viewed_bytes <= cache.capacity() && (cached_back != 0 || stats.misses != seen.size()))
+    {
+        printf("FAILED: panning back decoded %.1f MP, %llu misses for %zu tiles\n", cached_back / MP,
+               (unsigned long long)stats.misses, seen.size());
+        return 1;
+    }
+    if (reduced >= full || cached > reduced || stats.bytes > std::max(cache.capacity(), viewed_bytes))
+    {
+        printf("FAILED: panning\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int check_threads(const sim_params_t &params, std::mt19937 &rng)
+{
+    // a small cache, so that windows evict each other's tiles
+    TileCache<SimTile> cache(64 * 512 * 512 * 6);
+    std::atomic<uint64_t> fills(0), bad(0);
+    std::vector<TileWork> tiles;
+    std::uniform_int_distribution<uint32_t> pos(0, 20000);
+    for (int round = 0; round < 200; round++)
+    {
+        TileRect window;
+        window.x0 = pos(rng);
+        window.y0 = pos(rng) / 2;
+        window.x1 = window.x0 + 4000;
+        window.y1 = window.y0 + 3000;
+        determine_tiles_to_decode(30000, 15000, 512, 512, window, tiles);
+        // every tile twice: threads race for the same entry
+        std::vector<TileWork> jobs(tiles);
+        jobs.insert(jobs.end(), tiles.begin(), tiles.end());
+        std::shuffle(jobs.begin(), jobs.end(), rng);
+
+        std::atomic<size_t> next_job(0);
+        std::vector<std::vector<TileKey>> pinned(params.threads);
+        auto run = [&](int t)
+        {
+            for (size_t i = next_job++; i < jobs.size(); i = next_job++)
+            {
+                TileKey key = {uint32_t(round % 3), jobs[i].tile_id, 1};
+                bool owner = false;
+                SimTile &entry = cache.acquire(key, owner);
+                pinned[t].push_back(key);
+                if (owner)
+                {
+                    entry.key = key;
+                    entry.bytes = 512 * 512 * 6;
+                    fills++;
+                    cache.publish(key, entry.bytes);
+                }
+                else if (!(entry.key == key))
+                {
+                    bad++;
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int t = 1; t < params.threads; t++)
+            threads.emplace_back(run, t);
+        run(0);
+        for (auto &thread : threads)
+            thread.join();
+        std::vector<SimTile> evicted;
+        for (const auto &keys : pinned)
+            for (const auto &key : keys)
+                cache.release(key, evicted);
+        for (const auto &e : evicted)
+            if (e.bytes == 0)
+                bad++;
+    }
+    const TileCacheStats stats = cache.stats();
+    printf("threads: %d, %llu fills, %llu hits, %llu evictions\n", params.threads,
+           (unsigned long long)fills.load(), (unsigned long long)stats.hits, (unsigned long long)stats.evictions);
+    if (bad || fills != stats.misses || stats.bytes > cache.capacity())
+    {
+        printf("FAILED: threads, %llu bad entries\n", (unsigned long long)bad.load());
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    sim_params_t params;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-h") == 0)
+        {
+            printf("Usage: %s [-threads n] [-cache MiB] [-tile size]\n", argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (i + 1 >= argc)
+            break;
+        if (strcmp(argv[i], "-threads") == 0)
+            params.threads = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-cache") == 0)
+            params.cache_mib = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "-tile") == 0)
+            params.tile = std::max(16, atoi(argv[++i]));
+    }
+
+    std::mt19937 rng(7);
+    int failures = 0;
+    failures += check_geometry(rng);
+    failures += check_panning(params);
+    failures += check_threads(params, rng);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
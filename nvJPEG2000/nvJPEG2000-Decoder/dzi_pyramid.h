@@ -0,0 +1,557 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Deep Zoom (DZI) tile pyramid writer for the nvJPEG2000 decode sample.
+//
+// A DZI pyramid of a width x height image has levels 0 (1x1) to
+// max_level = ceil(log2(max(width, height))); level l is the image reduced
+// max_level - l times, ceil(size / 2^k) as for JPEG 2000 resolutions, so
+// resolution r of a codestream is DZI level max_level - r and needs no
+// resampling. Each level is cut into tile_size x tile_size tiles, extended
+// by `overlap` pixels into their neighbours, and written as
+// <name>_files/<level>/<column>_<row>.bmp next to <name>.dzi.
+//
+// DziLevelWriter receives a level as horizontal bands in any band height
+// (the sample pushes one row of codestream tiles at a time) and writes a row
+// of DZI tiles, on several threads, as soon as its rows are complete. Only
+// the rows of the current tile row are kept, unless the whole level is
+// needed to downsample the levels below the codestream's lowest resolution.
+//
+// Tiles whose samples all equal the background value (white by default, the
+// background of a slide) are not written. <name>_files/index.bin lists the
+// tiles that were written, sorted by (level, row, column), so a server finds
+// a tile, or learns that it is background, with one binary search and no
+// file system lookup (DziIndex).
+//
+// Only host code is used, so the pyramid can be checked without a GPU (see
+// dzi_pyramid_check.cpp).
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(WIN32) || defined(_WIN32) || defined(WIN64) || defined(_WIN64)
+#include <direct.h>
+#endif
+
+#include "../../common/image_writer.h"
+
+inline int dzi_make_dir(const std::string &path)
+{
+#if defined(WIN32) || defined(_WIN32) || defined(WIN64) || defined(_WIN64)
+    int err = _mkdir(path.c_str());
+#else
+    int err = mkdir(path.c_str(), 0755);
+#endif
+    struct stat st;
+    return (err == 0 || (stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFDIR))) ? 0 : 1;
+}
+
+struct DziLayout
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t tile_size = 254;
+    uint32_t overlap = 1;
+
+    DziLayout() {}
+    DziLayout(uint32_t w, uint32_t h, uint32_t tile, uint32_t ovl)
+        : width(w), height(h), tile_size((std::max)(tile, 1u)), overlap(ovl)
+    {
+    }
+
+    uint32_t max_level() const
+    {
+        uint32_t level = 0;
+        while ((uint64_t(1) << level) < (std::max)(width, height))
+            level++;
+        return level;
+    }
+
+    uint32_t level_width(uint32_t level) const { return reduce(width, max_level() - level); }
+    uint32_t level_height(uint32_t level) const { return reduce(height, max_level() - level); }
+    uint32_t columns(uint32_t level) const { return (level_width(level) + tile_size - 1) / tile_size; }
+    uint32_t rows(uint32_t level) const { return (level_height(level) + tile_size - 1) / tile_size; }
+
+    /** Rows [y0, y1) of the level covered by tile row `row`, overlap included. */
+    void row_span(uint32_t level, uint32_t row, uint32_t &y0, uint32_t &y1) const
+    {
+        span(row, level_height(level), y0, y1);
+    }
+
+    /** Columns [x0, x1) of the level covered by tile column `column`, overlap included. */
+    void column_span(uint32_t level, uint32_t column, uint32_t &x0, uint32_t &x1) const
+    {
+        span(column, level_width(level), x0, x1);
+    }
+
+    static uint32_t reduce(uint32_t size, uint32_t times)
+    {
+        return static_cast<uint32_t>((uint64_t(size) + (uint64_t(1) << times) - 1) >> times);
+    }
+
+  private:
+    void span(uint32_t index, uint32_t size, uint32_t &p0, uint32_t &p1) const
+    {
+        const uint32_t start = index * tile_size;
+        p0 = start > overlap ? start - overlap : 0;
+        p1 = (std::min)(size, start + tile_size + overlap);
+    }
+};
+
+struct DziIndexEntry
+{
+    uint32_t level;
+    uint32_t row;
+    uint32_t column;
+    uint32_t bytes;   // size of the tile file
+
+    bool operator<(const DziIndexEntry &o) const
+    {
+        if (level != o.level)
+            return level < o.level;
+        return row != o.row ? row < o.row : column < o.column;
+    }
+};
+
+class DziIndex
+{
+  public:
+    DziLayout layout;
+    uint32_t background = 0;
+    std::vector<DziIndexEntry> entries;
+
+    void add(const std::vector<DziIndexEntry> &more)
+    {
+        entries.insert(entries.end(), more.begin(), more.end());
+    }
+
+    /** Sorts the entries and writes them after a fixed size header. */
+    int save(const std::string &filename)
+    {
+        std::sort(entries.begin(), entries.end());
+        Header header;
+        memcpy(header.magic, "DZIX", 4);
+        header.width = layout.width;
+        header.height = layout.height;
+        header.tile_size = layout.tile_size;
+        header.overlap = layout.overlap;
+        header.background = background;
+        header.count = static_cast<uint32_t>(entries.size());
+        FILE *file = fopen(filename.c_str(), "wb");
+        if (!file)
+            return 1;
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        if (!entries.empty())
+            ok = ok && fwrite(entries.data(), sizeof(DziIndexEntry), entries.size(), file) == entries.size();
+        return (fclose(file) == 0 && ok) ? 0 : 1;
+    }
+
+    int load(const std::string &filename)
+    {
+        FILE *file = fopen(filename.c_str(), "rb");
+        if (!file)
+            return 1;
+        Header header;
+        bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "DZIX", 4) == 0 &&
+                  header.version == 1;
+        if (ok)
+        {
+            layout = DziLayout(header.width, header.height, header.tile_size, header.overlap);
+            background = header.background;
+            entries.resize(header.count);
+            if (header.count)
+                ok = fread(entries.data(), sizeof(DziIndexEntry), header.count, file) == header.count;
+        }
+        fclose(file);
+        return ok ? 0 : 1;
+    }
+
+    /** The entry of a tile, nullptr if the tile is background. */
+    const DziIndexEntry *find(uint32_t level, uint32_t column, uint32_t row) const
+    {
+        DziIndexEntry key = {level, row, column, 0};
+        auto it = std::lower_bound(entries.begin(), entries.end(), key);
+        if (it == entries.end() || it->level != level || it->row != row || it->column != column)
+            return nullptr;
+        return &*it;
+    }
+
+  private:
+    // little endian on the platforms the samples support
+    struct Header
+    {
+        char magic[4];
+        uint32_t version = 1;
+        uint32_t width, height, tile_size, overlap;
+        uint32_t background;   // sample value of the tiles that are not written
+        uint32_t count;
+    };
+};
+
+// <name>.dzi, the descriptor read by Deep Zoom viewers
+inline int write_dzi_descriptor(const std::string &filename, const DziLayout &layout)
+{
+    std::ofstream out(filename.c_str());
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"bmp\" Overlap=\""
+        << layout.overlap << "\" TileSize=\"" << layout.tile_size << "\">\n"
+        << "  <Size Width=\"" << layout.width << "\" Height=\"" << layout.height << "\"/>\n"
+        << "</Image>\n";
+    out.close();
+    return out.fail() ? 1 : 0;
+}
+
+// size of a 24 bit BMP as written by ImageWriter::write_bmp
+inline uint32_t dzi_bmp_bytes(uint32_t width, uint32_t height)
+{
+    return 54 + ((width * 3 + 3) & ~3u) * height;
+}
+
+template <typename T>
+class DziLevelWriter
+{
+  public:
+    /**
+     * Writes level `level` of layout into directory dir, which exists.
+     * Samples have `precision` significant bits; with keep_image the whole
+     * level stays in image() after finish().
+     */
+    DziLevelWriter(const DziLayout &layout, uint32_t level, uint32_t num_channels, int precision,
+                   const std::string &dir, int threads, T background, bool keep_image)
+        : layout_(layout), level_(level), channels_((std::min)(num_channels, 4u)), precision_(precision),
+          dir_(dir), threads_((std::max)(threads, 1)), background_(background), keep_image_(keep_image),
+          width_(layout.level_width(level)), height_(layout.level_height(level)), rows_(layout.rows(level))
+    {
+        planes_.resize(channels_);
+    }
+
+    /**
+     * Appends the next `height` rows of the level, channel c starting at
+     * planes[c] with rows pitch elements apart, and writes the tile rows
+     * that are complete. Returns the number of tiles that failed.
+     */
+    int push(const T *const *planes, size_t pitch, uint32_t height)
+    {
+        height = (std::min)(height, height_ - received_);
+        const size_t stored = received_ - base_;
+        for (uint32_t c = 0; c < channels_; c++)
+        {
+            planes_[c].resize((stored + height) * width_);
+            for (uint32_t y = 0; y < height; y++)
+            {
+                memcpy(planes_[c].data() + (stored + y) * width_, planes[c] + y * pitch, width_ * sizeof(T));
+            }
+        }
+        received_ += height;
+
+        int failures = 0;
+        uint32_t y0, y1;
+        while (next_row_ < rows_)
+        {
+            layout_.row_span(level_, next_row_, y0, y1);
+            if (received_ < y1)
+                break;
+            failures += write_row(next_row_, y0, y1);
+            next_row_++;
+            if (!keep_image_ && next_row_ < rows_)
+            {
+                // keep the rows from the start of the next tile row, its top overlap included
+                layout_.row_span(level_, next_row_, y0, y1);
+                drop(y0);
+            }
+        }
+        return failures;
+    }
+
+    bool complete() const { return next_row_ == rows_; }
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+
+    /** The whole level, channel c at image()[c], when kept. */
+    const std::vector<std::vector<T>> &image() const { return planes_; }
+
+    const std::vector<DziIndexEntry> &entries() const { return entries_; }
+    uint64_t written() const { return written_; }
+    uint64_t skipped() const { return skipped_; }
+
+  private:
+    void drop(uint32_t first_row)
+    {
+        if (first_row <= base_)
+            return;
+        const size_t n = first_row - base_;
+        const size_t stored = received_ - base_;
+        for (auto &plane : planes_)
+        {
+            std::copy(plane.begin() + n * width_, plane.begin() + stored * width_, plane.begin());
+            plane.resize((stored - n) * width_);
+        }
+        base_ = first_row;
+    }
+
+    // writes the tiles of one tile row, columns claimed by the threads in turn
+    int write_row(uint32_t row, uint32_t y0, uint32_t y1)
+    {
+        const uint32_t columns = layout_.columns(level_);
+        std::atomic<uint32_t> next_column(0);
+        std::atomic<int> failures(0);
+        std::mutex mutex;
+        auto run = [&]()
+        {
+            std::vector<DziIndexEntry> entries;
+            uint64_t skipped = 0;
+            for (uint32_t column = next_column++; column < columns; column = next_column++)
+            {
+                uint32_t x0, x1;
+                layout_.column_span(level_, column, x0, x1);
+                HostImage<T> tile;
+                for (uint32_t c = 0; c < channels_; c++)
+                {
+                    tile.channel[c] = planes_[c].data() + size_t(y0 - base_) * width_ + x0;
+                    tile.row_stride[c] = width_;
+                }
+                tile.num_channels = channels_;
+                tile.width = x1 - x0;
+                tile.height = y1 - y0;
+                tile.precision = precision_;
+                if (is_background(tile))
+                {
+                    skipped++;
+                    continue;
+                }
+                const std::string filename = dir_ + "/" + std::to_string(column) + "_" + std::to_string(row) + ".bmp";
+                if (thread_image_writer().write_bmp(filename.c_str(), tile))
+                {
+                    failures++;
+                    continue;
+                }
+                entries.push_back({level_, row, column, dzi_bmp_bytes(tile.width, tile.height)});
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            entries_.insert(entries_.end(), entries.begin(), entries.end());
+            written_ += entries.size();
+            skipped_ += skipped;
+        };
+        const uint32_t num_threads = (std::min)(static_cast<uint32_t>(threads_), columns);
+        std::vector<std::thread> threads;
+        for (uint32_t t = 1; t < num_threads; t++)
+            threads.emplace_back(run);
+        run();
+        for (auto &thread : threads)
+            thread.join();
+        return failures;
+    }
+
+    bool is_background(const HostImage<T> &tile) const
+    {
+        for (int c = 0; c < tile.num_channels; c++)
+        {
+            for (int y = 0; y < tile.height; y++)
+            {
+                const T *p = tile.row(c, y);
+                for (int x = 0; x < tile.width; x++)
+                {
+                    if (p[x] != background_)
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    DziLayout layout_;
+    uint32_t level_;
+    uint32_t channels_;
+    int precision_;
+    std::string dir_;
+    int threads_;
+    T background_;
+    bool keep_image_;
+    uint32_t width_, height_, rows_;
+    std::vector<std::vector<T>> planes_;   // rows [base_, received_) of the level
+    uint32_t base_ = 0;
+    uint32_t received_ = 0;
+    uint32_t next_row_ = 0;
+    std::vector<DziIndexEntry> entries_;
+    uint64_t written_ = 0;
+    uint64_t skipped_ = 0;
+};
+
+// 2x2 box filter of a planar image; a last odd row or column averages the
+// samples that exist
+template <typename T>
+void dzi_downsample(const std::vector<std::vector<T>> &src, uint32_t width, uint32_t height,
+                    std::vector<std::vector<T>> &dst)
+{
+    const uint32_t w = (width + 1) / 2, h = (height + 1) / 2;
+    dst.resize(src.size());
+    for (size_t c = 0; c < src.size(); c++)
+    {
+        dst[c].resize(size_t(w) * h);
+        for (uint32_t y = 0; y < h; y++)
+        {
+            const uint32_t sy0 = 2 * y, sy1 = (std::min)(2 * y + 1, height - 1);
+            for (uint32_t x = 0; x < w; x++)
+            {
+                const uint32_t sx0 = 2 * x, sx1 = (std::min)(2 * x + 1, width - 1);
+                const uint32_t n = (sy1 - sy0 + 1) * (sx1 - sx0 + 1);
+                uint32_t sum = src[c][size_t(sy0) * width + sx0];
+                if (sx1 != sx0)
+                    sum += src[c][size_t(sy0) * width + sx1];
+                if (sy1 != sy0)
+                {
+                    sum += src[c][size_t(sy1) * width + sx0];
+                    if (sx1 != sx0)
+                        sum += src[c][size_t(sy1) * width + sx1];
+                }
+                dst[c][size_t(y) * w + x] = static_cast<T>((sum + n / 2) / n);
+            }
+        }
+    }
+}
+
+// The levels of one image: begin_level() for every level decoded from the
+// codestream, highest first, the last one with keep_image, then finish()
+// writes the levels below it by downsampling, the descriptor and the index.
+template <typename T>
+class DziPyramidWriter
+{
+  public:
+    DziPyramidWriter(const std::string &output_dir, const std::string &name, const DziLayout &layout,
+                     uint32_t num_channels, int precision, int threads, T background)
+        : base_(output_dir + "/" + name), layout_(layout), channels_(num_channels), precision_(precision),
+          threads_(threads), background_(background)
+    {
+        index_.layout = layout;
+        index_.background = background;
+    }
+
+    /** Creates <name>_files and the directory of the level; nullptr on failure. */
+    DziLevelWriter<T> *begin_level(uint32_t level, bool keep_image)
+    {
+        end_level();
+        const std::string dir = base_ + "_files/" + std::to_string(level);
+        if (dzi_make_dir(base_ + "_files") || dzi_make_dir(dir))
+        {
+            std::cerr << "Cannot create directory " << dir << std::endl;
+            return nullptr;
+        }
+        level_.reset(new DziLevelWriter<T>(layout_, level, channels_, precision_, dir, threads_, background_, keep_image));
+        lowest_ = level;
+        return level_.get();
+    }
+
+    /** Writes the levels below the last one begun, the descriptor and the index. */
+    int finish()
+    {
+        if (!level_ || !level_->complete())
+        {
+            std::cerr << "Pyramid level " << lowest_ << " is incomplete" << std::endl;
+            return 1;
+        }
+        std::vector<std::vector<T>> image = level_->image(), smaller;
+        uint32_t width = level_->width(), height = level_->height();
+        if (lowest_ > 0 && (image.empty() || image[0].size() != size_t(width) * height))
+        {
+            std::cerr << "Pyramid level " << lowest_ << " was not kept for the levels below" << std::endl;
+            return 1;
+        }
+        end_level();
+        int failures = 0;
+        for (uint32_t level = lowest_; level-- > 0;)
+        {
+            dzi_downsample(image, width, height, smaller);
+            image.swap(smaller);
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+            DziLevelWriter<T> *writer = begin_level(level, false);
+            if (!writer)
+                return 1;
+            std::vector<const T *> planes;
+            for (auto &plane : image)
+                planes.push_back(plane.data());
+            failures += writer->push(planes.data(), width, height);
+            end_level();
+        }
+        if (failures)
+            return 1;
+        if (write_dzi_descriptor(base_ + ".dzi", layout_) || index_.save(base_ + "_files/index.bin"))
+        {
+            std::cerr << "Cannot write " << base_ << ".dzi" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    uint64_t written() const { return written_; }
+    uint64_t skipped() const { return skipped_; }
+    uint64_t bytes() const
+    {
+        uint64_t sum = 0;
+        for (const auto &e : index_.entries)
+            sum += e.bytes;
+        return sum;
+    }
+
+  private:
+    void end_level()
+    {
+        if (!level_)
+            return;
+        index_.add(level_->entries());
+        written_ += level_->written();
+        skipped_ += level_->skipped();
+        level_.reset();
+    }
+
+    std::string base_;
+    DziLayout layout_;
+    uint32_t channels_;
+    int precision_;
+    int threads_;
+    T background_;
+    DziIndex index_;
+    std::unique_ptr<DziLevelWriter<T>> level_;
+    uint32_t lowest_ = 0;
+    uint64_t written_ = 0;
+    uint64_t skipped_ = 0;
+};
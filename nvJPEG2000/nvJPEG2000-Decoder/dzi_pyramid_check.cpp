@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// CPU-only check of the DZI pyramid writer (dzi_pyramid.h).
+//
+// Synthetic 8 bit RGB and 12 bit gray images with white background areas
+// stand in for decoded codestreams: their resolutions are made by 2x2
+// averaging and pushed to the writer in bands of random height, as the
+// sample pushes rows of codestream tiles. Every tile of every level is then
+// looked up in the index and compared with the reference image, background
+// tiles must be missing and all other tiles must be on disk. Finally the
+// time to write the pyramid of a larger image is measured for 1 and for n
+// writer threads.
+//
+// The pyramids go to a scratch directory under the system temp directory
+// that is removed when the check passes; -o keeps them in output_dir.
+//
+// Build: g++ -O2 -std=c++17 -pthread dzi_pyramid_check.cpp -o dzi_pyramid_check
+// Usage: ./dzi_pyramid_check [-o output_dir] [-j threads] [-tile size] [-overlap pixels]
+
+#include "dzi_pyramid.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+
+struct check_params_t
+{
+    std::string output_dir = (std::filesystem::temp_directory_path() / "dzi_pyramid_check").string();
+    bool keep_output = false;
+    int threads = 4;
+    uint32_t tile_size = 254;
+    uint32_t overlap = 1;
+};
+
+typedef std::vector<std::vector<unsigned short>> Planes;
+
+// tissue-like blobs with texture on a white background
+static Planes make_image(uint32_t width, uint32_t height, uint32_t channels, unsigned short white, std::mt19937 &rng)
+{
+    Planes planes(channels, std::vector<unsigned short>(size_t(width) * height, white));
+    std::uniform_real_distribution<double> u(0, 1);
+    for (int blob = 0; blob < 6; blob++)
+    {
+        const double cx = u(rng) * width, cy = u(rng) * height, r = (0.05 + 0.15 * u(rng)) * std::max(width, height);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                const double dx = x - cx, dy = y - cy;
+                if (dx * dx + dy * dy > r * r)
+                    continue;
+                for (uint32_t c = 0; c < channels; c++)
+                {
+                    planes[c][size_t(y) * width + x] =
+                        static_cast<unsigned short>((x * (3 + c) + y * (5 + 2 * c) + blob * 37) % (white + 1) * 0.8);
+                }
+            }
+        }
+    }
+    return planes;
+}
+
+template <typename T>
+static std::vector<std::vector<T>> convert(const Planes &planes)
+{
+    std::vector<std::vector<T>> out(planes.size());
+    for (size_t c = 0; c < planes.size(); c++)
+        out[c].assign(planes[c].begin(), planes[c].end());
+    return out;
+}
+
+static bool read_bmp(const std::string &filename, uint32_t &width, uint32_t &height, std::vector<unsigned char> &bgr)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file)
+        return false;
+    unsigned char header[54];
+    bool ok = fread(header, 1, 54, file) == 54 && header[0] == 'B' && header[1] == 'M';
+    if (ok)
+    {
+        memcpy(&width, header + 18, 4);
+        memcpy(&height, header + 22, 4);
+        const size_t row_bytes = (width * 3 + 3) & ~3u;
+        std::vector<unsigned char> rows(row_bytes * height);
+        ok = fread(rows.data(), 1, rows.size(), file) == rows.size();
+        bgr.resize(size_t(width) * height * 3);
+        for (uint32_t y = 0; y < height && ok; y++)
+            memcpy(bgr.data() + size_t(y) * width * 3, rows.data() + (height - 1 - y) * row_bytes, width * 3);
+    }
+    fclose(file);
+    return ok;
+}
+
+// ImageWriter's rounding of `precision` bit samples to 8 bits
+static unsigned char to_8bit(unsigned int v, int precision)
+{
+    const int shift = precision - 8;
+    if (shift > 0)
+        v = (v >> shift) + ((v >> (shift - 1)) & 1);
+    return v > 255 ? 255 : static_cast<unsigned char>(v);
+}
+
+// writes the pyramid of image, with `native` levels pushed in bands and the rest downsampled
+template <typename T>
+static int write_pyramid(const std::string &name, const check_params_t &params, const std::vector<std::vector<T>> &image,
+                         uint32_t width, uint32_t height, int precision, uint32_t native, T white, std::mt19937 &rng,
+                         uint64_t &written, uint64_t &skipped)
+{
+    DziLayout layout(width, height, params.tile_size, params.overlap);
+    DziPyramidWriter<T> pyramid(params.output_dir, name, layout, static_cast<uint32_t>(image.size()), precision,
+                                params.threads, white);
+    std::vector<std::vector<T>> level_image = image, smaller;
+    std::uniform_int_distribution<uint32_t> band(1, 700);
+    native = std::min(native, layout.max_level() + 1);
+    for (uint32_t r = 0; r < native; r++)
+    {
+        if (r > 0)
+        {
+            dzi_downsample(level_image, DziLayout::reduce(width, r - 1), DziLayout::reduce(height, r - 1), smaller);
+            level_image.swap(smaller);
+        }
+        DziLevelWriter<T> *writer = pyramid.begin_level(layout.max_level() - r, r == native - 1);
+        if (!writer)
+            return 1;
+        const uint32_t w = writer->width();
+        for (uint32_t y = 0; y < writer->height();)
+        {
+            const uint32_t rows = std::min(band(rng), writer->height() - y);
+            std::vector<const T *> planes;
+            for (auto &plane : level_image)
+                planes.push_back(plane.data() + size_t(y) * w);
+            if (writer->push(planes.data(), w, rows))
+                return 1;
+            y += rows;
+        }
+    }
+    const int err = pyramid.finish();
+    written = pyramid.written();
+    skipped = pyramid.skipped();
+    return err;
+}
+
+template <typename T>
+static int check_pyramid(const std::string &name, const check_params_t &params, uint32_t width, uint32_t height,
+                         uint32_t channels, int precision, uint32_t native, std::mt19937 &rng)
+{
+    const T white = static_cast<T>((1u << precision) - 1);
+    const std::vector<std::vector<T>> image = convert<T>(make_image(width, height, channels, white, rng));
+    uint64_t written = 0, skipped = 0;
+    if (write_pyramid(name, params, image, width, height, precision, native, white, rng, written, skipped))
+    {
+        printf("FAILED: %s, writing the pyramid\n", name.c_str());
+        return 1;
+    }
+
+    DziIndex index;
+    const std::string base = params.output_dir + "/" + name;
+    if (index.load(base + "_files/index.bin") || index.layout.width != width || index.layout.height != height)
+    {
+        printf("FAILED: %s, reading the index\n", name.c_str());
+        return 1;
+    }
+    std::ifstream dzi(base + ".dzi");
+    std::string descriptor((std::istreambuf_iterator<char>(dzi)), std::istreambuf_iterator<char>());
+    if (descriptor.find("Width=\"" + std::to_string(width) + "\"") == std::string::npos ||
+        descriptor.find("TileSize=\"" + std::to_string(params.tile_size) + "\"") == std::string::npos)
+    {
+        printf("FAILED: %s, descriptor\n", name.c_str());
+        return 1;
+    }
+
+    const DziLayout &layout = index.layout;
+    std::vector<std::vector<T>> level_image = image, smaller;
+    uint64_t tiles = 0, found = 0;
+    std::vector<unsigned char> bgr;
+    for (uint32_t level = layout.max_level() + 1; level-- > 0;)
+    {
+        const uint32_t r = layout.max_level() - level;
+        if (r > 0)
+        {
+            dzi_downsample(level_image, DziLayout::reduce(width, r - 1), DziLayout::reduce(height, r - 1), smaller);
+            level_image.swap(smaller);
+        }
+        const uint32_t lw = layout.level_width(level);
+        for (uint32_t row = 0; row < layout.rows(level); row++)
+        {
+            for (uint32_t column = 0; column < layout.columns(level); column++)
+            {
+                tiles++;
+                uint32_t x0, x1, y0, y1;
+                layout.column_span(level, column, x0, x1);
+                layout.row_span(level, row, y0, y1);
+                const DziIndexEntry *entry = index.find(level, column, row);
+                const std::string filename = base + "_files/" + std::to_string(level) + "/" + std::to_string(column) +
+                                             "_" + std::to_string(row) + ".bmp";
+                bool background = true;
+                for (uint32_t y = y0; y < y1; y++)
+                    for (uint32_t x = x0; x < x1; x++)
+                        for (uint32_t c = 0; c < channels; c++)
+                            background = background && level_image[c][size_t(y) * lw + x] == white;
+                if (!entry)
+                {
+                    if (!background)
+                    {
+                        printf("FAILED: %s, tile %u/%u_%u missing from the index\n", name.c_str(), level, column, row);
+                        return 1;
+                    }
+                    continue;
+                }
+                found++;
+                uint32_t tw = 0, th = 0;
+                if (background || !read_bmp(filename, tw, th, bgr) || tw != x1 - x0 || th != y1 - y0 ||
+                    entry->bytes != dzi_bmp_bytes(tw, th))
+                {
+                    printf("FAILED: %s, tile %u/%u_%u\n", name.c_str(), level, column, row);
+                    return 1;
+                }
+                for (uint32_t y = y0; y < y1; y++)
+                {
+                    for (uint32_t x = x0; x < x1; x++)
+                    {
+                        const unsigned char *px = bgr.data() + (size_t(y - y0) * tw + (x - x0)) * 3;
+                        for (uint32_t c = 0; c < 3; c++)
+                        {
+                            const uint32_t channel = channels >= 3 ? c : 0;
+                            if (px[2 - c] != to_8bit(level_image[channel][size_t(y) * lw + x], precision))
+                            {
+                                printf("FAILED: %s, tile %u/%u_%u differs at %u,%u\n", name.c_str(), level, column,
+                                       row, x, y);
+                                return 1;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf("%s: %ux%u, %u levels (%u native), %llu tiles, %llu written, %llu background\n", name.c_str(), width,
+           height, layout.max_level() + 1, std::min(native, layout.max_level() + 1), (unsigned long long)tiles,
+           (unsigned long long)found, (unsigned long long)skipped);
+    if (found != written || found + skipped != tiles)
+    {
+        printf("FAILED: %s, tile count\n", name.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    check_params_t params;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-h") == 0)
+        {
+            printf("Usage: %s [-o output_dir] [-j threads] [-tile size] [-overlap pixels]\n", argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (i + 1 >= argc)
+            break;
+        if (strcmp(argv[i], "-o") == 0)
+        {
+            params.output_dir = argv[++i];
+            params.keep_output = true;
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+            params.threads = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-tile") == 0)
+            params.tile_size = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-overlap") == 0)
+            params.overlap = atoi(argv[++i]);
+    }
+    if (dzi_make_dir(params.output_dir))
+    {
+        printf("Cannot create %s\n", params.output_dir.c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937 rng(3);
+    int failures = 0;
+    failures += check_pyramid<unsigned char>("rgb8", params, 2999, 2101, 3, 8, 6, rng);
+    failures += check_pyramid<unsigned short>("gray12", params, 1025, 4097, 1, 12, 3, rng);
+    failures += check_pyramid<unsigned char>("tiny", params, 3, 1, 3, 8, 6, rng);
+
+    // writer throughput, 1 and n threads
+    const uint32_t width = 8192, height = 6144;
+    const std::vector<std::vector<unsigned char>> image = convert<unsigned char>(make_image(width, height, 3, 255, rng));
+    printf("%8s %12s %10s\n", "threads", "seconds", "tiles/s");
+    for (int threads : {1, params.threads})
+    {
+        check_params_t p = params;
+        p.threads = threads;
+        uint64_t written = 0, skipped = 0;
+        auto start = std::chrono::steady_clock::now();
+        failures += write_pyramid<unsigned char>("timing", p, image, width, height, 8, 6, 255, rng, written, skipped);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%8d %12.3f %10.0f\n", threads, seconds, written / seconds);
+    }
+    if (failures)
+        printf("pyramids left in %s\n", params.output_dir.c_str());
+    else if (!params.keep_output)
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(params.output_dir, ec);
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -134,6 +134,149 @@ int allocate_output_buffers(nvjpeg2kImage_t& output_image, nvjpeg2kImageInfo_t&
     return EXIT_SUCCESS;
 }
 
+// Get the file name, without directory and extension.
+std::string image_base_name(const std::string &filename)
+{
+    size_t position = filename.rfind(separator);
+    std::string name = (std::string::npos == position) ? filename : filename.substr(position + 1);
+    position = name.rfind(".");
+    return (std::string::npos == position) ? name : name.substr(0, position);
+}
+
+// Decodes the parsed image at each of its resolutions, one row of codestream tiles at a time,
+// and writes the levels as a DZI tile pyramid. Two bands alternate, so the GPU decodes the next
+// row of tiles while the previous one is written out.
+template <typename T>
+int decode_pyramid(const std::string &filename, decode_params_t &params, nvjpeg2kDecodeParams_t decode_params,
+    const nvjpeg2kImageInfo_t &image_info, uint8_t precision, nvjpeg2kImageType_t pixel_type, double &time)
+{
+    double start = Wtime();
+    const uint32_t num_comps = image_info.num_components;
+    const uint32_t width = image_info.image_width;
+    const uint32_t height = image_info.image_height;
+    const uint32_t tile_w = image_info.tile_width;
+    const uint32_t tile_h = image_info.tile_height;
+    const uint32_t tiles_x = (width + tile_w - 1) / tile_w;
+    const uint32_t tiles_y = (height + tile_h - 1) / tile_h;
+    if (num_comps > 4)
+    {
+        std::cout << "Pyramid output supports up to 4 components" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    uint32_t num_resolutions = 0;
+    CHECK_NVJPEG2K(nvjpeg2kStreamGetResolutionsInTile(params.jpeg2k_stream, 0, &num_resolutions));
+    DziLayout layout(width, height, params.dzi_tile_size, params.dzi_overlap);
+    const uint32_t native = (std::min)(num_resolutions, layout.max_level() + 1);
+    const T white = static_cast<T>((1u << precision) - 1);
+    DziPyramidWriter<T> pyramid(params.pyramid_dir, image_base_name(filename), layout, num_comps, precision,
+        params.pyramid_threads, white);
+
+    // one row of codestream tiles at full resolution, components one after the other
+    const size_t band_elements = (size_t)width * tile_h;
+    T *d_band[2];
+    T *h_band[2];
+    cudaEvent_t band_ready[2];
+    for (int b = 0; b < 2; b++)
+    {
+        CHECK_CUDA(cudaMalloc((void**)&d_band[b], band_elements * num_comps * sizeof(T)));
+        CHECK_CUDA(cudaMallocHost((void**)&h_band[b], band_elements * num_comps * sizeof(T)));
+        CHECK_CUDA(cudaEventCreateWithFlags(&band_ready[b], cudaEventDisableTiming));
+    }
+
+    // decodes the tiles of tile row ty, reduced r times, and copies them to the host
+    auto issue_band = [&](int b, uint32_t r, uint32_t ty) -> int
+    {
+        const uint32_t level_width = DziLayout::reduce(width, r);
+        const uint32_t rows = DziLayout::reduce((std::min)((ty + 1) * tile_h, height), r) - DziLayout::reduce(ty * tile_h, r);
+        void *planes[4];
+        size_t pitches[4];
+        for (uint32_t tx = 0; tx < tiles_x; tx++)
+        {
+            const uint32_t x0 = DziLayout::reduce(tx * tile_w, r);
+            const uint32_t x1 = DziLayout::reduce((std::min)((tx + 1) * tile_w, width), r);
+            if (x0 == x1 || rows == 0)
+            {
+                continue;
+            }
+            const uint32_t tile_id = ty * tiles_x + tx;
+            uint32_t tile_resolutions = 0;
+            CHECK_NVJPEG2K(nvjpeg2kStreamGetResolutionsInTile(params.jpeg2k_stream, tile_id, &tile_resolutions));
+            if (tile_resolutions <= r)
+            {
+                std::cout << "Tile " << tile_id << " has only " << tile_resolutions << " resolutions" << std::endl;
+                return EXIT_FAILURE;
+            }
+            for (uint32_t c = 0; c < num_comps; c++)
+            {
+                planes[c] = d_band[b] + c * band_elements + x0;
+                pitches[c] = level_width * sizeof(T);
+            }
+            nvjpeg2kImage_t tile_out;
+            tile_out.num_components = num_comps;
+            tile_out.pixel_data = planes;
+            tile_out.pitch_in_bytes = pitches;
+            tile_out.pixel_type = pixel_type;
+            CHECK_NVJPEG2K(nvjpeg2kDecodeTile(params.nvjpeg2k_handle, params.nvjpeg2k_decode_state,
+                params.jpeg2k_stream, decode_params, tile_id, tile_resolutions - r, &tile_out, params.stream));
+        }
+        for (uint32_t c = 0; c < num_comps; c++)
+        {
+            CHECK_CUDA(cudaMemcpyAsync(h_band[b] + c * band_elements, d_band[b] + c * band_elements,
+                (size_t)level_width * rows * sizeof(T), cudaMemcpyDeviceToHost, params.stream));
+        }
+        CHECK_CUDA(cudaEventRecord(band_ready[b], params.stream));
+        return EXIT_SUCCESS;
+    };
+
+    int failures = 0;
+    for (uint32_t r = 0; r < native; r++)
+    {
+        // the lowest resolution is kept to downsample the levels below it
+        DziLevelWriter<T> *level = pyramid.begin_level(layout.max_level() - r, r == native - 1);
+        if (!level || issue_band(0, r, 0))
+        {
+            return EXIT_FAILURE;
+        }
+        for (uint32_t ty = 0; ty < tiles_y; ty++)
+        {
+            const int b = ty % 2;
+            if (ty + 1 < tiles_y && issue_band(1 - b, r, ty + 1))
+            {
+                return EXIT_FAILURE;
+            }
+            CHECK_CUDA(cudaEventSynchronize(band_ready[b]));
+            const uint32_t rows = DziLayout::reduce((std::min)((ty + 1) * tile_h, height), r) - DziLayout::reduce(ty * tile_h, r);
+            const T *planes[4];
+            for (uint32_t c = 0; c < num_comps; c++)
+            {
+                planes[c] = h_band[b] + c * band_elements;
+            }
+            failures += level->push(planes, level->width(), rows);
+        }
+    }
+    if (failures || pyramid.finish())
+    {
+        std::cout << "Cannot write the pyramid of " << filename << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (int b = 0; b < 2; b++)
+    {
+        CHECK_CUDA(cudaFree(d_band[b]));
+        CHECK_CUDA(cudaFreeHost(h_band[b]));
+        CHECK_CUDA(cudaEventDestroy(band_ready[b]));
+    }
+    time += Wtime() - start;
+    if (params.verbose)
+    {
+        std::cout << "Pyramid of " << filename << ": " << layout.max_level() + 1 << " levels, " << native
+                  << " decoded, " << pyramid.written() << " tiles written (" << pyramid.bytes() / (1024 * 1024)
+                  << " MiB), " << pyramid.skipped() << " background tiles skipped" << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
 int decode_images(FileNames &current_names, const FileData &img_data, const std::vector<size_t> &img_len,
                   decode_params_t &params, double &time)
 {
@@ -197,6 +340,21 @@ int decode_images(FileNames &current_names, const FileData &img_data, const std:
             return EXIT_FAILURE;
         }
 
+        if (params.pyramid)
+        {
+            int err = output_image.pixel_type == NVJPEG2K_UINT8
+                ? decode_pyramid<unsigned char>(current_names[i], params, decode_params, image_info,
+                    image_comp_info[0].precision, output_image.pixel_type, time)
+                : decode_pyramid<unsigned short>(current_names[i], params, decode_params, image_info,
+                    image_comp_info[0].precision, output_image.pixel_type, time);
+            if (err)
+            {
+                return EXIT_FAILURE;
+            }
+            time += parse_time;
+            continue;
+        }
+
         if(allocate_output_buffers(output_image, image_info, image_comp_info, bytes_per_element, params.rgb_output))
         {
             return EXIT_FAILURE;
@@ -302,7 +460,8 @@ int main(int argc, const char *argv[])
     {
         std::cout << "Usage: " << argv[0]
                   << " -i images_dir [-b batch_size] [-t total_images] "
-                     "[-w warmup_iterations] [-o output_dir] [-v verbose] [-rgb_output]"
+                     "[-w warmup_iterations] [-o output_dir] [-v verbose] [-rgb_output] "
+                     "[-pyramid pyramid_dir] [-tile_size size] [-overlap pixels] [-pyramid_threads n]"
                   << std::endl;
         std::cout << "Parameters: " << std::endl;
         std::cout << "\timages_dir\t:\tPath to single image or directory of images"
@@ -323,6 +482,13 @@ int main(int argc, const char *argv[])
         std::cout << "\trgb_output\t:\tUse this flag when decoding images with 420/422 subsampling"<<std::endl
                   << "\t\t\t\tsuch that the nvJPEG2000 library generates RGB output"
                   << std::endl;
+        std::cout << "\tpyramid_dir\t:\tWrite a DZI tile pyramid of each image, from its resolution levels,"<<std::endl
+                  << "\t\t\t\tto this directory instead of decoding the full image"
+                  << std::endl;
+        std::cout << "\tsize, pixels\t:\tPyramid tile size (default 254) and overlap (default 1)"
+                  << std::endl;
+        std::cout << "\tn\t\t:\tThreads writing pyramid tiles (default: all cores)"
+                  << std::endl;
         std::cout << "\tverbose\t\t:\tLog verbose messages to console"
                   << std::endl;
         return EXIT_SUCCESS;
@@ -383,6 +549,35 @@ int main(int argc, const char *argv[])
         params.rgb_output = 1;
     }
 
+    params.pyramid = false;
+    if ((pidx = findParamIndex(argv, argc, "-pyramid")) != -1)
+    {
+        params.pyramid_dir = argv[pidx + 1];
+        params.pyramid = true;
+        // pyramid levels need all components at the same size
+        params.rgb_output = 1;
+        if (dzi_make_dir(params.pyramid_dir))
+        {
+            std::cout << "Cannot create directory " << params.pyramid_dir << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    params.dzi_tile_size = 254;
+    if ((pidx = findParamIndex(argv, argc, "-tile_size")) != -1)
+    {
+        params.dzi_tile_size = (std::max)(1, std::atoi(argv[pidx + 1]));
+    }
+    params.dzi_overlap = 1;
+    if ((pidx = findParamIndex(argv, argc, "-overlap")) != -1)
+    {
+        params.dzi_overlap = (std::max)(0, std::atoi(argv[pidx + 1]));
+    }
+    params.pyramid_threads = (std::max)(1u, std::thread::hardware_concurrency());
+    if ((pidx = findParamIndex(argv, argc, "-pyramid_threads")) != -1)
+    {
+        params.pyramid_threads = (std::max)(1, std::atoi(argv[pidx + 1]));
+    }
+
     if(params.verbose)
     {
         if(params.write_decoded)
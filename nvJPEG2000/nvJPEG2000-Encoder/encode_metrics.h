@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+// Per-image quality and size metrics of the JPEG 2000 encode sample.
+//
+// PsnrAccumulator sums the squared error of decoded components against the
+// source; the peak is the largest sample value at the source precision.
+// EncodeCsv writes one row per encoded image, so that target_psnr, the code
+// block size and the wavelet can be tuned against the bitrate and the
+// throughput of a run.
+//
+// Only host code is used (see encode_metrics_check.cpp).
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <string>
+
+class PsnrAccumulator
+{
+  public:
+    explicit PsnrAccumulator(int precision) : precision_(precision) {}
+
+    /** Adds a width x height component, rows pitch_in_bytes apart. */
+    template <typename T>
+    void add(const void *reference, size_t reference_pitch, const void *decoded, size_t decoded_pitch,
+             uint32_t width, uint32_t height)
+    {
+        for (uint32_t y = 0; y < height; y++)
+        {
+            const T *r = reinterpret_cast<const T *>(static_cast<const unsigned char *>(reference) + y * reference_pitch);
+            const T *d = reinterpret_cast<const T *>(static_cast<const unsigned char *>(decoded) + y * decoded_pitch);
+            uint64_t row = 0;
+            for (uint32_t x = 0; x < width; x++)
+            {
+                const int64_t e = static_cast<int64_t>(r[x]) - static_cast<int64_t>(d[x]);
+                row += static_cast<uint64_t>(e * e);
+            }
+            sse_ += static_cast<double>(row);
+        }
+        samples_ += uint64_t(width) * height;
+    }
+
+    double mse() const { return samples_ ? sse_ / samples_ : 0; }
+
+    /** PSNR in dB over all components added, infinity when lossless. */
+    double psnr() const
+    {
+        if (sse_ == 0)
+            return std::numeric_limits<double>::infinity();
+        const double peak = static_cast<double>((uint32_t(1) << precision_) - 1);
+        return 10.0 * std::log10(peak * peak / mse());
+    }
+
+  private:
+    int precision_;
+    double sse_ = 0;
+    uint64_t samples_ = 0;
+};
+
+struct EncodeRecord
+{
+    std::string file;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t components = 0;
+    int precision = 8;
+    double target_psnr = 0;
+    int irreversible = 0;
+    int code_block = 64;
+    size_t raw_bytes = 0;     // all source components
+    size_t bytes = 0;         // bitstream
+    double psnr = 0;          // NaN when not measured
+    double latency = 0;       // seconds of the encode on its stream (CUDA events around it)
+};
+
+class EncodeCsv
+{
+  public:
+    int open(const std::string &filename)
+    {
+        out_.open(filename.c_str());
+        if (!out_)
+            return 1;
+        out_ << "file,width,height,components,precision,target_psnr,irreversible,code_block,"
+                "bytes,bits_per_pixel,compression_ratio,psnr_db,latency_ms\n";
+        return 0;
+    }
+
+    bool is_open() const { return out_.is_open(); }
+
+    void close() { out_.close(); }
+
+    int write(const EncodeRecord &r)
+    {
+        const double pixels = double(r.width) * r.height;
+        char line[512];
+        snprintf(line, sizeof(line), ",%u,%u,%u,%d,%g,%d,%d,%zu,%.4f,%.3f,%s,%.3f\n", r.width, r.height,
+                 r.components, r.precision, r.target_psnr, r.irreversible, r.code_block, r.bytes,
+                 pixels > 0 ? r.bytes * 8.0 / pixels : 0.0, r.bytes ? double(r.raw_bytes) / r.bytes : 0.0,
+                 format_psnr(r.psnr).c_str(), r.latency * 1e3);
+        out_ << quote(r.file) << line;
+        return out_ ? 0 : 1;
+    }
+
+    static std::string format_psnr(double psnr)
+    {
+        if (std::isnan(psnr))
+            return "";
+        if (std::isinf(psnr))
+            return "inf";
+        char s[32];
+        snprintf(s, sizeof(s), "%.3f", psnr);
+        return s;
+    }
+
+  private:
+    static std::string quote(const std::string &s)
+    {
+        if (s.find_first_of(",\"\n") == std::string::npos)
+            return s;
+        std::string q = "\"";
+        for (char c : s)
+        {
+            if (c == '"')
+                q += '"';
+            q += c;
+        }
+        return q + "\"";
+    }
+
+    std::ofstream out_;
+};
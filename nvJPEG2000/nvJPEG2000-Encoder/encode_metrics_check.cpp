@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2023, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+// CPU-only check of the per-image metrics of the encode sample
+// (encode_metrics.h).
+//
+// PSNR is checked against closed forms: identical images give infinity, a
+// constant error e on 8 bit samples gives 20 log10(255 / e), and 16 bit
+// samples use the peak of their precision. Padding beyond the component
+// width must be ignored. The CSV rows are read back and compared field by
+// field; they go to a file in the system temp directory that is removed when
+// the check passes, -csv keeps them in the given file.
+//
+// Build: g++ -O2 -std=c++17 encode_metrics_check.cpp -o encode_metrics_check
+// Usage: ./encode_metrics_check [-csv file]
+
+#include "encode_metrics.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+#include <vector>
+
+static int failures = 0;
+
+static void expect_near(const char *name, double value, double expected)
+{
+    const bool ok = std::isinf(expected) ? value == expected : std::fabs(value - expected) < 1e-9;
+    printf("%-32s %12.6f %12.6f %s\n", name, value, expected, ok ? "" : "FAILED");
+    if (!ok)
+        failures++;
+}
+
+template <typename T>
+static double psnr_of(int precision, uint32_t width, uint32_t height, uint32_t pitch, T value, T error)
+{
+    // rows carry pitch - width samples of padding that differ wildly
+    std::vector<T> reference(size_t(pitch) * height, value), decoded(size_t(pitch) * height, 0);
+    for (uint32_t y = 0; y < height; y++)
+        for (uint32_t x = 0; x < width; x++)
+            decoded[size_t(y) * pitch + x] = static_cast<T>(value - error);
+    PsnrAccumulator accumulator(precision);
+    accumulator.add<T>(reference.data(), pitch * sizeof(T), decoded.data(), pitch * sizeof(T), width, height);
+    return accumulator.psnr();
+}
+
+int main(int argc, const char *argv[])
+{
+    std::string csv_file = (std::filesystem::temp_directory_path() / "encode_metrics_check.csv").string();
+    bool keep_csv = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-h") == 0)
+        {
+            printf("Usage: %s [-csv file]\n", argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc)
+        {
+            csv_file = argv[++i];
+            keep_csv = true;
+        }
+    }
+
+    printf("%-32s %12s %12s\n", "case", "psnr", "expected");
+    expect_near("identical", psnr_of<uint8_t>(8, 64, 32, 64, 200, 0), std::numeric_limits<double>::infinity());
+    expect_near("8 bit, error 1", psnr_of<uint8_t>(8, 64, 32, 64, 200, 1), 20 * std::log10(255.0));
+    expect_near("8 bit, error 5, padded rows", psnr_of<uint8_t>(8, 61, 7, 80, 200, 5), 20 * std::log10(255.0 / 5));
+    expect_near("12 bit, error 3", psnr_of<uint16_t>(12, 33, 17, 40, 3000, 3), 20 * std::log10(4095.0 / 3));
+    expect_near("16 bit, error 100", psnr_of<uint16_t>(16, 16, 16, 16, 60000, 100), 20 * std::log10(65535.0 / 100));
+
+    // a component with error 2 and a lossless one: MSE is 2 over both
+    {
+        std::vector<uint8_t> a(16 * 16, 100), b(16 * 16, 98), c(8 * 8, 50);
+        PsnrAccumulator accumulator(8);
+        accumulator.add<uint8_t>(a.data(), 16, b.data(), 16, 16, 16);
+        accumulator.add<uint8_t>(c.data(), 8, c.data(), 8, 8, 8);
+        expect_near("two components, mse", accumulator.mse(), 4.0 * 256 / (256 + 64));
+    }
+
+    EncodeCsv csv;
+    if (csv.open(csv_file))
+    {
+        printf("Cannot open %s\n", csv_file.c_str());
+        return EXIT_FAILURE;
+    }
+    EncodeRecord record;
+    record.file = "images/a,b.ppm";
+    record.width = 1920;
+    record.height = 1080;
+    record.components = 3;
+    record.target_psnr = 40;
+    record.irreversible = 1;
+    record.raw_bytes = 1920 * 1080 * 3;
+    record.bytes = 259200;
+    record.psnr = 40.25;
+    record.latency = 0.0125;
+    csv.write(record);
+    record.file = "lossless.pgm";
+    record.psnr = std::numeric_limits<double>::infinity();
+    csv.write(record);
+    record.psnr = std::nan("");
+    csv.write(record);
+    csv.close();
+
+    const char *expected[] = {
+        "file,width,height,components,precision,target_psnr,irreversible,code_block,"
+        "bytes,bits_per_pixel,compression_ratio,psnr_db,latency_ms",
+        "\"images/a,b.ppm\",1920,1080,3,8,40,1,64,259200,1.0000,24.000,40.250,12.500",
+        "lossless.pgm,1920,1080,3,8,40,1,64,259200,1.0000,24.000,inf,12.500",
+        "lossless.pgm,1920,1080,3,8,40,1,64,259200,1.0000,24.000,,12.500",
+    };
+    std::ifstream in(csv_file.c_str());
+    std::string line;
+    for (const char *e : expected)
+    {
+        if (!std::getline(in, line) || line != e)
+        {
+            printf("FAILED: csv line\n  %s\nexpected\n  %s\n", line.c_str(), e);
+            failures++;
+        }
+    }
+    if (std::getline(in, line))
+    {
+        printf("FAILED: unexpected csv line %s\n", line.c_str());
+        failures++;
+    }
+    in.close();
+    printf("csv %s\n", failures ? "FAILED" : "ok");
+    if (failures)
+        printf("csv left in %s\n", csv_file.c_str());
+    else if (!keep_csv)
+        std::remove(csv_file.c_str());
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
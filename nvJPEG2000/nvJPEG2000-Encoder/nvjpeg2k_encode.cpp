@@ -383,80 +383,297 @@ void populate_encoderconfig(nvjpeg2kEncodeConfig_t& enc_config, Image& input_ima
     enc_config.num_resolutions = 6;
 }
 
-int encode_images(Image* input_images, encode_params_t &params, BitStreamData &bitstreams, double &time)
+std::string output_filename(const std::string &input_name, encode_params_t &params)
 {
-    cudaEvent_t startEvent = NULL, stopEvent = NULL;
-    float loopTime = 0;
-    
-    CHECK_CUDA(cudaEventCreateWithFlags(&startEvent, cudaEventBlockingSync));
-    CHECK_CUDA(cudaEventCreateWithFlags(&stopEvent, cudaEventBlockingSync));
-    nvjpeg2kEncodeConfig_t enc_config;
-    size_t bs_sz;
+    // Get the file name, without extension.
+    // This will be used to rename the output file.
+    size_t position = input_name.rfind("/");
+    std::string sFileName =
+        (std::string::npos == position)
+            ? input_name
+            : input_name.substr(position + 1, input_name.size());
 
-    CHECK_CUDA(cudaEventRecord(startEvent, params.stream));
-    for(int batch_id = 0; batch_id < params.batch_size; batch_id++)
+    position = sFileName.rfind(".");
+    sFileName = (std::string::npos == position) ? sFileName
+                                                : sFileName.substr(0, position);
+    const char* wavelet_type []= {"revWavelet","irrevWavelet"};
+    return params.output_dir + "/" + sFileName
+           + "_q" + std::to_string((int)params.target_psnr)
+           + "_"+ wavelet_type[params.irreversible]
+           + "_blksz"+ std::to_string((int)params.cblk_w)+"x"+std::to_string((int)params.cblk_h)
+           +".jp2";
+}
+
+int write_bitstream(const unsigned char *data, size_t size, const std::string &fname)
+{
+    std::ofstream bitstream_file(fname,
+                        std::ios::out | std::ios::binary);
+    if (!(bitstream_file.is_open()))
     {
-        populate_encoderconfig(enc_config, input_images[batch_id], params);
+        std::cout << "Cannot open image: " <<fname<<std::endl;
+        return EXIT_FAILURE;
+    }
+    bitstream_file.write((const char*)data, size);
+    bitstream_file.close();
+    return bitstream_file ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-        CHECK_NVJPEG2K(nvjpeg2kEncodeParamsSetEncodeConfig(params.enc_params, &enc_config));
-        CHECK_NVJPEG2K(nvjpeg2kEncodeParamsSetQuality(params.enc_params, params.target_psnr));
-        CHECK_NVJPEG2K(nvjpeg2kEncode(params.enc_handle, params.enc_state, params.enc_params, 
-            &input_images[batch_id].getImageDevice(), params.stream));
+int create_encode_slots(encode_params_t &params)
+{
+    for (int i = 0; i < params.num_states; i++)
+    {
+        std::unique_ptr<encode_slot_t> slot(new encode_slot_t);
+        CHECK_NVJPEG2K(nvjpeg2kEncodeStateCreate(params.enc_handle, &slot->enc_state));
+        CHECK_NVJPEG2K(nvjpeg2kEncodeParamsCreate(&slot->enc_params));
+        CHECK_CUDA(cudaStreamCreateWithFlags(&slot->stream, cudaStreamNonBlocking));
+        CHECK_CUDA(cudaEventCreate(&slot->issued));
+        CHECK_CUDA(cudaEventCreate(&slot->encoded));
+        params.slots.push_back(std::move(slot));
+    }
+    return EXIT_SUCCESS;
+}
 
-        CHECK_NVJPEG2K(nvjpeg2kEncodeRetrieveBitstream(params.enc_handle, params.enc_state, NULL, &bs_sz, 
-            params.stream));
-        bitstreams[batch_id].resize(bs_sz);
-        CHECK_NVJPEG2K(nvjpeg2kEncodeRetrieveBitstream(params.enc_handle, params.enc_state, bitstreams[batch_id].data(), &bs_sz, 
-            params.stream));
-        CHECK_CUDA(cudaStreamSynchronize(params.stream));
+int destroy_encode_slots(encode_params_t &params)
+{
+    for (auto &slot : params.slots)
+    {
+        for (auto &buffer : slot->buffers)
+        {
+            if (buffer.data)
+            {
+                CHECK_CUDA(cudaFreeHost(buffer.data));
+            }
+        }
+        CHECK_CUDA(cudaEventDestroy(slot->issued));
+        CHECK_CUDA(cudaEventDestroy(slot->encoded));
+        CHECK_CUDA(cudaStreamDestroy(slot->stream));
+        CHECK_NVJPEG2K(nvjpeg2kEncodeParamsDestroy(slot->enc_params));
+        CHECK_NVJPEG2K(nvjpeg2kEncodeStateDestroy(slot->enc_state));
     }
+    params.slots.clear();
+    return EXIT_SUCCESS;
+}
 
-    CHECK_CUDA(cudaEventRecord(stopEvent, params.stream));
-    
-    CHECK_CUDA(cudaEventSynchronize(stopEvent));
-    CHECK_CUDA(cudaEventElapsedTime(&loopTime, startEvent, stopEvent));
-    time += static_cast<double>(loopTime/1000.0); // loopTime is in milliseconds
+int create_psnr_decoder(psnr_decoder_t &decoder)
+{
+    CHECK_NVJPEG2K(nvjpeg2kCreateSimple(&decoder.handle));
+    CHECK_NVJPEG2K(nvjpeg2kDecodeStateCreate(decoder.handle, &decoder.state));
+    CHECK_NVJPEG2K(nvjpeg2kStreamCreate(&decoder.jpeg2k_stream));
+    CHECK_CUDA(cudaStreamCreateWithFlags(&decoder.stream, cudaStreamNonBlocking));
+    return EXIT_SUCCESS;
+}
 
-    CHECK_CUDA(cudaEventDestroy(stopEvent));
-    CHECK_CUDA(cudaEventDestroy(startEvent));
-    
+int destroy_psnr_decoder(psnr_decoder_t &decoder)
+{
+    for (int c = 0; c < MAX_COMPONENTS; c++)
+    {
+        if (decoder.pixel_data_d[c])
+        {
+            CHECK_CUDA(cudaFree(decoder.pixel_data_d[c]));
+        }
+    }
+    CHECK_CUDA(cudaStreamDestroy(decoder.stream));
+    CHECK_NVJPEG2K(nvjpeg2kStreamDestroy(decoder.jpeg2k_stream));
+    CHECK_NVJPEG2K(nvjpeg2kDecodeStateDestroy(decoder.state));
+    CHECK_NVJPEG2K(nvjpeg2kDestroy(decoder.handle));
     return EXIT_SUCCESS;
 }
 
-int write_output(BitStreamData &bitstreams, FileNames &filenames, encode_params_t& params) 
+// Decodes the bitstream and compares it with the source image.
+int measure_psnr(const unsigned char *data, size_t size, Image &source, psnr_decoder_t &decoder, double &psnr)
 {
-    for (int batch_id = 0; batch_id < params.batch_size; batch_id++) 
-    {
-        // Get the file name, without extension.
-        // This will be used to rename the output file.
-        size_t position = filenames[batch_id].rfind("/");
-        std::string sFileName =
-            (std::string::npos == position)
-                ? filenames[batch_id]
-                : filenames[batch_id].substr(position + 1, filenames[batch_id].size());
-
-        position = sFileName.rfind(".");
-        sFileName = (std::string::npos == position) ? sFileName
-                                                    : sFileName.substr(0, position);
-        const char* wavelet_type []= {"revWavelet","irrevWavelet"};
-        std::string fname(params.output_dir + "/" + sFileName 
-                         + "_q" + std::to_string((int)params.target_psnr)
-                         + "_"+ wavelet_type[params.irreversible]
-                         + "_blksz"+ std::to_string((int)params.cblk_w)+"x"+std::to_string((int)params.cblk_h)
-                         +".jp2");
-
-        std::ofstream bitstream_file(fname,
-                            std::ios::out | std::ios::binary);
-        if (!(bitstream_file.is_open()))
-        {
-            std::cout << "Cannot open image: " <<fname<<std::endl;
+    nvjpeg2kImageInfo_t image_info;
+    nvjpeg2kImageComponentInfo_t comp_info[MAX_COMPONENTS];
+    CHECK_NVJPEG2K(nvjpeg2kStreamParse(decoder.handle, data, size, 0, 0, decoder.jpeg2k_stream));
+    CHECK_NVJPEG2K(nvjpeg2kStreamGetImageInfo(decoder.jpeg2k_stream, &image_info));
+    if (image_info.num_components != source.getnvjpeg2kImageInfo().num_components)
+    {
+        std::cout << "Decoded image does not match the source" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    nvjpeg2kImage_t &source_h = source.getImageHost();
+    const size_t bytes_per_sample = source_h.pixel_type == NVJPEG2K_UINT16 ? 2 : 1;
+    void *pixel_data[MAX_COMPONENTS];
+    size_t pitch_in_bytes[MAX_COMPONENTS];
+    for (uint32_t c = 0; c < image_info.num_components; c++)
+    {
+        CHECK_NVJPEG2K(nvjpeg2kStreamGetImageComponentInfo(decoder.jpeg2k_stream, &comp_info[c], c));
+        pitch_in_bytes[c] = comp_info[c].component_width * bytes_per_sample;
+        const size_t comp_size = pitch_in_bytes[c] * comp_info[c].component_height;
+        if (comp_size > decoder.capacity_d[c])
+        {
+            if (decoder.pixel_data_d[c])
+            {
+                CHECK_CUDA(cudaFree(decoder.pixel_data_d[c]));
+            }
+            CHECK_CUDA(cudaMalloc(&decoder.pixel_data_d[c], comp_size));
+            decoder.capacity_d[c] = comp_size;
+        }
+        decoder.pixel_data_h[c].resize(comp_size);
+        pixel_data[c] = decoder.pixel_data_d[c];
+    }
+
+    nvjpeg2kImage_t output_image;
+    output_image.pixel_data = pixel_data;
+    output_image.pitch_in_bytes = pitch_in_bytes;
+    output_image.pixel_type = source_h.pixel_type;
+    output_image.num_components = image_info.num_components;
+    CHECK_NVJPEG2K(nvjpeg2kDecode(decoder.handle, decoder.state, decoder.jpeg2k_stream, &output_image, decoder.stream));
+    for (uint32_t c = 0; c < image_info.num_components; c++)
+    {
+        CHECK_CUDA(cudaMemcpyAsync(decoder.pixel_data_h[c].data(), pixel_data[c], decoder.pixel_data_h[c].size(),
+            cudaMemcpyDeviceToHost, decoder.stream));
+    }
+    CHECK_CUDA(cudaStreamSynchronize(decoder.stream));
+
+    PsnrAccumulator accumulator(source.getnvjpeg2kCompInfo()[0].precision);
+    for (uint32_t c = 0; c < image_info.num_components; c++)
+    {
+        if (bytes_per_sample == 2)
+        {
+            accumulator.add<uint16_t>(source_h.pixel_data[c], source_h.pitch_in_bytes[c], decoder.pixel_data_h[c].data(),
+                pitch_in_bytes[c], comp_info[c].component_width, comp_info[c].component_height);
+        }
+        else
+        {
+            accumulator.add<uint8_t>(source_h.pixel_data[c], source_h.pitch_in_bytes[c], decoder.pixel_data_h[c].data(),
+                pitch_in_bytes[c], comp_info[c].component_width, comp_info[c].component_height);
+        }
+    }
+    psnr = accumulator.psnr();
+    return EXIT_SUCCESS;
+}
+
+// Waits for the encode in flight on the slot, retrieves its bitstream into the
+// next pinned buffer of the slot and hands it to the file writer.
+int retire_slot(encode_slot_t &slot, Image* input_images, FileNames &filenames, encode_params_t &params,
+    double &metrics_time)
+{
+    const int batch_id = slot.batch_id;
+    slot.batch_id = -1;
+
+    size_t bs_sz = 0;
+    CHECK_NVJPEG2K(nvjpeg2kEncodeRetrieveBitstream(params.enc_handle, slot.enc_state, NULL, &bs_sz,
+        slot.stream));
+
+    bitstream_buffer_t &buffer = slot.buffers[slot.next_buffer];
+    slot.next_buffer ^= 1;
+    {
+        std::unique_lock<std::mutex> lock(buffer.mutex);
+        buffer.done.wait(lock, [&buffer] { return !buffer.writing; });
+    }
+    if (bs_sz > buffer.capacity)
+    {
+        if (buffer.data)
+        {
+            CHECK_CUDA(cudaFreeHost(buffer.data));
+        }
+        // leave room for larger bitstreams of the following images
+        buffer.capacity = std::max(bs_sz + bs_sz / 4, size_t(1) << 20);
+        CHECK_CUDA(cudaMallocHost(reinterpret_cast<void **>(&buffer.data), buffer.capacity));
+    }
+    buffer.size = bs_sz;
+    CHECK_NVJPEG2K(nvjpeg2kEncodeRetrieveBitstream(params.enc_handle, slot.enc_state, buffer.data, &bs_sz,
+        slot.stream));
+    CHECK_CUDA(cudaStreamSynchronize(slot.stream));
+    float latency_ms = 0;
+    CHECK_CUDA(cudaEventElapsedTime(&latency_ms, slot.issued, slot.encoded));
+
+    if (params.csv.is_open() && params.record_metrics)
+    {
+        const double start = Wtime();
+        Image &image = input_images[batch_id];
+        EncodeRecord record;
+        record.file = filenames[batch_id];
+        record.width = image.getnvjpeg2kImageInfo().image_width;
+        record.height = image.getnvjpeg2kImageInfo().image_height;
+        record.components = image.getnvjpeg2kImageInfo().num_components;
+        record.precision = image.getnvjpeg2kCompInfo()[0].precision;
+        record.target_psnr = params.target_psnr;
+        record.irreversible = params.irreversible;
+        record.code_block = params.cblk_w;
+        const size_t bytes_per_sample = image.getImageHost().pixel_type == NVJPEG2K_UINT16 ? 2 : 1;
+        for (uint32_t c = 0; c < record.components; c++)
+        {
+            record.raw_bytes += size_t(image.getnvjpeg2kCompInfo()[c].component_width) *
+                image.getnvjpeg2kCompInfo()[c].component_height * bytes_per_sample;
+        }
+        record.bytes = bs_sz;
+        record.latency = latency_ms * 1e-3;
+        if (measure_psnr(buffer.data, bs_sz, image, params.psnr_decoder, record.psnr))
+        {
+            return EXIT_FAILURE;
+        }
+        if (params.csv.write(record))
+        {
+            std::cout << "Cannot write " << params.csv_file << std::endl;
+            return EXIT_FAILURE;
+        }
+        metrics_time += Wtime() - start;
+    }
+
+    if (params.write_bitstream)
+    {
+        {
+            std::lock_guard<std::mutex> lock(buffer.mutex);
+            buffer.writing = true;
+        }
+        std::string fname = output_filename(filenames[batch_id], params);
+        bitstream_buffer_t *pending = &buffer;
+        params.writer->submit([pending, fname](ImageWriter &) {
+            const int err = write_bitstream(pending->data, pending->size, fname);
+            {
+                std::lock_guard<std::mutex> lock(pending->mutex);
+                pending->writing = false;
+            }
+            pending->done.notify_all();
+            return err;
+        });
+    }
+    return EXIT_SUCCESS;
+}
+
+// Encodes the batch round-robin over the encode slots: image i goes to slot
+// i % num_states, whose previous image is retired first, so up to num_states
+// encodes run on the GPU while the host retrieves and writes bitstreams.
+int encode_images(Image* input_images, FileNames &filenames, encode_params_t &params, double &time)
+{
+    nvjpeg2kEncodeConfig_t enc_config;
+    const int num_slots = static_cast<int>(params.slots.size());
+    double metrics_time = 0;
+
+    const double start = Wtime();
+    for(int batch_id = 0; batch_id < params.batch_size; batch_id++)
+    {
+        encode_slot_t &slot = *params.slots[batch_id % num_slots];
+        if (slot.batch_id >= 0 && retire_slot(slot, input_images, filenames, params, metrics_time))
+        {
             return EXIT_FAILURE;
-            
         }
-        bitstream_file.write((char*)bitstreams[batch_id].data(),bitstreams[batch_id].size());
-        bitstream_file.close();
 
+        populate_encoderconfig(enc_config, input_images[batch_id], params);
+
+        CHECK_NVJPEG2K(nvjpeg2kEncodeParamsSetEncodeConfig(slot.enc_params, &enc_config));
+        CHECK_NVJPEG2K(nvjpeg2kEncodeParamsSetQuality(slot.enc_params, params.target_psnr));
+        CHECK_CUDA(cudaEventRecord(slot.issued, slot.stream));
+        CHECK_NVJPEG2K(nvjpeg2kEncode(params.enc_handle, slot.enc_state, slot.enc_params,
+            &input_images[batch_id].getImageDevice(), slot.stream));
+        CHECK_CUDA(cudaEventRecord(slot.encoded, slot.stream));
+        slot.batch_id = batch_id;
     }
+
+    // retire the remaining encodes in the order they were issued
+    for (int i = 0; i < num_slots; i++)
+    {
+        encode_slot_t &slot = *params.slots[(params.batch_size + i) % num_slots];
+        if (slot.batch_id >= 0 && retire_slot(slot, input_images, filenames, params, metrics_time))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    time += Wtime() - start - metrics_time;
+
     return EXIT_SUCCESS;
 }
 
@@ -467,9 +684,19 @@ double process_images(FileNames &image_names, encode_params_t &params,
     // we wrap over image files to process total_images of files
     FileNames::iterator file_iter = image_names.begin();
     
-    BitStreamData bitsteam_output(params.batch_size);
     FileNames current_names(params.batch_size);
-    CHECK_CUDA(cudaStreamCreateWithFlags(&params.stream, cudaStreamNonBlocking));
+    if (create_encode_slots(params))
+    {
+        return EXIT_FAILURE;
+    }
+    if (params.csv.is_open() && create_psnr_decoder(params.psnr_decoder))
+    {
+        return EXIT_FAILURE;
+    }
+    // bitstream files are written on a background thread, at most one
+    // pending write per bitstream buffer
+    AsyncImageWriter writer(2 * params.slots.size());
+    params.writer = &writer;
     int total_processed = 0;
 
     double test_time = 0;
@@ -482,17 +709,11 @@ double process_images(FileNames &image_names, encode_params_t &params,
             return EXIT_FAILURE;
         }
         double time = 0;
-        if(encode_images(input_images.data(), params, bitsteam_output, time))
+        params.record_metrics = warmup >= params.warmup;
+        if(encode_images(input_images.data(), current_names, params, time))
         {
             return EXIT_FAILURE;
         }   
-        if(params.write_bitstream) 
-        {
-            if( write_output(bitsteam_output, current_names, params))
-            {
-                return EXIT_FAILURE;
-            }
-        }
         if (warmup < params.warmup)
         {
             warmup++;
@@ -504,14 +725,27 @@ double process_images(FileNames &image_names, encode_params_t &params,
         }
     }
 
+    if (writer.flush())
+    {
+        std::cout << "Failed to write bitstreams to " << params.output_dir << std::endl;
+        return EXIT_FAILURE;
+    }
+    params.writer = nullptr;
+
     for(auto& img : input_images)
     {
         img.tearDown();
     }
     total = test_time;
 
-    CHECK_CUDA(cudaStreamDestroy(params.stream));
-    
+    if (destroy_encode_slots(params))
+    {
+        return EXIT_FAILURE;
+    }
+    if (params.csv.is_open() && destroy_psnr_decoder(params.psnr_decoder))
+    {
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
@@ -643,7 +877,8 @@ int main(int argc, const char *argv[])
         std::cout << "Usage: " << argv[0]
                   << " -i images_dir [-b batch_size] [-t total_images] "
                   << "[-I] [-cblk cblk_w,cblk_h]"<<std::endl
-                  << "\t[-w warmup_iterations] [-o output_dir] "<<std::endl
+                  << "\t[-w warmup_iterations] [-o output_dir] [-q target_psnr] "
+                  << "[-states num_states] [-csv metrics_file]"<<std::endl
                   << "\t[-img_fmt img_w,img_h,num_comp,precision,chromaformat]"
                   << " (-img_fmt is mandatory for raw yuv files)"<<std::endl
                   << "\teg: for an 8 bit image of size 1920x1080 with 420 subsamling: "
@@ -669,6 +904,13 @@ int main(int argc, const char *argv[])
         std::cout
             << "\toutput_dir\t:\tWrite compressed jpeg 2000 files  to this directory"
             << std::endl;
+        std::cout << "\ttarget_psnr\t:\tTarget PSNR of the encoded images in dB" << std::endl;
+        std::cout << "\tnum_states\t:\tEncode states used round-robin, each with its own "
+                     "stream (default 4)"
+                  << std::endl;
+        std::cout << "\tmetrics_file\t:\tWrite size, bitrate, PSNR and latency of every "
+                     "encoded image to this CSV file"
+                  << std::endl;
         return EXIT_SUCCESS;
     }
 
@@ -744,10 +986,30 @@ int main(int argc, const char *argv[])
         }
     }
 
+    params.num_states = 4;
+    if ((pidx = findParamIndex(argv, argc, "-states")) != -1)
+    {
+        params.num_states = std::atoi(argv[pidx + 1]);
+        if (params.num_states < 1)
+        {
+            std::cout<<"Invalid number of encode states"<<std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    params.writer = nullptr;
+    params.record_metrics = true;
+    if ((pidx = findParamIndex(argv, argc, "-csv")) != -1)
+    {
+        params.csv_file = argv[pidx + 1];
+        if (params.csv.open(params.csv_file))
+        {
+            std::cout << "Cannot open " << params.csv_file << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
 
     CHECK_NVJPEG2K(nvjpeg2kEncoderCreateSimple(&params.enc_handle));
-    CHECK_NVJPEG2K(nvjpeg2kEncodeStateCreate(params.enc_handle, &params.enc_state));
-    CHECK_NVJPEG2K(nvjpeg2kEncodeParamsCreate(&params.enc_params));
 
     // read source images
     FileNames image_names;
@@ -768,7 +1030,7 @@ int main(int argc, const char *argv[])
 
     std::cout << "Encoding images in directory: " << params.input_dir
               << ", total " << params.total_images << ", batchsize "
-              << params.batch_size << std::endl;
+              << params.batch_size << ", encode states " << params.num_states << std::endl;
 
     double total;
     if (process_images(image_names, params, total))
@@ -784,8 +1046,6 @@ int main(int argc, const char *argv[])
                           params.batch_size)
               << std::endl;
 
-    CHECK_NVJPEG2K(nvjpeg2kEncodeParamsDestroy(params.enc_params));
-    CHECK_NVJPEG2K(nvjpeg2kEncodeStateDestroy(params.enc_state));
     CHECK_NVJPEG2K(nvjpeg2kEncoderDestroy(params.enc_handle));
     
     return EXIT_SUCCESS;
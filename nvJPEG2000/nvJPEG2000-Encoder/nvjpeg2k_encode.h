@@ -32,6 +32,9 @@
 #include <vector>
 #include <algorithm>
 #include <cstring>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 
 #if defined(WIN32) || defined(_WIN32) || defined(WIN64) || defined(_WIN64)
 #include <windows.h>
@@ -52,6 +55,9 @@ namespace fs = std::experimental::filesystem::v1;
 #include <cuda_runtime_api.h>
 #include <nvjpeg2k.h>
 
+#include "../../common/image_writer.h"
+#include "encode_metrics.h"
+
 #define CHECK_CUDA(call)                                                                                          \
     {                                                                                                             \
         cudaError_t _e = (call);                                                                                  \
@@ -72,7 +78,6 @@ namespace fs = std::experimental::filesystem::v1;
         }                                                                                                   \
     }
 
-typedef std::vector<std::vector<unsigned char>> BitStreamData;
 typedef std::vector<std::string> FileNames;
 
 constexpr int MAX_COMPONENTS = 4;
@@ -255,6 +260,46 @@ class Image
     }
 };
 
+// Pinned host buffer a bitstream is retrieved into. While `writing` is set,
+// the file writer thread still reads it.
+struct bitstream_buffer_t
+{
+    unsigned char *data = nullptr;
+    size_t capacity = 0;
+    size_t size = 0;
+    bool writing = false;
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+// One encode in flight: an encode state with its own parameters and stream,
+// and two bitstream buffers so that retrieving the next bitstream overlaps
+// writing the previous one. The events around the encode time it on the
+// stream, independently of when the slot is retired.
+struct encode_slot_t
+{
+    nvjpeg2kEncodeState_t enc_state = nullptr;
+    nvjpeg2kEncodeParams_t enc_params = nullptr;
+    cudaStream_t stream = nullptr;
+    bitstream_buffer_t buffers[2];
+    int next_buffer = 0;
+    int batch_id = -1; // image being encoded, -1 when idle
+    cudaEvent_t issued = nullptr;
+    cudaEvent_t encoded = nullptr;
+};
+
+// Decodes encoded bitstreams again to measure their PSNR.
+struct psnr_decoder_t
+{
+    nvjpeg2kHandle_t handle = nullptr;
+    nvjpeg2kDecodeState_t state = nullptr;
+    nvjpeg2kStream_t jpeg2k_stream = nullptr;
+    cudaStream_t stream = nullptr;
+    void *pixel_data_d[MAX_COMPONENTS] = {};
+    size_t capacity_d[MAX_COMPONENTS] = {};
+    std::vector<unsigned char> pixel_data_h[MAX_COMPONENTS];
+};
+
 struct encode_params_t
 {
     std::string input_dir;
@@ -266,15 +311,19 @@ struct encode_params_t
     int cblk_w;
     int cblk_h;
     double target_psnr;
+    int num_states;
     nvjpeg2kEncoder_t enc_handle;
-    nvjpeg2kEncodeState_t enc_state;
-    nvjpeg2kEncodeParams_t enc_params;
+    std::vector<std::unique_ptr<encode_slot_t>> slots;
     nvjpeg2kImageComponentInfo_t comp_info[MAX_COMPONENTS]; // required when input is yuv
     nvjpeg2kImageInfo_t img_info; // required when input is yuv
-    cudaStream_t stream;
     std::string output_dir;
     bool write_bitstream;
     bool img_fmt_init;
+    AsyncImageWriter *writer;
+    std::string csv_file;
+    EncodeCsv csv;
+    psnr_decoder_t psnr_decoder;
+    bool record_metrics; // false during warmup batches
 };
 
 double Wtime(void)
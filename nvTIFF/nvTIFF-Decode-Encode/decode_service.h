@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+// Scheduling of the multi-file decode service of nvtiff_example (-l).
+//
+// Files are parsed on parse_threads CPU threads into one of `prefetch`
+// parse slots (an nvtiffStream_t each in the sample), so at most `prefetch`
+// parsed files are held in host memory at once. The subfiles of a parsed file
+// are split into jobs of at most pages_per_job subfiles, and one worker thread
+// per device takes jobs from a shared queue, so the pages of a large file are
+// decoded on all devices while the next files are parsed. A slot is reused
+// once every job of its file has been decoded.
+//
+// The parse and decode steps are callbacks, so the scheduling is the same
+// with or without a GPU (see decode_service_simulation.cpp).
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+template <typename T>
+class BlockingQueue {
+public:
+	void push(const T &v) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			items_.push_back(v);
+		}
+		cv_.notify_one();
+	}
+
+	// returns false once the queue is closed and empty
+	bool pop(T &v) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		cv_.wait(lock, [this] { return closed_ || !items_.empty(); });
+		if (items_.empty()) return false;
+		v = items_.front();
+		items_.pop_front();
+		return true;
+	}
+
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			closed_ = true;
+		}
+		cv_.notify_all();
+	}
+
+private:
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<T> items_;
+	bool closed_ = false;
+};
+
+struct ServiceConfig {
+	int num_devices = 1;
+	int parse_threads = 2;
+	int prefetch = 0;		// parse slots, 0: 2*num_devices + parse_threads
+	unsigned int pages_per_job = 8;
+};
+
+struct ServiceJob {
+	int file;
+	int slot;
+	unsigned int first;	// first subfile
+	unsigned int count;	// subfiles
+};
+
+struct ServiceStats {
+	int files = 0;		// parsed and decoded
+	int failed = 0;		// failed to parse or to decode
+	unsigned long long pages = 0;
+	std::vector<unsigned long long> device_pages;
+	std::vector<int> device_jobs;
+	double parse_seconds = 0;	// summed over the parse threads
+};
+
+// Reads one file name per line; empty lines and lines starting with '#' are
+// skipped.
+static inline int readFileList(const char *path, std::vector<std::string> &files) {
+
+	std::ifstream in(path);
+	if (!in) return 1;
+	std::string line;
+	while (std::getline(in, line)) {
+		while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+		if (line.empty() || line[0] == '#') continue;
+		files.push_back(line);
+	}
+	return 0;
+}
+
+// parse(file, slot) parses files[file] into the slot and returns its number
+// of subfiles, or a negative value on failure. decode(device, job) decodes
+// the subfiles of the job on the device and returns false on failure; each
+// device is served by one thread. clock() returns seconds.
+template <typename Parse, typename Decode, typename Clock>
+ServiceStats runDecodeService(int num_files, ServiceConfig config, Parse parse, Decode decode, Clock clock) {
+
+	if (config.num_devices < 1) config.num_devices = 1;
+	if (config.parse_threads < 1) config.parse_threads = 1;
+	if (config.prefetch < 1) config.prefetch = 2*config.num_devices + config.parse_threads;
+	if (config.pages_per_job < 1) config.pages_per_job = 1;
+
+	ServiceStats stats;
+	stats.device_pages.assign(config.num_devices, 0);
+	stats.device_jobs.assign(config.num_devices, 0);
+
+	BlockingQueue<int> free_slots;
+	BlockingQueue<ServiceJob> jobs;
+	for(int s = 0; s < config.prefetch; s++) {
+		free_slots.push(s);
+	}
+	// jobs still to decode for the file in each slot, and whether one failed
+	std::vector<std::atomic<unsigned int>> pending(config.prefetch);
+	std::vector<std::atomic<bool>> slot_failed(config.prefetch);
+
+	std::mutex stats_mutex;
+	std::atomic<int> next_file(0);
+
+	std::vector<std::thread> parsers;
+	for(int t = 0; t < config.parse_threads; t++) {
+		parsers.emplace_back([&] {
+			double seconds = 0;
+			int failed = 0;
+			for(;;) {
+				const int file = next_file++;
+				if (file >= num_files) break;
+				int slot = -1;
+				if (!free_slots.pop(slot)) break;
+
+				const double start = clock();
+				const long long pages = parse(file, slot);
+				seconds += clock() - start;
+				if (pages <= 0) {
+					if (pages < 0) failed++;
+					free_slots.push(slot);
+					continue;
+				}
+				const unsigned int njobs = (unsigned int)((pages + config.pages_per_job - 1)/config.pages_per_job);
+				pending[slot] = njobs;
+				slot_failed[slot] = false;
+				for(unsigned int j = 0; j < njobs; j++) {
+					const unsigned int first = j*config.pages_per_job;
+					const unsigned int count = (unsigned int)std::min<long long>(config.pages_per_job, pages - first);
+					jobs.push(ServiceJob{file, slot, first, count});
+				}
+			}
+			std::lock_guard<std::mutex> lock(stats_mutex);
+			stats.parse_seconds += seconds;
+			stats.failed += failed;
+		});
+	}
+
+	std::vector<std::thread> workers;
+	for(int d = 0; d < config.num_devices; d++) {
+		workers.emplace_back([&, d] {
+			ServiceJob job;
+			unsigned long long pages = 0;
+			int njobs = 0, files = 0, failed = 0;
+			while (jobs.pop(job)) {
+				if (decode(d, job)) {
+					pages += job.count;
+				} else {
+					slot_failed[job.slot] = true;
+				}
+				njobs++;
+				if (--pending[job.slot] == 0) {
+					if (slot_failed[job.slot]) failed++;
+					else files++;
+					free_slots.push(job.slot);
+				}
+			}
+			std::lock_guard<std::mutex> lock(stats_mutex);
+			stats.device_pages[d] = pages;
+			stats.device_jobs[d] = njobs;
+			stats.pages += pages;
+			stats.files += files;
+			stats.failed += failed;
+		});
+	}
+
+	for(auto &t : parsers) t.join();
+	jobs.close();
+	for(auto &t : workers) t.join();
+	return stats;
+}
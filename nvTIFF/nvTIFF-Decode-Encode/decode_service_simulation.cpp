@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+// CPU-only check of the multi-file decode service scheduling
+// (decode_service.h), with sleeps standing in for parsing and decoding.
+//
+// A list of multi-page files, a few of which fail to parse, is decoded on 1,
+// 2 and 4 simulated devices. Every subfile of every parsed file must be
+// decoded exactly once, a parse slot must not be reused while jobs of its
+// file are pending, and no more than `prefetch` files may be parsed at once.
+// The throughput should grow with the number of devices until parsing
+// becomes the bottleneck.
+//
+// Build: g++ -O2 -std=c++14 -pthread decode_service_simulation.cpp -o decode_service_simulation
+// Usage: ./decode_service_simulation [-n files] [-p parse_threads] [-j pages_per_job]
+
+#include "decode_service.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+static double now() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void busy(double seconds) {
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+int main(int argc, char **argv) {
+
+	int nfiles = 200;
+	ServiceConfig config;
+	for(int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-h")) {
+			printf("Usage: %s [-n files] [-p parse_threads] [-j pages_per_job]\n", argv[0]);
+			return EXIT_SUCCESS;
+		}
+		if (i+1 >= argc) break;
+		if      (!strcmp(argv[i], "-n")) nfiles = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-p")) config.parse_threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-j")) config.pages_per_job = atoi(argv[++i]);
+	}
+
+	// 1 to 40 pages per file; every 17th file is corrupt
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<int> npages(1, 40);
+	std::vector<int> pages(nfiles);
+	unsigned long long total_pages = 0;
+	int expected_failed = 0;
+	for(int f = 0; f < nfiles; f++) {
+		pages[f] = (f % 17 == 16) ? -1 : npages(rng);
+		if (pages[f] < 0) expected_failed++;
+		else total_pages += pages[f];
+	}
+	const double parse_time = 200e-6;	// per file
+	const double decode_time = 50e-6;	// per page
+
+	int failures = 0;
+	printf("%8s %8s %8s %8s %10s %10s %12s\n", "devices", "files", "failed", "pages", "seconds", "pages/s", "pages/device");
+	for(int ndev : {1, 2, 4}) {
+		config.num_devices = ndev;
+		config.prefetch = 0;
+		const int prefetch = 2*ndev + std::max(1, config.parse_threads);
+
+		std::vector<std::vector<std::atomic<int>>> decoded(nfiles);
+		for(int f = 0; f < nfiles; f++) {
+			decoded[f] = std::vector<std::atomic<int>>(std::max(pages[f], 0));
+			for(auto &d : decoded[f]) d = 0;
+		}
+		std::vector<std::atomic<int>> slot_file(prefetch);
+		for(auto &s : slot_file) s = -1;
+		std::atomic<int> errors(0), in_use(0), max_in_use(0);
+		std::vector<std::atomic<int>> remaining(nfiles);
+
+		const double start = now();
+		ServiceStats stats = runDecodeService(nfiles, config,
+			[&](int file, int slot) -> long long {
+				if (slot < 0 || slot >= prefetch) {
+					errors++;
+					return -1;
+				}
+				if (slot_file[slot] != -1) errors++;
+				slot_file[slot] = file;
+				const int n = ++in_use;
+				int m = max_in_use;
+				while (n > m && !max_in_use.compare_exchange_weak(m, n)) {}
+				busy(parse_time);
+				if (pages[file] < 0) {
+					slot_file[slot] = -1;
+					in_use--;
+					return -1;
+				}
+				remaining[file] = pages[file];
+				return pages[file];
+			},
+			[&](int dev, const ServiceJob &job) -> bool {
+				if (dev < 0 || dev >= ndev || slot_file[job.slot] != job.file) errors++;
+				busy(decode_time*job.count);
+				for(unsigned int p = job.first; p < job.first+job.count; p++) {
+					decoded[job.file][p]++;
+				}
+				// the last job of a file frees its slot after this returns
+				if ((remaining[job.file] -= job.count) == 0) {
+					slot_file[job.slot] = -1;
+					in_use--;
+				}
+				return true;
+			},
+			now);
+		const double seconds = now()-start;
+
+		for(int f = 0; f < nfiles; f++) {
+			for(auto &d : decoded[f]) {
+				if (d != 1) errors++;
+			}
+		}
+		printf("%8d %8d %8d %8llu %10.3lf %10.0lf", ndev, stats.files, stats.failed, stats.pages, seconds, stats.pages/seconds);
+		for(int d = 0; d < ndev; d++) printf(" %llu", stats.device_pages[d]);
+		printf("\n");
+		if (errors || stats.pages != total_pages || stats.failed != expected_failed ||
+		    stats.files != nfiles-expected_failed || max_in_use > prefetch) {
+			printf("FAILED: %d scheduling errors, max %d files parsed at once\n", (int)errors, (int)max_in_use);
+			failures++;
+		}
+	}
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
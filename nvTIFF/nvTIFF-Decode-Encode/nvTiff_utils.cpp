@@ -34,11 +34,20 @@
 #include <windows.h>
 #include <chrono>
 #  pragma warning(disable:4819)
+#include <io.h>
+#include <fcntl.h>
 #else
 #include <unistd.h>
 #include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #endif
 
+#include <algorithm>
+#include <set>
+
 void *Malloc(size_t sz) {
 
 	void *ptr;
@@ -155,3 +164,553 @@ double Wtime(void) {
 
 }
 
+// *****************************************************************************
+// TIFF / BigTIFF mapped reader
+// -----------------------------------------------------------------------------
+enum {
+	TIFF_SHORT = 3,
+	TIFF_LONG = 4,
+	TIFF_LONG8 = 16,
+	TIFF_IFD8 = 18
+};
+
+static int tiffTypeSize(unsigned int type) {
+
+	switch (type) {
+		case 1: case 2: case 6: case 7: return 1;	// BYTE, ASCII, SBYTE, UNDEFINED
+		case 3: case 8: return 2;			// SHORT, SSHORT
+		case 4: case 9: case 11: case 13: return 4;	// LONG, SLONG, FLOAT, IFD
+		case 5: case 10: case 12: return 8;		// RATIONAL, SRATIONAL, DOUBLE
+		case 16: case 17: case 18: return 8;		// LONG8, SLONG8, IFD8
+		default: return 0;
+	}
+}
+
+static unsigned long long tiffGet(const unsigned char *p, int bytes, bool bigEndian) {
+
+	unsigned long long v = 0;
+	for(int i = 0; i < bytes; i++) {
+		v = (v << 8) | p[bigEndian ? i : bytes-1-i];
+	}
+	return v;
+}
+
+static unsigned int divUp(unsigned int a, unsigned int b) {
+	return b ? (a + b - 1)/b : 0;
+}
+
+unsigned int TiffImageDesc::chunksAcross() const {
+	return tiled() ? divUp(ncol, tileWidth) : 1;
+}
+
+unsigned int TiffImageDesc::chunksDown() const {
+	return tiled() ? divUp(nrow, tileLength) : divUp(nrow, rowsPerStrip);
+}
+
+void TiffImageDesc::chunksInWindow(const TiffRect &window, std::vector<TiffChunkArea> &chunks) const {
+
+	chunks.clear();
+	const unsigned int cw = tiled() ? tileWidth : ncol;
+	const unsigned int ch = tiled() ? tileLength : rowsPerStrip;
+	const unsigned int x1 = std::min(window.x1, ncol);
+	const unsigned int y1 = std::min(window.y1, nrow);
+	if (!cw || !ch || window.x0 >= x1 || window.y0 >= y1) return;
+
+	const unsigned int across = chunksAcross();
+	for(unsigned int cy = window.y0 / ch; cy < divUp(y1, ch); cy++) {
+		for(unsigned int cx = window.x0 / cw; cx < divUp(x1, cw); cx++) {
+			TiffChunkArea c;
+			c.chunk = (unsigned long long)cy*across + cx;
+			c.rect.x0 = cx*cw;
+			c.rect.y0 = cy*ch;
+			c.rect.x1 = std::min(c.rect.x0 + cw, ncol);
+			c.rect.y1 = std::min(c.rect.y0 + ch, nrow);
+			c.area.x0 = std::max(c.rect.x0, window.x0);
+			c.area.y0 = std::max(c.rect.y0, window.y0);
+			c.area.x1 = std::min(c.rect.x1, x1);
+			c.area.y1 = std::min(c.rect.y1, y1);
+			chunks.push_back(c);
+		}
+	}
+}
+
+unsigned long long TiffDirectory::chunkOffset(unsigned long long i) const {
+	return tiffGet(offsets_ + i*offsetSize_, offsetSize_, bigEndian_);
+}
+
+unsigned long long TiffDirectory::chunkBytes(unsigned long long i) const {
+	return tiffGet(counts_ + i*countSize_, countSize_, bigEndian_);
+}
+
+TiffMappedFile::TiffMappedFile() : data_(NULL), size_(0), bigTiff_(false), bigEndian_(false) {
+#if defined(_WIN32)
+	file_ = NULL;
+	mapping_ = NULL;
+#endif
+}
+
+TiffMappedFile::~TiffMappedFile() {
+	close();
+}
+
+void TiffMappedFile::close() {
+
+	images_.clear();
+	if (data_) {
+#if defined(_WIN32)
+		UnmapViewOfFile(data_);
+#else
+		munmap((void *)data_, size_);
+#endif
+	}
+#if defined(_WIN32)
+	if (mapping_) CloseHandle((HANDLE)mapping_);
+	if (file_) CloseHandle((HANDLE)file_);
+	mapping_ = NULL;
+	file_ = NULL;
+#endif
+	data_ = NULL;
+	size_ = 0;
+}
+
+int TiffMappedFile::open(const char *path) {
+
+	close();
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, "Cannot open file %s...\n", path);
+		return 1;
+	}
+	file_ = file;
+	LARGE_INTEGER sz;
+	GetFileSizeEx(file, &sz);
+	size_ = sz.QuadPart;
+	if (size_) {
+		mapping_ = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		data_ = mapping_ ? (const unsigned char *)MapViewOfFile((HANDLE)mapping_, FILE_MAP_READ, 0, 0, 0) : NULL;
+	}
+#else
+	const int fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open file %s...\n", path);
+		return 1;
+	}
+	struct stat st;
+	if (fstat(fd, &st)) {
+		::close(fd);
+		fprintf(stderr, "Cannot stat file %s...\n", path);
+		return 1;
+	}
+	size_ = st.st_size;
+	if (size_) {
+		void *p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		data_ = p == MAP_FAILED ? NULL : (const unsigned char *)p;
+	}
+	// the mapping stays valid after the descriptor is closed
+	::close(fd);
+#endif
+	if (!data_ || size_ < 8) {
+		fprintf(stderr, "Cannot map file %s...\n", path);
+		close();
+		return 1;
+	}
+
+	if (data_[0] == 'I' && data_[1] == 'I') {
+		bigEndian_ = false;
+	} else if (data_[0] == 'M' && data_[1] == 'M') {
+		bigEndian_ = true;
+	} else {
+		fprintf(stderr, "%s is not a TIFF file\n", path);
+		close();
+		return 1;
+	}
+	const unsigned int version = tiffGet(data_ + 2, 2, bigEndian_);
+	unsigned long long ifd;
+	if (version == 42) {
+		bigTiff_ = false;
+		ifd = tiffGet(data_ + 4, 4, bigEndian_);
+	} else if (version == 43 && size_ >= 16 && tiffGet(data_ + 4, 2, bigEndian_) == 8) {
+		bigTiff_ = true;
+		ifd = tiffGet(data_ + 8, 8, bigEndian_);
+	} else {
+		fprintf(stderr, "%s: unsupported TIFF version %u\n", path, version);
+		close();
+		return 1;
+	}
+
+	std::set<unsigned long long> visited;
+	while (ifd) {
+		if (!visited.insert(ifd).second) {
+			fprintf(stderr, "%s: loop in the image directories\n", path);
+			close();
+			return 1;
+		}
+		TiffDirectory dir;
+		if (parseDirectory(ifd, dir, ifd)) {
+			fprintf(stderr, "%s: invalid image directory %zu\n", path, images_.size());
+			close();
+			return 1;
+		}
+		images_.push_back(dir);
+	}
+	return 0;
+}
+
+// Reads one directory; every entry and every strip or tile must lie inside
+// the file.
+int TiffMappedFile::parseDirectory(unsigned long long off, TiffDirectory &dir, unsigned long long &next) {
+
+	const int countBytes = bigTiff_ ? 8 : 2;
+	const int entryBytes = bigTiff_ ? 20 : 12;
+	const int valueBytes = bigTiff_ ? 8 : 4;
+	if (off + countBytes > size_) return 1;
+	const unsigned long long nent = tiffGet(data_ + off, countBytes, bigEndian_);
+	const unsigned long long end = off + countBytes + nent*entryBytes + valueBytes;
+	if (nent > (size_ - off)/entryBytes || end > size_) return 1;
+
+	dir.offsets_ = dir.counts_ = NULL;
+	dir.bigEndian_ = bigEndian_;
+	dir.numChunks = 0;
+	unsigned long long nOffsets = 0, nCounts = 0;
+	bool haveRowsPerStrip = false;
+
+	for(unsigned long long e = 0; e < nent; e++) {
+		const unsigned char *p = data_ + off + countBytes + e*entryBytes;
+		const unsigned int tag = tiffGet(p, 2, bigEndian_);
+		const unsigned int type = tiffGet(p + 2, 2, bigEndian_);
+		const unsigned long long count = tiffGet(p + 4, valueBytes, bigEndian_);
+		const int sz = tiffTypeSize(type);
+		if (!sz || count > size_) continue;	// unknown types are skipped
+
+		// values that do not fit in the entry are stored elsewhere
+		const unsigned char *values = p + 4 + valueBytes;
+		if (count*sz > (unsigned long long)valueBytes) {
+			const unsigned long long voff = tiffGet(values, valueBytes, bigEndian_);
+			if (voff > size_ || count*sz > size_ - voff) return 1;
+			values = data_ + voff;
+		}
+		const unsigned long long v0 = count ? tiffGet(values, sz, bigEndian_) : 0;
+
+		switch (tag) {
+			case 256: dir.desc.ncol = v0; break;
+			case 257: dir.desc.nrow = v0; break;
+			case 258:
+				for(unsigned long long k = 0; k < count && k < 4; k++) {
+					dir.desc.bitsPerSample[k] = tiffGet(values + k*sz, sz, bigEndian_);
+				}
+				break;
+			case 259: dir.desc.compression = v0; break;
+			case 262: dir.desc.photometricInt = v0; break;
+			case 277: dir.desc.samplesPerPixel = v0; break;
+			case 278: dir.desc.rowsPerStrip = v0; haveRowsPerStrip = true; break;
+			case 284: dir.desc.planarConf = v0; break;
+			case 317: dir.desc.predictor = v0; break;
+			case 322: dir.desc.tileWidth = v0; break;
+			case 323: dir.desc.tileLength = v0; break;
+			case 339: dir.desc.sampleFormat = v0; break;
+			case 273:
+			case 324:
+				if (sz != 2 && sz != 4 && sz != 8) return 1;
+				dir.offsets_ = values;
+				dir.offsetSize_ = sz;
+				nOffsets = count;
+				break;
+			case 279:
+			case 325:
+				if (sz != 2 && sz != 4 && sz != 8) return 1;
+				dir.counts_ = values;
+				dir.countSize_ = sz;
+				nCounts = count;
+				break;
+		}
+	}
+	next = tiffGet(data_ + end - valueBytes, valueBytes, bigEndian_);
+
+	if (!dir.offsets_ || !dir.counts_ || nOffsets != nCounts) return 1;
+	if (!haveRowsPerStrip || dir.desc.rowsPerStrip > dir.desc.nrow) {
+		dir.desc.rowsPerStrip = dir.desc.nrow;
+	}
+	if (dir.desc.tiled() && !dir.desc.tileLength) return 1;
+	dir.numChunks = nOffsets;
+	for(unsigned long long i = 0; i < dir.numChunks; i++) {
+		const unsigned long long o = dir.chunkOffset(i), n = dir.chunkBytes(i);
+		if (o > size_ || n > size_ - o) return 1;
+	}
+	return 0;
+}
+
+TiffSpan TiffMappedFile::chunk(size_t image, unsigned long long i) const {
+
+	const TiffDirectory &dir = images_[image];
+	TiffSpan span = {data_ + dir.chunkOffset(i), dir.chunkBytes(i)};
+	return span;
+}
+
+void TiffMappedFile::print(FILE *fp) const {
+
+	static const char *compression[] = {"", "none", "CCITT", "T4", "T6", "LZW", "OJPEG", "JPEG", "Deflate"};
+	fprintf(fp, "%s, %s endian, %zu image(s), %llu bytes\n", bigTiff_ ? "BigTIFF" : "TIFF",
+		bigEndian_ ? "big" : "little", images_.size(), size_);
+	for(size_t i = 0; i < images_.size(); i++) {
+		const TiffImageDesc &d = images_[i].desc;
+		unsigned long long bytes = 0, largest = 0;
+		for(unsigned long long c = 0; c < images_[i].numChunks; c++) {
+			bytes += images_[i].chunkBytes(c);
+			largest = std::max(largest, images_[i].chunkBytes(c));
+		}
+		fprintf(fp, "\timage %zu: %ux%u, %u x %u bits, %s, predictor %u, ", i, d.ncol, d.nrow,
+			d.samplesPerPixel, d.bitsPerSample[0],
+			d.compression < 9 ? compression[d.compression] : "other", d.predictor);
+		if (d.tiled()) {
+			fprintf(fp, "%llu %ux%u tiles", images_[i].numChunks, d.tileWidth, d.tileLength);
+		} else {
+			fprintf(fp, "%llu strips of %u rows", images_[i].numChunks, d.rowsPerStrip);
+		}
+		fprintf(fp, ", %llu bytes (largest %llu)\n", bytes, largest);
+	}
+}
+
+// *****************************************************************************
+// TIFF / BigTIFF writer
+// -----------------------------------------------------------------------------
+TiffFileWriter::TiffFileWriter() : fd_(-1), mem_(NULL), bigTiff_(false), pos_(0), nextLink_(0) {}
+
+TiffFileWriter::~TiffFileWriter() {
+	if (isOpen()) close();
+}
+
+int TiffFileWriter::open(const char *path, bool bigTiff) {
+
+#if defined(_WIN32)
+	fd_ = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+	if (fd_ < 0) {
+		fprintf(stderr, "Cannot open file %s...\n", path);
+		return 1;
+	}
+	return start(bigTiff);
+}
+
+int TiffFileWriter::open(std::vector<unsigned char> *buffer, bool bigTiff) {
+
+	mem_ = buffer;
+	mem_->clear();
+	return start(bigTiff);
+}
+
+int TiffFileWriter::start(bool bigTiff) {
+
+	bigTiff_ = bigTiff;
+	unsigned char h[16] = {'I', 'I'};
+	if (bigTiff_) {
+		h[2] = 43;
+		h[4] = 8;
+		pos_ = 16;
+		nextLink_ = 8;
+	} else {
+		h[2] = 42;
+		pos_ = 8;
+		nextLink_ = 4;
+	}
+	// the first directory offset stays 0 until appendImage()
+	return writeAt(0, h, pos_);
+}
+
+int TiffFileWriter::writeAt(unsigned long long off, const void *p, size_t n) {
+
+	const unsigned char *b = (const unsigned char *)p;
+	if (mem_) {
+		if (off + n > mem_->size()) mem_->resize(off + n);
+		if (n) memcpy(mem_->data() + off, b, n);
+		return 0;
+	}
+	while (n) {
+#if defined(_WIN32)
+		if (_lseeki64(fd_, off, SEEK_SET) < 0) return 1;
+		const int w = _write(fd_, b, (unsigned int)std::min<size_t>(n, 1 << 30));
+#else
+		const ssize_t w = pwrite(fd_, b, n, off);
+#endif
+		if (w <= 0) return 1;
+		b += w;
+		off += w;
+		n -= w;
+	}
+	return 0;
+}
+
+// writes the spans at pos_
+int TiffFileWriter::writeVec(const TiffSpan *spans, size_t n) {
+
+#if !defined(_WIN32)
+	if (!mem_) return writeVecFd(spans, n);
+#endif
+	for(size_t i = 0; i < n; i++) {
+		if (writeAt(pos_, spans[i].data, spans[i].size)) return 1;
+		pos_ += spans[i].size;
+	}
+	return 0;
+}
+
+#if !defined(_WIN32)
+int TiffFileWriter::writeVecFd(const TiffSpan *spans, size_t n) {
+
+	const size_t maxIov = IOV_MAX;
+	std::vector<struct iovec> iov;
+	size_t i = 0;
+	while (i < n) {
+		iov.clear();
+		for(size_t k = i; k < n && iov.size() < maxIov; k++) {
+			if (spans[k].size) {
+				struct iovec v = {(void *)spans[k].data, (size_t)spans[k].size};
+				iov.push_back(v);
+			}
+			i = k+1;
+		}
+		size_t first = 0;
+		if (lseek(fd_, pos_, SEEK_SET) < 0) return 1;
+		while (first < iov.size()) {
+			const ssize_t w = writev(fd_, iov.data() + first, (int)(iov.size() - first));
+			if (w <= 0) return 1;
+			pos_ += w;
+			// skip what was written, possibly part of a span
+			size_t left = w;
+			while (first < iov.size() && left >= iov[first].iov_len) {
+				left -= iov[first].iov_len;
+				first++;
+			}
+			if (left) {
+				iov[first].iov_base = (char *)iov[first].iov_base + left;
+				iov[first].iov_len -= left;
+			}
+		}
+	}
+	return 0;
+}
+#endif
+
+int TiffFileWriter::appendChunks(const TiffSpan *spans, size_t n, unsigned long long *offsets) {
+
+	if (!isOpen()) return 1;
+	if (pos_ & 1) {
+		const unsigned char z = 0;
+		if (writeAt(pos_, &z, 1)) return 1;
+		pos_++;
+	}
+	unsigned long long off = pos_;
+	for(size_t i = 0; i < n; i++) {
+		offsets[i] = off;
+		off += spans[i].size;
+	}
+	if (!bigTiff_ && off > 0xFFFFFFFFULL) {
+		fprintf(stderr, "TIFF file larger than 4 GiB, BigTIFF is needed\n");
+		return 1;
+	}
+	return writeVec(spans, n);
+}
+
+static void tiffPut(std::vector<unsigned char> &b, unsigned long long v, int bytes) {
+	for(int i = 0; i < bytes; i++) b.push_back((unsigned char)(v >> (8*i)));
+}
+
+int TiffFileWriter::appendImage(const TiffImageDesc &desc, const unsigned long long *offsets,
+				const unsigned long long *counts, unsigned long long nchunks) {
+
+	if (!isOpen()) return 1;
+	struct Entry {
+		unsigned short tag, type;
+		std::vector<unsigned long long> values;
+	};
+	const unsigned short offType = bigTiff_ ? TIFF_LONG8 : TIFF_LONG;
+	const int nsamples = std::max(1, std::min<int>(desc.samplesPerPixel, 4));
+
+	// in ascending tag order
+	std::vector<Entry> e;
+	e.push_back(Entry{256, TIFF_LONG, {desc.ncol}});
+	e.push_back(Entry{257, TIFF_LONG, {desc.nrow}});
+	e.push_back(Entry{258, TIFF_SHORT, {}});
+	for(int c = 0; c < nsamples; c++) e.back().values.push_back(desc.bitsPerSample[c]);
+	e.push_back(Entry{259, TIFF_SHORT, {desc.compression}});
+	e.push_back(Entry{262, TIFF_SHORT, {desc.photometricInt}});
+	Entry offs{(unsigned short)(desc.tiled() ? 324 : 273), offType, std::vector<unsigned long long>(offsets, offsets + nchunks)};
+	Entry cnts{(unsigned short)(desc.tiled() ? 325 : 279), offType, std::vector<unsigned long long>(counts, counts + nchunks)};
+	if (!desc.tiled()) e.push_back(offs);
+	e.push_back(Entry{277, TIFF_SHORT, {desc.samplesPerPixel}});
+	if (!desc.tiled()) {
+		e.push_back(Entry{278, TIFF_LONG, {desc.rowsPerStrip}});
+		e.push_back(cnts);
+	}
+	e.push_back(Entry{284, TIFF_SHORT, {desc.planarConf}});
+	if (desc.predictor != 1) e.push_back(Entry{317, TIFF_SHORT, {desc.predictor}});
+	if (desc.tiled()) {
+		e.push_back(Entry{322, TIFF_LONG, {desc.tileWidth}});
+		e.push_back(Entry{323, TIFF_LONG, {desc.tileLength}});
+		e.push_back(offs);
+		e.push_back(cnts);
+	}
+	e.push_back(Entry{339, TIFF_SHORT, {}});
+	for(int c = 0; c < nsamples; c++) e.back().values.push_back(desc.sampleFormat);
+
+	if (pos_ & 1) {
+		const unsigned char z = 0;
+		if (writeAt(pos_, &z, 1)) return 1;
+		pos_++;
+	}
+	const int countBytes = bigTiff_ ? 8 : 2;
+	const int valueBytes = bigTiff_ ? 8 : 4;
+	const unsigned long long tableBytes = countBytes + e.size()*(4 + 2*valueBytes) + valueBytes;
+
+	// values that do not fit in an entry follow the table
+	std::vector<unsigned char> ifd, extra;
+	tiffPut(ifd, e.size(), countBytes);
+	for(size_t i = 0; i < e.size(); i++) {
+		const int sz = tiffTypeSize(e[i].type);
+		tiffPut(ifd, e[i].tag, 2);
+		tiffPut(ifd, e[i].type, 2);
+		tiffPut(ifd, e[i].values.size(), valueBytes);
+		if (e[i].values.size()*sz <= (size_t)valueBytes) {
+			for(size_t k = 0; k < e[i].values.size(); k++) tiffPut(ifd, e[i].values[k], sz);
+			for(size_t k = e[i].values.size()*sz; k < (size_t)valueBytes; k++) ifd.push_back(0);
+		} else {
+			if (extra.size() & 1) extra.push_back(0);
+			tiffPut(ifd, pos_ + tableBytes + extra.size(), valueBytes);
+			for(size_t k = 0; k < e[i].values.size(); k++) tiffPut(extra, e[i].values[k], sz);
+		}
+	}
+	const unsigned long long link = pos_ + ifd.size();
+	tiffPut(ifd, 0, valueBytes);	// no next directory yet
+	ifd.insert(ifd.end(), extra.begin(), extra.end());
+
+	if (!bigTiff_ && pos_ + ifd.size() > 0xFFFFFFFFULL) {
+		fprintf(stderr, "TIFF file larger than 4 GiB, BigTIFF is needed\n");
+		return 1;
+	}
+	if (writeAt(pos_, ifd.data(), ifd.size())) return 1;
+
+	// link it from the header or the previous directory
+	std::vector<unsigned char> off;
+	tiffPut(off, pos_, valueBytes);
+	if (writeAt(nextLink_, off.data(), off.size())) return 1;
+	nextLink_ = link;
+	pos_ += ifd.size();
+	return 0;
+}
+
+int TiffFileWriter::close() {
+
+	if (mem_) {
+		mem_ = NULL;
+		return 0;
+	}
+	if (fd_ < 0) return 1;
+#if defined(_WIN32)
+	const int rv = _close(fd_);
+#else
+	const int rv = ::close(fd_);
+#endif
+	fd_ = -1;
+	return rv != 0;
+}
@@ -21,6 +21,7 @@
  */
 #ifndef __UTILS_H__
 #define __UTILS_H__
+#include <stdio.h>
 #include <sys/types.h>
 #if defined(WIN32) || defined(_WIN32) || defined(WIN64) || defined(_WIN64) || defined(_MSC_VER)
 #  define WINDOWS_LEAN_AND_MEAN
@@ -48,4 +49,161 @@ extern UTILS_LINKAGE int Remove(const char *pathname);
 extern UTILS_LINKAGE off_t getFsize(const char *fpath);
 extern UTILS_LINKAGE double Wtime(void);
 
+#ifdef __cplusplus
+#include <vector>
+
+// Host-side TIFF and BigTIFF access.
+//
+// TiffMappedFile maps the whole file and walks its IFD chain; the strip or
+// tile offsets and byte counts are read from the mapping when asked for, and
+// chunk() returns a span of the mapping, so compressed data is never copied
+// before it reaches a decoder.
+//
+// TiffFileWriter appends chunks with vectored writes straight from the
+// callers' buffers and writes each image directory after its chunks,
+// patching the previous directory's next offset in place (pwrite). It can
+// also build the file in memory, for parsers that take a buffer.
+
+struct TiffSpan {
+	const unsigned char *data;
+	unsigned long long size;
+};
+
+// an area of an image, [x0, x1) x [y0, y1)
+struct TiffRect {
+	unsigned int x0;
+	unsigned int y0;
+	unsigned int x1;
+	unsigned int y1;
+
+	unsigned int width() const { return x1 - x0; }
+	unsigned int height() const { return y1 - y0; }
+	bool empty() const { return x1 <= x0 || y1 <= y0; }
+};
+
+// a strip or tile that intersects a window
+struct TiffChunkArea {
+	unsigned long long chunk;	// strip or tile index in the image
+	TiffRect rect;			// the strip or tile, clipped to the image
+	TiffRect area;			// its part inside the window
+};
+
+struct TiffImageDesc {
+	unsigned int nrow = 0;
+	unsigned int ncol = 0;
+	unsigned int rowsPerStrip = 0;	// strips, when tileWidth is 0
+	unsigned int tileWidth = 0;	// 0: the image is organized in strips
+	unsigned int tileLength = 0;
+	unsigned short samplesPerPixel = 1;
+	unsigned short bitsPerSample[4] = {8, 8, 8, 8};
+	unsigned short photometricInt = 1;
+	unsigned short planarConf = 1;
+	unsigned short sampleFormat = 1;
+	unsigned short compression = 1;	// 1: none, 5: LZW, 8: Deflate
+	unsigned short predictor = 1;	// 1: none, 2: horizontal differencing
+
+	bool tiled() const { return tileWidth != 0; }
+	// strips or tiles across and down the image
+	unsigned int chunksAcross() const;
+	unsigned int chunksDown() const;
+
+	// the strips or tiles that intersect window, in file order
+	void chunksInWindow(const TiffRect &window, std::vector<TiffChunkArea> &chunks) const;
+};
+
+class TiffDirectory {
+public:
+	TiffImageDesc desc;
+	unsigned long long numChunks;	// strips or tiles
+
+	unsigned long long chunkOffset(unsigned long long i) const;
+	unsigned long long chunkBytes(unsigned long long i) const;
+
+private:
+	friend class TiffMappedFile;
+	const unsigned char *offsets_;	// arrays of the mapped file
+	const unsigned char *counts_;
+	int offsetSize_;
+	int countSize_;
+	bool bigEndian_;
+};
+
+class TiffMappedFile {
+public:
+	TiffMappedFile();
+	~TiffMappedFile();
+	TiffMappedFile(const TiffMappedFile &) = delete;
+	TiffMappedFile &operator=(const TiffMappedFile &) = delete;
+
+	// maps and parses the file; returns nonzero, with a message, if it is not
+	// a TIFF file this reader can walk
+	int open(const char *path);
+	void close();
+
+	bool bigTiff() const { return bigTiff_; }
+	bool bigEndian() const { return bigEndian_; }
+	const unsigned char *data() const { return data_; }
+	unsigned long long size() const { return size_; }
+
+	size_t numImages() const { return images_.size(); }
+	const TiffDirectory &image(size_t i) const { return images_[i]; }
+
+	// compressed strip or tile i of an image, without copying
+	TiffSpan chunk(size_t image, unsigned long long i) const;
+
+	void print(FILE *fp) const;
+
+private:
+	int parseDirectory(unsigned long long off, TiffDirectory &dir, unsigned long long &next);
+
+	const unsigned char *data_;
+	unsigned long long size_;
+	bool bigTiff_;
+	bool bigEndian_;
+	std::vector<TiffDirectory> images_;
+#if defined(_WIN32)
+	void *file_;
+	void *mapping_;
+#endif
+};
+
+class TiffFileWriter {
+public:
+	TiffFileWriter();
+	~TiffFileWriter();
+	TiffFileWriter(const TiffFileWriter &) = delete;
+	TiffFileWriter &operator=(const TiffFileWriter &) = delete;
+
+	int open(const char *path, bool bigTiff);
+	// writes into *buffer, which must outlive the writer
+	int open(std::vector<unsigned char> *buffer, bool bigTiff);
+
+	// Writes the spans back to back, starting at an even offset, and returns
+	// the file offset of each in offsets.
+	int appendChunks(const TiffSpan *spans, size_t n, unsigned long long *offsets);
+
+	// Writes the directory of an image whose chunks were appended before.
+	int appendImage(const TiffImageDesc &desc, const unsigned long long *offsets,
+			const unsigned long long *counts, unsigned long long nchunks);
+
+	int close();
+
+	bool bigTiff() const { return bigTiff_; }
+	unsigned long long size() const { return pos_; }
+
+private:
+	int start(bool bigTiff);
+	int writeAt(unsigned long long off, const void *p, size_t n);
+	int writeVec(const TiffSpan *spans, size_t n);
+	int writeVecFd(const TiffSpan *spans, size_t n);
+	bool isOpen() const { return fd_ >= 0 || mem_; }
+
+	int fd_;
+	std::vector<unsigned char> *mem_;
+	bool bigTiff_;
+	unsigned long long pos_;
+	unsigned long long nextLink_;	// where the next directory's offset goes
+};
+#endif
+
 #endif
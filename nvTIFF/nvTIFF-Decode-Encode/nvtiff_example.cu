@@ -39,6 +39,10 @@
 #include "nvTiff_utils.h"
 #include "cudamacro.h"
 #include <nvTiff.h>
+#include "../../common/image_writer.h"
+#include "decode_service.h"
+#include "tiff_strip_writer.h"
+#include "tiff_codec.h"
 
 #define CHECK_NVTIFF(call)                                                \
     {                                                                       \
@@ -57,180 +61,796 @@
 
 #define MAX_STR_LEN	(256)
 
-// quick and dirty BMP file writer
+// BMP file writer, input - interleaved 8 bit samples, BPP bytes per pixel
 static void writeBMPFile(const char *filename, unsigned char *chan, int LD, int WIDTH, int HEIGHT, int BPP, int IS_GREYSCALE) {
 
-	unsigned int headers[13];
-	FILE * outfile;
-	int extrabytes;
-	int paddedsize;
-	int x; int y; int n;
-	int red, green, blue;
-
-	extrabytes = 4 - ((WIDTH * 3) % 4);                 // How many bytes of padding to add to each
-	// horizontal line - the size of which must
-	// be a multiple of 4 bytes.
-	if (extrabytes == 4)
-		extrabytes = 0;
-
-	paddedsize = ((WIDTH * 3) + extrabytes) * HEIGHT;
-
-	// Headers...
-	// Note that the "BM" identifier in bytes 0 and 1 is NOT included in these "headers".
-
-	headers[0]  = paddedsize + 54;      // bfSize (whole file size)
-	headers[1]  = 0;                    // bfReserved (both)
-	headers[2]  = 54;                   // bfOffbits
-	headers[3]  = 40;                   // biSize
-	headers[4]  = WIDTH;  // biWidth
-	headers[5]  = HEIGHT; // biHeight
-
-	// Would have biPlanes and biBitCount in position 6, but they're shorts.
-	// It's easier to write them out separately (see below) than pretend
-	// they're a single int, especially with endian issues...
-
-	headers[7]  = 0;                    // biCompression
-	headers[8]  = paddedsize;           // biSizeImage
-	headers[9]  = 0;                    // biXPelsPerMeter
-	headers[10] = 0;                    // biYPelsPerMeter
-	headers[11] = 0;                    // biClrUsed
-	headers[12] = 0;                    // biClrImportant
-
-	outfile = Fopen(filename, "wb");
-
-	//
-	// Headers begin...
-	// When printing ints and shorts, we write out 1 character at a time to avoid endian issues.
-	//
-
-	fprintf(outfile, "BM");
-
-	for (n = 0; n <= 5; n++)
-	{
-		fprintf(outfile, "%c", headers[n] & 0x000000FF);
-		fprintf(outfile, "%c", (headers[n] & 0x0000FF00) >> 8);
-		fprintf(outfile, "%c", (headers[n] & 0x00FF0000) >> 16);
-		fprintf(outfile, "%c", (headers[n] & (unsigned int) 0xFF000000) >> 24);
-	}
-
-	// These next 4 characters are for the biPlanes and biBitCount fields.
-
-	fprintf(outfile, "%c", 1);
-	fprintf(outfile, "%c", 0);
-	fprintf(outfile, "%c", 24);
-	fprintf(outfile, "%c", 0);
-
-	for (n = 7; n <= 12; n++)
-	{
-		fprintf(outfile, "%c", headers[n] & 0x000000FF);
-		fprintf(outfile, "%c", (headers[n] & 0x0000FF00) >> 8);
-		fprintf(outfile, "%c", (headers[n] & 0x00FF0000) >> 16);
-		fprintf(outfile, "%c", (headers[n] & (unsigned int) 0xFF000000) >> 24);
-	}
-
-	//
-	// Headers done, now write the data...
-	//
-
-	for (y = HEIGHT - 1; y >= 0; y--)     // BMP image format is written from bottom to top...
-	{
-		for (x = 0; x <= WIDTH - 1; x++)
-		{
-			/*
-			red = reduce(redcount[x][y] + COLOUR_OFFSET) * red_multiplier;
-			green = reduce(greencount[x][y] + COLOUR_OFFSET) * green_multiplier;
-			blue = reduce(bluecount[x][y] + COLOUR_OFFSET) * blue_multiplier;
-			*/
-
-			if (!IS_GREYSCALE) {
-				red   = chan[0 + y*LD*BPP + BPP*x];
-				green = chan[1 + y*LD*BPP + BPP*x]; 
-				blue  = chan[2 + y*LD*BPP + BPP*x];
-			} else {
-				red   = chan[0 + y*LD*BPP + BPP*x];
-				green = red;
-				blue  = red;
+	const int ncomp = IS_GREYSCALE ? 1 : 3;
+	if (thread_image_writer().write_bmp(filename,
+		HostImage<unsigned char>::interleaved(chan, (size_t)LD*BPP, BPP, ncomp, WIDTH, HEIGHT))) {
+		fprintf(stderr, "Error writing file %s\n", filename);
+	}
+	return;
+}
+
+
+// PPM (3 components) or PAM (4 components) file writer, input - interleaved
+// samples of BPP bits
+void writePPM(const char * filename, unsigned char *chan, int LD, int WIDTH, int HEIGHT, int BPP, int NUMCOMP)
+{
+	int err;
+	if (BPP == 8) {
+		err = thread_image_writer().write_pnm(filename,
+			HostImage<unsigned char>::interleaved(chan, (size_t)LD*NUMCOMP, NUMCOMP, NUMCOMP, WIDTH, HEIGHT, BPP),
+			"nvTIFF");
+	} else {
+		err = thread_image_writer().write_pnm(filename,
+			HostImage<unsigned short>::interleaved(reinterpret_cast<unsigned short *>(chan),
+				(size_t)LD*NUMCOMP*2, NUMCOMP, NUMCOMP, WIDTH, HEIGHT, BPP),
+			"nvTIFF");
+	}
+	if (err) {
+		std::cerr << "Cannot write output file: " << filename << std::endl;
+	}
+	return;
+}
+
+
+// Writes decoded image i as outImage_<i>.bmp, .ppm (16-bit samples) or
+// .raw (other grayscale images).
+static void writeDecodedImage(unsigned int i, unsigned char *imageOut_h, size_t imageSize,
+			      unsigned int width, unsigned int height, int photometricInt,
+			      int bitsPerSample, int samplesPerPixel) {
+
+	char outfname[MAX_STR_LEN];
+
+	const int bitsPerPixel = bitsPerSample*samplesPerPixel;
+	const int isgreyScale = (photometricInt == NVTIFF_PHOTOMETRIC_MINISWHITE) ||
+				(photometricInt == NVTIFF_PHOTOMETRIC_MINISBLACK);
+
+	if (bitsPerSample == 16) {
+
+		snprintf(outfname, MAX_STR_LEN, "outImage_%d.ppm", i);
+
+		printf("\t\timage %u... PPM format\n", i);
+		writePPM(outfname,
+			 imageOut_h,
+			 width,
+			 width,
+			 height,
+			 bitsPerSample, samplesPerPixel);
+	} else if (!isgreyScale || bitsPerPixel == 8) {
+
+		snprintf(outfname, MAX_STR_LEN, "outImage_%d.bmp", i);
+
+		printf("\t\timage %u... BMP format\n", i);
+		writeBMPFile(outfname,
+			     imageOut_h,
+			     width,
+			     width,
+			     height,
+			     bitsPerPixel/8,
+			     isgreyScale);
+	} else {
+		snprintf(outfname, MAX_STR_LEN, "outImage_%d.raw", i);
+
+		printf("\t\timage %u... RAW format\n", i);
+		FILE *f = Fopen(outfname, "w");
+		Fwrite(imageOut_h, imageSize, 1, f);
+		fclose(f);
+	}
+}
+
+// Decoder, stream and output buffers of one device, reused across files
+struct DeviceDecodeCtx {
+	int devId;
+	cudaStream_t stream;
+	nvtiffDecoder_t decoder;
+	std::vector<unsigned char *> imageOut_d;
+	size_t imageSize;	// bytes of each output buffer
+};
+
+// Makes sure the device has nimages output buffers of at least imageSize bytes.
+static void reserveOutput(DeviceDecodeCtx &ctx, unsigned int nimages, size_t imageSize) {
+
+	if (imageSize > ctx.imageSize) {
+		for(size_t i = 0; i < ctx.imageOut_d.size(); i++) {
+			CHECK_CUDA(cudaFree(ctx.imageOut_d[i]));
+			CHECK_CUDA(cudaMalloc(&ctx.imageOut_d[i], imageSize));
+		}
+		ctx.imageSize = imageSize;
+	}
+	while (ctx.imageOut_d.size() < nimages) {
+		unsigned char *image_d;
+		CHECK_CUDA(cudaMalloc(&image_d, ctx.imageSize));
+		ctx.imageOut_d.push_back(image_d);
+	}
+}
+
+// Service mode (-l): decodes every file of the list, parsing upcoming files
+// on CPU threads while earlier ones decode, with the subfiles of each file
+// shared among the first numGpus devices (all visible devices if 0).
+static int decodeFileList(const char *listName, int numGpus, ServiceConfig config, int verbose) {
+
+	std::vector<std::string> files;
+	if (readFileList(listName, files)) {
+		fprintf(stderr, "Cannot read file list %s\n", listName);
+		return EXIT_FAILURE;
+	}
+
+	int ndev = 0;
+	CHECK_CUDA(cudaGetDeviceCount(&ndev));
+	if (numGpus <= 0 || numGpus > ndev) {
+		numGpus = ndev;
+	}
+	config.num_devices = numGpus;
+	if (config.prefetch < 1) {
+		config.prefetch = 2*config.num_devices + config.parse_threads;
+	}
+
+	printf("\nUsing %d GPU(s):\n", numGpus);
+	std::vector<DeviceDecodeCtx> ctxs(numGpus);
+	for(int d = 0; d < numGpus; d++) {
+		cudaDeviceProp props;
+		CHECK_CUDA(cudaSetDevice(d));
+		CHECK_CUDA(cudaGetDeviceProperties(&props, d));
+		printf("\t%2d (%s, %d SMs, %d th/SM max, CC %d.%d, ECC %s)\n",
+				d, props.name, props.multiProcessorCount,
+				props.maxThreadsPerMultiProcessor,
+				props.major, props.minor,
+				props.ECCEnabled?"on":"off");
+
+		ctxs[d].devId = d;
+		ctxs[d].imageSize = 0;
+		CHECK_CUDA(cudaStreamCreate(&ctxs[d].stream));
+		CHECK_NVTIFF(nvtiffDecoderCreate(&ctxs[d].decoder, nullptr, nullptr, ctxs[d].stream));
+	}
+	printf("\n");
+
+	// one parsed file per slot; a slot is reused once all its subfiles are decoded
+	std::vector<nvtiffStream_t> tiff_streams(config.prefetch);
+	std::vector<nvtiffFileInfo_t> file_infos(config.prefetch);
+	for(int s = 0; s < config.prefetch; s++) {
+		CHECK_NVTIFF(nvtiffStreamCreate(&tiff_streams[s]));
+	}
+
+	std::atomic<unsigned long long> inBytes(0);
+	std::atomic<unsigned long long> outBytes(0);
+
+	printf("Decoding %zu files with %d parse threads, %d files prefetched, %u subfiles per job... ",
+		files.size(), config.parse_threads, config.prefetch, config.pages_per_job);
+	fflush(stdout);
+
+	double __t = Wtime();
+	ServiceStats stats = runDecodeService((int)files.size(), config,
+		[&](int file, int slot) -> long long {
+			const nvtiffStatus_t st = nvtiffStreamParseFromFile(files[file].c_str(), tiff_streams[slot]);
+			if (st != NVTIFF_STATUS_SUCCESS) {
+				fprintf(stderr, "\nCannot parse %s (nvTiff error %d), skipping\n", files[file].c_str(), (int)st);
+				return -1;
+			}
+			CHECK_NVTIFF(nvtiffStreamGetFileInfo(tiff_streams[slot], &file_infos[slot]));
+			inBytes += getFsize(files[file].c_str());
+			if (verbose) {
+				printf("\n\t%s: %u %ux%u subfile(s)", files[file].c_str(), file_infos[slot].num_images,
+					file_infos[slot].image_width, file_infos[slot].image_height);
 			}
+			return file_infos[slot].num_images;
+		},
+		[&](int dev, const ServiceJob &job) -> bool {
+			DeviceDecodeCtx &ctx = ctxs[dev];
+			const nvtiffFileInfo_t &info = file_infos[job.slot];
+			const size_t imageSize = (size_t)info.image_width*info.image_height*(info.bits_per_pixel/8);
+
+			CHECK_CUDA(cudaSetDevice(ctx.devId));
+			reserveOutput(ctx, job.count, imageSize);
+			const nvtiffStatus_t st = nvtiffDecodeRange(tiff_streams[job.slot], ctx.decoder,
+								    job.first, job.count, ctx.imageOut_d.data(), ctx.stream);
+			CHECK_CUDA(cudaStreamSynchronize(ctx.stream));
+			if (st != NVTIFF_STATUS_SUCCESS) {
+				fprintf(stderr, "\nCannot decode subfiles [%u, %u] of %s (nvTiff error %d)\n",
+					job.first, job.first+job.count-1, files[job.file].c_str(), (int)st);
+				return false;
+			}
+			outBytes += imageSize*job.count;
+			return true;
+		},
+		Wtime);
+	__t = Wtime()-__t;
+
+	printf("done in %lf secs\n\n", __t);
+	printf("\t%d files decoded, %d failed, %llu subfiles\n", stats.files, stats.failed, stats.pages);
+	printf("\t%.1lf pages/s, %.1lf MB/s decoded, %.1lf MB/s read (parsing: %lf secs on %d threads)\n",
+		stats.pages/__t, outBytes/__t/1.0E+6, inBytes/__t/1.0E+6, stats.parse_seconds, config.parse_threads);
+	for(int d = 0; d < numGpus; d++) {
+		printf("\tGPU %2d: %llu subfiles in %d jobs\n", d, stats.device_pages[d], stats.device_jobs[d]);
+	}
+	printf("\n");
+
+	for(int s = 0; s < config.prefetch; s++) {
+		CHECK_NVTIFF(nvtiffStreamDestroy(tiff_streams[s]));
+	}
+	for(int d = 0; d < numGpus; d++) {
+		CHECK_CUDA(cudaSetDevice(ctxs[d].devId));
+		for(size_t i = 0; i < ctxs[d].imageOut_d.size(); i++) {
+			CHECK_CUDA(cudaFree(ctxs[d].imageOut_d[i]));
+		}
+		CHECK_NVTIFF(nvtiffDecoderDestroy(ctxs[d].decoder, ctxs[d].stream));
+		CHECK_CUDA(cudaStreamDestroy(ctxs[d].stream));
+	}
+	return stats.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+// One slot of the encode ring: compressed strips of a chunk on the device
+// and, once encoded, in pinned host memory
+struct EncodeSlot {
+	cudaStream_t stream;
+	nvTiffEncodeCtx_t *ctx;
+	unsigned long long maxStrips;	// strips of the size/offset arrays
+	unsigned long long dataBytes;	// bytes of the strip data buffers
+	unsigned long long stripAlloc;	// bytes per strip of the chunk in flight
+	unsigned long long *stripSize_d;
+	unsigned long long *stripOffs_d;
+	unsigned char      *stripData_d;
+	unsigned long long *stripSize_h;
+	unsigned long long *stripOffs_h;
+	unsigned char      *stripData_h;
+	std::vector<unsigned char *> images_d;	// first row of the chunk in each subfile
+	unsigned char      *tiles_d;		// tiled encode: the tiles of the chunk
+	unsigned long long tilesBytes;
+	EncodeChunk chunk;
+	int busy;
+
+	EncodeSlot() : stream(NULL), ctx(NULL), maxStrips(0), dataBytes(0), stripAlloc(0),
+		       stripSize_d(NULL), stripOffs_d(NULL), stripData_d(NULL),
+		       stripSize_h(NULL), stripOffs_h(NULL), stripData_h(NULL),
+		       tiles_d(NULL), tilesBytes(0), busy(0) {}
+};
+
+// Tiled encode (--tile). nvTiffEncode compresses strips of contiguous rows,
+// so each tile is gathered into a buffer of its own and encoded as an image
+// of tileLength rows in one strip: the planner's subfiles are the tiles of
+// all subfiles, in file order.
+struct EncodeTiling {
+	unsigned char **images_d;	// device array of the subfile images
+	unsigned int nrow;
+	unsigned int tileWidth;
+	unsigned int tileLength;
+	unsigned int tilesAcross;
+	unsigned int tilesPerImage;
+};
+
+// Copies tiles [first, first+gridDim.x) of the global tile index into
+// consecutive tiles of tw x th pixels; the parts of the edge tiles outside
+// the image are zero.
+__global__ void gatherTiles(unsigned char *const *images_d, unsigned long long first,
+			    unsigned int tilesAcross, unsigned int tilesPerImage,
+			    unsigned int ncol, unsigned int nrow, unsigned int tw, unsigned int th,
+			    unsigned int pixelSize, unsigned char *tiles_d) {
+
+	const unsigned long long t = first + blockIdx.x;
+	const unsigned char *image = images_d[t / tilesPerImage];
+	const unsigned int tile = t % tilesPerImage;
+	const unsigned int x0 = (tile % tilesAcross)*tw*pixelSize;
+	const unsigned int y0 = (tile / tilesAcross)*th;
+	const size_t rowBytes = (size_t)ncol*pixelSize;
+	const unsigned int tileRowBytes = tw*pixelSize;
+
+	unsigned char *out = tiles_d + (size_t)blockIdx.x*tileRowBytes*th;
+	for(unsigned int i = threadIdx.x; i < tileRowBytes*th; i += blockDim.x) {
+		const unsigned int y = y0 + i / tileRowBytes;
+		const unsigned int x = x0 + i % tileRowBytes;
+		out[i] = (y < nrow && x < rowBytes) ? image[y*rowBytes + x] : 0;
+	}
+}
+
+// Makes room in the slot for chunks of maxStrips strips of stripAlloc bytes,
+// and for maxStrips tiles of tileBytes when encoding tiles.
+static void reserveEncodeSlot(EncodeSlot &slot, int devId, unsigned int nStripOut,
+			      unsigned long long maxStrips, unsigned long long stripAlloc,
+			      unsigned long long tileBytes) {
+
+	if (!slot.stream) {
+		CHECK_CUDA(cudaStreamCreate(&slot.stream));
+	}
+	if (maxStrips > slot.maxStrips) {
+		if (slot.ctx) {
+			nvTiffEncodeCtxDestroy(slot.ctx);
+			CHECK_CUDA(cudaFree(slot.stripSize_d));
+			CHECK_CUDA(cudaFree(slot.stripOffs_d));
+			CHECK_CUDA(cudaFreeHost(slot.stripSize_h));
+			CHECK_CUDA(cudaFreeHost(slot.stripOffs_h));
+		}
+		// whole subfiles, or a band of strips of one subfile
+		const unsigned int ctxSubFiles = std::max(1ULL, maxStrips/nStripOut);
+		const unsigned int ctxStrips = std::min<unsigned long long>(maxStrips, nStripOut);
+		slot.ctx = nvTiffEncodeCtxCreate(devId, ctxSubFiles, ctxStrips);
+		CHECK_CUDA(cudaMalloc(&slot.stripSize_d, sizeof(*slot.stripSize_d)*maxStrips));
+		CHECK_CUDA(cudaMalloc(&slot.stripOffs_d, sizeof(*slot.stripOffs_d)*maxStrips));
+		CHECK_CUDA(cudaMallocHost(&slot.stripSize_h, sizeof(*slot.stripSize_h)*maxStrips));
+		CHECK_CUDA(cudaMallocHost(&slot.stripOffs_h, sizeof(*slot.stripOffs_h)*maxStrips));
+		slot.maxStrips = maxStrips;
+	}
+	if (maxStrips*stripAlloc > slot.dataBytes) {
+		if (slot.stripData_d) {
+			CHECK_CUDA(cudaFree(slot.stripData_d));
+			CHECK_CUDA(cudaFreeHost(slot.stripData_h));
+		}
+		slot.dataBytes = maxStrips*stripAlloc;
+		CHECK_CUDA(cudaMalloc(&slot.stripData_d, slot.dataBytes));
+		CHECK_CUDA(cudaMallocHost(&slot.stripData_h, slot.dataBytes));
+	}
+	if (maxStrips*tileBytes > slot.tilesBytes) {
+		if (slot.tiles_d) {
+			CHECK_CUDA(cudaFree(slot.tiles_d));
+		}
+		slot.tilesBytes = maxStrips*tileBytes;
+		CHECK_CUDA(cudaMalloc(&slot.tiles_d, slot.tilesBytes));
+	}
+	slot.stripAlloc = stripAlloc;
+}
+
+static void issueEncodeChunk(EncodeSlot &slot, const EncodeChunk &chunk, unsigned char **imageOut_d,
+			     unsigned int ncol, unsigned short pixelSize, int rowsPerStrip,
+			     const EncodeTiling *tiling) {
+
+	slot.chunk = chunk;
+	slot.images_d.resize(chunk.nSubFiles);
+	if (tiling) {
+		const size_t tileBytes = (size_t)tiling->tileWidth*tiling->tileLength*pixelSize;
+		gatherTiles<<<chunk.nSubFiles, 256, 0, slot.stream>>>(tiling->images_d, chunk.subfile,
+								     tiling->tilesAcross, tiling->tilesPerImage,
+								     ncol, tiling->nrow,
+								     tiling->tileWidth, tiling->tileLength,
+								     pixelSize, slot.tiles_d);
+		CHECK_CUDA(cudaGetLastError());
+		for(unsigned int i = 0; i < chunk.nSubFiles; i++) {
+			slot.images_d[i] = slot.tiles_d + i*tileBytes;
+		}
+		ncol = tiling->tileWidth;
+		rowsPerStrip = tiling->tileLength;
+	} else {
+		for(unsigned int i = 0; i < chunk.nSubFiles; i++) {
+			slot.images_d[i] = imageOut_d[chunk.subfile + i] +
+					   (size_t)chunk.strip*rowsPerStrip*ncol*pixelSize;
+		}
+	}
+	int rv = nvTiffEncode(slot.ctx,
+			      chunk.nrow,
+			      ncol,
+			      pixelSize,
+			      rowsPerStrip,
+			      chunk.nSubFiles,
+			      slot.images_d.data(),
+			      slot.stripAlloc,
+			      slot.stripSize_d,
+			      slot.stripOffs_d,
+			      slot.stripData_d,
+			      slot.stream);
+	if (rv != NVTIFF_ENCODE_SUCCESS) {
+		printf("error, while encoding images!\n");
+		exit(EXIT_FAILURE);
+	}
+	slot.busy = 1;
+}
+
+// Waits for the chunk of the slot and copies its strips to the host.
+// Returns NVTIFF_ENCODE_COMP_OVERFLOW if a strip did not fit in stripAlloc.
+static int finishEncodeChunk(EncodeSlot &slot) {
+
+	int rv = nvTiffEncodeFinalize(slot.ctx, slot.stream);
+	if (rv == NVTIFF_ENCODE_COMP_OVERFLOW) {
+		return rv;
+	}
+	if (rv != NVTIFF_ENCODE_SUCCESS) {
+		printf("error, while finalizing compressed images!\n");
+		exit(EXIT_FAILURE);
+	}
+	const unsigned long long nStrips = slot.chunk.totStrips();
+	CHECK_CUDA(cudaMemcpyAsync(slot.stripSize_h, slot.stripSize_d, sizeof(*slot.stripSize_h)*nStrips,
+				   cudaMemcpyDeviceToHost, slot.stream));
+	CHECK_CUDA(cudaMemcpyAsync(slot.stripOffs_h, slot.stripOffs_d, sizeof(*slot.stripOffs_h)*nStrips,
+				   cudaMemcpyDeviceToHost, slot.stream));
+	CHECK_CUDA(cudaMemcpyAsync(slot.stripData_h, slot.stripData_d, slot.ctx->stripSizeTot,
+				   cudaMemcpyDeviceToHost, slot.stream));
+	CHECK_CUDA(cudaStreamSynchronize(slot.stream));
+	return NVTIFF_ENCODE_SUCCESS;
+}
+
+static void destroyEncodeSlot(EncodeSlot &slot) {
+
+	if (slot.ctx) {
+		nvTiffEncodeCtxDestroy(slot.ctx);
+		CHECK_CUDA(cudaFree(slot.stripSize_d));
+		CHECK_CUDA(cudaFree(slot.stripOffs_d));
+		CHECK_CUDA(cudaFreeHost(slot.stripSize_h));
+		CHECK_CUDA(cudaFreeHost(slot.stripOffs_h));
+	}
+	if (slot.stripData_d) {
+		CHECK_CUDA(cudaFree(slot.stripData_d));
+		CHECK_CUDA(cudaFreeHost(slot.stripData_h));
+	}
+	if (slot.tiles_d) {
+		CHECK_CUDA(cudaFree(slot.tiles_d));
+	}
+	if (slot.stream) {
+		CHECK_CUDA(cudaStreamDestroy(slot.stream));
+	}
+	slot = EncodeSlot();
+}
 
-			if (red > 255) red = 255; if (red < 0) red = 0;
-			if (green > 255) green = 255; if (green < 0) green = 0;
-			if (blue > 255) blue = 255; if (blue < 0) blue = 0;
-			// Also, it's written in (b,g,r) format...
+// Decodes the strips or tiles of an encoded chunk with the CPU codec and
+// compares them with the host copies of the images they were encoded from;
+// returns the number that differ.
+static int checkEncodeChunk(const EncodeSlot &slot, const TiffImageDesc &desc, unsigned int nStripOut,
+			    const std::vector<std::vector<unsigned char>> &images_h, int nthreads) {
+
+	const unsigned long long first = slot.chunk.firstStrip(nStripOut);
+	const unsigned int across = desc.chunksAcross();
+	const unsigned int perImage = across*desc.chunksDown();
+	const unsigned int cw = desc.tiled() ? desc.tileWidth : desc.ncol;
+	const unsigned int ch = desc.tiled() ? desc.tileLength : desc.rowsPerStrip;
+	const size_t pixelSize = tiffRowBytes(desc)/desc.ncol;
+	const size_t rowBytes = tiffRowBytes(desc);
+
+	std::atomic<int> bad(0);
+	parallelFor(slot.chunk.totStrips(), nthreads, [&](size_t k) {
+
+		const std::vector<unsigned char> &image = images_h[(first + k) / perImage];
+		const unsigned int c = (first + k) % perImage;
+		const unsigned int x0 = (c % across)*cw;
+		const unsigned int y0 = (c / across)*ch;
+		const unsigned int rows = std::min(ch, desc.nrow - y0);
+
+		// the last strip is short, edge tiles are zero padded
+		std::vector<unsigned char> ref((size_t)(desc.tiled() ? ch : rows)*cw*pixelSize, 0);
+		for(unsigned int r = 0; r < rows; r++) {
+			memcpy(ref.data() + (size_t)r*cw*pixelSize, image.data() + (y0 + r)*rowBytes + x0*pixelSize,
+			       std::min(cw, desc.ncol - x0)*pixelSize);
+		}
+		std::vector<unsigned char> out(ref.size());
+		size_t n = 0;
+		if (lzwDecode(slot.stripData_h + slot.stripOffs_h[k], slot.stripSize_h[k], out.data(), out.size(), &n) ||
+		    n != ref.size() || out != ref) {
+			bad++;
+		}
+	});
+	return bad;
+}
 
-			fprintf(outfile, "%c", blue);
-			fprintf(outfile, "%c", green);
-			fprintf(outfile, "%c", red);
+// The window clipped to the image, or the whole image if window is NULL.
+static TiffRect clipWindow(const TiffImageDesc &desc, const TiffRect *window) {
+
+	TiffRect r = {0, 0, desc.ncol, desc.nrow};
+	if (window) {
+		r.x0 = std::min(window->x0, desc.ncol);
+		r.y0 = std::min(window->y0, desc.nrow);
+		r.x1 = std::min(window->x1, desc.ncol);
+		r.y1 = std::min(window->y1, desc.nrow);
+	}
+	return r;
+}
+
+// Decode window (--window). The nvTIFF decoder reads strips only, so the
+// strips or tiles that intersect the window are repackaged, still compressed,
+// as the pages of a TIFF file built in memory: the band of strips across the
+// window of each subfile, or each tile as an image of one strip. The pages
+// are decoded in one call and their parts inside the window copied into the
+// output images.
+struct WindowPage {
+	unsigned int subfile;	// output image
+	TiffRect rect;		// the page in its subfile
+	TiffRect area;		// the part of the page inside the window
+};
+
+struct WindowFile {
+	std::vector<unsigned char> data;
+	TiffImageDesc page;		// layout of every page
+	std::vector<WindowPage> pages;
+	TiffRect window;		// clipped to the images
+	unsigned long long chunks;	// strips or tiles in the pages...
+	unsigned long long chunksTot;	// ...and in the images
+};
+
+static int buildWindowFile(const TiffMappedFile &file, int frameBeg, int nDecode,
+			   const TiffRect &window, WindowFile &wf) {
+
+	const TiffImageDesc &desc = file.image(frameBeg).desc;
+	if (desc.planarConf != 1 && desc.samplesPerPixel > 1) {
+		fprintf(stderr, "Decode window: planar images are not supported\n");
+		return 1;
+	}
+	// the pages are written little endian, with the strips as they are
+	if (file.bigEndian() && desc.bitsPerSample[0] > 8) {
+		fprintf(stderr, "Decode window: big endian files with %d-bit samples are not supported\n",
+			desc.bitsPerSample[0]);
+		return 1;
+	}
+	wf.window = clipWindow(desc, &window);
+	if (wf.window.empty()) {
+		fprintf(stderr, "Decode window: %u,%u,%u,%u is outside the %ux%u images\n",
+			window.x0, window.y0, window.x1, window.y1, desc.ncol, desc.nrow);
+		return 1;
+	}
+
+	TiffFileWriter writer;
+	if (writer.open(&wf.data, file.bigTiff())) return 1;
+
+	wf.pages.clear();
+	wf.chunks = wf.chunksTot = 0;
+	std::vector<TiffChunkArea> chunks;
+	for(int i = 0; i < nDecode; i++) {
+
+		const TiffDirectory &dir = file.image(frameBeg + i);
+		const TiffImageDesc &d = dir.desc;
+		if (d.nrow != desc.nrow || d.ncol != desc.ncol || tiffRowBytes(d) != tiffRowBytes(desc) ||
+		    d.tileWidth != desc.tileWidth || d.tileLength != desc.tileLength ||
+		    (!d.tiled() && d.rowsPerStrip != desc.rowsPerStrip)) {
+			fprintf(stderr, "Decode window: image %d has a different layout than image %d\n",
+				frameBeg + i, frameBeg);
+			return 1;
+		}
+		d.chunksInWindow(wf.window, chunks);
+
+		std::vector<TiffSpan> spans(chunks.size());
+		std::vector<unsigned long long> offs(chunks.size()), counts(chunks.size());
+		for(size_t k = 0; k < chunks.size(); k++) {
+			spans[k] = file.chunk(frameBeg + i, chunks[k].chunk);
+			counts[k] = spans[k].size;
 		}
-		if (extrabytes)      // See above - BMP lines must be of lengths divisible by 4.
-		{
-			for (n = 1; n <= extrabytes; n++)
-			{
-				fprintf(outfile, "%c", 0);
+		if (writer.appendChunks(spans.data(), spans.size(), offs.data())) return 1;
+
+		wf.page = d;
+		if (d.tiled()) {
+			// edge tiles are whole tiles in the file
+			wf.page.ncol = d.tileWidth;
+			wf.page.nrow = wf.page.rowsPerStrip = d.tileLength;
+			wf.page.tileWidth = wf.page.tileLength = 0;
+			for(size_t k = 0; k < chunks.size(); k++) {
+				const TiffRect &r = chunks[k].rect;
+				const WindowPage p = {(unsigned int)i, {r.x0, r.y0, r.x0 + d.tileWidth, r.y0 + d.tileLength},
+						      chunks[k].area};
+				if (writer.appendImage(wf.page, &offs[k], &counts[k], 1)) return 1;
+				wf.pages.push_back(p);
 			}
+		} else {
+			const WindowPage p = {(unsigned int)i, {0, chunks.front().rect.y0, d.ncol, chunks.back().rect.y1},
+					      wf.window};
+			wf.page.nrow = p.rect.height();
+			if (writer.appendImage(wf.page, offs.data(), counts.data(), chunks.size())) return 1;
+			wf.pages.push_back(p);
 		}
+		wf.chunks += chunks.size();
+		wf.chunksTot += dir.numChunks;
 	}
+	return writer.close();
+}
 
-	fclose(outfile);
-	return;
+// Copies the part inside the window of each decoded page into its image.
+static void copyWindowPages(const WindowFile &wf, unsigned char *const *pages_d,
+			    unsigned char **imageOut_d, cudaStream_t stream) {
+
+	const size_t pixelSize = tiffRowBytes(wf.page)/wf.page.ncol;
+	const size_t pagePitch = tiffRowBytes(wf.page);
+	const size_t outPitch = wf.window.width()*pixelSize;
+	for(size_t k = 0; k < wf.pages.size(); k++) {
+		const WindowPage &p = wf.pages[k];
+		CHECK_CUDA(cudaMemcpy2DAsync(imageOut_d[p.subfile] + (p.area.y0 - wf.window.y0)*outPitch +
+					     (p.area.x0 - wf.window.x0)*pixelSize,
+					     outPitch,
+					     pages_d[k] + (p.area.y0 - p.rect.y0)*pagePitch + (p.area.x0 - p.rect.x0)*pixelSize,
+					     pagePitch,
+					     p.area.width()*pixelSize,
+					     p.area.height(),
+					     cudaMemcpyDeviceToDevice,
+					     stream));
+	}
 }
 
+// Decodes the images, or their part inside window if not NULL, again with
+// the CPU codec and compares them byte for byte with the GPU output; returns
+// the number of images that differ.
+static int checkDecodeOnCpu(const char *fname, int frameBeg, int nDecode, const TiffRect *window,
+			    unsigned char **imageOut_d, size_t imageSize, int nthreads, double gpuSecs) {
 
-void writePPM(const char * filename, unsigned char *chan, int LD, int WIDTH, int HEIGHT, int BPP, int NUMCOMP)
-{
-    std::ofstream rOutputStream(filename);
-    if (!rOutputStream)
-    {
-        std::cerr << "Cannot open output file: " << filename << std::endl;
-        return;   
-    }
+	TiffMappedFile file;
+	if (file.open(fname)) {
+		fprintf(stderr, "CPU check: cannot read %s\n", fname);
+		return nDecode;
+	}
+	printf("\tChecking the images with the CPU decoder on %d thread(s)...\n", nthreads);
+	fflush(stdout);
 
-    
-    
-    if( NUMCOMP ==4)
-    {
-        rOutputStream << "P7\n";
-        rOutputStream << "#nvTIFF\n";
-        rOutputStream << "WIDTH "<<WIDTH<<"\n";
-        rOutputStream << "HEIGHT "<<HEIGHT<<"\n";
-        rOutputStream << "DEPTH "<<NUMCOMP<<"\n";
-        rOutputStream << "MAXVAL "<<(1<<BPP)-1<<"\n";
-        rOutputStream << "TUPLTYPE RGB_ALPHA\n";
-        rOutputStream << "ENDHDR\n";
-    }
-    else
-    {
-        rOutputStream << "P6\n";
-        rOutputStream << "#nvTIFF\n";
-        rOutputStream << WIDTH << " " << HEIGHT << "\n";
-        rOutputStream << (1<<BPP)-1<<"\n";
-    }
-    for(int y = 0; y < HEIGHT; y++)
-    {
-        for(int x = 0; x < WIDTH; x++)
-        {
-            if( BPP == 8)
-            {
-				rOutputStream << chan[(y*LD + x)*NUMCOMP];
-                rOutputStream << chan[(y*LD + x)*NUMCOMP + 1];
-                rOutputStream << chan[(y*LD + x)*NUMCOMP + 2];
-                if( NUMCOMP == 4)
-                {
-                    rOutputStream << chan[(y*LD + x)*NUMCOMP + 3];;
-                }
-            }
-            else
-            {
-                int pixel_offset = (y * LD *NUMCOMP*2 + (x*NUMCOMP*2 ));
-				for( int c = 0; c < NUMCOMP; c++)
-				{
-					rOutputStream << chan[pixel_offset + 2 * c +1]<<chan[pixel_offset + 2*c];
-				}
+	std::vector<unsigned char> cpu(imageSize), gpu(imageSize);
+	double secs = 0;
+	int bad = 0;
+	for(int i = 0; i < nDecode; i++) {
+
+		const size_t image = frameBeg + i;
+		const TiffImageDesc *d = image < file.numImages() ? &file.image(image).desc : NULL;
+		const TiffRect rect = d ? clipWindow(*d, window) : TiffRect();
+		if (!d || tiffRowBytes(*d)/d->ncol*rect.width()*rect.height() != imageSize) {
+			printf("\t\timage %zu: not found with the same size\n", image);
+			bad++;
+			continue;
+		}
+		double __t = Wtime();
+		const int rv = cpuDecodeWindow(file, image, rect, cpu.data(), nthreads);
+		secs += Wtime()-__t;
+		if (rv) {
+			bad++;
+			continue;
+		}
+		CHECK_CUDA(cudaMemcpy(gpu.data(), imageOut_d[i], imageSize, cudaMemcpyDeviceToHost));
+		const auto diff = std::mismatch(cpu.begin(), cpu.end(), gpu.begin());
+		if (diff.first != cpu.end()) {
+			printf("\t\timage %zu: first difference at byte %zu (GPU %d, CPU %d)\n",
+				image, (size_t)(diff.first - cpu.begin()), *diff.second, *diff.first);
+			bad++;
+		}
+	}
+	printf("\t...%d of %d image(s) match, CPU decode in %lf secs (%.2lfx the GPU time)\n\n",
+		nDecode-bad, nDecode, secs, secs/gpuSecs);
+	return bad;
+}
 
-            }
-            
-        }
-    }
-    return;
+// Decodes, and optionally encodes, the images of the file, or their part
+// inside window if not NULL, with the CPU codec, for hosts without a GPU.
+// Output files are the ones of the GPU path.
+static int runOnCpu(const char *fname, int frameBeg, int frameEnd, const TiffRect *window,
+		    int nthreads, int decWriteOutN, int doEncode, int encRowsPerStrip,
+		    unsigned int encTileWidth, unsigned int encTileLength, int encWriteOut, int encBigTiff) {
+
+	TiffMappedFile file;
+	if (file.open(fname) || !file.numImages()) {
+		fprintf(stderr, "Cannot read TIFF file %s\n", fname);
+		return EXIT_FAILURE;
+	}
+	frameBeg = std::max(frameBeg, 0);
+	frameEnd = std::min<int>(frameEnd, file.numImages()-1);
+	if (frameBeg > frameEnd) {
+		fprintf(stderr, "Invalid frame range!\n");
+		return EXIT_FAILURE;
+	}
+	const int nDecode = frameEnd-frameBeg+1;
+
+	// all images in the file must have the same properties, as on the GPU
+	const TiffImageDesc &desc = file.image(frameBeg).desc;
+	for(int i = frameBeg; i <= frameEnd; i++) {
+		const TiffImageDesc &d = file.image(i).desc;
+		if (d.nrow != desc.nrow || d.ncol != desc.ncol || tiffRowBytes(d) != tiffRowBytes(desc)) {
+			fprintf(stderr, "Image %d has a different size than image %d\n", i, frameBeg);
+			return EXIT_FAILURE;
+		}
+	}
+	// the output images are the window
+	const TiffRect rect = clipWindow(desc, window);
+	if (rect.empty()) {
+		fprintf(stderr, "Decode window: %u,%u,%u,%u is outside the %ux%u images\n",
+			window->x0, window->y0, window->x1, window->y1, desc.ncol, desc.nrow);
+		return EXIT_FAILURE;
+	}
+	const unsigned int ncol = rect.width();
+	const unsigned int nrow = rect.height();
+	const size_t imageSize = tiffRowBytes(desc)/desc.ncol*ncol*nrow;
+	std::vector<std::vector<unsigned char>> images(nDecode, std::vector<unsigned char>(imageSize));
+
+	if (window) {
+		std::vector<TiffChunkArea> chunks;
+		desc.chunksInWindow(rect, chunks);
+		printf("Window %u,%u,%u,%u: %zu of %llu %s per image\n",
+			rect.x0, rect.y0, rect.x1, rect.y1, chunks.size(),
+			file.image(frameBeg).numChunks, desc.tiled() ? "tiles" : "strips");
+	}
+	printf("Decoding %u, %s %ux%u images [%d, %d], from file %s on %d CPU thread(s)... ",
+		nDecode,
+		desc.photometricInt == NVTIFF_PHOTOMETRIC_RGB ? "RGB" : "Grayscale",
+		ncol,
+		nrow,
+		frameBeg,
+		frameEnd,
+		fname,
+		nthreads);
+	fflush(stdout);
+
+	double __t = Wtime();
+	for(int i = 0; i < nDecode; i++) {
+		if (cpuDecodeWindow(file, frameBeg+i, rect, images[i].data(), nthreads)) {
+			printf("error, while decoding image %d!\n", frameBeg+i);
+			return EXIT_FAILURE;
+		}
+	}
+	__t = Wtime()-__t;
+	printf("done in %lf secs\n\n", __t);
+
+	if (decWriteOutN) {
+
+		const unsigned int nout = std::min(decWriteOutN, nDecode);
+
+		printf("\tWriting images for the first %d subfile(s)...\n", nout);
+		fflush(stdout);
+
+		__t = Wtime();
+		for(unsigned int i = 0; i < nout; i++) {
+			writeDecodedImage(i, images[i].data(), imageSize,
+					  ncol,
+					  nrow,
+					  desc.photometricInt,
+					  desc.bitsPerSample[0],
+					  desc.samplesPerPixel);
+		}
+		__t = Wtime()-__t;
+		printf("\t...done in %lf secs\n\n", __t);
+	}
+
+	if (doEncode) {
+
+		TiffImageDesc enc = desc;
+		enc.ncol = ncol;
+		enc.nrow = nrow;
+		enc.rowsPerStrip = std::min<unsigned int>(encRowsPerStrip, nrow);
+		enc.tileWidth = encTileWidth;
+		enc.tileLength = encTileLength;
+		enc.compression = 5;
+		enc.predictor = 1;
+		const bool bigTiff = encBigTiff || double(imageSize)*nDecode > 0.9*4294967295.0;
+
+		TiffFileWriter writer;
+		if (encWriteOut && writer.open("outFile.tif", bigTiff)) {
+			fprintf(stderr, "Cannot open outFile.tif\n");
+			return EXIT_FAILURE;
+		}
+
+		char layout[64];
+		if (enc.tiled()) {
+			snprintf(layout, sizeof(layout), "%ux%u tiles", enc.tileWidth, enc.tileLength);
+		} else {
+			snprintf(layout, sizeof(layout), "%u rows per strip", enc.rowsPerStrip);
+		}
+		printf("Encoding %u, %s %ux%u images using %s on %d CPU thread(s)... ",
+			nDecode,
+			enc.photometricInt == NVTIFF_PHOTOMETRIC_RGB ? "RGB" : "Grayscale",
+			enc.ncol,
+			enc.nrow,
+			layout,
+			nthreads);
+		fflush(stdout);
+
+		std::vector<std::vector<unsigned char>> strips;
+		unsigned long long stripSizeTot = 0;
+		__t = Wtime();
+		for(int i = 0; i < nDecode; i++) {
+			if (cpuEncodeImage(enc, images[i].data(), nthreads, strips)) {
+				printf("error, while encoding image %d!\n", frameBeg+i);
+				return EXIT_FAILURE;
+			}
+			std::vector<TiffSpan> spans(strips.size());
+			std::vector<unsigned long long> offs(strips.size()), counts(strips.size());
+			for(size_t k = 0; k < strips.size(); k++) {
+				spans[k].data = strips[k].data();
+				spans[k].size = counts[k] = strips[k].size();
+				stripSizeTot += counts[k];
+			}
+			if (encWriteOut &&
+			    (writer.appendChunks(spans.data(), spans.size(), offs.data()) ||
+			     writer.appendImage(enc, offs.data(), counts.data(), strips.size()))) {
+				fprintf(stderr, "Error while writing to outFile.tif\n");
+				return EXIT_FAILURE;
+			}
+		}
+		if (encWriteOut && writer.close()) {
+			fprintf(stderr, "Error while writing to outFile.tif\n");
+			return EXIT_FAILURE;
+		}
+		__t = Wtime()-__t;
+
+		printf("done in %lf secs (compr. ratio: %.2lfx)\n\n", __t, double(imageSize)*nDecode/stripSizeTot);
+		if (encWriteOut) {
+			printf("\tWrote %u compressed images to outFile.tif (%s, %llu bytes)\n\n",
+				nDecode, bigTiff ? "BigTIFF" : "TIFF", writer.size());
+		}
+	}
+	return EXIT_SUCCESS;
 }
 
 
@@ -239,6 +859,7 @@ static void usage(const char *pname) {
 	fprintf(stdout, 
 		"Usage:\n"
 		"%s [options] -f|--file <TIFF_FILE>\n"
+		"%s [options] -l|--file-list <LIST_FILE>\n"
 		"\n"
 		"General options:\n"
 		"\n"
@@ -265,7 +886,7 @@ static void usage(const char *pname) {
                 "\t\t  * image data compressed with LZW (Compression=5) or uncompressed              \n"
                 "\t\t  * pixel components stored in \"chunky\" format (RGB..., PlanarConfiguration=1)\n"
 		"\t\t    for RGB images                                                              \n"
-                "\t\t  * image data must be organized in Strips, not Tiles                           \n"
+                "\t\t  * image data must be organized in Strips, not Tiles (see --window)            \n"
                 "\t\t  * pixels of RGB images must be represented with at most 4 components          \n"
                 "\t\t  * each component must be represented exactly with:                            \n"
                 "\t\t      * 8 bits for LZW compressed images                                        \n"
@@ -308,6 +929,61 @@ static void usage(const char *pname) {
 		"\t\tOutput files are named outImage_0.bmp, outImage_1.bmp...\n"
 		"\t\tDefualt: disabled.\n"
 		"\n"
+		"\t--window X0,Y0,X1,Y1\n"
+		"\t\tDecodes only the area [X0, X1) x [Y0, Y1) of the images, clipped to them.  Only\n"
+		"\t\tthe strips or tiles that intersect the window are decoded,  and tiled images are\n"
+		"\t\tsupported: the strips or tiles are passed, still compressed, to the decoder as\n"
+		"\t\tthe pages of a TIFF file built in memory.  The output images, and the images\n"
+		"\t\tencoded with -E, are the window.\n"
+		"\t\tDefault: whole images.\n"
+		"\n"
+		"CPU options:\n"
+		"\n"
+		"\t--cpu-check\n"
+		"\t\tDecodes the images again with the CPU codec (LZW, Deflate, uncompressed) and\n"
+		"\t\tcompares them byte for byte with the GPU output,  reporting the CPU time.  With\n"
+		"\t\t-E, the encoded strips are also decoded on the CPU and compared with the images\n"
+		"\t\t(not counted in the encoding time).\n"
+		"\t\tDefault: disabled.\n"
+		"\n"
+		"\t--cpu\n"
+		"\t\tDecodes, and encodes with -E, on the CPU only.  This is also done when no CUDA\n"
+		"\t\tdevice is found.  The CPU codec supports strips and tiles,  and Deflate when it\n"
+		"\t\tis built with zlib.\n"
+		"\t\tDefault: disabled.\n"
+		"\n"
+		"\t--cpu-threads NUM_THREADS\n"
+		"\t\tNumber of CPU threads of the CPU codec; strips or tiles are decoded and encoded\n"
+		"\t\tin parallel.\n"
+		"\t\tDefault: all hardware threads.\n"
+		"\n"
+		"Service options:\n"
+		"\n"
+		"\t-l LIST_FILE\n"
+		"\t--file-list LIST_FILE\n"
+		"\t\tDecodes all the TIFF files listed in LIST_FILE, one path per line, and reports\n"
+		"\t\tthe aggregate throughput.  Files are parsed on CPU threads while the previous\n"
+		"\t\tones decode, and the subfiles of each file are shared among the GPUs.  Decoder,\n"
+		"\t\tstream and output buffers of each GPU are reused across files.  The decoding\n"
+		"\t\tand encoding options above are ignored.\n"
+		"\n"
+		"\t--gpus NUM_GPUS\n"
+		"\t\tNumber of GPUs to decode on (devices 0 to NUM_GPUS-1).\n"
+		"\t\tDefault: all visible GPUs.\n"
+		"\n"
+		"\t--parse-threads NUM_THREADS\n"
+		"\t\tNumber of CPU threads parsing files.\n"
+		"\t\tDefault: 2.\n"
+		"\n"
+		"\t--prefetch NUM_FILES\n"
+		"\t\tMaximum number of parsed files held in host memory.\n"
+		"\t\tDefault: 2*NUM_GPUS + NUM_THREADS.\n"
+		"\n"
+		"\t--pages-per-job NUM_PAGES\n"
+		"\t\tNumber of subfiles a GPU decodes at once; the subfiles of a file are split in\n"
+		"\t\tjobs of this size, which are taken by the first GPU that is free.\n"
+		"\t\tDefault: 8.\n"
+		"\n"
 		"Encoding options:\n"
 		"\n"
 		"\t-E\n"
@@ -325,19 +1001,39 @@ static void usage(const char *pname) {
 		"\t\tThis option is ignored if -E is not specified.\n"
 		"\t\tDefault: 1.\n"
 		"\n"
+		"\t--tile WIDTHxLENGTH\n"
+		"\t\tDivides the images into tiles of WIDTH x LENGTH pixels, multiples of 16, instead\n"
+		"\t\tof strips.  Each tile is compressed as an independent byte stream;  tiles  at\n"
+		"\t\tthe right and bottom edges are padded with zeros.\n"
+		"\t\tThis option is ignored if -E is not specified.\n"
+		"\t\tDefault: strips.\n"
+		"\n"
 		"\t-s\n"
 		"\t--stripalloc\n"
 		"\t\tSpecifies the initial estimate of the maximum size  of  compressed  strips.   If\n"
-		"\t\tduring compression one or more strips require more  space,  the  compression  is\n"
-		"\t\taborted and restarted automatically with a safe estimate. \n"
+		"\t\tduring compression one or more strips require more  space,  the  chunk  of  strips\n"
+		"\t\tbeing compressed is encoded again with a safe estimate. \n"
+		"\t\tThis option is ignored if -E is not specified.\n"
+		"\t\tDefault: the size, in bytes, of a strip (or tile) in the uncompressed images.\n" 
+		"\n"
+		"\t--ring-mb SIZE\n"
+		"\t\tDevice memory, in MiB, used for the compressed strips.  The strips are encoded in\n"
+		"\t\tchunks of whole images, or of consecutive strips of one image if an image does not\n"
+		"\t\tfit, through two buffers of half this size:  one chunk is encoded while the\n"
+		"\t\tprevious one is copied to the host and written.\n"
 		"\t\tThis option is ignored if -E is not specified.\n"
-		"\t\tDefault: the size, in bytes, of a strip in the uncompressed images.\n" 
+		"\t\tDefault: 256.\n"
+		"\n"
+		"\t--bigtiff\n"
+		"\t\tWrites the output file as BigTIFF.  BigTIFF is also used when the uncompressed\n"
+		"\t\timages are close to 4 GiB.\n"
+		"\t\tDefault: disabled.\n"
 		"\n"
 		"\t--encode-out\n"
 		"\t\tEnables the writing of the compressed  images  to  an  output  TIFF  file named\n"
-		"\t\toutFile.tif.\n"
+		"\t\toutFile.tif.  The strips of each chunk are written as soon as they are encoded.\n"
 		"\t\tDefualt: disabled.\n",
-		pname);
+		pname, pname);
 
 	exit(EXIT_FAILURE);
 }
@@ -362,6 +1058,20 @@ int main(int argc, char **argv) {
 	int encRowsPerStrip = 1;
 	unsigned long long encStripAllocSize = 0;
 	int encWriteOut = 0;
+	unsigned long long encRingMB = 256;
+	int encBigTiff = 0;
+	unsigned int encTileWidth = 0;
+	unsigned int encTileLength = 0;
+
+	TiffRect window = {0, 0, 0, 0};
+
+	char *fileList = NULL;
+	int numGpus = 0;
+	ServiceConfig serviceConfig;
+
+	int cpuThreads = std::max(1u, std::thread::hardware_concurrency());
+	int cpuCheck = 0;
+	int cpuOnly = 0;
 
 	int och;
 	while(1) {
@@ -379,11 +1089,23 @@ int main(int argc, char **argv) {
 			{"rowsxstrip", required_argument, 0, 'r'},
 			{"stripalloc", required_argument, 0, 's'},
 			{"encode-out", optional_argument, 0,   2},
+			{ "file-list", required_argument, 0, 'l'},
+			{      "gpus", required_argument, 0,   3},
+			{"parse-threads", required_argument, 0, 4},
+			{  "prefetch", required_argument, 0,   5},
+			{"pages-per-job", required_argument, 0, 6},
+			{   "ring-mb", required_argument, 0,   7},
+			{   "bigtiff",       no_argument, 0,   8},
+			{"cpu-threads", required_argument, 0,  9},
+			{ "cpu-check",       no_argument, 0,  10},
+			{       "cpu",       no_argument, 0,  11},
+			{      "tile", required_argument, 0,  12},
+			{    "window", required_argument, 0,  13},
 			{      "help",       no_argument, 0, 'h'},
 			{           0,                 0, 0,   0}
 		};
 
-		och = getopt_long(argc, argv, "f:d:vo::hb:e:m:cEr:s:", long_options, &option_index);
+		och = getopt_long(argc, argv, "f:d:vo::hb:e:m:cEr:s:l:", long_options, &option_index);
 		if (och == -1) break;
 		switch (och) {
 			case   0:// handles long opts with non-NULL flag field
@@ -436,6 +1158,50 @@ int main(int argc, char **argv) {
 			case   2:
 				encWriteOut = 1;
 				break;
+			case 'l':
+				fileList = strdup(optarg);
+				break;
+			case   3:
+				numGpus = atoi(optarg);
+				break;
+			case   4:
+				serviceConfig.parse_threads = atoi(optarg);
+				break;
+			case   5:
+				serviceConfig.prefetch = atoi(optarg);
+				break;
+			case   6:
+				serviceConfig.pages_per_job = atoi(optarg) > 0 ? atoi(optarg) : 1;
+				break;
+			case   7:
+				encRingMB = atoi(optarg) > 0 ? atoi(optarg) : 1;
+				break;
+			case   8:
+				encBigTiff = 1;
+				break;
+			case   9:
+				cpuThreads = atoi(optarg) > 0 ? atoi(optarg) : 1;
+				break;
+			case  10:
+				cpuCheck = 1;
+				break;
+			case  11:
+				cpuOnly = 1;
+				break;
+			case  12:
+				if (sscanf(optarg, "%ux%u", &encTileWidth, &encTileLength) != 2 ||
+				    !encTileWidth || !encTileLength || encTileWidth % 16 || encTileLength % 16) {
+					fprintf(stderr, "Invalid tile size (%s), width and length must be multiples of 16!\n", optarg);
+					usage(argv[0]);
+				}
+				break;
+			case  13:
+				if (sscanf(optarg, "%u,%u,%u,%u", &window.x0, &window.y0, &window.x1, &window.y1) != 4 ||
+				    window.empty()) {
+					fprintf(stderr, "Invalid decode window (%s)!\n", optarg);
+					usage(argv[0]);
+				}
+				break;
 			case 'h':
 			case '?':
 				usage(argv[0]);
@@ -445,6 +1211,13 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	if (fileList) {
+		const int rv = decodeFileList(fileList, numGpus, serviceConfig, verbose);
+		free(fileList);
+		free(fname);
+		return rv;
+	}
+
 	if (!fname) {
 		fprintf(stderr, "Please specify a TIFF file with the -f option!\n");
 		usage(argv[0]);
@@ -454,6 +1227,20 @@ int main(int argc, char **argv) {
 		fprintf(stderr, "Invalid frame range!\n");
 		usage(argv[0]);
 	}
+	const bool decodeWindow = !window.empty();
+
+	int ndev = 0;
+	if (cpuOnly || cudaGetDeviceCount(&ndev) != cudaSuccess || ndev == 0) {
+		if (!cpuOnly) {
+			printf("\nNo CUDA device found, using the CPU codec\n");
+		}
+		printf("\n");
+		const int rv = runOnCpu(fname, frameBeg, frameEnd, decodeWindow ? &window : NULL,
+					cpuThreads, decWriteOutN, doEncode, encRowsPerStrip,
+					encTileWidth, encTileLength, encWriteOut, encBigTiff);
+		free(fname);
+		return rv;
+	}
 
 	CHECK_CUDA(cudaSetDevice(devId));
 
@@ -478,6 +1265,12 @@ int main(int argc, char **argv) {
 
 	if (verbose > 1) {
 		nvTiffDumpRaw(fname);
+
+		// strip or tile layout, walked on the host
+		TiffMappedFile layout;
+		if (!layout.open(fname)) {
+			layout.print(stdout);
+		}
 	}
 
 	nvtiffStream_t tiff_stream;
@@ -487,8 +1280,25 @@ int main(int argc, char **argv) {
 	CHECK_NVTIFF(nvtiffDecoderCreate(&decoder,
         nullptr, nullptr, 0));
 
-    CHECK_NVTIFF(nvtiffStreamParseFromFile(fname, tiff_stream));
-
+	// decode window: the selected images are parsed from the pages built in
+	// memory, which hold only the strips or tiles inside the window
+	TiffMappedFile windowSrc;
+	WindowFile wf;
+	if (decodeWindow) {
+		if (windowSrc.open(fname) || !windowSrc.numImages()) {
+			fprintf(stderr, "Cannot read TIFF file %s\n", fname);
+			exit(EXIT_FAILURE);
+		}
+		frameBeg = fmax(frameBeg, 0);
+		frameEnd = fmin(frameEnd, windowSrc.numImages()-1);
+		if (frameBeg > frameEnd ||
+		    buildWindowFile(windowSrc, frameBeg, frameEnd-frameBeg+1, window, wf)) {
+			exit(EXIT_FAILURE);
+		}
+		CHECK_NVTIFF(nvtiffStreamParse(wf.data.data(), wf.data.size(), tiff_stream));
+	} else {
+		CHECK_NVTIFF(nvtiffStreamParseFromFile(fname, tiff_stream));
+	}
     
     CHECK_NVTIFF(nvtiffStreamGetFileInfo(tiff_stream, &file_info));
 
@@ -497,8 +1307,14 @@ int main(int argc, char **argv) {
 		CHECK_NVTIFF(nvtiffStreamPrint(tiff_stream));
 	}
 	
-	frameBeg = fmax(frameBeg, 0);
-	frameEnd = fmin(frameEnd, file_info.num_images-1);
+	if (!decodeWindow) {
+		frameBeg = fmax(frameBeg, 0);
+		frameEnd = fmin(frameEnd, file_info.num_images-1);
+	} else {
+		// the output images are the window
+		file_info.image_width = wf.window.width();
+		file_info.image_height = wf.window.height();
+	}
 	const int nDecode = frameEnd-frameBeg+1;
 
 	// allocate device memory for images
@@ -513,6 +1329,21 @@ int main(int argc, char **argv) {
 		CHECK_CUDA(cudaMalloc(imageOut_d+i, imageSize));
 	}
 
+	// the decoded pages of the window, copied into the images
+	unsigned char *pagesBuf_d = NULL;
+	std::vector<unsigned char *> pages_d;
+	if (decodeWindow) {
+		const size_t pageSize = tiffRowBytes(wf.page)*wf.page.nrow;
+		CHECK_CUDA(cudaMalloc(&pagesBuf_d, pageSize*wf.pages.size()));
+		for(size_t k = 0; k < wf.pages.size(); k++) {
+			pages_d.push_back(pagesBuf_d + k*pageSize);
+		}
+		printf("Window %u,%u,%u,%u: %llu of %llu %s, in %zu page(s) of %ux%u\n",
+			wf.window.x0, wf.window.y0, wf.window.x1, wf.window.y1,
+			wf.chunks, wf.chunksTot, windowSrc.image(frameBeg).desc.tiled() ? "tiles" : "strips",
+			wf.pages.size(), wf.page.ncol, wf.page.nrow);
+	}
+
 	printf("Decoding %u, %s %ux%u images [%d, %d], from file %s... ",
 		nDecode,
 		file_info.photometric_int == NVTIFF_PHOTOMETRIC_RGB ? "RGB" : "Grayscale",
@@ -525,7 +1356,10 @@ int main(int argc, char **argv) {
 
 
 	double __t = Wtime();
-	if (!decodeRange) {
+	if (decodeWindow) {
+		CHECK_NVTIFF(nvtiffDecode(tiff_stream, decoder, pages_d.data(), stream));
+		copyWindowPages(wf, pages_d.data(), imageOut_d, stream);
+	} else if (!decodeRange) {
 		CHECK_NVTIFF(nvtiffDecode(tiff_stream, decoder, imageOut_d, stream));
 	} else { 
 		CHECK_NVTIFF(nvtiffDecodeRange(tiff_stream, decoder, frameBeg, nDecode, imageOut_d, stream));
@@ -537,6 +1371,12 @@ int main(int argc, char **argv) {
 
 	printf("done in %lf secs\n\n", __t);
 
+	int cpuCheckFailures = 0;
+	if (cpuCheck) {
+		cpuCheckFailures += checkDecodeOnCpu(fname, frameBeg, nDecode, decodeWindow ? &window : NULL,
+						     imageOut_d, imageSize, cpuThreads, __t);
+	}
+
 	if (decWriteOutN) {
 
 		unsigned char *imageOut_h = (unsigned char *)Malloc(sizeof(*imageOut_h)*imageSize);
@@ -551,44 +1391,12 @@ int main(int argc, char **argv) {
 
 			CHECK_CUDA(cudaMemcpy(imageOut_h, imageOut_d[i], imageSize, cudaMemcpyDeviceToHost));
 
-			char outfname[MAX_STR_LEN];
-
-			const int isgreyScale = (file_info.photometric_int == NVTIFF_PHOTOMETRIC_MINISWHITE) ||
-						(file_info.photometric_int == NVTIFF_PHOTOMETRIC_MINISBLACK);
-			//void writePPM(const char * filename, unsigned char *chan, int LD, int WIDTH, int HEIGHT, int BPP, int NUMCOMP)
-
-			if(file_info.bits_per_sample[0] == 16)
-			{
-					snprintf(outfname, MAX_STR_LEN, "outImage_%d.ppm", i);
-					 writePPM(outfname,
-					     imageOut_h,
-					     file_info.image_width,
-					     file_info.image_width, 
-					     file_info.image_height,
-					     file_info.bits_per_sample[0], file_info.samples_per_pixel);
-			}
-			else
-			if (!isgreyScale || (isgreyScale && file_info.bits_per_pixel == 8)) {
-
-				snprintf(outfname, MAX_STR_LEN, "outImage_%d.bmp", i);
-
-				printf("\t\timage %u... BMP format\n", i);
-				writeBMPFile(outfname,
-					     imageOut_h,
-					     file_info.image_width,
-					     file_info.image_width, 
-					     file_info.image_height,
-					     //tiffData->subFiles[i].samplesPerPixel,
-					     file_info.bits_per_pixel/8,
-					     isgreyScale);
-			} else {
-				snprintf(outfname, MAX_STR_LEN, "outImage_%d.raw", i);
-
-				printf("\t\timage %u... RAW format\n", i);
-				FILE *f = Fopen(outfname, "w");
-				Fwrite(imageOut_h, imageSize, 1, f);
-				fclose(f);
-			}
+			writeDecodedImage(i, imageOut_h, imageSize,
+					  file_info.image_width,
+					  file_info.image_height,
+					  file_info.photometric_int,
+					  file_info.bits_per_sample[0],
+					  file_info.samples_per_pixel);
 		}
 		__t = Wtime()-__t;
 		printf("\t...done in %lf secs\n\n", __t);
@@ -597,21 +1405,22 @@ int main(int argc, char **argv) {
 	}
 
 #ifdef LIBTIFF_TEST
-	TIFF* tif = TIFFOpen(fname, "r");
+	TIFF* tif = decodeWindow ? NULL : TIFFOpen(fname, "r");
 	if (tif) {
 
 		// we alredy know that all subfiles have the same porperties
 		uint32_t *raster;
-		raster = (uint32_t *)_TIFFmalloc(tiffData->subFiles[0].ncol*tiffData->subFiles[0].nrow * sizeof (uint32_t));
+		raster = (uint32_t *)_TIFFmalloc((size_t)file_info.image_width*file_info.image_height * sizeof (uint32_t));
 
 		printf("\tDecoding with libTIFF... "); fflush(stdout);
 		double __t = Wtime();
-		for(int i = 0; i < tiffData->nSubFiles; i++) {
+		TIFFSetDirectory(tif, frameBeg);
+		for(int i = 0; i < nDecode; i++) {
 			if (!TIFFReadRGBAImage(tif,
-					       tiffData->subFiles[i].ncol,
-					       tiffData->subFiles[i].nrow,
+					       file_info.image_width,
+					       file_info.image_height,
 					       raster, 0)) {
-				fprintf(stderr, "Error while decoding image %d with libTiff\n", i);
+				fprintf(stderr, "Error while decoding image %d with libTiff\n", frameBeg+i);
 				break;
 			}
 			TIFFReadDirectory(tif);
@@ -653,155 +1462,162 @@ int main(int argc, char **argv) {
 
 		unsigned int nSubFiles = nDecode;
 		unsigned int nStripOut = DIV_UP(nrow, encRowsPerStrip);
-		unsigned int totStrips = nSubFiles*nStripOut;
 
-		unsigned long long *stripSize_d = NULL;
-		unsigned long long *stripOffs_d = NULL;
-		unsigned char      *stripData_d = NULL;
+		// tiles are gathered and encoded as images of one strip each, so
+		// the chunks are planned over the tiles of all the subfiles
+		const bool encTiled = encTileWidth != 0;
+		EncodeTiling tiling;
+		if (encTiled) {
+			tiling.nrow = nrow;
+			tiling.tileWidth = encTileWidth;
+			tiling.tileLength = encTileLength;
+			tiling.tilesAcross = DIV_UP(ncol, encTileWidth);
+			tiling.tilesPerImage = tiling.tilesAcross*DIV_UP(nrow, encTileLength);
+			CHECK_CUDA(cudaMalloc(&tiling.images_d, sizeof(*tiling.images_d)*nSubFiles));
+			CHECK_CUDA(cudaMemcpy(tiling.images_d, imageOut_d, sizeof(*tiling.images_d)*nSubFiles,
+					      cudaMemcpyHostToDevice));
+			nStripOut = 1;
+		}
+		const unsigned long long tileBytes = encTiled ? (unsigned long long)encTileWidth*encTileLength*pixelSize : 0;
 
 		if (encStripAllocSize <= 0) {
-			encStripAllocSize = encRowsPerStrip*ncol*(pixelSize);
+			encStripAllocSize = encTiled ? tileBytes : encRowsPerStrip*ncol*(pixelSize);
 		}
 
-		CHECK_CUDA(cudaMalloc(&stripSize_d, sizeof(*stripSize_d)*totStrips));
-		CHECK_CUDA(cudaMalloc(&stripOffs_d, sizeof(*stripOffs_d)*totStrips));
-		CHECK_CUDA(cudaMalloc(&stripData_d, sizeof(*stripData_d)*totStrips*encStripAllocSize));
-
-		nvTiffEncodeCtx_t *ctx = nvTiffEncodeCtxCreate(devId, nSubFiles, nStripOut);
+		// the strips are encoded in chunks through two slots of at most
+		// half the ring each, so one chunk encodes while the previous one
+		// is copied to the host and written
+		const unsigned long long ringBytes = encRingMB << 20;
+		unsigned long long maxStrips = std::max(1ULL, ringBytes/(2*encStripAllocSize));
+		EncodeSlot slots[2];
+
+		TiffImageDesc desc;
+		desc.nrow = nrow;
+		desc.ncol = ncol;
+		desc.rowsPerStrip = encRowsPerStrip;
+		desc.tileWidth = encTileWidth;
+		desc.tileLength = encTileLength;
+		desc.samplesPerPixel = samplesPerPixel;
+		memcpy(desc.bitsPerSample, bitsPerSample, sizeof(*bitsPerSample)*std::min<int>(samplesPerPixel, 4));
+		desc.photometricInt = photometricInt;
+		desc.planarConf = planarConf;
+		desc.sampleFormat = sampleFormat;
+		desc.compression = 5;
+		// LZW rarely expands images, leave room for it anyway
+		const bool bigTiff = encBigTiff || double(imageSize)*nSubFiles > 0.9*4294967295.0;
+
+		TiffStripWriter writer;
+		if (encWriteOut && writer.open("outFile.tif", desc, nSubFiles, bigTiff)) {
+			fprintf(stderr, "Cannot open outFile.tif\n");
+			exit(EXIT_FAILURE);
+		}
 
-		printf("Encoding %u, %s %ux%u images using %d rows per strip and %llu bytes per strip... ",
+		char layout[64];
+		if (encTiled) {
+			snprintf(layout, sizeof(layout), "%ux%u tiles", encTileWidth, encTileLength);
+		} else {
+			snprintf(layout, sizeof(layout), "%d rows per strip", encRowsPerStrip);
+		}
+		printf("Encoding %u, %s %ux%u images using %s and %llu bytes per %s, %llu MiB ring... ",
 			nDecode,
 			photometricInt == 2 ? "RGB" : "Grayscale",
 			ncol,
 			nrow,
-			encRowsPerStrip,
-			encStripAllocSize);
+			layout,
+			encStripAllocSize,
+			encTiled ? "tile" : "strip",
+			encRingMB);
 		fflush(stdout);
-		int rv;
+
+		// host copies of the images, to check the strips against
+		std::vector<std::vector<unsigned char>> encImages_h;
+		int encBadStrips = 0;
+		double encCheckSecs = 0;
+		if (cpuCheck) {
+			encImages_h.resize(nSubFiles, std::vector<unsigned char>(imageSize));
+			for(unsigned int i = 0; i < nSubFiles; i++) {
+				CHECK_CUDA(cudaMemcpy(encImages_h[i].data(), imageOut_d[i], imageSize, cudaMemcpyDeviceToHost));
+			}
+		}
+
+		const EncodeTiling *encTiling = encTiled ? &tiling : NULL;
+		EncodeChunkPlanner planner(encTiled ? nSubFiles*tiling.tilesPerImage : nSubFiles,
+					   encTiled ? encTileLength : nrow,
+					   encTiled ? encTileLength : encRowsPerStrip);
+		unsigned long long stripSizeTot = 0;
+		int nChunks = 0;
+		int cur = 0;
 		__t = Wtime();
-		do {
-			rv = nvTiffEncode(ctx,
-					  nrow,
-					  ncol,
-					  pixelSize,
-					  encRowsPerStrip,
-					  nSubFiles,
-					  imageOut_d,
-					  encStripAllocSize,
-					  stripSize_d,
-					  stripOffs_d,
-					  stripData_d,
-					  stream);
-			if (rv != NVTIFF_ENCODE_SUCCESS) {
-				printf("error, while encoding images!\n");
-				exit(EXIT_FAILURE);
+		if (!planner.done()) {
+			reserveEncodeSlot(slots[0], devId, nStripOut, maxStrips, encStripAllocSize, tileBytes);
+			issueEncodeChunk(slots[0], planner.next(maxStrips), imageOut_d, ncol, pixelSize, encRowsPerStrip, encTiling);
+		}
+		while (slots[cur].busy) {
+			EncodeSlot &slot = slots[cur];
+			EncodeSlot &other = slots[cur^1];
+			if (!planner.done()) {
+				reserveEncodeSlot(other, devId, nStripOut, maxStrips, encStripAllocSize, tileBytes);
+				issueEncodeChunk(other, planner.next(maxStrips), imageOut_d, ncol, pixelSize, encRowsPerStrip, encTiling);
 			}
-			rv = nvTiffEncodeFinalize(ctx, stream);
-			if (rv != NVTIFF_ENCODE_SUCCESS) {
-				if (rv == NVTIFF_ENCODE_COMP_OVERFLOW) {
-					printf("overflow, using %llu bytes per strip...", ctx->stripSizeMax);
-
-					// * free ctx mem
-					// * reallocate a larger stripData_d buffer
-					// * init a new ctx and retry
-					// * retry compression
-					encStripAllocSize = ctx->stripSizeMax;
-					nvTiffEncodeCtxDestroy(ctx);
-					CHECK_CUDA(cudaFree(stripData_d));
-					CHECK_CUDA(cudaMalloc(&stripData_d, sizeof(*stripData_d)*totStrips*encStripAllocSize));
-					ctx = nvTiffEncodeCtxCreate(devId, nSubFiles, nStripOut);
-				} else {
-					printf("error, while finalizing compressed images!\n");
-					exit(EXIT_FAILURE);
+			if (finishEncodeChunk(slot) == NVTIFF_ENCODE_COMP_OVERFLOW) {
+				// encode this chunk again, and the one issued after it, with
+				// room for the largest strip and fewer strips per chunk
+				encStripAllocSize = std::max(encStripAllocSize, slot.ctx->stripSizeMax);
+				maxStrips = std::max(1ULL, ringBytes/(2*encStripAllocSize));
+				printf("overflow, using %llu bytes per strip...", encStripAllocSize);
+				if (other.busy) {
+					nvTiffEncodeFinalize(other.ctx, other.stream);
+					CHECK_CUDA(cudaStreamSynchronize(other.stream));
+					other.busy = 0;
 				}
+				slot.busy = 0;
+				planner.rewind(slot.chunk);
+				reserveEncodeSlot(slot, devId, nStripOut, maxStrips, encStripAllocSize, tileBytes);
+				issueEncodeChunk(slot, planner.next(maxStrips), imageOut_d, ncol, pixelSize, encRowsPerStrip, encTiling);
+				continue;
 			}
-		} while(rv == NVTIFF_ENCODE_COMP_OVERFLOW);
-
-		CHECK_CUDA(cudaStreamSynchronize(stream));
-		__t = Wtime()-__t;
-
-		printf("done in %lf secs (compr. ratio: %.2lfx)\n\n",
-			__t, double(imageSize)*nSubFiles/ctx->stripSizeTot);
-
-		//printf("Total size of compressed strips: %llu bytes\n", ctx->stripSizeTot);
+			if (encWriteOut &&
+			    writer.writeStrips(slot.chunk.firstStrip(nStripOut), slot.chunk.totStrips(),
+					       slot.stripSize_h, slot.stripOffs_h, slot.stripData_h)) {
+				fprintf(stderr, "Error while writing to outFile.tif\n");
+				exit(EXIT_FAILURE);
+			}
+			if (cpuCheck) {
+				const double t = Wtime();
+				encBadStrips += checkEncodeChunk(slot, desc, nStripOut, encImages_h, cpuThreads);
+				encCheckSecs += Wtime()-t;
+			}
+			stripSizeTot += slot.ctx->stripSizeTot;
+			nChunks++;
+			slot.busy = 0;
+			cur ^= 1;
+		}
+		if (encWriteOut && writer.close()) {
+			fprintf(stderr, "Error while writing the directories of outFile.tif\n");
+			exit(EXIT_FAILURE);
+		}
+		__t = Wtime()-__t-encCheckSecs;
 
+		printf("done in %lf secs (compr. ratio: %.2lfx, %d chunks of up to %llu strips)\n\n",
+			__t, double(imageSize)*nSubFiles/stripSizeTot, nChunks, maxStrips);
 		if (encWriteOut) {
-			unsigned long long *stripSize_h = (unsigned long long *)Malloc(sizeof(*stripSize_h)*totStrips);
-			CHECK_CUDA(cudaMemcpy(stripSize_h,
-					      stripSize_d,
-					      sizeof(*stripSize_h)*totStrips,
-					      cudaMemcpyDeviceToHost));
-
-			unsigned long long *stripOffs_h = (unsigned long long *)Malloc(sizeof(*stripOffs_h)*totStrips);
-			CHECK_CUDA(cudaMemcpy(stripOffs_h,
-					      stripOffs_d,
-					      sizeof(*stripOffs_h)*totStrips,
-					      cudaMemcpyDeviceToHost));
-
-			unsigned char *stripData_h = (unsigned char *)Malloc(sizeof(*stripData_h)*ctx->stripSizeTot);
-			CHECK_CUDA(cudaMemcpy(stripData_h,
-					      stripData_d,
-					      ctx->stripSizeTot,
-					      cudaMemcpyDeviceToHost));
-#if 0
-			FILE *fp = Fopen("stripData.txt", "w");
-
-			size_t stripSize = sizeof(*stripData_h)*encRowsPerStrip*ncol*pixelSize;
-			for(unsigned int i = 0; i < nSubFiles; i++) {
-
-				fprintf(fp, "compressed image %d:\n", i);
-				for(unsigned int j = 0; j < nStripOut; j++) {
-
-					unsigned long long off = stripOffs_h[i*nStripOut + j];
-					unsigned long long len = stripSize_h[i*nStripOut + j];
-
-					fprintf(fp, "\tstrip %5u, size: %6llu bytes (ratio: %5.2lfx), "
-						    "fingerprint: %02X %02X %02X %02X ... %02X %02X %02X %02X\n",
-						j, len, double(stripSize)/len,
-						stripData_h[off + 0],
-						stripData_h[off + 1],
-						stripData_h[off + 2],
-						stripData_h[off + 3],
-						stripData_h[off + len-4],
-						stripData_h[off + len-3],
-						stripData_h[off + len-2],
-						stripData_h[off + len-1]);
-				}
-				fprintf(fp, "\n");
-			}
-			fclose(fp);
-#endif
-			printf("\tWriting %u compressed images to TIFF file... ", nDecode); fflush(stdout);
-			__t = Wtime();
-			nvTiffWriteFile("outFile.tif",
-					VER_REG_TIFF,
-					nSubFiles,
-					nrow,
-					ncol,
-					encRowsPerStrip,
-					samplesPerPixel,
-					bitsPerSample,
-					photometricInt,
-					planarConf,
-					stripSize_h,
-					stripOffs_h,
-					stripData_h,
-					sampleFormat);
-			__t = Wtime()-__t;
-			printf("done in %lf secs\n\n", __t);
-		
-			free(stripSize_h);
-			free(stripOffs_h);
-			free(stripData_h);
+			printf("\tWrote %u compressed images to outFile.tif (%s, %llu bytes)\n\n",
+				nDecode, bigTiff ? "BigTIFF" : "TIFF", writer.bytesWritten());
+		}
+		if (cpuCheck) {
+			printf("\tCPU check of %llu %s on %d thread(s): %d differ from the images (%lf secs)\n\n",
+				(unsigned long long)nSubFiles*desc.chunksAcross()*desc.chunksDown(),
+				encTiled ? "tiles" : "strips", cpuThreads, encBadStrips, encCheckSecs);
+			cpuCheckFailures += encBadStrips;
 		}
 
 #ifdef LIBTIFF_TEST
-		tif = TIFFOpen("libTiffOut.tif", "w");
+		tif = encTiled ? NULL : TIFFOpen("libTiffOut.tif", "w");
 		if (tif) {
 
 			unsigned char **imageOut_h = (unsigned char **)Malloc(sizeof(*imageOut_h)*nDecode);
 			for(unsigned int i = 0; i < nDecode; i++) {
-				imageOut_h[i] = (unsigned char *)Malloc(sizeof(*imageOut_h)*imageSize);
+				imageOut_h[i] = (unsigned char *)Malloc(sizeof(**imageOut_h)*imageSize);
 				CHECK_CUDA(cudaMemcpy(imageOut_h[i],
 							imageOut_d[i],
 							imageSize,
@@ -814,9 +1630,9 @@ int main(int argc, char **argv) {
 			__t = Wtime();
 			for(unsigned int i = 0; i < nDecode; i++) {
 
-				TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, nrow);
-				TIFFSetField(tif, TIFFTAG_IMAGELENGTH, ncol);
-				TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+				TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, ncol);
+				TIFFSetField(tif, TIFFTAG_IMAGELENGTH, nrow);
+				TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, bitsPerSample[0]);
 				TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
 				TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, photometricInt);
 				TIFFSetField(tif, TIFFTAG_FILLORDER, 1);
@@ -850,16 +1666,21 @@ int main(int argc, char **argv) {
 			printf("done in %lf secs\n\n", __t);
 
 			TIFFClose(tif);
+
+			for(unsigned int i = 0; i < nDecode; i++) {
+				free(imageOut_h[i]);
+			}
+			free(imageOut_h);
 		}
 #endif
 
-		CHECK_CUDA(cudaFree(stripSize_d));
-		CHECK_CUDA(cudaFree(stripOffs_d));
-		CHECK_CUDA(cudaFree(stripData_d));
-		
-		free(bitsPerSample);
+		destroyEncodeSlot(slots[0]);
+		destroyEncodeSlot(slots[1]);
+		if (encTiled) {
+			CHECK_CUDA(cudaFree(tiling.images_d));
+		}
 
-		nvTiffEncodeCtxDestroy(ctx);
+		free(bitsPerSample);
 	}
 
 	// cleanup
@@ -867,6 +1688,9 @@ int main(int argc, char **argv) {
 		CHECK_CUDA(cudaFree(imageOut_d[i]));
 	}
 	free(imageOut_d);
+	if (pagesBuf_d) {
+		CHECK_CUDA(cudaFree(pagesBuf_d));
+	}
 
 	free(fname);
 	
@@ -882,6 +1706,6 @@ int main(int argc, char **argv) {
 
 	CHECK_CUDA(cudaDeviceReset());
 
-	return 0;
+	return cpuCheckFailures ? EXIT_FAILURE : 0;
 }
 
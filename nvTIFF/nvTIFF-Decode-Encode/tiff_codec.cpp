@@ -0,0 +1,502 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+#ifdef NVTIFF_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#include "tiff_codec.h"
+
+#define LZW_CLEAR	256
+#define LZW_EOI		257
+#define LZW_FIRST	258
+#define LZW_CODES	4096
+#define LZW_MIN_BITS	9
+#define LZW_MAX_BITS	12
+
+// Every string in the table is the previous string followed by the first
+// byte of the next one, and both were just written next to each other, so
+// a code is decoded by copying length[code] bytes from offset[code] of the
+// output: no per-byte table walk, and memcpy for strings of any length.
+int lzwDecode(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t dstSize, size_t *outSize) {
+
+	size_t offset[LZW_CODES];
+	unsigned int length[LZW_CODES];
+
+	uint64_t bits = 0;	// left aligned
+	int nbits = 0;
+	size_t pos = 0;
+
+	int width = LZW_MIN_BITS;
+	unsigned int next = LZW_FIRST;
+	bool havePrev = false;
+	size_t prevOff = 0, prevLen = 0;
+	size_t out = 0;
+
+	*outSize = 0;
+	for(;;) {
+		while(nbits <= 56 && pos < srcSize) {
+			bits |= (uint64_t)src[pos++] << (56 - nbits);
+			nbits += 8;
+		}
+		if (nbits < width) break;	// not terminated with EOI
+
+		const unsigned int code = (unsigned int)(bits >> (64 - width));
+		bits <<= width;
+		nbits -= width;
+
+		if (code == LZW_EOI) break;
+		if (code == LZW_CLEAR) {
+			width = LZW_MIN_BITS;
+			next = LZW_FIRST;
+			havePrev = false;
+			continue;
+		}
+		if (!havePrev) {
+			if (code > 255) return 1;
+		} else {
+			if (code > next) return 1;
+			// string(prev) + first(code): where prev ends, code starts
+			if (next < LZW_CODES) {
+				offset[next] = prevOff;
+				length[next] = (unsigned int)prevLen + 1;
+				next++;
+				if (next + 1 >= (1u << width) && width < LZW_MAX_BITS) width++;
+			}
+		}
+		if (out == dstSize) break;	// more data than the strip holds
+
+		size_t len;
+		if (code < 256) {
+			len = 1;
+			dst[out] = (unsigned char)code;
+		} else {
+			const size_t off = offset[code];
+			len = std::min<size_t>(length[code], dstSize - out);
+			if (off + len <= out) {
+				memcpy(dst + out, dst + off, len);
+			} else {
+				// KwKwK: the string ends with its own first byte
+				for(size_t k = 0; k < len; k++) dst[out + k] = dst[off + k];
+			}
+		}
+		prevOff = out;
+		prevLen = len;
+		havePrev = true;
+		out += len;
+	}
+	*outSize = out;
+	return 0;
+}
+
+struct LzwBitWriter {
+	unsigned char *p;
+	uint64_t acc = 0;
+	int nacc = 0;
+
+	void put(unsigned int code, int width) {
+		acc = (acc << width) | code;
+		nacc += width;
+		while(nacc >= 8) {
+			nacc -= 8;
+			*p++ = (unsigned char)(acc >> nacc);
+		}
+	}
+	void flush() {
+		if (nacc) *p++ = (unsigned char)(acc << (8 - nacc));
+		nacc = 0;
+	}
+};
+
+// Codes follow libtiff's encoder: the width grows one code early, and the
+// table is cleared when it holds 4094 codes, so the output reads back with
+// any TIFF reader.
+int lzwEncode(const unsigned char *src, size_t srcSize, std::vector<unsigned char> &dst) {
+
+	// (prefix << 8 | byte) -> code, open addressing, at most half full
+	const unsigned int HASH_BITS = 13;
+	const unsigned int HASH_MASK = (1u << HASH_BITS) - 1;
+	std::vector<int32_t> keys(1u << HASH_BITS);
+	std::vector<uint16_t> codes(1u << HASH_BITS);
+
+	// 12 bits per byte at worst, plus Clear codes
+	dst.resize(srcSize + srcSize/2 + srcSize/1024 + 16);
+
+	LzwBitWriter w;
+	w.p = dst.data();
+
+	int width = LZW_MIN_BITS;
+	unsigned int next = LZW_FIRST;
+	std::fill(keys.begin(), keys.end(), -1);
+	w.put(LZW_CLEAR, width);
+
+	// adds a code after one was written; clears the table when it is full
+	auto grow = [&]() {
+		next++;
+		if (next == LZW_CODES - 2) {
+			w.put(LZW_CLEAR, width);
+			std::fill(keys.begin(), keys.end(), -1);
+			next = LZW_FIRST;
+			width = LZW_MIN_BITS;
+		} else if (next > (1u << width) - 1) {
+			width++;
+		}
+	};
+
+	if (srcSize) {
+		unsigned int ent = src[0];
+		for(size_t i = 1; i < srcSize; i++) {
+			const int32_t key = (int32_t)(ent << 8 | src[i]);
+			unsigned int h = ((uint32_t)key * 2654435761u) >> (32 - HASH_BITS);
+			while(keys[h] >= 0 && keys[h] != key) h = (h + 1) & HASH_MASK;
+			if (keys[h] == key) {
+				ent = codes[h];
+				continue;
+			}
+			w.put(ent, width);
+			keys[h] = key;
+			codes[h] = (uint16_t)next;
+			grow();
+			ent = src[i];
+		}
+		w.put(ent, width);
+		grow();
+	}
+	w.put(LZW_EOI, width);
+	w.flush();
+
+	dst.resize(w.p - dst.data());
+	return 0;
+}
+
+#ifdef NVTIFF_WITH_ZLIB
+bool deflateSupported() { return true; }
+
+int deflateDecode(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t dstSize, size_t *outSize) {
+
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit(&zs) != Z_OK) return 1;
+
+	zs.next_in = const_cast<Bytef *>(src);
+	zs.avail_in = (uInt)srcSize;
+	zs.next_out = dst;
+	zs.avail_out = (uInt)dstSize;
+
+	const int rv = inflate(&zs, Z_FINISH);
+	*outSize = zs.total_out;
+	inflateEnd(&zs);
+
+	// a full strip with data left over is accepted, as libtiff does
+	return (rv == Z_STREAM_END || (rv == Z_BUF_ERROR && zs.avail_out == 0)) ? 0 : 1;
+}
+
+int deflateEncode(const unsigned char *src, size_t srcSize, std::vector<unsigned char> &dst, int level) {
+
+	uLongf n = compressBound((uLong)srcSize);
+	dst.resize(n);
+	if (compress2(dst.data(), &n, src, (uLong)srcSize, level) != Z_OK) return 1;
+	dst.resize(n);
+	return 0;
+}
+#else
+bool deflateSupported() { return false; }
+
+int deflateDecode(const unsigned char *, size_t, unsigned char *, size_t, size_t *outSize) {
+	*outSize = 0;
+	return 1;
+}
+
+int deflateEncode(const unsigned char *, size_t, std::vector<unsigned char> &, int) {
+	return 1;
+}
+#endif
+
+template <typename T>
+static void undoDifferencing(unsigned char *data, size_t rowBytes, unsigned int width, unsigned int rows, unsigned int samples) {
+
+	const size_t n = (size_t)width*samples;
+	for(unsigned int r = 0; r < rows; r++) {
+		T *p = reinterpret_cast<T *>(data + r*rowBytes);
+		for(size_t i = samples; i < n; i++) {
+			p[i] = (T)(p[i] + p[i - samples]);
+		}
+	}
+}
+
+// backwards, so that each difference reads values not yet replaced; the
+// loop has no carried dependency and vectorizes
+template <typename T>
+static void applyDifferencing(unsigned char *data, size_t rowBytes, unsigned int width, unsigned int rows, unsigned int samples) {
+
+	const size_t n = (size_t)width*samples;
+	for(unsigned int r = 0; r < rows; r++) {
+		T *p = reinterpret_cast<T *>(data + r*rowBytes);
+		for(size_t i = n; i-- > samples;) {
+			p[i] = (T)(p[i] - p[i - samples]);
+		}
+	}
+}
+
+int predictorDecode(unsigned char *data, size_t rowBytes, unsigned int width, unsigned int rows,
+		    unsigned int samples, unsigned int bitsPerSample) {
+	switch(bitsPerSample) {
+		case 8: undoDifferencing<uint8_t>(data, rowBytes, width, rows, samples); return 0;
+		case 16: undoDifferencing<uint16_t>(data, rowBytes, width, rows, samples); return 0;
+		case 32: undoDifferencing<uint32_t>(data, rowBytes, width, rows, samples); return 0;
+	}
+	return 1;
+}
+
+int predictorEncode(unsigned char *data, size_t rowBytes, unsigned int width, unsigned int rows,
+		    unsigned int samples, unsigned int bitsPerSample) {
+	switch(bitsPerSample) {
+		case 8: applyDifferencing<uint8_t>(data, rowBytes, width, rows, samples); return 0;
+		case 16: applyDifferencing<uint16_t>(data, rowBytes, width, rows, samples); return 0;
+		case 32: applyDifferencing<uint32_t>(data, rowBytes, width, rows, samples); return 0;
+	}
+	return 1;
+}
+
+size_t tiffRowBytes(const TiffImageDesc &desc) {
+	return ((size_t)desc.ncol*desc.samplesPerPixel*desc.bitsPerSample[0] + 7) / 8;
+}
+
+// the strip or tile layout the codec works on
+struct ChunkLayout {
+	unsigned int width;	// pixels per chunk row
+	unsigned int rows;	// rows per chunk
+	size_t rowBytes;
+	unsigned int across;
+	unsigned long long count;
+
+	explicit ChunkLayout(const TiffImageDesc &d) {
+		width = d.tiled() ? d.tileWidth : d.ncol;
+		rows = d.tiled() ? d.tileLength : d.rowsPerStrip;
+		rowBytes = ((size_t)width*d.samplesPerPixel*d.bitsPerSample[0] + 7) / 8;
+		across = d.chunksAcross();
+		count = (unsigned long long)across*d.chunksDown();
+	}
+};
+
+static int checkDesc(const TiffImageDesc &d, const char *op) {
+
+	if (d.planarConf != 1) {
+		fprintf(stderr, "CPU %s: planar configuration %d is not supported\n", op, d.planarConf);
+		return 1;
+	}
+	for(int s = 1; s < d.samplesPerPixel && s < 4; s++) {
+		if (d.bitsPerSample[s] != d.bitsPerSample[0]) {
+			fprintf(stderr, "CPU %s: samples of different sizes are not supported\n", op);
+			return 1;
+		}
+	}
+	if (d.tiled() && d.bitsPerSample[0] % 8) {
+		fprintf(stderr, "CPU %s: tiles of %d-bit samples are not supported\n", op, d.bitsPerSample[0]);
+		return 1;
+	}
+	switch(d.compression) {
+		case 1:
+		case 5:
+			break;
+		case 8:
+		case 32946:
+			if (deflateSupported()) break;
+			fprintf(stderr, "CPU %s: Deflate needs a build with zlib\n", op);
+			return 1;
+		default:
+			fprintf(stderr, "CPU %s: compression %d is not supported\n", op, d.compression);
+			return 1;
+	}
+	if (d.predictor != 1 && (d.predictor != 2 || (d.bitsPerSample[0] != 8 &&
+						      d.bitsPerSample[0] != 16 &&
+						      d.bitsPerSample[0] != 32))) {
+		fprintf(stderr, "CPU %s: predictor %d with %d-bit samples is not supported\n",
+			op, d.predictor, d.bitsPerSample[0]);
+		return 1;
+	}
+	return 0;
+}
+
+static int decodeChunk(unsigned short compression, const TiffSpan &s, unsigned char *dst, size_t dstSize, size_t *outSize) {
+
+	switch(compression) {
+		case 1:
+			*outSize = std::min<size_t>(s.size, dstSize);
+			memcpy(dst, s.data, *outSize);
+			return 0;
+		case 5:
+			return lzwDecode(s.data, s.size, dst, dstSize, outSize);
+		default:
+			return deflateDecode(s.data, s.size, dst, dstSize, outSize);
+	}
+}
+
+static void swapSamples(unsigned char *p, size_t n, unsigned int bitsPerSample) {
+
+	const unsigned int b = bitsPerSample / 8;
+	for(size_t i = 0; i + b <= n; i += b) {
+		std::reverse(p + i, p + i + b);
+	}
+}
+
+int cpuDecodeWindow(const TiffMappedFile &file, size_t image, const TiffRect &window, unsigned char *out, int nthreads) {
+
+	const TiffDirectory &dir = file.image(image);
+	const TiffImageDesc &d = dir.desc;
+	if (checkDesc(d, "decode")) return 1;
+
+	const ChunkLayout cl(d);
+	if (dir.numChunks < cl.count) {
+		fprintf(stderr, "CPU decode: image %zu has %llu chunks, %llu expected\n", image, dir.numChunks, cl.count);
+		return 1;
+	}
+	std::vector<TiffChunkArea> chunks;
+	d.chunksInWindow(window, chunks);
+	if (chunks.empty()) {
+		fprintf(stderr, "CPU decode: the window is outside image %zu\n", image);
+		return 1;
+	}
+	// the window clipped to the image
+	const TiffRect win = {chunks.front().area.x0, chunks.front().area.y0,
+			      chunks.back().area.x1, chunks.back().area.y1};
+	const bool fullRows = win.x0 == 0 && win.x1 == d.ncol;
+	if (!fullRows && d.bitsPerSample[0] % 8) {
+		fprintf(stderr, "CPU decode: windows of %d-bit samples must span whole rows\n", d.bitsPerSample[0]);
+		return 1;
+	}
+	const size_t outRowBytes = ((size_t)win.width()*d.samplesPerPixel*d.bitsPerSample[0] + 7) / 8;
+	const size_t bytesPerPixel = (size_t)d.samplesPerPixel*d.bitsPerSample[0] / 8;
+	const bool swap = file.bigEndian() && d.bitsPerSample[0] > 8;
+
+	std::atomic<int> failed(0);
+	parallelFor(chunks.size(), nthreads, [&](size_t k) {
+
+		const TiffChunkArea &c = chunks[k];
+
+		// strips wholly inside the window land in place; other strips,
+		// and tiles, are decoded whole and clipped
+		const bool inPlace = !d.tiled() && fullRows && c.area.y0 == c.rect.y0 && c.area.y1 == c.rect.y1;
+		const size_t dstSize = (size_t)(d.tiled() ? cl.rows : c.rect.height())*cl.rowBytes;
+		std::vector<unsigned char> scratch;
+		unsigned char *dst = out + (size_t)(c.rect.y0 - win.y0)*outRowBytes;
+		if (!inPlace) {
+			scratch.resize(dstSize);
+			dst = scratch.data();
+		}
+
+		size_t n = 0;
+		if (decodeChunk(d.compression, file.chunk(image, c.chunk), dst, dstSize, &n)) {
+			fprintf(stderr, "CPU decode: corrupt %s %llu of image %zu\n", d.tiled() ? "tile" : "strip", c.chunk, image);
+			failed = 1;
+			return;
+		}
+		memset(dst + n, 0, dstSize - n);
+
+		if (swap) swapSamples(dst, dstSize, d.bitsPerSample[0]);
+		if (d.predictor == 2) {
+			predictorDecode(dst, cl.rowBytes, cl.width, (unsigned int)(dstSize / cl.rowBytes),
+					d.samplesPerPixel, d.bitsPerSample[0]);
+		}
+		if (!inPlace) {
+			// whole rows of strips, which may hold samples of under 8 bits
+			const bool rows = fullRows && !d.tiled();
+			const size_t x = rows ? 0 : (c.area.x0 - c.rect.x0)*bytesPerPixel;
+			const size_t bytes = rows ? outRowBytes : c.area.width()*bytesPerPixel;
+			unsigned char *o = out + (size_t)(c.area.y0 - win.y0)*outRowBytes + (rows ? 0 : (c.area.x0 - win.x0)*bytesPerPixel);
+			for(unsigned int r = 0; r < c.area.height(); r++) {
+				memcpy(o + r*outRowBytes, dst + (size_t)(c.area.y0 - c.rect.y0 + r)*cl.rowBytes + x, bytes);
+			}
+		}
+	});
+	return failed;
+}
+
+int cpuDecodeImage(const TiffMappedFile &file, size_t image, unsigned char *out, int nthreads) {
+
+	const TiffImageDesc &d = file.image(image).desc;
+	const TiffRect all = {0, 0, d.ncol, d.nrow};
+	return cpuDecodeWindow(file, image, all, out, nthreads);
+}
+
+int cpuEncodeImage(const TiffImageDesc &desc, const unsigned char *image, int nthreads,
+		   std::vector<std::vector<unsigned char>> &chunks, int deflateLevel) {
+
+	const TiffImageDesc &d = desc;
+	if (checkDesc(d, "encode")) return 1;
+	if (d.compression == 32946) {
+		fprintf(stderr, "CPU encode: write Deflate as compression 8\n");
+		return 1;
+	}
+
+	const ChunkLayout cl(d);
+	const size_t rowBytes = tiffRowBytes(d);
+	const size_t bytesPerPixel = (size_t)d.samplesPerPixel*d.bitsPerSample[0] / 8;
+
+	chunks.resize(cl.count);
+
+	std::atomic<int> failed(0);
+	parallelFor(cl.count, nthreads, [&](size_t i) {
+
+		const unsigned int cx = (unsigned int)(i % cl.across);
+		const unsigned int cy = (unsigned int)(i / cl.across);
+		const unsigned int y0 = cy*cl.rows;
+		const unsigned int rows = std::min(cl.rows, d.nrow - y0);
+
+		// the last strip is short; tiles are whole and zero padded
+		const unsigned char *src = image + (size_t)y0*rowBytes;
+		size_t srcSize = (size_t)rows*rowBytes;
+		std::vector<unsigned char> copy;
+		if (d.tiled()) {
+			copy.assign((size_t)cl.rows*cl.rowBytes, 0);
+			const unsigned int x0 = cx*cl.width;
+			const size_t bytes = std::min(cl.width, d.ncol - x0)*bytesPerPixel;
+			for(unsigned int r = 0; r < rows; r++) {
+				memcpy(copy.data() + r*cl.rowBytes, src + (size_t)r*rowBytes + x0*bytesPerPixel, bytes);
+			}
+		} else if (d.predictor == 2) {
+			copy.assign(src, src + srcSize);
+		}
+		if (!copy.empty()) {
+			src = copy.data();
+			srcSize = copy.size();
+		}
+		if (d.predictor == 2) {
+			predictorEncode(copy.data(), cl.rowBytes, cl.width, (unsigned int)(srcSize / cl.rowBytes),
+					d.samplesPerPixel, d.bitsPerSample[0]);
+		}
+
+		int rv = 0;
+		switch(d.compression) {
+			case 1: chunks[i].assign(src, src + srcSize); break;
+			case 5: rv = lzwEncode(src, srcSize, chunks[i]); break;
+			default: rv = deflateEncode(src, srcSize, chunks[i], deflateLevel); break;
+		}
+		if (rv) failed = 1;
+	});
+	return failed;
+}
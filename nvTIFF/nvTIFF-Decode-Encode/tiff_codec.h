@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+// CPU reference codec for the strips and tiles of TIFF files: LZW
+// (Compression=5), Deflate (Compression=8 and 32946, through zlib when built
+// with NVTIFF_WITH_ZLIB) and uncompressed data, with or without horizontal
+// differencing (Predictor=2).
+//
+// LZW is sequential within a strip, so images are decoded and encoded with
+// one strip or tile per task on nthreads threads. The decoder keeps, for each
+// code, where its string was last written and copies it from there; the
+// encoder finds (prefix, byte) pairs in an open addressing hash table.
+//
+// Images are interleaved ("chunky", PlanarConfiguration=1) with rows of
+// width*samples*bytes, as nvtiffDecode returns them, so the CPU output can
+// be compared byte for byte with the GPU output.
+
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "nvTiff_utils.h"
+
+// decodes a TIFF LZW stream into dst; *outSize receives the decoded bytes
+int lzwDecode(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t dstSize, size_t *outSize);
+int lzwEncode(const unsigned char *src, size_t srcSize, std::vector<unsigned char> &dst);
+
+// zlib streams; return nonzero when built without zlib
+int deflateDecode(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t dstSize, size_t *outSize);
+int deflateEncode(const unsigned char *src, size_t srcSize, std::vector<unsigned char> &dst, int level);
+bool deflateSupported();
+
+// horizontal differencing of rows of width pixels of samples values of
+// bitsPerSample (8, 16 or 32, host byte order)
+int predictorDecode(unsigned char *data, size_t rowBytes, unsigned int width, unsigned int rows,
+		    unsigned int samples, unsigned int bitsPerSample);
+int predictorEncode(unsigned char *data, size_t rowBytes, unsigned int width, unsigned int rows,
+		    unsigned int samples, unsigned int bitsPerSample);
+
+// bytes per row of an interleaved image
+size_t tiffRowBytes(const TiffImageDesc &desc);
+
+// Decodes an image of the file into out, tiffRowBytes()*nrow bytes.
+int cpuDecodeImage(const TiffMappedFile &file, size_t image, unsigned char *out, int nthreads);
+
+// Decodes the part of an image inside window, clipped to the image, into out
+// (rows of window.width() pixels); only the strips or tiles that intersect
+// the window are decoded.
+int cpuDecodeWindow(const TiffMappedFile &file, size_t image, const TiffRect &window, unsigned char *out, int nthreads);
+
+// Encodes an interleaved image in strips of desc.rowsPerStrip rows, or in
+// tiles, with desc.compression (1, 5 or 8) and desc.predictor; chunks
+// receives one buffer per strip or tile.
+int cpuEncodeImage(const TiffImageDesc &desc, const unsigned char *image, int nthreads,
+		   std::vector<std::vector<unsigned char>> &chunks, int deflateLevel = 6);
+
+// runs fn(i) for i in [0, n) on up to nthreads threads, the calling thread
+// included; tasks are handed out in order from a shared counter
+template <typename Fn>
+void parallelFor(size_t n, int nthreads, Fn fn) {
+
+	if (nthreads < 1) nthreads = 1;
+	if ((size_t)nthreads > n) nthreads = (int)n;
+
+	std::atomic<size_t> next(0);
+	auto work = [&]() {
+		for(size_t i; (i = next.fetch_add(1)) < n;) {
+			fn(i);
+		}
+	};
+	std::vector<std::thread> threads;
+	for(int t = 1; t < nthreads; t++) {
+		threads.emplace_back(work);
+	}
+	work();
+	for(auto &t: threads) {
+		t.join();
+	}
+}
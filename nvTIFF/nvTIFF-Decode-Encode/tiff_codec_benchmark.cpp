@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+// CPU baseline of the nvTIFF sample: multi-threaded LZW and Deflate decode
+// and encode of TIFF strips and tiles (tiff_codec.h), in MB/s of decoded
+// data for 1, 2, 4, ... threads.
+//
+// Every image of the input is decoded on each thread count, then encoded
+// back with LZW and with Deflate (when built with zlib) in strips of -r
+// rows; each encoding is written with TiffFileWriter, read back and decoded
+// again, and must give the same pixels. Synthetic images check the LZW
+// table resets, 16-bit horizontal differencing and tiles. Decode windows
+// must give the same pixels as the whole image, and are timed for the
+// central quarter of each image.
+//
+// Strips are the unit of work, so a file with few strips cannot use more
+// threads than it has strips; re-encode with a small -r to measure scaling.
+//
+// Build: g++ -O3 -std=c++14 -DNVTIFF_WITH_ZLIB tiff_codec_benchmark.cpp tiff_codec.cpp nvTiff_utils.cpp -o tiff_codec_benchmark -lz -lpthread
+// Usage: ./tiff_codec_benchmark [-f tiff_file] [-t max_threads] [-n repeats] [-r rows_per_strip] [-o output_file]
+
+#include "tiff_codec.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define EXPECT(cond, ...) { if (!(cond)) { printf("FAILED: " __VA_ARGS__); printf("\n"); failures++; } }
+
+static const char *compressionName(int c) {
+	switch(c) {
+		case 1: return "none";
+		case 5: return "LZW";
+		case 8:
+		case 32946: return "Deflate";
+	}
+	return "?";
+}
+
+// best time of repeats runs of fn, in seconds
+template <typename Fn>
+static double timeBest(int repeats, Fn fn) {
+
+	double best = 1e30;
+	for(int r = 0; r < repeats; r++) {
+		double t = Wtime();
+		fn();
+		t = Wtime()-t;
+		best = std::min(best, t);
+	}
+	return best;
+}
+
+static std::vector<int> threadCounts(int maxThreads) {
+
+	std::vector<int> v;
+	for(int t = 1; t < maxThreads; t *= 2) v.push_back(t);
+	v.push_back(maxThreads);
+	return v;
+}
+
+static void printRate(const char *op, int threads, double seconds, size_t bytes) {
+
+	const double mbs = bytes / seconds / 1e6;
+	printf("  %-16s %7d %10.2lf %10.1lf %12.1lf\n", op, threads, seconds*1e3, mbs, mbs/threads);
+}
+
+// writes one image of encoded chunks and decodes it back
+static int writeAndDecode(const char *fname, const TiffImageDesc &desc,
+			  const std::vector<std::vector<unsigned char>> &chunks,
+			  std::vector<unsigned char> &image, int nthreads) {
+
+	std::vector<TiffSpan> spans(chunks.size());
+	std::vector<unsigned long long> offs(chunks.size()), counts(chunks.size());
+	for(size_t k = 0; k < chunks.size(); k++) {
+		spans[k].data = chunks[k].data();
+		spans[k].size = chunks[k].size();
+		counts[k] = spans[k].size;
+	}
+	TiffFileWriter w;
+	if (w.open(fname, false) ||
+	    w.appendChunks(spans.data(), spans.size(), offs.data()) ||
+	    w.appendImage(desc, offs.data(), counts.data(), chunks.size()) ||
+	    w.close()) {
+		return 1;
+	}
+	TiffMappedFile f;
+	if (f.open(fname) || f.numImages() != 1) return 1;
+	image.resize(tiffRowBytes(f.image(0).desc)*f.image(0).desc.nrow);
+	return cpuDecodeImage(f, 0, image.data(), nthreads);
+}
+
+// the window decode must be the same part of the whole image
+static bool checkWindow(const TiffMappedFile &f, size_t i, const std::vector<unsigned char> &image,
+			const TiffRect &w, int nthreads) {
+
+	const TiffImageDesc &d = f.image(i).desc;
+	const size_t bpp = (size_t)d.samplesPerPixel*d.bitsPerSample[0] / 8;
+	const size_t rowBytes = tiffRowBytes(d);
+	std::vector<unsigned char> win((size_t)w.width()*w.height()*bpp);
+	if (cpuDecodeWindow(f, i, w, win.data(), nthreads)) return false;
+	for(unsigned int y = 0; y < w.height(); y++) {
+		if (memcmp(win.data() + (size_t)y*w.width()*bpp, image.data() + (w.y0 + y)*rowBytes + w.x0*bpp, w.width()*bpp)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static TiffRect centralQuarter(const TiffImageDesc &d) {
+	const TiffRect w = {d.ncol/4, d.nrow/4, d.ncol/4 + std::max(1u, d.ncol/2), d.nrow/4 + std::max(1u, d.nrow/2)};
+	return w;
+}
+
+static void checkRoundTrip(const char *name, const char *fname, const TiffImageDesc &desc,
+			   const std::vector<unsigned char> &image, int nthreads) {
+
+	std::vector<std::vector<unsigned char>> chunks;
+	std::vector<unsigned char> back;
+	size_t encoded = 0;
+	bool ok = !cpuEncodeImage(desc, image.data(), nthreads, chunks) &&
+		  !writeAndDecode(fname, desc, chunks, back, nthreads) && back == image;
+	TiffMappedFile f;
+	ok = ok && !f.open(fname) && checkWindow(f, 0, image, centralQuarter(desc), nthreads) &&
+	     checkWindow(f, 0, image, TiffRect{desc.ncol - 1, 0, desc.ncol, desc.nrow}, nthreads);
+	for(auto &c: chunks) encoded += c.size();
+	EXPECT(ok, "%s: round trip", name);
+	printf("%-36s %9zu -> %9zu bytes: %s\n", name, image.size(), encoded, ok ? "ok" : "FAILED");
+}
+
+static void syntheticChecks(const char *fname, int nthreads) {
+
+	unsigned int seed = 1;
+	auto rnd = [&]() { seed = seed*1103515245u + 12345u; return seed >> 16; };
+
+	// long runs and noise: several LZW table resets per strip
+	{
+		TiffImageDesc d;
+		d.ncol = 1024;
+		d.nrow = 512;
+		d.rowsPerStrip = 200;
+		d.compression = 5;
+		std::vector<unsigned char> img(d.ncol*d.nrow);
+		for(size_t i = 0; i < img.size(); i++) {
+			img[i] = (i / 4096) % 3 == 0 ? (unsigned char)rnd() : (i / 4096) % 3 == 1 ? 7 : (unsigned char)(i % 13);
+		}
+		checkRoundTrip("LZW, table resets", fname, d, img, nthreads);
+
+		std::vector<unsigned char> one(1, 42), code;
+		size_t n = 0;
+		lzwEncode(one.data(), 1, code);
+		EXPECT(!lzwDecode(code.data(), code.size(), one.data(), 1, &n) && n == 1 && one[0] == 42, "LZW, one byte");
+	}
+	// 16-bit RGB with horizontal differencing
+	{
+		TiffImageDesc d;
+		d.ncol = 301;
+		d.nrow = 77;
+		d.rowsPerStrip = 10;
+		d.samplesPerPixel = 3;
+		d.photometricInt = 2;
+		d.compression = 5;
+		d.predictor = 2;
+		for(int s = 0; s < 3; s++) d.bitsPerSample[s] = 16;
+		std::vector<unsigned char> img(tiffRowBytes(d)*d.nrow);
+		unsigned short *p = reinterpret_cast<unsigned short *>(img.data());
+		for(size_t i = 0; i < img.size()/2; i++) p[i] = (unsigned short)(i*37 + (rnd() & 15));
+		checkRoundTrip("LZW, 16-bit RGB, predictor", fname, d, img, nthreads);
+		if (deflateSupported()) {
+			d.compression = 8;
+			checkRoundTrip("Deflate, 16-bit RGB, predictor", fname, d, img, nthreads);
+		}
+	}
+	// tiles that do not divide the image
+	{
+		TiffImageDesc d;
+		d.ncol = 250;
+		d.nrow = 130;
+		d.tileWidth = 64;
+		d.tileLength = 48;
+		d.samplesPerPixel = 3;
+		d.photometricInt = 2;
+		d.compression = 5;
+		d.predictor = 2;
+		std::vector<unsigned char> img(tiffRowBytes(d)*d.nrow);
+		for(size_t i = 0; i < img.size(); i++) img[i] = (unsigned char)((i % 750) / 3 + (rnd() & 3));
+		checkRoundTrip("LZW, tiles, predictor", fname, d, img, nthreads);
+	}
+}
+
+static void benchmarkImage(const TiffMappedFile &src, size_t i, const char *fname, const std::vector<int> &threads,
+			   int repeats, unsigned int rowsPerStrip) {
+
+	const TiffImageDesc &d = src.image(i).desc;
+	const size_t bytes = tiffRowBytes(d)*d.nrow;
+	printf("image %zu: %ux%u, %d x %d-bit, %s, predictor %d, %llu %s, %.2lf MB\n",
+		i, d.ncol, d.nrow, d.samplesPerPixel, d.bitsPerSample[0], compressionName(d.compression), d.predictor,
+		src.image(i).numChunks, d.tiled() ? "tiles" : "strips", bytes/1e6);
+	printf("  %-16s %7s %10s %10s %12s\n", "", "threads", "ms", "MB/s", "MB/s/thread");
+
+	std::vector<unsigned char> image(bytes);
+	if (cpuDecodeImage(src, i, image.data(), 1)) {
+		printf("  cannot decode on the CPU, skipped\n");
+		return;
+	}
+	std::vector<unsigned char> again(bytes);
+	std::string op = std::string("decode ") + compressionName(d.compression);
+	for(int t: threads) {
+		const double s = timeBest(repeats, [&]() { cpuDecodeImage(src, i, again.data(), t); });
+		printRate(op.c_str(), t, s, bytes);
+		EXPECT(again == image, "image %zu: decoding on %d threads differs", i, t);
+	}
+	if (d.bitsPerSample[0] % 8 == 0) {
+		const TiffRect w = centralQuarter(d);
+		std::vector<TiffChunkArea> parts;
+		d.chunksInWindow(w, parts);
+		char name[64];
+		snprintf(name, sizeof(name), "window %ux%u", w.width(), w.height());
+		for(int t: threads) {
+			std::vector<unsigned char> win((size_t)w.width()*w.height()*d.samplesPerPixel*d.bitsPerSample[0]/8);
+			const double s = timeBest(repeats, [&]() { cpuDecodeWindow(src, i, w, win.data(), t); });
+			printRate(name, t, s, win.size());
+		}
+		EXPECT(checkWindow(src, i, image, w, threads.back()), "image %zu: window differs from the image", i);
+		printf("  window at %u,%u: %zu of %llu %s decoded\n", w.x0, w.y0, parts.size(), src.image(i).numChunks,
+			d.tiled() ? "tiles" : "strips");
+	}
+
+	TiffImageDesc enc = d;
+	enc.tileWidth = enc.tileLength = 0;
+	enc.rowsPerStrip = rowsPerStrip ? std::min(rowsPerStrip, d.nrow) : (d.tiled() ? std::min(d.tileLength, d.nrow) : d.rowsPerStrip);
+	if (enc.bitsPerSample[0] != 8 && enc.bitsPerSample[0] != 16 && enc.bitsPerSample[0] != 32) enc.predictor = 1;
+	if (enc.predictor == 3) enc.predictor = 1;
+
+	const int compressions[] = {5, 8};
+	for(int c: compressions) {
+		if (c == 8 && !deflateSupported()) continue;
+		enc.compression = (unsigned short)c;
+		std::vector<std::vector<unsigned char>> chunks;
+		op = std::string("encode ") + compressionName(c);
+		for(int t: threads) {
+			const double s = timeBest(repeats, [&]() { cpuEncodeImage(enc, image.data(), t, chunks); });
+			printRate(op.c_str(), t, s, bytes);
+		}
+		size_t encoded = 0;
+		for(auto &ch: chunks) encoded += ch.size();
+		const bool ok = !writeAndDecode(fname, enc, chunks, again, threads.back()) && again == image;
+		EXPECT(ok, "image %zu: %s round trip", i, compressionName(c));
+		printf("  %s, %zu strips of %u rows: %zu bytes (%.2lf:1), round trip %s\n", compressionName(c),
+			chunks.size(), enc.rowsPerStrip, encoded, (double)bytes/std::max<size_t>(encoded, 1), ok ? "ok" : "FAILED");
+	}
+}
+
+int main(int argc, char **argv) {
+
+	std::string input = "images/bali_notiles.tif";
+	std::string output = "tiff_codec_benchmark.tif";
+	int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	int repeats = 5;
+	unsigned int rowsPerStrip = 16;
+	for(int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-h")) {
+			printf("Usage: %s [-f tiff_file] [-t max_threads] [-n repeats] [-r rows_per_strip] [-o output_file]\n", argv[0]);
+			return EXIT_SUCCESS;
+		}
+		if (i+1 >= argc) break;
+		if      (!strcmp(argv[i], "-f")) input = argv[++i];
+		else if (!strcmp(argv[i], "-o")) output = argv[++i];
+		else if (!strcmp(argv[i], "-t")) maxThreads = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-n")) repeats = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "-r")) rowsPerStrip = (unsigned int)atoi(argv[++i]);
+	}
+	printf("Deflate: %s\n", deflateSupported() ? "zlib" : "not built (define NVTIFF_WITH_ZLIB)");
+
+	syntheticChecks(output.c_str(), maxThreads);
+
+	TiffMappedFile src;
+	if (src.open(input.c_str())) {
+		printf("FAILED: cannot walk %s\n", input.c_str());
+		return EXIT_FAILURE;
+	}
+	printf("%s: ", input.c_str());
+	src.print(stdout);
+	const std::vector<int> threads = threadCounts(maxThreads);
+	for(size_t i = 0; i < src.numImages(); i++) {
+		benchmarkImage(src, i, output.c_str(), threads, repeats, rowsPerStrip);
+	}
+	src.close();
+	Remove(output.c_str());
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
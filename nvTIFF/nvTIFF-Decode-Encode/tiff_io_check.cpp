@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+// CPU-only check of the host TIFF reader and writer of nvTiff_utils
+// (TiffMappedFile, TiffFileWriter).
+//
+// The input file is mapped and walked, then copied as TIFF and as BigTIFF
+// by passing its compressed strips or tiles straight from the mapping to the
+// writer; the copies must have the same images and chunks. A tiled image, a
+// big endian file and damaged files (truncated, looping directories) are
+// checked as well, and so are a copy built in memory and the strips or tiles
+// listed for decode windows.
+//
+// Build: g++ -O2 -std=c++14 tiff_io_check.cpp nvTiff_utils.cpp -o tiff_io_check
+// Usage: ./tiff_io_check [-f tiff_file] [-o output_file]
+
+#include "nvTiff_utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define EXPECT(cond, ...) { if (!(cond)) { printf("FAILED: " __VA_ARGS__); printf("\n"); failures++; } }
+
+static bool sameDesc(const TiffImageDesc &a, const TiffImageDesc &b) {
+	return a.nrow == b.nrow && a.ncol == b.ncol && a.tileWidth == b.tileWidth && a.tileLength == b.tileLength &&
+	       (a.tiled() || a.rowsPerStrip == b.rowsPerStrip) && a.samplesPerPixel == b.samplesPerPixel &&
+	       !memcmp(a.bitsPerSample, b.bitsPerSample, sizeof(a.bitsPerSample[0])*std::min<int>(a.samplesPerPixel, 4)) &&
+	       a.photometricInt == b.photometricInt && a.planarConf == b.planarConf &&
+	       a.sampleFormat == b.sampleFormat && a.compression == b.compression && a.predictor == b.predictor;
+}
+
+// copies every image of src to dst through zero copy spans
+static int copyTiff(const TiffMappedFile &src, const char *dst, bool bigTiff) {
+
+	TiffFileWriter writer;
+	if (writer.open(dst, bigTiff)) return 1;
+	for(size_t i = 0; i < src.numImages(); i++) {
+		const TiffDirectory &dir = src.image(i);
+		std::vector<TiffSpan> spans(dir.numChunks);
+		std::vector<unsigned long long> offs(dir.numChunks), counts(dir.numChunks);
+		for(unsigned long long k = 0; k < dir.numChunks; k++) {
+			spans[k] = src.chunk(i, k);
+			counts[k] = spans[k].size;
+		}
+		if (writer.appendChunks(spans.data(), spans.size(), offs.data()) ||
+		    writer.appendImage(dir.desc, offs.data(), counts.data(), dir.numChunks)) {
+			return 1;
+		}
+	}
+	return writer.close();
+}
+
+static void checkCopy(const TiffMappedFile &src, const char *dst, bool bigTiff) {
+
+	EXPECT(!copyTiff(src, dst, bigTiff), "cannot copy to %s", dst);
+	TiffMappedFile copy;
+	EXPECT(!copy.open(dst), "cannot read the copy %s", dst);
+	EXPECT(copy.bigTiff() == bigTiff, "wrong TIFF version");
+	EXPECT(copy.numImages() == src.numImages(), "%zu images in the copy, not %zu", copy.numImages(), src.numImages());
+	for(size_t i = 0; i < std::min(copy.numImages(), src.numImages()); i++) {
+		EXPECT(sameDesc(copy.image(i).desc, src.image(i).desc), "image %zu: different description", i);
+		EXPECT(copy.image(i).numChunks == src.image(i).numChunks, "image %zu: different chunk count", i);
+		for(unsigned long long k = 0; k < std::min(copy.image(i).numChunks, src.image(i).numChunks); k++) {
+			const TiffSpan a = src.chunk(i, k), b = copy.chunk(i, k);
+			EXPECT(a.size == b.size && !memcmp(a.data, b.data, a.size), "image %zu: chunk %llu differs", i, k);
+		}
+	}
+	printf("copy as %-8s %llu bytes: %s\n", bigTiff ? "BigTIFF" : "TIFF", copy.size(), failures ? "FAILED" : "ok");
+}
+
+static void writeBytes(const char *fname, const std::vector<unsigned char> &b) {
+	FILE *fp = fopen(fname, "wb");
+	if (fp) {
+		fwrite(b.data(), 1, b.size(), fp);
+		fclose(fp);
+	}
+}
+
+int main(int argc, char **argv) {
+
+	std::string input = "images/bali_notiles.tif";
+	std::string output = "tiff_io_check.tif";
+	for(int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-h")) {
+			printf("Usage: %s [-f tiff_file] [-o output_file]\n", argv[0]);
+			return EXIT_SUCCESS;
+		}
+		if (i+1 >= argc) break;
+		if      (!strcmp(argv[i], "-f")) input = argv[++i];
+		else if (!strcmp(argv[i], "-o")) output = argv[++i];
+	}
+
+	// the sample image
+	TiffMappedFile src;
+	double t = Wtime();
+	if (src.open(input.c_str())) {
+		printf("FAILED: cannot walk %s\n", input.c_str());
+		return EXIT_FAILURE;
+	}
+	t = Wtime()-t;
+	printf("%s: mapped and walked in %.1lf us\n", input.c_str(), t*1e6);
+	src.print(stdout);
+	for(size_t i = 0; i < src.numImages(); i++) {
+		const TiffImageDesc &d = src.image(i).desc;
+		EXPECT(src.image(i).numChunks == (unsigned long long)d.chunksAcross()*d.chunksDown()*(d.planarConf == 2 ? d.samplesPerPixel : 1),
+			"image %zu: %llu chunks do not cover the image", i, src.image(i).numChunks);
+	}
+	checkCopy(src, output.c_str(), false);
+	checkCopy(src, output.c_str(), true);
+
+	// a tiled image with more tiles than fit in a directory entry
+	{
+		TiffImageDesc d;
+		d.ncol = 100;
+		d.nrow = 70;
+		d.tileWidth = 32;
+		d.tileLength = 16;
+		const unsigned long long ntiles = d.chunksAcross()*d.chunksDown();
+		std::vector<std::vector<unsigned char>> tiles(ntiles);
+		std::vector<TiffSpan> spans(ntiles);
+		for(unsigned long long k = 0; k < ntiles; k++) {
+			tiles[k].assign(32*16, (unsigned char)k);
+			spans[k].data = tiles[k].data();
+			spans[k].size = tiles[k].size() - k;	// distinct sizes
+		}
+		std::vector<unsigned long long> offs(ntiles), counts(ntiles);
+		for(unsigned long long k = 0; k < ntiles; k++) counts[k] = spans[k].size;
+		TiffFileWriter w;
+		EXPECT(!w.open(output.c_str(), false) && !w.appendChunks(spans.data(), ntiles, offs.data()) &&
+		       !w.appendImage(d, offs.data(), counts.data(), ntiles) && !w.close(), "cannot write a tiled image");
+		TiffMappedFile tiled;
+		EXPECT(!tiled.open(output.c_str()) && tiled.numImages() == 1, "cannot read the tiled image back");
+		if (tiled.numImages() == 1) {
+			EXPECT(tiled.image(0).desc.tiled() && sameDesc(tiled.image(0).desc, d), "tiled description");
+			EXPECT(tiled.image(0).numChunks == ntiles, "%llu tiles", tiled.image(0).numChunks);
+			for(unsigned long long k = 0; k < std::min(ntiles, tiled.image(0).numChunks); k++) {
+				const TiffSpan s = tiled.chunk(0, k);
+				EXPECT(s.size == spans[k].size && !memcmp(s.data, spans[k].data, s.size), "tile %llu", k);
+			}
+		}
+		printf("tiled image (%llu tiles): %s\n", ntiles, failures ? "FAILED" : "ok");
+	}
+
+	// a big endian 3x2 grayscale image in one strip
+	{
+		const unsigned char mm[] = {
+			'M', 'M', 0, 42, 0, 0, 0, 14,
+			1, 2, 3, 4, 5, 6,				// strip
+			0, 6,						// 6 entries
+			1, 0, 0, 3, 0, 0, 0, 1, 0, 3, 0, 0,		// width 3
+			1, 1, 0, 3, 0, 0, 0, 1, 0, 2, 0, 0,		// length 2
+			1, 3, 0, 3, 0, 0, 0, 1, 0, 1, 0, 0,		// no compression
+			1, 17, 0, 4, 0, 0, 0, 1, 0, 0, 0, 8,		// strip offset
+			1, 22, 0, 3, 0, 0, 0, 1, 0, 2, 0, 0,		// 2 rows per strip
+			1, 23, 0, 4, 0, 0, 0, 1, 0, 0, 0, 6,		// strip bytes
+			0, 0, 0, 0};
+		writeBytes(output.c_str(), std::vector<unsigned char>(mm, mm + sizeof(mm)));
+		TiffMappedFile be;
+		EXPECT(!be.open(output.c_str()) && be.bigEndian() && be.numImages() == 1, "cannot read the big endian file");
+		if (be.numImages() == 1) {
+			const TiffSpan s = be.chunk(0, 0);
+			EXPECT(be.image(0).desc.ncol == 3 && be.image(0).desc.nrow == 2 && s.size == 6 && s.data[0] == 1 && s.data[5] == 6,
+				"big endian image");
+		}
+		printf("big endian file: %s\n", failures ? "FAILED" : "ok");
+	}
+
+	// damaged files must be rejected
+	{
+		const std::vector<unsigned char> orig(src.data(), src.data() + src.size());
+		std::vector<unsigned char> bad(orig.begin(), orig.begin() + orig.size()/2);
+		writeBytes(output.c_str(), bad);
+		TiffMappedFile f;
+		printf("expected errors:\n");
+		fflush(stdout);
+		EXPECT(f.open(output.c_str()) != 0, "truncated file accepted");
+
+		// first directory pointing at itself as the next one
+		std::vector<unsigned char> loop(orig);
+		if (!src.bigTiff() && !src.bigEndian()) {
+			const unsigned long long ifd = loop[4] | (loop[5] << 8) | (loop[6] << 16) | ((unsigned long long)loop[7] << 24);
+			const unsigned long long nent = loop[ifd] | (loop[ifd+1] << 8);
+			const unsigned long long next = ifd + 2 + nent*12;
+			for(int k = 0; k < 4; k++) loop[next + k] = (unsigned char)(ifd >> (8*k));
+			writeBytes(output.c_str(), loop);
+			EXPECT(f.open(output.c_str()) != 0, "directory loop accepted");
+		}
+		printf("damaged files: %s\n", failures ? "FAILED" : "ok");
+	}
+
+	// the same copy built in memory and in a file
+	{
+		std::vector<unsigned char> mem;
+		TiffFileWriter w;
+		bool ok = !w.open(&mem, false);
+		for(size_t i = 0; ok && i < src.numImages(); i++) {
+			const TiffDirectory &dir = src.image(i);
+			std::vector<TiffSpan> spans(dir.numChunks);
+			std::vector<unsigned long long> offs(dir.numChunks), counts(dir.numChunks);
+			for(unsigned long long k = 0; k < dir.numChunks; k++) {
+				spans[k] = src.chunk(i, k);
+				counts[k] = spans[k].size;
+			}
+			ok = !w.appendChunks(spans.data(), spans.size(), offs.data()) &&
+			     !w.appendImage(dir.desc, offs.data(), counts.data(), dir.numChunks);
+		}
+		ok = !w.close() && ok && !copyTiff(src, output.c_str(), false);
+		TiffMappedFile f;
+		EXPECT(ok && !f.open(output.c_str()) && f.size() == mem.size() && !memcmp(f.data(), mem.data(), mem.size()),
+			"the copy in memory differs from the file");
+		printf("copy in memory %zu bytes: %s\n", mem.size(), failures ? "FAILED" : "ok");
+	}
+
+	// decode windows: the listed parts must cover each window exactly once
+	{
+		TiffImageDesc strips, tiles;
+		strips.ncol = tiles.ncol = 100;
+		strips.nrow = tiles.nrow = 70;
+		strips.rowsPerStrip = 8;
+		tiles.tileWidth = 32;
+		tiles.tileLength = 16;
+		const TiffRect windows[] = {{0, 0, 100, 70}, {5, 3, 6, 4}, {31, 15, 65, 49}, {90, 60, 500, 500}, {0, 69, 100, 70}};
+		for(const TiffImageDesc *d : {&strips, &tiles}) {
+			for(const TiffRect &w : windows) {
+				std::vector<TiffChunkArea> parts;
+				d->chunksInWindow(w, parts);
+				const unsigned int x1 = std::min(w.x1, d->ncol), y1 = std::min(w.y1, d->nrow);
+				std::vector<int> cover((size_t)d->ncol*d->nrow, 0);
+				bool inside = true;
+				for(const TiffChunkArea &c : parts) {
+					const unsigned int cw = d->tiled() ? d->tileWidth : d->ncol;
+					const unsigned int ch = d->tiled() ? d->tileLength : d->rowsPerStrip;
+					inside = inside && c.chunk == (unsigned long long)(c.rect.y0/ch)*d->chunksAcross() + c.rect.x0/cw &&
+						 c.area.x0 >= c.rect.x0 && c.area.x1 <= c.rect.x1 && c.area.y0 >= c.rect.y0 && c.area.y1 <= c.rect.y1;
+					for(unsigned int y = c.area.y0; y < c.area.y1; y++) {
+						for(unsigned int x = c.area.x0; x < c.area.x1; x++) cover[(size_t)y*d->ncol + x]++;
+					}
+				}
+				bool exact = inside;
+				for(unsigned int y = 0; y < d->nrow; y++) {
+					for(unsigned int x = 0; x < d->ncol; x++) {
+						const int want = x >= w.x0 && x < x1 && y >= w.y0 && y < y1;
+						exact = exact && cover[(size_t)y*d->ncol + x] == want;
+					}
+				}
+				EXPECT(exact, "%s window %u,%u,%u,%u: %zu parts do not cover it", d->tiled() ? "tiled" : "stripped",
+					w.x0, w.y0, w.x1, w.y1, parts.size());
+			}
+		}
+		std::vector<TiffChunkArea> parts;
+		tiles.chunksInWindow(TiffRect{100, 0, 120, 10}, parts);
+		EXPECT(parts.empty(), "window outside the image");
+		printf("decode windows: %s\n", failures ? "FAILED" : "ok");
+	}
+
+	remove(output.c_str());
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+// Chunked encoding of nvtiff_example (-E), with bounded device memory.
+//
+// EncodeChunkPlanner hands out the strips of all subfiles, in file order, in
+// chunks of at most a given number of strips: whole subfiles when at least
+// one fits, otherwise a band of consecutive strips of one subfile. Either way
+// a chunk is a contiguous range of the global strip index
+// (subfile*stripsPerSubfile + strip), encoded by one nvTiffEncode call into
+// one slot of the device ring.
+//
+// TiffStripWriter streams the compressed strips of each chunk to the output
+// file as soon as they reach the host (TiffFileWriter of nvTiff_utils), and
+// writes the IFDs, which need every strip offset and byte count, after the
+// last strip. For a tiled desc the "strips" are the tiles of each subfile,
+// in file order. Classic TIFF is used unless BigTIFF is requested (files that
+// may exceed 4 GiB).
+//
+// Only host code is used (see tiff_strip_writer_check.cpp).
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "nvTiff_utils.h"
+
+struct EncodeChunk {
+	unsigned int subfile;	// first subfile
+	unsigned int nSubFiles;	// whole subfiles, or 1 for a band
+	unsigned int strip;	// first strip in the subfile
+	unsigned int nStrips;	// strips per subfile in the chunk
+	unsigned int nrow;	// rows of each subfile in the chunk
+
+	unsigned long long firstStrip(unsigned int stripsPerSubfile) const {
+		return (unsigned long long)subfile*stripsPerSubfile + strip;
+	}
+	unsigned long long totStrips() const {
+		return (unsigned long long)nSubFiles*nStrips;
+	}
+};
+
+class EncodeChunkPlanner {
+public:
+	EncodeChunkPlanner(unsigned int nSubFiles, unsigned int nrow, unsigned int rowsPerStrip)
+		: nSubFiles_(nSubFiles), nrow_(nrow), rowsPerStrip_(rowsPerStrip),
+		  stripsPerSubfile_((nrow + rowsPerStrip - 1)/rowsPerStrip), subfile_(0), strip_(0) {}
+
+	unsigned int stripsPerSubfile() const { return stripsPerSubfile_; }
+	bool done() const { return subfile_ >= nSubFiles_; }
+
+	// next chunk of at most maxStrips strips (at least one strip)
+	EncodeChunk next(unsigned long long maxStrips) {
+		EncodeChunk c;
+		c.subfile = subfile_;
+		c.strip = strip_;
+		maxStrips = std::max(maxStrips, 1ULL);
+		if (strip_ == 0 && maxStrips >= stripsPerSubfile_) {
+			c.nSubFiles = (unsigned int)std::min<unsigned long long>(maxStrips/stripsPerSubfile_, nSubFiles_ - subfile_);
+			c.nStrips = stripsPerSubfile_;
+			c.nrow = nrow_;
+			subfile_ += c.nSubFiles;
+		} else {
+			c.nSubFiles = 1;
+			c.nStrips = (unsigned int)std::min<unsigned long long>(maxStrips, stripsPerSubfile_ - strip_);
+			c.nrow = std::min(c.nStrips*rowsPerStrip_, nrow_ - strip_*rowsPerStrip_);
+			strip_ += c.nStrips;
+			if (strip_ == stripsPerSubfile_) {
+				strip_ = 0;
+				subfile_++;
+			}
+		}
+		return c;
+	}
+
+	// hands out the strips from the start of c again
+	void rewind(const EncodeChunk &c) {
+		subfile_ = c.subfile;
+		strip_ = c.strip;
+	}
+
+private:
+	unsigned int nSubFiles_, nrow_, rowsPerStrip_, stripsPerSubfile_;
+	unsigned int subfile_, strip_;
+};
+
+class TiffStripWriter {
+public:
+	int open(const char *fname, const TiffImageDesc &desc, unsigned int nSubFiles, bool bigTiff) {
+		desc_ = desc;
+		nSubFiles_ = nSubFiles;
+		stripsPerSubfile_ = desc.chunksAcross()*desc.chunksDown();
+		const size_t totStrips = (size_t)nSubFiles*stripsPerSubfile_;
+		stripOffs_.assign(totStrips, 0);
+		stripSize_.assign(totStrips, 0);
+		written_.assign(totStrips, 0);
+		return file_.open(fname, bigTiff);
+	}
+
+	// Appends strips [first, first+n) of the global strip index, strip i
+	// being size[i] bytes at data + offs[i], with one vectored write.
+	int writeStrips(unsigned long long first, unsigned long long n,
+			const unsigned long long *size, const unsigned long long *offs,
+			const unsigned char *data) {
+		if (first + n > stripOffs_.size()) return 1;
+		spans_.resize(n);
+		for(unsigned long long i = 0; i < n; i++) {
+			spans_[i].data = data + offs[i];
+			spans_[i].size = size[i];
+			stripSize_[first + i] = size[i];
+			written_[first + i] = 1;
+		}
+		return file_.appendChunks(spans_.data(), n, stripOffs_.data() + first);
+	}
+
+	unsigned long long bytesWritten() const { return file_.size(); }
+
+	// writes the IFDs and closes the file
+	int close() {
+		int err = 0;
+		for(size_t i = 0; i < written_.size(); i++) {
+			if (!written_[i]) err = 1;
+		}
+		for(unsigned int s = 0; s < nSubFiles_ && !err; s++) {
+			const size_t first = (size_t)s*stripsPerSubfile_;
+			err = file_.appendImage(desc_, stripOffs_.data() + first, stripSize_.data() + first, stripsPerSubfile_);
+		}
+		return file_.close() || err;
+	}
+
+private:
+	TiffFileWriter file_;
+	TiffImageDesc desc_;
+	unsigned int nSubFiles_;
+	unsigned int stripsPerSubfile_;
+	std::vector<unsigned long long> stripOffs_;
+	std::vector<unsigned long long> stripSize_;
+	std::vector<unsigned char> written_;
+	std::vector<TiffSpan> spans_;
+};
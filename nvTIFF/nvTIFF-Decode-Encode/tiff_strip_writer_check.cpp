@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+// CPU-only check of the chunked encode of nvtiff_example
+// (tiff_strip_writer.h).
+//
+// The chunk planner must hand out every strip of every subfile exactly once,
+// in file order, in chunks of at most the requested size, also when a chunk
+// is handed out again with fewer strips (as after a strip overflow).
+// The writer is fed uncompressed strips chunk by chunk, packed at arbitrary
+// offsets in a buffer as the encoder returns them; the file is read back
+// (TiffMappedFile) as TIFF and BigTIFF and compared with the source images.
+// Tiled images are planned as nvtiff_example does, one tile per planner
+// subfile, and must read back with their tiles in file order.
+//
+// Build: g++ -O2 -std=c++14 tiff_strip_writer_check.cpp nvTiff_utils.cpp -o tiff_strip_writer_check
+// Usage: ./tiff_strip_writer_check [-o output_file]
+
+#include "tiff_strip_writer.h"
+
+#include <stdlib.h>
+#include <random>
+#include <string>
+
+static int failures = 0;
+
+#define EXPECT(cond, ...) { if (!(cond)) { printf("FAILED: " __VA_ARGS__); printf("\n"); failures++; } }
+
+static void checkPlanner(unsigned int nSubFiles, unsigned int nrow, unsigned int rps, unsigned long long maxStrips) {
+
+	EncodeChunkPlanner planner(nSubFiles, nrow, rps);
+	const unsigned int sps = planner.stripsPerSubfile();
+	unsigned long long next = 0;
+	int nChunks = 0;
+	bool rewound = false;
+	while (!planner.done()) {
+		EncodeChunk c = planner.next(maxStrips);
+		// hand the third chunk out again with half the strips
+		if (nChunks == 2 && !rewound) {
+			planner.rewind(c);
+			c = planner.next(std::max(1ULL, maxStrips/2));
+			rewound = true;
+		}
+		EXPECT(c.firstStrip(sps) == next, "planner %u,%u,%u,%llu: chunk starts at strip %llu, not %llu",
+			nSubFiles, nrow, rps, maxStrips, c.firstStrip(sps), next);
+		EXPECT(c.totStrips() >= 1 && c.totStrips() <= std::max(1ULL, maxStrips), "chunk of %llu strips", c.totStrips());
+		EXPECT(c.nSubFiles == 1 || (c.strip == 0 && c.nStrips == sps), "multi-subfile chunk is not whole subfiles");
+		const unsigned int rows = std::min(c.nStrips*rps, nrow - c.strip*rps);
+		EXPECT(c.nrow == rows, "chunk of %u rows, not %u", c.nrow, rows);
+		next += c.totStrips();
+		nChunks++;
+	}
+	EXPECT(next == (unsigned long long)nSubFiles*sps, "planner covered %llu strips", next);
+}
+
+// strips of each image concatenated
+static int readBack(const char *fname, std::vector<std::vector<unsigned char>> &images, bool &big) {
+
+	TiffMappedFile tiff;
+	if (tiff.open(fname)) return 1;
+	big = tiff.bigTiff();
+	for(size_t i = 0; i < tiff.numImages(); i++) {
+		std::vector<unsigned char> img;
+		for(unsigned long long k = 0; k < tiff.image(i).numChunks; k++) {
+			const TiffSpan strip = tiff.chunk(i, k);
+			img.insert(img.end(), strip.data, strip.data + strip.size);
+		}
+		images.push_back(img);
+	}
+	return 0;
+}
+
+static void checkWriter(const char *fname, bool bigTiff, unsigned int nSubFiles, unsigned int nrow,
+			unsigned int ncol, unsigned int rps, unsigned long long maxStrips) {
+
+	std::mt19937 rng(nSubFiles*1000 + nrow);
+	const size_t rowBytes = (size_t)ncol*3;
+	std::vector<std::vector<unsigned char>> src(nSubFiles, std::vector<unsigned char>(rowBytes*nrow));
+	for(auto &img : src) for(auto &b : img) b = (unsigned char)rng();
+
+	TiffImageDesc desc;
+	desc.nrow = nrow;
+	desc.ncol = ncol;
+	desc.rowsPerStrip = rps;
+	desc.samplesPerPixel = 3;
+	desc.bitsPerSample[0] = desc.bitsPerSample[1] = desc.bitsPerSample[2] = 8;
+	desc.photometricInt = 2;
+	desc.planarConf = 1;
+	desc.sampleFormat = 1;
+	desc.compression = 1;
+
+	TiffStripWriter writer;
+	EXPECT(!writer.open(fname, desc, nSubFiles, bigTiff), "cannot open %s", fname);
+	EncodeChunkPlanner planner(nSubFiles, nrow, rps);
+	while (!planner.done()) {
+		const EncodeChunk c = planner.next(maxStrips);
+		// pack the strips of the chunk after some leading bytes, like the
+		// encoder's strip data buffer
+		std::vector<unsigned char> data(rng() % 7, 0xEE);
+		std::vector<unsigned long long> size, offs;
+		for(unsigned int i = 0; i < c.nSubFiles; i++) {
+			for(unsigned int j = 0; j < c.nStrips; j++) {
+				const unsigned int row = (c.strip + j)*rps;
+				const unsigned int rows = std::min(rps, nrow - row);
+				const unsigned char *p = src[c.subfile + i].data() + row*rowBytes;
+				offs.push_back(data.size());
+				size.push_back(rows*rowBytes);
+				data.insert(data.end(), p, p + rows*rowBytes);
+			}
+		}
+		EXPECT(!writer.writeStrips(c.firstStrip(planner.stripsPerSubfile()), c.totStrips(),
+					   size.data(), offs.data(), data.data()), "writeStrips");
+	}
+	EXPECT(!writer.close(), "close");
+
+	std::vector<std::vector<unsigned char>> back;
+	bool big = false;
+	EXPECT(!readBack(fname, back, big), "cannot read %s back", fname);
+	EXPECT(big == bigTiff, "wrong TIFF version");
+	EXPECT(back == src, "%s: %zu images read back differ from the source", fname, back.size());
+	printf("%-8s %3u images %4ux%-4u %3u rows/strip, chunks of %3llu strips: %llu bytes\n",
+		bigTiff ? "BigTIFF" : "TIFF", nSubFiles, ncol, nrow, rps, maxStrips, writer.bytesWritten());
+}
+
+// tiles planned as subfiles of one strip each
+static void checkTiledWriter(const char *fname, unsigned int nSubFiles, unsigned int nrow, unsigned int ncol,
+			     unsigned int tw, unsigned int th, unsigned long long maxStrips) {
+
+	TiffImageDesc desc;
+	desc.nrow = nrow;
+	desc.ncol = ncol;
+	desc.tileWidth = tw;
+	desc.tileLength = th;
+	const unsigned int tilesPerImage = desc.chunksAcross()*desc.chunksDown();
+
+	// distinct contents and sizes for every tile
+	std::mt19937 rng(tilesPerImage);
+	std::vector<std::vector<unsigned char>> tiles((size_t)nSubFiles*tilesPerImage);
+	for(auto &t : tiles) {
+		t.resize(1 + rng() % (tw*th));
+		for(auto &b : t) b = (unsigned char)rng();
+	}
+
+	TiffStripWriter writer;
+	EXPECT(!writer.open(fname, desc, nSubFiles, false), "cannot open %s", fname);
+	EncodeChunkPlanner planner(nSubFiles*tilesPerImage, th, th);
+	while (!planner.done()) {
+		const EncodeChunk c = planner.next(maxStrips);
+		std::vector<unsigned char> data;
+		std::vector<unsigned long long> size, offs;
+		for(unsigned long long k = 0; k < c.totStrips(); k++) {
+			const std::vector<unsigned char> &t = tiles[c.firstStrip(1) + k];
+			offs.push_back(data.size());
+			size.push_back(t.size());
+			data.insert(data.end(), t.begin(), t.end());
+		}
+		EXPECT(!writer.writeStrips(c.firstStrip(1), c.totStrips(), size.data(), offs.data(), data.data()), "writeStrips");
+	}
+	EXPECT(!writer.close(), "close");
+
+	TiffMappedFile tiff;
+	EXPECT(!tiff.open(fname) && tiff.numImages() == nSubFiles, "cannot read %s back", fname);
+	for(size_t i = 0; i < tiff.numImages(); i++) {
+		EXPECT(tiff.image(i).desc.tiled() && tiff.image(i).numChunks == tilesPerImage, "image %zu: not %u tiles", i, tilesPerImage);
+		for(unsigned long long k = 0; k < std::min<unsigned long long>(tiff.image(i).numChunks, tilesPerImage); k++) {
+			const TiffSpan s = tiff.chunk(i, k);
+			const std::vector<unsigned char> &t = tiles[i*tilesPerImage + k];
+			EXPECT(s.size == t.size() && !memcmp(s.data, t.data(), s.size), "image %zu: tile %llu differs", i, k);
+		}
+	}
+	printf("TIFF     %3u images %4ux%-4u %ux%u tiles, chunks of %3llu tiles: %llu bytes\n",
+		nSubFiles, ncol, nrow, tw, th, maxStrips, writer.bytesWritten());
+}
+
+int main(int argc, char **argv) {
+
+	std::string fname = "tiff_strip_writer_check.tif";
+	for(int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-h")) {
+			printf("Usage: %s [-o output_file]\n", argv[0]);
+			return EXIT_SUCCESS;
+		}
+		if (!strcmp(argv[i], "-o") && i+1 < argc) fname = argv[++i];
+	}
+
+	for(unsigned int nSubFiles : {1u, 3u, 7u}) {
+		for(unsigned int nrow : {1u, 5u, 64u, 97u}) {
+			for(unsigned int rps : {1u, 4u, 16u, 128u}) {
+				for(unsigned long long maxStrips : {1ULL, 3ULL, 7ULL, 25ULL, 1000ULL}) {
+					checkPlanner(nSubFiles, nrow, rps, maxStrips);
+				}
+			}
+		}
+	}
+	printf("planner %s\n", failures ? "FAILED" : "ok");
+
+	checkWriter(fname.c_str(), false, 1, 1, 1, 1, 1);
+	checkWriter(fname.c_str(), false, 3, 97, 37, 4, 5);
+	checkWriter(fname.c_str(), true, 3, 97, 37, 4, 5);
+	checkWriter(fname.c_str(), false, 5, 64, 101, 7, 40);
+	checkWriter(fname.c_str(), true, 2, 200, 33, 3, 1000);
+	checkTiledWriter(fname.c_str(), 3, 100, 70, 32, 16, 7);
+	checkTiledWriter(fname.c_str(), 2, 64, 64, 64, 64, 1);
+	remove(fname.c_str());
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}